@@ -257,7 +257,7 @@ u32 arm_to_a64_reg[] =
   aa64_emit_branch_patch((u32*)dest, aa64_br_offset_from(target, dest))       \
 
 #define generate_branch_no_cycle_update(writeback_location, new_pc)           \
-  if(pc == idle_loop_target_pc)                                               \
+  if(pc == idle_loop_target_pc || pc == idle_loop_pc)                         \
   {                                                                           \
     generate_load_imm(reg_cycles, 0);                                         \
     generate_load_pc(reg_a0, new_pc);                                         \
@@ -1283,6 +1283,9 @@ u32 execute_store_cpsr_body(u32 _cpsr, u32 address, u32 store_mask)
 #define thumb_load_pc_pool_const(rd, value)                                   \
   generate_load_imm(arm_to_a64_reg[rd], (value));                             \
 
+#define arm_load_const(rd, value)                                             \
+  generate_load_imm(arm_to_a64_reg[rd], (value));                             \
+
 #define arm_access_memory_load(mem_type)                                      \
   cycle_count += 2;                                                           \
   generate_load_pc(reg_a1, (pc));                                             \
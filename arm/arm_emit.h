@@ -452,7 +452,7 @@ u32 arm_disect_imm_32bit(u32 imm, u32 *stores, u32 *rotations)
 
 
 #define generate_branch_no_cycle_update(writeback_location, new_pc, mode)     \
-  if(pc == idle_loop_target_pc)                                               \
+  if(pc == idle_loop_target_pc || pc == idle_loop_pc)                         \
   {                                                                           \
     generate_branch_idle_eliminate(writeback_location, new_pc, mode);         \
   }                                                                           \
@@ -1745,6 +1745,11 @@ static void trace_instruction(u32 pc, u32 mode)
   generate_load_pc(rgdst, (value));                                           \
   thumb_complete_store_reg(rgdst, reg_rd)
 
+#define arm_load_const(reg_rd, value)                                         \
+  u32 rgdst = arm_prepare_store_reg(reg_a0, reg_rd);                          \
+  generate_load_pc(rgdst, (value));                                           \
+  arm_complete_store_reg(rgdst, reg_rd)
+
 #define thumb_access_memory_load(mem_type, _rd)                               \
   cycle_count += 2;                                                           \
   generate_load_call_##mem_type();                                            \
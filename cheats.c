@@ -29,9 +29,9 @@ typedef struct
   unsigned cheat_count;
 } cheat_type;
 
-cheat_type cheats[MAX_CHEATS];
-u32 max_cheat = 0;
-u32 cheat_master_hook = 0xffffffff;
+instance_local cheat_type cheats[MAX_CHEATS];
+instance_local u32 max_cheat = 0;
+instance_local u32 cheat_master_hook = 0xffffffff;
 
 static bool has_encrypted_codebreaker(cheat_type *cheat)
 {
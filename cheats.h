@@ -35,7 +35,7 @@ void process_cheats(void);
 cheat_error cheat_parse(unsigned index, const char *code);
 void cheat_clear(void);
 
-extern u32 cheat_master_hook;
+extern instance_local u32 cheat_master_hook;
 
 #endif
 
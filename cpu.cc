@@ -53,10 +53,9 @@ const u8 bit_count[256] =
   u32 imm;                                                                    \
   u32 rn = (opcode >> 16) & 0x0F;                                             \
   u32 rd = (opcode >> 12) & 0x0F;                                             \
-  u32 imm_ror = ((opcode >> 8) & 0xF) << 1;                                   \
   (void)rd;                                                                   \
   (void)rn;                                                                   \
-  ror(imm, opcode & 0xFF, imm_ror);                                           \
+  imm = operand;                                                              \
   using_register(arm, rd, op_dest);                                           \
   using_register(arm, rn, op_src)                                             \
 
@@ -75,7 +74,7 @@ const u8 bit_count[256] =
   u32 psr_pfield = ((opcode >> 16) & 1) | ((opcode >> 18) & 2);               \
   u32 rd = (opcode >> 12) & 0x0F;                                             \
   (void)rd;                                                                   \
-  ror(imm, opcode & 0xFF, ((opcode >> 8) & 0x0F) * 2);                        \
+  imm = operand;                                                              \
   using_register(arm, rd, op_dest)                                            \
 
 #define arm_decode_branchx(opcode)                                            \
@@ -147,7 +146,7 @@ const u8 bit_count[256] =
   using_register_list(arm, reg_list, 16)                                      \
 
 #define arm_decode_branch()                                                   \
-  s32 offset = ((s32)((u32)(opcode << 8))) >> 6                               \
+  s32 offset = (s32)operand                                                   \
 
 
 #define thumb_decode_shift()                                                  \
@@ -580,6 +579,10 @@ static inline u32 fast_shift_operation(u32 opcode, u32 rm_val, u32 c_flag) {
   z_flag = (dest == 0);                                                      \
   n_flag = ((signed)dest < 0)                                                      \
 
+// While executing, the flags live in n/z/c/v_flag and the top bits of CPSR
+// are stale: they are only collapsed into it before CPSR is read (or saved)
+// and when leaving the execution loop.
+
 #define extract_flags()                                                       \
   n_flag = reg[REG_CPSR] >> 31;                                               \
   z_flag = (reg[REG_CPSR] >> 30) & 0x01;                                      \
@@ -669,7 +672,7 @@ static inline u32 fast_shift_operation(u32 opcode, u32 rm_val, u32 c_flag) {
 
 #define arm_data_proc_flags_imm()                                             \
   arm_decode_data_proc_imm(opcode)                                            \
-  if(imm_ror)                                                                 \
+  if(opcode & 0xF00)                                                          \
     c_flag = (imm >> 31);  /* imm is rotated already! */                      \
 
 #define arm_data_proc_imm()                                                   \
@@ -823,6 +826,7 @@ const u32 spsr_masks[4] = { 0x00000000, 0x000000EF, 0xF0000000, 0xF00000EF };
 
 #define arm_psr_store_cpsr(source)                                            \
   const u32 store_mask = cpsr_masks[psr_pfield][PRIVMODE(reg[CPU_MODE])];     \
+  collapse_flags();                                                           \
   reg[REG_CPSR] = (source & store_mask) | (reg[REG_CPSR] & (~store_mask));    \
   extract_flags();                                                            \
   if(store_mask & 0xFF)                                                       \
@@ -900,6 +904,18 @@ const u32 spsr_masks[4] = { 0x00000000, 0x000000EF, 0xF0000000, 0xF00000EF };
   }                                                                           \
 }                                                                             \
 
+#ifdef HAVE_DYNAREC
+  // Writes to RAM that holds cached decoded instructions (see the decoded
+  // instruction cache below) must invalidate them, as well as translated code
+  // (with the translation thread the interpreter runs in between translated
+  // code), like the translated stores do.
+  #define smc_check_write(size, waddr)                                        \
+    ram_code_written(waddr, (size) / 8)                                       \
+
+#else
+  #define smc_check_write(size, waddr)
+#endif
+
 #define fast_write_memory(size, type, address, value)                         \
 {                                                                             \
   u32 _address = (address) & ~(aligned_address_mask##size & 0x03);            \
@@ -911,6 +927,7 @@ const u32 spsr_masks[4] = { 0x00000000, 0x000000EF, 0xF0000000, 0xF00000EF };
   }                                                                           \
                                                                               \
   cpu_alert |= write_memory##size(_address, value);                           \
+  smc_check_write(size, _address);                                            \
 }                                                                             \
 
 #define load_aligned32(address, dest)                                         \
@@ -945,6 +962,7 @@ const u32 spsr_masks[4] = { 0x00000000, 0x000000EF, 0xF0000000, 0xF00000EF };
     STATS_MEMORY_ACCESS(write, u32, region);                                  \
   }                                                                           \
   cpu_alert |= write_memory32(_address, value);                               \
+  smc_check_write(32, _address);                                              \
 }                                                                             \
 
 #define load_memory_u8(address, dest)                                         \
@@ -1397,7 +1415,7 @@ const u32 cpu_modes[16] =
 // ARM/Thumb mode is stored in the flags directly, this is simpler than
 // shadowing it since it has a constant 1bit represenation.
 
-u32 instruction_count = 0;
+instance_local u32 instruction_count = 0;
 
 void set_cpu_mode(cpu_mode_type new_mode)
 {
@@ -1484,23 +1502,255 @@ cpu_alert_type flag_interrupt(irq_type irq_raised)
 
 // When switching modes set spsr[new_mode] to cpsr. Modifying PC as the
 // target of a data proc instruction will set cpsr to spsr[cpu_mode].
-u32 reg[64];
-u32 spsr[6];
-u32 reg_mode[7][7];
-
-u8 *memory_map_read [8 * 1024];
-u16 oam_ram[512];
-u16 palette_ram[512];
-u16 palette_ram_converted[512];
-u8 ewram[1024 * 256 * 2];
-u8 iwram[1024 * 32 * 2];
-u8 vram[1024 * 96];
-u16 io_registers[512];
+instance_local u32 reg[64];
+instance_local u32 spsr[6];
+instance_local u32 reg_mode[7][7];
+
+instance_local u8 *memory_map_read [8 * 1024];
+instance_local u16 oam_ram[512];
+instance_local u16 palette_ram[512];
+instance_local u16 palette_ram_converted[512];
+instance_local u8 ewram[1024 * 256 * 2];
+instance_local u8 iwram[1024 * 32 * 2];
+instance_local u8 vram[1024 * 96];
+instance_local u16 io_registers[512];
 #endif
 
-void execute_arm(u32 cycles)
+#ifdef THREADED_JIT
+// Set by the translation thread once the block the translated code is
+// waiting for is ready: the interpreter returns when it gets there.
+volatile u32 interpreter_resume_pc = ~0U;
+#endif
+
+// Instruction dispatch: with GCC (and compatible compilers) the handlers are
+// reached through tables of label addresses, the switch statements remain as
+// the portable fallback. The ARM table is indexed by the condition too, so
+// that unconditional instructions (most of them) skip the condition check.
+// Flag setting variants already have their own handlers (opcode bit 20).
+#if defined(__GNUC__) && !defined(TRACE_INSTRUCTIONS) && \
+    !defined(CPU_SWITCH_DISPATCH)
+  #define CPU_COMPUTED_GOTO
+#endif
+
+#ifdef CPU_COMPUTED_GOTO
+  #define cpu_case(set, value)                                                \
+    case value: set##_##value                                                 \
+
+  #define cpu_case_range(set, first, last)                                    \
+    case first ... last: set##_##first                                        \
+
+  #define dispatch_arm_condition(value)                                       \
+    arm_conditions[value] = &&arm_cond_##value                                \
+
+  #define dispatch_arm(value)                                                 \
+    arm_ops[value] = &&arm_op_##value                                         \
+
+  #define dispatch_arm_range(first, last)                                     \
+    for (i = first; i <= last; i++)                                           \
+      arm_ops[i] = &&arm_op_##first                                           \
+
+  #define dispatch_thumb(value)                                               \
+    thumb_dispatch[value] = &&thumb_op_##value                                \
+
+  #define dispatch_thumb_range(first, last)                                   \
+    for (i = first; i <= last; i++)                                           \
+      thumb_dispatch[i] = &&thumb_op_##first                                  \
+
+#else
+  #define cpu_case(set, value)                                                \
+    case value                                                                \
+
+  #define cpu_case_range(set, first, last)                                    \
+    case first ... last                                                       \
+
+#endif
+
+// Decoded instruction cache: direct mapped and indexed by PC, each entry
+// keeps the opcode along with its handler and its pre-extracted operand (the
+// rotated ARM immediate or the ARM branch offset, see arm_decode_operand), so
+// that cached instructions skip the fetch, the dispatch table and that
+// decoding. ARM entries are tagged with their PC, Thumb ones with their PC
+// plus one, DECODE_CACHE_NO_TAG matches neither.
+// Gamepak and BIOS code never changes. RAM code is only cached with the
+// dynarec, whose RAM code pages (see cpu_threaded.c) flag the pages holding
+// cached instructions: writes to them (from the interpreter, DMA or translated
+// code alike) call invalidate_ram_code, which drops the page entries.
+#define DECODE_CACHE_SIZE     (16 * 1024)
+#define DECODE_CACHE_NO_TAG   0x00000002
+
+typedef struct
 {
+  u32 tag;
   u32 opcode;
+  u32 operand;
+#ifdef CPU_COMPUTED_GOTO
+  const void *handler;
+#endif
+} decoded_instruction_type;
+
+static instance_local decoded_instruction_type
+ decode_cache[DECODE_CACHE_SIZE];
+
+#define decode_cache_entry(pc)                                                \
+  (&decode_cache[((pc) >> 1) & (DECODE_CACHE_SIZE - 1)])                      \
+
+static void flush_decode_cache(void)
+{
+  u32 i;
+  for (i = 0; i < DECODE_CACHE_SIZE; i++)
+    decode_cache[i].tag = DECODE_CACHE_NO_TAG;
+}
+
+#ifdef HAVE_DYNAREC
+// Whether there are RAM entries (since the last flush_decode_cache_ram)
+static instance_local bool decode_cache_ram_used = false;
+
+// Drops the entries of the given RAM code page
+void invalidate_decode_cache_page(u32 page)
+{
+  u32 address = (page < (0x40000 >> RAM_CODE_PAGE_SHIFT)) ?
+    0x2000000 + (page << RAM_CODE_PAGE_SHIFT) :
+    0x3000000 + (page << RAM_CODE_PAGE_SHIFT) - 0x40000;
+  decoded_instruction_type *decoded = decode_cache_entry(address);
+  u32 i;
+
+  // The page entries are consecutive (and never wrap, the size is a multiple)
+  for (i = 0; i < (1 << RAM_CODE_PAGE_SHIFT) / 2; i++)
+  {
+    if ((decoded[i].tag & ~((1 << RAM_CODE_PAGE_SHIFT) - 1)) == address)
+      decoded[i].tag = DECODE_CACHE_NO_TAG;
+  }
+}
+
+// Drops the RAM entries, for when the RAM code pages are reset
+void flush_decode_cache_ram(void)
+{
+  u32 i;
+
+  if (!decode_cache_ram_used)
+    return;
+
+  for (i = 0; i < DECODE_CACHE_SIZE; i++)
+  {
+    if (((decode_cache[i].tag >> 24) - 0x02) < 2)
+      decode_cache[i].tag = DECODE_CACHE_NO_TAG;
+  }
+  decode_cache_ram_used = false;
+}
+#endif
+
+// Returns whether the instruction at pc can be cached, flagging its page when
+// it's in RAM. The RAM mirrors are not cached (their writes are not tracked).
+static inline bool decode_cache_allowed(u32 pc)
+{
+  switch (pc >> 24)
+  {
+    case 0x00:
+      return pc < 0x4000;
+
+    case 0x08 ... 0x0D:
+      return true;
+
+#ifdef HAVE_DYNAREC
+    case 0x02:
+    case 0x03:
+    {
+      u32 page;
+
+      if (pc < 0x2040000)
+        page = (pc & 0x3FFFF) >> RAM_CODE_PAGE_SHIFT;
+      else if (pc >= 0x3000000 && pc < 0x3008000)
+        page = (0x40000 + (pc & 0x7FFF)) >> RAM_CODE_PAGE_SHIFT;
+      else
+        return false;
+
+      ram_code_pages[page / 32] |= 1U << (page % 32);
+      decode_cache_ram_used = true;
+      return true;
+    }
+#endif
+
+    default:
+      return false;
+  }
+}
+
+// Operand pre-extracted with the opcode: the rotated immediate of data
+// processing and MSR instructions, and the branch offset of B and BL.
+static inline u32 arm_decode_operand(u32 opcode)
+{
+  u32 imm;
+
+  switch ((opcode >> 25) & 0x07)
+  {
+    case 0x1:
+      ror(imm, opcode & 0xFF, ((opcode >> 8) & 0x0F) * 2);
+      return imm;
+
+    case 0x5:
+      return ((s32)(opcode << 8)) >> 6;
+
+    default:
+      return 0;
+  }
+}
+
+// Thumb operands take a single mask or shift, there's nothing to pre-extract
+#define thumb_decode_operand(opcode) 0
+
+#ifdef CPU_COMPUTED_GOTO
+  #define arm_dispatch_handler(opcode)                                        \
+    handler = arm_dispatch[(opcode) >> 20]                                    \
+
+  #define thumb_dispatch_handler(opcode)                                      \
+    handler = thumb_dispatch[((opcode) >> 8) & 0xFF]                          \
+
+  #define decoded_handler_load(decoded)                                       \
+    handler = (decoded)->handler                                              \
+
+  #define decoded_handler_store(decoded)                                      \
+    (decoded)->handler = handler                                              \
+
+#else
+  #define arm_dispatch_handler(opcode)
+  #define thumb_dispatch_handler(opcode)
+  #define decoded_handler_load(decoded)
+  #define decoded_handler_store(decoded)
+#endif
+
+// Loads the instruction at PC into opcode, operand (and handler), from the
+// decoded instruction cache or from memory, caching it then.
+#define fetch_instruction(type, size, tag_value)                              \
+{                                                                             \
+  decoded_instruction_type *decoded = decode_cache_entry(reg[REG_PC]);        \
+  if(decoded->tag == (tag_value))                                             \
+  {                                                                           \
+    opcode = decoded->opcode;                                                 \
+    operand = decoded->operand;                                               \
+    decoded_handler_load(decoded);                                            \
+  }                                                                           \
+  else                                                                        \
+  {                                                                           \
+    opcode = readaddress##size(pc_address_block, (reg[REG_PC] & 0x7FFF));     \
+    operand = type##_decode_operand(opcode);                                  \
+    type##_dispatch_handler(opcode);                                          \
+    if(decode_cache_allowed(reg[REG_PC]))                                     \
+    {                                                                         \
+      decoded->tag = (tag_value);                                             \
+      decoded->opcode = opcode;                                               \
+      decoded->operand = operand;                                             \
+      decoded_handler_store(decoded);                                         \
+    }                                                                         \
+  }                                                                           \
+}                                                                             \
+
+// Runs the CPU until the frame is completed, or if single_slice is set, only
+// until the next event is processed (or the resume PC is reached). Returns
+// the update_gba result on frame completion, the remaining cycles otherwise.
+static u32 execute_arm_loop(u32 cycles, bool single_slice)
+{
+  u32 opcode;
+  u32 operand;
   u32 condition;
   u32 n_flag, z_flag, c_flag, v_flag;
   u32 pc_region = (reg[REG_PC] >> 15);
@@ -1510,6 +1760,135 @@ void execute_arm(u32 cycles)
   u32 update_ret;
   cpu_alert_type cpu_alert;
 
+#ifdef CPU_COMPUTED_GOTO
+  // Label addresses are only known in here, fill the tables on the first run
+  static instance_local const void *arm_dispatch[4096];
+  static instance_local const void *thumb_dispatch[256];
+  const void *handler;
+
+  if(!thumb_dispatch[0])
+  {
+    const void *arm_conditions[16];
+    const void **arm_ops = &arm_dispatch[0xE00];
+    u32 i;
+
+    for(i = 0; i < 256; i++)
+    {
+      arm_ops[i] = &&skip_instruction;
+      thumb_dispatch[i] = &&thumb_instruction_done;
+    }
+
+    dispatch_arm_condition(0x0); dispatch_arm_condition(0x1);
+    dispatch_arm_condition(0x2); dispatch_arm_condition(0x3);
+    dispatch_arm_condition(0x4); dispatch_arm_condition(0x5);
+    dispatch_arm_condition(0x6); dispatch_arm_condition(0x7);
+    dispatch_arm_condition(0x8); dispatch_arm_condition(0x9);
+    dispatch_arm_condition(0xA); dispatch_arm_condition(0xB);
+    dispatch_arm_condition(0xC); dispatch_arm_condition(0xD);
+    dispatch_arm_condition(0xF);
+
+    dispatch_arm(0x00); dispatch_arm(0x01); dispatch_arm(0x02);
+    dispatch_arm(0x03); dispatch_arm(0x04); dispatch_arm(0x05);
+    dispatch_arm(0x06); dispatch_arm(0x07); dispatch_arm(0x08);
+    dispatch_arm(0x09); dispatch_arm(0x0A); dispatch_arm(0x0B);
+    dispatch_arm(0x0C); dispatch_arm(0x0D); dispatch_arm(0x0E);
+    dispatch_arm(0x0F); dispatch_arm(0x10); dispatch_arm(0x11);
+    dispatch_arm(0x12); dispatch_arm(0x13); dispatch_arm(0x14);
+    dispatch_arm(0x15); dispatch_arm(0x16); dispatch_arm(0x17);
+    dispatch_arm(0x18); dispatch_arm(0x19); dispatch_arm(0x1A);
+    dispatch_arm(0x1B); dispatch_arm(0x1C); dispatch_arm(0x1D);
+    dispatch_arm(0x1E); dispatch_arm(0x1F); dispatch_arm(0x20);
+    dispatch_arm(0x21); dispatch_arm(0x22); dispatch_arm(0x23);
+    dispatch_arm(0x24); dispatch_arm(0x25); dispatch_arm(0x26);
+    dispatch_arm(0x27); dispatch_arm(0x28); dispatch_arm(0x29);
+    dispatch_arm(0x2A); dispatch_arm(0x2B); dispatch_arm(0x2C);
+    dispatch_arm(0x2D); dispatch_arm(0x2E); dispatch_arm(0x2F);
+    dispatch_arm(0x30); dispatch_arm(0x31); dispatch_arm(0x32);
+    dispatch_arm(0x33); dispatch_arm(0x34); dispatch_arm(0x35);
+    dispatch_arm(0x36); dispatch_arm(0x37); dispatch_arm(0x38);
+    dispatch_arm(0x39); dispatch_arm(0x3A); dispatch_arm(0x3B);
+    dispatch_arm(0x3C); dispatch_arm(0x3D); dispatch_arm(0x3E);
+    dispatch_arm(0x3F); dispatch_arm(0x40); dispatch_arm(0x41);
+    dispatch_arm(0x42); dispatch_arm(0x43); dispatch_arm(0x44);
+    dispatch_arm(0x45); dispatch_arm(0x46); dispatch_arm(0x47);
+    dispatch_arm(0x48); dispatch_arm(0x49); dispatch_arm(0x4A);
+    dispatch_arm(0x4B); dispatch_arm(0x4C); dispatch_arm(0x4D);
+    dispatch_arm(0x4E); dispatch_arm(0x4F); dispatch_arm(0x50);
+    dispatch_arm(0x51); dispatch_arm(0x52); dispatch_arm(0x53);
+    dispatch_arm(0x54); dispatch_arm(0x55); dispatch_arm(0x56);
+    dispatch_arm(0x57); dispatch_arm(0x58); dispatch_arm(0x59);
+    dispatch_arm(0x5A); dispatch_arm(0x5B); dispatch_arm(0x5C);
+    dispatch_arm(0x5D); dispatch_arm(0x5E); dispatch_arm(0x5F);
+    dispatch_arm(0x60); dispatch_arm(0x61); dispatch_arm(0x62);
+    dispatch_arm(0x63); dispatch_arm(0x64); dispatch_arm(0x65);
+    dispatch_arm(0x66); dispatch_arm(0x67); dispatch_arm(0x68);
+    dispatch_arm(0x69); dispatch_arm(0x6A); dispatch_arm(0x6B);
+    dispatch_arm(0x6C); dispatch_arm(0x6D); dispatch_arm(0x6E);
+    dispatch_arm(0x6F); dispatch_arm(0x70); dispatch_arm(0x71);
+    dispatch_arm(0x72); dispatch_arm(0x73); dispatch_arm(0x74);
+    dispatch_arm(0x75); dispatch_arm(0x76); dispatch_arm(0x77);
+    dispatch_arm(0x78); dispatch_arm(0x79); dispatch_arm(0x7A);
+    dispatch_arm(0x7B); dispatch_arm(0x7C); dispatch_arm(0x7D);
+    dispatch_arm(0x7E); dispatch_arm(0x7F); dispatch_arm(0x80);
+    dispatch_arm(0x81); dispatch_arm(0x82); dispatch_arm(0x83);
+    dispatch_arm(0x84); dispatch_arm(0x85); dispatch_arm(0x86);
+    dispatch_arm(0x87); dispatch_arm(0x88); dispatch_arm(0x89);
+    dispatch_arm(0x8A); dispatch_arm(0x8B); dispatch_arm(0x8C);
+    dispatch_arm(0x8D); dispatch_arm(0x8E); dispatch_arm(0x8F);
+    dispatch_arm(0x90); dispatch_arm(0x91); dispatch_arm(0x92);
+    dispatch_arm(0x93); dispatch_arm(0x94); dispatch_arm(0x95);
+    dispatch_arm(0x96); dispatch_arm(0x97); dispatch_arm(0x98);
+    dispatch_arm(0x99); dispatch_arm(0x9A); dispatch_arm(0x9B);
+    dispatch_arm(0x9C); dispatch_arm(0x9D); dispatch_arm(0x9E);
+    dispatch_arm(0x9F); dispatch_arm_range(0xA0, 0xAF);
+    dispatch_arm_range(0xB0, 0xBF);
+#ifdef HAVE_UNUSED
+    dispatch_arm_range(0xC0, 0xEF);
+#endif
+    dispatch_arm_range(0xF0, 0xFF);
+
+    dispatch_thumb_range(0x00, 0x07); dispatch_thumb_range(0x08, 0x0F);
+    dispatch_thumb_range(0x10, 0x17); dispatch_thumb(0x18);
+    dispatch_thumb(0x19); dispatch_thumb(0x1A); dispatch_thumb(0x1B);
+    dispatch_thumb(0x1C); dispatch_thumb(0x1D); dispatch_thumb(0x1E);
+    dispatch_thumb(0x1F); dispatch_thumb_range(0x20, 0x27);
+    dispatch_thumb_range(0x28, 0x2F); dispatch_thumb_range(0x30, 0x37);
+    dispatch_thumb_range(0x38, 0x3F); dispatch_thumb(0x40);
+    dispatch_thumb(0x41); dispatch_thumb(0x42); dispatch_thumb(0x43);
+    dispatch_thumb(0x44); dispatch_thumb(0x45); dispatch_thumb(0x46);
+    dispatch_thumb(0x47); dispatch_thumb_range(0x48, 0x4F);
+    dispatch_thumb(0x50); dispatch_thumb(0x51); dispatch_thumb(0x52);
+    dispatch_thumb(0x53); dispatch_thumb(0x54); dispatch_thumb(0x55);
+    dispatch_thumb(0x56); dispatch_thumb(0x57); dispatch_thumb(0x58);
+    dispatch_thumb(0x59); dispatch_thumb(0x5A); dispatch_thumb(0x5B);
+    dispatch_thumb(0x5C); dispatch_thumb(0x5D); dispatch_thumb(0x5E);
+    dispatch_thumb(0x5F); dispatch_thumb_range(0x60, 0x67);
+    dispatch_thumb_range(0x68, 0x6F); dispatch_thumb_range(0x70, 0x77);
+    dispatch_thumb_range(0x78, 0x7F); dispatch_thumb_range(0x80, 0x87);
+    dispatch_thumb_range(0x88, 0x8F); dispatch_thumb_range(0x90, 0x97);
+    dispatch_thumb_range(0x98, 0x9F); dispatch_thumb_range(0xA0, 0xA7);
+    dispatch_thumb_range(0xA8, 0xAF); dispatch_thumb(0xB0);
+    dispatch_thumb(0xB1); dispatch_thumb(0xB2); dispatch_thumb(0xB3);
+    dispatch_thumb(0xB4); dispatch_thumb(0xB5); dispatch_thumb(0xBC);
+    dispatch_thumb(0xBD); dispatch_thumb_range(0xC0, 0xC7);
+    dispatch_thumb_range(0xC8, 0xCF); dispatch_thumb(0xD0);
+    dispatch_thumb(0xD1); dispatch_thumb(0xD2); dispatch_thumb(0xD3);
+    dispatch_thumb(0xD4); dispatch_thumb(0xD5); dispatch_thumb(0xD6);
+    dispatch_thumb(0xD7); dispatch_thumb(0xD8); dispatch_thumb(0xD9);
+    dispatch_thumb(0xDA); dispatch_thumb(0xDB); dispatch_thumb(0xDC);
+    dispatch_thumb(0xDD); dispatch_thumb(0xDF);
+    dispatch_thumb_range(0xE0, 0xE7); dispatch_thumb_range(0xF0, 0xF7);
+    dispatch_thumb_range(0xF8, 0xFF);
+
+    // Indexed by opcode bits 31-20
+    for(i = 0; i < 4096; i++)
+    {
+      if((i >> 8) != 0xE)
+        arm_dispatch[i] = arm_conditions[i >> 8];
+    }
+  }
+#endif
+
   if(!pc_address_block)
     pc_address_block = load_gamepak_page(pc_region & 0x3FF);
   touch_gamepak_page(pc_region);
@@ -1521,9 +1900,11 @@ void execute_arm(u32 cycles)
     if (reg[CPU_HALT_STATE] != CPU_ACTIVE) {
        u32 ret = update_gba(cycles_remaining);
        if (completed_frame(ret))
-          return;
+          return ret;
 
        cycles_remaining = cycles_to_run(ret);
+       if (single_slice)
+          return cycles_remaining;
     }
 
     cpu_alert = CPU_ALERT_NONE;
@@ -1536,7 +1917,14 @@ void execute_arm(u32 cycles)
     {
 arm_loop:
 
-       collapse_flags();
+#ifdef THREADED_JIT
+       /* The translated block is ready, resume translated execution */
+       if (reg[REG_PC] == interpreter_resume_pc)
+       {
+          collapse_flags();
+          return MAX(cycles_remaining, 0);
+       }
+#endif
 
        /* Process cheats if we are about to execute the cheat hook */
        if (reg[REG_PC] == cheat_master_hook)
@@ -1546,86 +1934,90 @@ arm_loop:
        using_instruction(arm);
        check_pc_region();
        reg[REG_PC] &= ~0x03;
-       opcode = readaddress32(pc_address_block, (reg[REG_PC] & 0x7FFF));
+       fetch_instruction(arm, 32, reg[REG_PC]);
        condition = opcode >> 28;
 
+#ifdef CPU_COMPUTED_GOTO
+       goto *handler;
+#endif
+
        switch(condition)
        {
-          case 0x0:
+          cpu_case(arm_cond, 0x0):
              /* EQ */
              if(!z_flag)
                 arm_next_instruction();
              break;
-          case 0x1:
+          cpu_case(arm_cond, 0x1):
              /* NE      */
              if(z_flag)
                 arm_next_instruction();
              break;
-          case 0x2:
+          cpu_case(arm_cond, 0x2):
              /* CS       */
              if(!c_flag)
                 arm_next_instruction();
              break;
-          case 0x3:
+          cpu_case(arm_cond, 0x3):
              /* CC       */
              if(c_flag)
                 arm_next_instruction();
              break;
-          case 0x4:
+          cpu_case(arm_cond, 0x4):
              /* MI       */
              if(!n_flag)
                 arm_next_instruction();
              break;
 
-          case 0x5:
+          cpu_case(arm_cond, 0x5):
              /* PL       */
              if(n_flag)
                 arm_next_instruction();
              break;
 
-          case 0x6:
+          cpu_case(arm_cond, 0x6):
              /* VS       */
              if(!v_flag)
                 arm_next_instruction();
              break;
 
-          case 0x7:
+          cpu_case(arm_cond, 0x7):
              /* VC       */
              if(v_flag)
                 arm_next_instruction();
              break;
 
-          case 0x8:
+          cpu_case(arm_cond, 0x8):
              /* HI       */
              if((c_flag == 0) | z_flag)
                 arm_next_instruction();
              break;
 
-          case 0x9:
+          cpu_case(arm_cond, 0x9):
              /* LS       */
              if(c_flag & (z_flag ^ 1))
                 arm_next_instruction();
              break;
 
-          case 0xA:
+          cpu_case(arm_cond, 0xA):
              /* GE       */
              if(n_flag != v_flag)
                 arm_next_instruction();
              break;
 
-          case 0xB:
+          cpu_case(arm_cond, 0xB):
              /* LT       */
              if(n_flag == v_flag)
                 arm_next_instruction();
              break;
 
-          case 0xC:
+          cpu_case(arm_cond, 0xC):
              /* GT       */
              if(z_flag | (n_flag != v_flag))
                 arm_next_instruction();
              break;
 
-          case 0xD:
+          cpu_case(arm_cond, 0xD):
              /* LE       */
              if((z_flag == 0) & (n_flag == v_flag))
                 arm_next_instruction();
@@ -1635,19 +2027,24 @@ arm_loop:
              /* AL       */
              break;
 
-          case 0xF:
+          cpu_case(arm_cond, 0xF):
              /* Reserved - treat as "never" */
              arm_next_instruction();
              break;
        }
 
        #ifdef TRACE_INSTRUCTIONS
+       collapse_flags();
        interp_trace_instruction(reg[REG_PC], 1);
        #endif
 
+#ifdef CPU_COMPUTED_GOTO
+       goto *arm_dispatch[0xE00 | ((opcode >> 20) & 0xFF)];
+#endif
+
        switch((opcode >> 20) & 0xFF)
        {
-          case 0x00:
+          cpu_case(arm_op, 0x00):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -1668,7 +2065,7 @@ arm_loop:
              }
              break;
 
-          case 0x01:
+          cpu_case(arm_op, 0x01):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1701,7 +2098,7 @@ arm_loop:
              }
              break;
 
-          case 0x02:
+          cpu_case(arm_op, 0x02):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -1722,7 +2119,7 @@ arm_loop:
              }
              break;
 
-          case 0x03:
+          cpu_case(arm_op, 0x03):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1755,7 +2152,7 @@ arm_loop:
              }
              break;
 
-          case 0x04:
+          cpu_case(arm_op, 0x04):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn], -imm */
@@ -1768,7 +2165,7 @@ arm_loop:
              }
              break;
 
-          case 0x05:
+          cpu_case(arm_op, 0x05):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1796,7 +2193,7 @@ arm_loop:
              }
              break;
 
-          case 0x06:
+          cpu_case(arm_op, 0x06):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn], -imm */
@@ -1809,7 +2206,7 @@ arm_loop:
              }
              break;
 
-          case 0x07:
+          cpu_case(arm_op, 0x07):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1837,7 +2234,7 @@ arm_loop:
              }
              break;
 
-          case 0x08:
+          cpu_case(arm_op, 0x08):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -1858,7 +2255,7 @@ arm_loop:
              }
              break;
 
-          case 0x09:
+          cpu_case(arm_op, 0x09):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1891,7 +2288,7 @@ arm_loop:
              }
              break;
 
-          case 0x0A:
+          cpu_case(arm_op, 0x0A):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -1912,7 +2309,7 @@ arm_loop:
              }
              break;
 
-          case 0x0B:
+          cpu_case(arm_op, 0x0B):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1945,7 +2342,7 @@ arm_loop:
              }
              break;
 
-          case 0x0C:
+          cpu_case(arm_op, 0x0C):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -1966,7 +2363,7 @@ arm_loop:
              }
              break;
 
-          case 0x0D:
+          cpu_case(arm_op, 0x0D):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -1999,7 +2396,7 @@ arm_loop:
              }
              break;
 
-          case 0x0E:
+          cpu_case(arm_op, 0x0E):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -2020,7 +2417,7 @@ arm_loop:
              }
              break;
 
-          case 0x0F:
+          cpu_case(arm_op, 0x0F):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2053,7 +2450,7 @@ arm_loop:
              }
              break;
 
-          case 0x10:
+          cpu_case(arm_op, 0x10):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -2074,7 +2471,7 @@ arm_loop:
              }
              break;
 
-          case 0x11:
+          cpu_case(arm_op, 0x11):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2102,7 +2499,7 @@ arm_loop:
              }
              break;
 
-          case 0x12:
+          cpu_case(arm_op, 0x12):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn - rm]! */
@@ -2135,7 +2532,7 @@ arm_loop:
              }
              break;
 
-          case 0x13:
+          cpu_case(arm_op, 0x13):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2163,7 +2560,7 @@ arm_loop:
              }
              break;
 
-          case 0x14:
+          cpu_case(arm_op, 0x14):
              if((opcode & 0x90) == 0x90)
              {
                 if(opcode & 0x20)
@@ -2184,7 +2581,7 @@ arm_loop:
              }
              break;
 
-          case 0x15:
+          cpu_case(arm_op, 0x15):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2212,7 +2609,7 @@ arm_loop:
              }
              break;
 
-          case 0x16:
+          cpu_case(arm_op, 0x16):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn - imm]! */
@@ -2225,7 +2622,7 @@ arm_loop:
              }
              break;
 
-          case 0x17:
+          cpu_case(arm_op, 0x17):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2253,7 +2650,7 @@ arm_loop:
              }
              break;
 
-          case 0x18:
+          cpu_case(arm_op, 0x18):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn + rm] */
@@ -2266,7 +2663,7 @@ arm_loop:
              }
              break;
 
-          case 0x19:
+          cpu_case(arm_op, 0x19):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2294,7 +2691,7 @@ arm_loop:
              }
              break;
 
-          case 0x1A:
+          cpu_case(arm_op, 0x1A):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn + rm]! */
@@ -2307,7 +2704,7 @@ arm_loop:
              }
              break;
 
-          case 0x1B:
+          cpu_case(arm_op, 0x1B):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2335,7 +2732,7 @@ arm_loop:
              }
              break;
 
-          case 0x1C:
+          cpu_case(arm_op, 0x1C):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn + imm] */
@@ -2348,7 +2745,7 @@ arm_loop:
              }
              break;
 
-          case 0x1D:
+          cpu_case(arm_op, 0x1D):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2376,7 +2773,7 @@ arm_loop:
              }
              break;
 
-          case 0x1E:
+          cpu_case(arm_op, 0x1E):
              if((opcode & 0x90) == 0x90)
              {
                 /* STRH rd, [rn + imm]! */
@@ -2389,7 +2786,7 @@ arm_loop:
              }
              break;
 
-          case 0x1F:
+          cpu_case(arm_op, 0x1F):
              if((opcode & 0x90) == 0x90)
              {
                 switch((opcode >> 5) & 0x03)
@@ -2417,544 +2814,544 @@ arm_loop:
              }
              break;
 
-          case 0x20:
+          cpu_case(arm_op, 0x20):
              /* AND rd, rn, imm */
              arm_data_proc(reg[rn] & imm, imm);
              break;
 
-          case 0x21:
+          cpu_case(arm_op, 0x21):
              /* ANDS rd, rn, imm */
              arm_data_proc_logic_flags(reg[rn] & imm, imm);
              break;
 
-          case 0x22:
+          cpu_case(arm_op, 0x22):
              /* EOR rd, rn, imm */
              arm_data_proc(reg[rn] ^ imm, imm);
              break;
 
-          case 0x23:
+          cpu_case(arm_op, 0x23):
              /* EORS rd, rn, imm */
              arm_data_proc_logic_flags(reg[rn] ^ imm, imm);
              break;
 
-          case 0x24:
+          cpu_case(arm_op, 0x24):
              /* SUB rd, rn, imm */
              arm_data_proc(reg[rn] - imm, imm);
              break;
 
-          case 0x25:
+          cpu_case(arm_op, 0x25):
              /* SUBS rd, rn, imm */
              arm_data_proc_sub_flags(reg[rn], imm, 1, imm);
              break;
 
-          case 0x26:
+          cpu_case(arm_op, 0x26):
              /* RSB rd, rn, imm */
              arm_data_proc(imm - reg[rn], imm);
              break;
 
-          case 0x27:
+          cpu_case(arm_op, 0x27):
              /* RSBS rd, rn, imm */
              arm_data_proc_sub_flags(imm, reg[rn], 1, imm);
              break;
 
-          case 0x28:
+          cpu_case(arm_op, 0x28):
              /* ADD rd, rn, imm */
              arm_data_proc(reg[rn] + imm, imm);
              break;
 
-          case 0x29:
+          cpu_case(arm_op, 0x29):
              /* ADDS rd, rn, imm */
              arm_data_proc_add_flags(reg[rn], imm, 0, imm);
              break;
 
-          case 0x2A:
+          cpu_case(arm_op, 0x2A):
              /* ADC rd, rn, imm */
              arm_data_proc(reg[rn] + imm + c_flag, imm);
              break;
 
-          case 0x2B:
+          cpu_case(arm_op, 0x2B):
              /* ADCS rd, rn, imm */
              arm_data_proc_add_flags(reg[rn], imm, c_flag, imm);
              break;
 
-          case 0x2C:
+          cpu_case(arm_op, 0x2C):
              /* SBC rd, rn, imm */
              arm_data_proc(reg[rn] - imm + c_flag - 1, imm);
              break;
 
-          case 0x2D:
+          cpu_case(arm_op, 0x2D):
              /* SBCS rd, rn, imm */
              arm_data_proc_sub_flags(reg[rn], imm, c_flag, imm);
              break;
 
-          case 0x2E:
+          cpu_case(arm_op, 0x2E):
              /* RSC rd, rn, imm */
              arm_data_proc(imm - reg[rn] + c_flag - 1, imm);
              break;
 
-          case 0x2F:
+          cpu_case(arm_op, 0x2F):
              /* RSCS rd, rn, imm */
              arm_data_proc_sub_flags(imm, reg[rn], c_flag, imm);
              break;
 
-          case 0x30:
-          case 0x31:
+          cpu_case(arm_op, 0x30):
+          cpu_case(arm_op, 0x31):
              /* TST rn, imm */
              arm_data_proc_test_logic(reg[rn] & imm, imm);
              break;
 
-          case 0x32:
+          cpu_case(arm_op, 0x32):
              /* MSR cpsr, imm */
              arm_psr(imm, store, cpsr);
              break;
 
-          case 0x33:
+          cpu_case(arm_op, 0x33):
              /* TEQ rn, imm */
              arm_data_proc_test_logic(reg[rn] ^ imm, imm);
              break;
 
-          case 0x34:
-          case 0x35:
+          cpu_case(arm_op, 0x34):
+          cpu_case(arm_op, 0x35):
              /* CMP rn, imm */
              arm_data_proc_test_sub(reg[rn], imm, imm);
              break;
 
-          case 0x36:
+          cpu_case(arm_op, 0x36):
              /* MSR spsr, imm */
              arm_psr(imm, store, spsr);
              break;
 
-          case 0x37:
+          cpu_case(arm_op, 0x37):
              /* CMN rn, imm */
              arm_data_proc_test_add(reg[rn], imm, imm);
              break;
 
-          case 0x38:
+          cpu_case(arm_op, 0x38):
              /* ORR rd, rn, imm */
              arm_data_proc(reg[rn] | imm, imm);
              break;
 
-          case 0x39:
+          cpu_case(arm_op, 0x39):
              /* ORRS rd, rn, imm */
              arm_data_proc_logic_flags(reg[rn] | imm, imm);
              break;
 
-          case 0x3A:
+          cpu_case(arm_op, 0x3A):
              /* MOV rd, imm */
              arm_data_proc(imm, imm);
              break;
 
-          case 0x3B:
+          cpu_case(arm_op, 0x3B):
              /* MOVS rd, imm */
              arm_data_proc_logic_flags(imm, imm);
              break;
 
-          case 0x3C:
+          cpu_case(arm_op, 0x3C):
              /* BIC rd, rn, imm */
              arm_data_proc(reg[rn] & (~imm), imm);
              break;
 
-          case 0x3D:
+          cpu_case(arm_op, 0x3D):
              /* BICS rd, rn, imm */
              arm_data_proc_logic_flags(reg[rn] & (~imm), imm);
              break;
 
-          case 0x3E:
+          cpu_case(arm_op, 0x3E):
              /* MVN rd, imm */
              arm_data_proc(~imm, imm);
              break;
 
-          case 0x3F:
+          cpu_case(arm_op, 0x3F):
              /* MVNS rd, imm */
              arm_data_proc_logic_flags(~imm, imm);
              break;
 
-          case 0x40:
+          cpu_case(arm_op, 0x40):
              /* STR rd, [rn], -imm */
              arm_access_memory(store, no_op, imm, u32, yes, - offset);
              break;
 
-          case 0x41:
+          cpu_case(arm_op, 0x41):
              /* LDR rd, [rn], -imm */
              arm_access_memory(load, no_op, imm, u32, yes, - offset);
              break;
 
-          case 0x42:
+          cpu_case(arm_op, 0x42):
              /* STRT rd, [rn], -imm */
              arm_access_memory(store, no_op, imm, u32, yes, - offset);
              break;
 
-          case 0x43:
+          cpu_case(arm_op, 0x43):
              /* LDRT rd, [rn], -imm */
              arm_access_memory(load, no_op, imm, u32, yes, - offset);
              break;
 
-          case 0x44:
+          cpu_case(arm_op, 0x44):
              /* STRB rd, [rn], -imm */
              arm_access_memory(store, no_op, imm, u8, yes, - offset);
              break;
 
-          case 0x45:
+          cpu_case(arm_op, 0x45):
              /* LDRB rd, [rn], -imm */
              arm_access_memory(load, no_op, imm, u8, yes, - offset);
              break;
 
-          case 0x46:
+          cpu_case(arm_op, 0x46):
              /* STRBT rd, [rn], -imm */
              arm_access_memory(store, no_op, imm, u8, yes, - offset);
              break;
 
-          case 0x47:
+          cpu_case(arm_op, 0x47):
              /* LDRBT rd, [rn], -imm */
              arm_access_memory(load, no_op, imm, u8, yes, - offset);
              break;
 
-          case 0x48:
+          cpu_case(arm_op, 0x48):
              /* STR rd, [rn], +imm */
              arm_access_memory(store, no_op, imm, u32, yes, + offset);
              break;
 
-          case 0x49:
+          cpu_case(arm_op, 0x49):
              /* LDR rd, [rn], +imm */
              arm_access_memory(load, no_op, imm, u32, yes, + offset);
              break;
 
-          case 0x4A:
+          cpu_case(arm_op, 0x4A):
              /* STRT rd, [rn], +imm */
              arm_access_memory(store, no_op, imm, u32, yes, + offset);
              break;
 
-          case 0x4B:
+          cpu_case(arm_op, 0x4B):
              /* LDRT rd, [rn], +imm */
              arm_access_memory(load, no_op, imm, u32, yes, + offset);
              break;
 
-          case 0x4C:
+          cpu_case(arm_op, 0x4C):
              /* STRB rd, [rn], +imm */
              arm_access_memory(store, no_op, imm, u8, yes, + offset);
              break;
 
-          case 0x4D:
+          cpu_case(arm_op, 0x4D):
              /* LDRB rd, [rn], +imm */
              arm_access_memory(load, no_op, imm, u8, yes, + offset);
              break;
 
-          case 0x4E:
+          cpu_case(arm_op, 0x4E):
              /* STRBT rd, [rn], +imm */
              arm_access_memory(store, no_op, imm, u8, yes, + offset);
              break;
 
-          case 0x4F:
+          cpu_case(arm_op, 0x4F):
              /* LDRBT rd, [rn], +imm */
              arm_access_memory(load, no_op, imm, u8, yes, + offset);
              break;
 
-          case 0x50:
+          cpu_case(arm_op, 0x50):
              /* STR rd, [rn - imm] */
              arm_access_memory(store, - offset, imm, u32, no, no_op);
              break;
 
-          case 0x51:
+          cpu_case(arm_op, 0x51):
              /* LDR rd, [rn - imm] */
              arm_access_memory(load, - offset, imm, u32, no, no_op);
              break;
 
-          case 0x52:
+          cpu_case(arm_op, 0x52):
              /* STR rd, [rn - imm]! */
              arm_access_memory(store, - offset, imm, u32, yes, no_op);
              break;
 
-          case 0x53:
+          cpu_case(arm_op, 0x53):
              /* LDR rd, [rn - imm]! */
              arm_access_memory(load, - offset, imm, u32, yes, no_op);
              break;
 
-          case 0x54:
+          cpu_case(arm_op, 0x54):
              /* STRB rd, [rn - imm] */
              arm_access_memory(store, - offset, imm, u8, no, no_op);
              break;
 
-          case 0x55:
+          cpu_case(arm_op, 0x55):
              /* LDRB rd, [rn - imm] */
              arm_access_memory(load, - offset, imm, u8, no, no_op);
              break;
 
-          case 0x56:
+          cpu_case(arm_op, 0x56):
              /* STRB rd, [rn - imm]! */
              arm_access_memory(store, - offset, imm, u8, yes, no_op);
              break;
 
-          case 0x57:
+          cpu_case(arm_op, 0x57):
              /* LDRB rd, [rn - imm]! */
              arm_access_memory(load, - offset, imm, u8, yes, no_op);
              break;
 
-          case 0x58:
+          cpu_case(arm_op, 0x58):
              /* STR rd, [rn + imm] */
              arm_access_memory(store, + offset, imm, u32, no, no_op);
              break;
 
-          case 0x59:
+          cpu_case(arm_op, 0x59):
              /* LDR rd, [rn + imm] */
              arm_access_memory(load, + offset, imm, u32, no, no_op);
              break;
 
-          case 0x5A:
+          cpu_case(arm_op, 0x5A):
              /* STR rd, [rn + imm]! */
              arm_access_memory(store, + offset, imm, u32, yes, no_op);
              break;
 
-          case 0x5B:
+          cpu_case(arm_op, 0x5B):
              /* LDR rd, [rn + imm]! */
              arm_access_memory(load, + offset, imm, u32, yes, no_op);
              break;
 
-          case 0x5C:
+          cpu_case(arm_op, 0x5C):
              /* STRB rd, [rn + imm] */
              arm_access_memory(store, + offset, imm, u8, no, no_op);
              break;
 
-          case 0x5D:
+          cpu_case(arm_op, 0x5D):
              /* LDRB rd, [rn + imm] */
              arm_access_memory(load, + offset, imm, u8, no, no_op);
              break;
 
-          case 0x5E:
+          cpu_case(arm_op, 0x5E):
              /* STRB rd, [rn + imm]! */
              arm_access_memory(store, + offset, imm, u8, yes, no_op);
              break;
 
-          case 0x5F:
+          cpu_case(arm_op, 0x5F):
              /* LDRBT rd, [rn + imm]! */
              arm_access_memory(load, + offset, imm, u8, yes, no_op);
              break;
 
-          case 0x60:
+          cpu_case(arm_op, 0x60):
              /* STR rd, [rn], -reg_op */
              arm_access_memory(store, no_op, reg, u32, yes, - reg_offset);
              break;
 
-          case 0x61:
+          cpu_case(arm_op, 0x61):
              /* LDR rd, [rn], -reg_op */
              arm_access_memory(load, no_op, reg, u32, yes, - reg_offset);
              break;
 
-          case 0x62:
+          cpu_case(arm_op, 0x62):
              /* STRT rd, [rn], -reg_op */
              arm_access_memory(store, no_op, reg, u32, yes, - reg_offset);
              break;
 
-          case 0x63:
+          cpu_case(arm_op, 0x63):
              /* LDRT rd, [rn], -reg_op */
              arm_access_memory(load, no_op, reg, u32, yes, - reg_offset);
              break;
 
-          case 0x64:
+          cpu_case(arm_op, 0x64):
              /* STRB rd, [rn], -reg_op */
              arm_access_memory(store, no_op, reg, u8, yes, - reg_offset);
              break;
 
-          case 0x65:
+          cpu_case(arm_op, 0x65):
              /* LDRB rd, [rn], -reg_op */
              arm_access_memory(load, no_op, reg, u8, yes, - reg_offset);
              break;
 
-          case 0x66:
+          cpu_case(arm_op, 0x66):
              /* STRBT rd, [rn], -reg_op */
              arm_access_memory(store, no_op, reg, u8, yes, - reg_offset);
              break;
 
-          case 0x67:
+          cpu_case(arm_op, 0x67):
              /* LDRBT rd, [rn], -reg_op */
              arm_access_memory(load, no_op, reg, u8, yes, - reg_offset);
              break;
 
-          case 0x68:
+          cpu_case(arm_op, 0x68):
              /* STR rd, [rn], +reg_op */
              arm_access_memory(store, no_op, reg, u32, yes, + reg_offset);
              break;
 
-          case 0x69:
+          cpu_case(arm_op, 0x69):
              /* LDR rd, [rn], +reg_op */
              arm_access_memory(load, no_op, reg, u32, yes, + reg_offset);
              break;
 
-          case 0x6A:
+          cpu_case(arm_op, 0x6A):
              /* STRT rd, [rn], +reg_op */
              arm_access_memory(store, no_op, reg, u32, yes, + reg_offset);
              break;
 
-          case 0x6B:
+          cpu_case(arm_op, 0x6B):
              /* LDRT rd, [rn], +reg_op */
              arm_access_memory(load, no_op, reg, u32, yes, + reg_offset);
              break;
 
-          case 0x6C:
+          cpu_case(arm_op, 0x6C):
              /* STRB rd, [rn], +reg_op */
              arm_access_memory(store, no_op, reg, u8, yes, + reg_offset);
              break;
 
-          case 0x6D:
+          cpu_case(arm_op, 0x6D):
              /* LDRB rd, [rn], +reg_op */
              arm_access_memory(load, no_op, reg, u8, yes, + reg_offset);
              break;
 
-          case 0x6E:
+          cpu_case(arm_op, 0x6E):
              /* STRBT rd, [rn], +reg_op */
              arm_access_memory(store, no_op, reg, u8, yes, + reg_offset);
              break;
 
-          case 0x6F:
+          cpu_case(arm_op, 0x6F):
              /* LDRBT rd, [rn], +reg_op */
              arm_access_memory(load, no_op, reg, u8, yes, + reg_offset);
              break;
 
-          case 0x70:
+          cpu_case(arm_op, 0x70):
              /* STR rd, [rn - reg_op] */
              arm_access_memory(store, - reg_offset, reg, u32, no, no_op);
              break;
 
-          case 0x71:
+          cpu_case(arm_op, 0x71):
              /* LDR rd, [rn - reg_op] */
              arm_access_memory(load, - reg_offset, reg, u32, no, no_op);
              break;
 
-          case 0x72:
+          cpu_case(arm_op, 0x72):
              /* STR rd, [rn - reg_op]! */
              arm_access_memory(store, - reg_offset, reg, u32, yes, no_op);
              break;
 
-          case 0x73:
+          cpu_case(arm_op, 0x73):
              /* LDR rd, [rn - reg_op]! */
              arm_access_memory(load, - reg_offset, reg, u32, yes, no_op);
              break;
 
-          case 0x74:
+          cpu_case(arm_op, 0x74):
              /* STRB rd, [rn - reg_op] */
              arm_access_memory(store, - reg_offset, reg, u8, no, no_op);
              break;
 
-          case 0x75:
+          cpu_case(arm_op, 0x75):
              /* LDRB rd, [rn - reg_op] */
              arm_access_memory(load, - reg_offset, reg, u8, no, no_op);
              break;
 
-          case 0x76:
+          cpu_case(arm_op, 0x76):
              /* STRB rd, [rn - reg_op]! */
              arm_access_memory(store, - reg_offset, reg, u8, yes, no_op);
              break;
 
-          case 0x77:
+          cpu_case(arm_op, 0x77):
              /* LDRB rd, [rn - reg_op]! */
              arm_access_memory(load, - reg_offset, reg, u8, yes, no_op);
              break;
 
-          case 0x78:
+          cpu_case(arm_op, 0x78):
              /* STR rd, [rn + reg_op] */
              arm_access_memory(store, + reg_offset, reg, u32, no, no_op);
              break;
 
-          case 0x79:
+          cpu_case(arm_op, 0x79):
              /* LDR rd, [rn + reg_op] */
              arm_access_memory(load, + reg_offset, reg, u32, no, no_op);
              break;
 
-          case 0x7A:
+          cpu_case(arm_op, 0x7A):
              /* STR rd, [rn + reg_op]! */
              arm_access_memory(store, + reg_offset, reg, u32, yes, no_op);
              break;
 
-          case 0x7B:
+          cpu_case(arm_op, 0x7B):
              /* LDR rd, [rn + reg_op]! */
              arm_access_memory(load, + reg_offset, reg, u32, yes, no_op);
              break;
 
-          case 0x7C:
+          cpu_case(arm_op, 0x7C):
              /* STRB rd, [rn + reg_op] */
              arm_access_memory(store, + reg_offset, reg, u8, no, no_op);
              break;
 
-          case 0x7D:
+          cpu_case(arm_op, 0x7D):
              /* LDRB rd, [rn + reg_op] */
              arm_access_memory(load, + reg_offset, reg, u8, no, no_op);
              break;
 
-          case 0x7E:
+          cpu_case(arm_op, 0x7E):
              /* STRB rd, [rn + reg_op]! */
              arm_access_memory(store, + reg_offset, reg, u8, yes, no_op);
              break;
 
-          case 0x7F:
+          cpu_case(arm_op, 0x7F):
              /* LDRBT rd, [rn + reg_op]! */
              arm_access_memory(load, + reg_offset, reg, u8, yes, no_op);
              break;
 
           /* STM instructions: STMDA, STMIA, STMDB, STMIB */
 
-          case 0x80:   /* STMDA rn, rlist */
+          cpu_case(arm_op, 0x80):   /* STMDA rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, false, false, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x88:   /* STMIA rn, rlist */
+          cpu_case(arm_op, 0x88):   /* STMIA rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, false, false, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x90:   /* STMDB rn, rlist */
+          cpu_case(arm_op, 0x90):   /* STMDB rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, false, false, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x98:   /* STMIB rn, rlist */
+          cpu_case(arm_op, 0x98):   /* STMIB rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, false, false, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
 
-          case 0x82:   /* STMDA rn!, rlist */
+          cpu_case(arm_op, 0x82):   /* STMDA rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, true, false, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x8A:   /* STMIA rn!, rlist */
+          cpu_case(arm_op, 0x8A):   /* STMIA rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, true, false, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x92:   /* STMDB rn!, rlist */
+          cpu_case(arm_op, 0x92):   /* STMDB rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, true, false, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x9A:   /* STMIB rn!, rlist */
+          cpu_case(arm_op, 0x9A):   /* STMIB rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccStore, true, false, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
 
-          case 0x84:   /* STMDA rn, rlist^ */
+          cpu_case(arm_op, 0x84):   /* STMDA rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, false, true, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x8C:   /* STMIA rn, rlist^ */
+          cpu_case(arm_op, 0x8C):   /* STMIA rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, false, true, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x94:   /* STMDB rn, rlist^ */
+          cpu_case(arm_op, 0x94):   /* STMDB rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, false, true, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x9C:   /* STMIB rn, rlist^ */
+          cpu_case(arm_op, 0x9C):   /* STMIB rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, false, true, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
 
-          case 0x86:   /* STMDA rn!, rlist^ */
+          cpu_case(arm_op, 0x86):   /* STMDA rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, true, true, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x8E:   /* STMIA rn!, rlist^ */
+          cpu_case(arm_op, 0x8E):   /* STMIA rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, true, true, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x96:   /* STMDB rn!, rlist^ */
+          cpu_case(arm_op, 0x96):   /* STMDB rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, true, true, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x9E:   /* STMIB rn!, rlist^ */
+          cpu_case(arm_op, 0x9E):   /* STMIB rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccStore, true, true, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
@@ -2962,84 +3359,84 @@ arm_loop:
 
           /* LDM instructions: LDMDA, LDMIA, LDMDB, LDMIB */
 
-          case 0x81:   /* LDMDA rn, rlist */
+          cpu_case(arm_op, 0x81):   /* LDMDA rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, false, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x89:   /* LDMIA rn, rlist */
+          cpu_case(arm_op, 0x89):   /* LDMIA rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, false, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x91:   /* LDMDB rn, rlist */
+          cpu_case(arm_op, 0x91):   /* LDMDB rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, false, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x99:   /* LDMIB rn, rlist */
+          cpu_case(arm_op, 0x99):   /* LDMIB rn, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, false, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
 
-          case 0x83:   /* LDMDA rn!, rlist */
+          cpu_case(arm_op, 0x83):   /* LDMDA rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, false, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x8B:   /* LDMIA rn!, rlist */
+          cpu_case(arm_op, 0x8B):   /* LDMIA rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, false, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x93:   /* LDMDB rn!, rlist */
+          cpu_case(arm_op, 0x93):   /* LDMDB rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, false, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
-          case 0x9B:   /* LDMIB rn!, rlist */
+          cpu_case(arm_op, 0x9B):   /* LDMIB rn!, rlist */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, false, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             break;
 
-          case 0x85:   /* LDMDA rn, rlist^ */
+          cpu_case(arm_op, 0x85):   /* LDMDA rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, true, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x8D:   /* LDMIA rn, rlist^ */
+          cpu_case(arm_op, 0x8D):   /* LDMIA rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, true, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x95:   /* LDMDB rn, rlist^ */
+          cpu_case(arm_op, 0x95):   /* LDMDB rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, true, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x9D:   /* LDMIB rn, rlist^ */
+          cpu_case(arm_op, 0x9D):   /* LDMIB rn, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, false, true, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
 
-          case 0x87:   /* LDMDA rn!, rlist^ */
+          cpu_case(arm_op, 0x87):   /* LDMDA rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, true, AddrPostDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x8F:   /* LDMIA rn!, rlist^ */
+          cpu_case(arm_op, 0x8F):   /* LDMIA rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, true, AddrPostInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x97:   /* LDMDB rn!, rlist^ */
+          cpu_case(arm_op, 0x97):   /* LDMDB rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, true, AddrPreDec>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
-          case 0x9F:   /* LDMIB rn!, rlist^ */
+          cpu_case(arm_op, 0x9F):   /* LDMIB rn!, rlist^ */
             cpu_alert |= exec_arm_block_mem<AccLoad, true, true, AddrPreInc>(
               (opcode >> 16) & 0x0F, opcode & 0xFFFF, cycles_remaining);
             arm_spsr_restore_ldm_check();
             break;
 
 
-          case 0xA0 ... 0xAF:
+          cpu_case_range(arm_op, 0xA0, 0xAF):
              {
                 /* B offset */
                 arm_decode_branch();
@@ -3048,7 +3445,7 @@ arm_loop:
                 break;
              }
 
-          case 0xB0 ... 0xBF:
+          cpu_case_range(arm_op, 0xB0, 0xBF):
              {
                 /* BL offset */
                 arm_decode_branch();
@@ -3059,12 +3456,12 @@ arm_loop:
              }
 
 #ifdef HAVE_UNUSED
-          case 0xC0 ... 0xEF:
+          cpu_case_range(arm_op, 0xC0, 0xEF):
              /* coprocessor instructions, reserved on GBA */
              break;
 #endif
 
-          case 0xF0 ... 0xFF:
+          cpu_case_range(arm_op, 0xF0, 0xFF):
             collapse_flags();
             reg[REG_BUS_VALUE] = 0xe3a02004;  // After SWI, we read bios[0xE4]
             REG_MODE(MODE_SUPERVISOR)[6] = reg[REG_PC] + 4;
@@ -3091,15 +3488,24 @@ skip_instruction:
     collapse_flags();
     update_ret = update_gba(cycles_remaining);
     if (completed_frame(update_ret))
-       return;
+       return update_ret;
     cycles_remaining = cycles_to_run(update_ret);
+    if (single_slice)
+       return cycles_remaining;
     continue;
 
     do
     {
 thumb_loop:
 
-       collapse_flags();
+#ifdef THREADED_JIT
+       /* The translated block is ready, resume translated execution */
+       if (reg[REG_PC] == interpreter_resume_pc)
+       {
+          collapse_flags();
+          return MAX(cycles_remaining, 0);
+       }
+#endif
 
        /* Process cheats if we are about to execute the cheat hook */
        if (reg[REG_PC] == cheat_master_hook)
@@ -3110,74 +3516,79 @@ thumb_loop:
        using_instruction(thumb);
        check_pc_region();
        reg[REG_PC] &= ~0x01;
-       opcode = readaddress16(pc_address_block, (reg[REG_PC] & 0x7FFF));
+       fetch_instruction(thumb, 16, reg[REG_PC] + 1);
 
        #ifdef TRACE_INSTRUCTIONS
+       collapse_flags();
        interp_trace_instruction(reg[REG_PC], 0);
        #endif
 
+#ifdef CPU_COMPUTED_GOTO
+       goto *handler;
+#endif
+
        switch((opcode >> 8) & 0xFF)
        {
-          case 0x00 ... 0x07:
+          cpu_case_range(thumb_op, 0x00, 0x07):
              /* LSL rd, rs, offset */
              thumb_shift(shift, lsl, imm);
              break;
 
-          case 0x08 ... 0x0F:
+          cpu_case_range(thumb_op, 0x08, 0x0F):
              /* LSR rd, rs, offset */
              thumb_shift(shift, lsr, imm);
              break;
 
-          case 0x10 ... 0x17:
+          cpu_case_range(thumb_op, 0x10, 0x17):
              /* ASR rd, rs, offset */
              thumb_shift(shift, asr, imm);
              break;
 
-          case 0x18:
-          case 0x19:
+          cpu_case(thumb_op, 0x18):
+          cpu_case(thumb_op, 0x19):
              /* ADD rd, rs, rn */
              thumb_add(add_sub, rd, reg[rs], reg[rn], 0);
              break;
 
-          case 0x1A:
-          case 0x1B:
+          cpu_case(thumb_op, 0x1A):
+          cpu_case(thumb_op, 0x1B):
              /* SUB rd, rs, rn */
              thumb_sub(add_sub, rd, reg[rs], reg[rn], 1);
              break;
 
-          case 0x1C:
-          case 0x1D:
+          cpu_case(thumb_op, 0x1C):
+          cpu_case(thumb_op, 0x1D):
              /* ADD rd, rs, imm */
              thumb_add(add_sub_imm, rd, reg[rs], imm, 0);
              break;
 
-          case 0x1E:
-          case 0x1F:
+          cpu_case(thumb_op, 0x1E):
+          cpu_case(thumb_op, 0x1F):
              /* SUB rd, rs, imm */
              thumb_sub(add_sub_imm, rd, reg[rs], imm, 1);
              break;
 
-          case 0x20 ... 0x27:
+          cpu_case_range(thumb_op, 0x20, 0x27):
              /* MOV r0..7, imm */
              thumb_logic(imm, ((opcode >> 8) & 7), imm);
              break;
 
-          case 0x28 ... 0x2F:
+          cpu_case_range(thumb_op, 0x28, 0x2F):
              /* CMP r0..7, imm */
              thumb_test_sub(imm, reg[(opcode >> 8) & 7], imm);
              break;
 
-          case 0x30 ... 0x37:
+          cpu_case_range(thumb_op, 0x30, 0x37):
              /* ADD r0..7, imm */
              thumb_add(imm, ((opcode >> 8) & 7), reg[(opcode >> 8) & 7], imm, 0);
              break;
 
-          case 0x38 ... 0x3F:
+          cpu_case_range(thumb_op, 0x38, 0x3F):
              /* SUB r0..7, imm */
              thumb_sub(imm, ((opcode >> 8) & 7), reg[(opcode >> 8) & 7], imm, 1);
              break;
 
-          case 0x40:
+          cpu_case(thumb_op, 0x40):
              switch((opcode >> 6) & 0x03)
              {
                 case 0x00:
@@ -3202,7 +3613,7 @@ thumb_loop:
              }
              break;
 
-          case 0x41:
+          cpu_case(thumb_op, 0x41):
              switch((opcode >> 6) & 0x03)
              {
                 case 0x00:
@@ -3227,7 +3638,7 @@ thumb_loop:
              }
              break;
 
-          case 0x42:
+          cpu_case(thumb_op, 0x42):
              switch((opcode >> 6) & 0x03)
              {
                 case 0x00:
@@ -3252,7 +3663,7 @@ thumb_loop:
              }
              break;
 
-          case 0x43:
+          cpu_case(thumb_op, 0x43):
              switch((opcode >> 6) & 0x03)
              {
                 case 0x00:
@@ -3277,12 +3688,12 @@ thumb_loop:
              }
              break;
 
-          case 0x44:
+          cpu_case(thumb_op, 0x44):
              /* ADD rd, rs */
              thumb_hireg_op(reg[rd] + reg[rs]);
              break;
 
-          case 0x45:
+          cpu_case(thumb_op, 0x45):
              /* CMP rd, rs */
              {
                 thumb_pc_offset(4);
@@ -3295,12 +3706,12 @@ thumb_loop:
              }
              break;
 
-          case 0x46:
+          cpu_case(thumb_op, 0x46):
              /* MOV rd, rs */
              thumb_hireg_op(reg[rs]);
              break;
 
-          case 0x47:
+          cpu_case(thumb_op, 0x47):
              /* BX rs */
              {
                 thumb_decode_hireg_op();
@@ -3322,113 +3733,113 @@ thumb_loop:
              }
              break;
 
-          case 0x48 ... 0x4F:
+          cpu_case_range(thumb_op, 0x48, 0x4F):
              /* LDR r0..7, [pc + imm] */
              thumb_access_memory(load, imm, ((reg[REG_PC] - 2) & ~2) + (imm * 4) + 4, reg[(opcode >> 8) & 7], u32);
              break;
 
-          case 0x50:
-          case 0x51:
+          cpu_case(thumb_op, 0x50):
+          cpu_case(thumb_op, 0x51):
              /* STR rd, [rb + ro] */
              thumb_access_memory(store, mem_reg, reg[rb] + reg[ro], reg[rd], u32);
              break;
 
-          case 0x52:
-          case 0x53:
+          cpu_case(thumb_op, 0x52):
+          cpu_case(thumb_op, 0x53):
              /* STRH rd, [rb + ro] */
              thumb_access_memory(store, mem_reg, reg[rb] + reg[ro], reg[rd], u16);
              break;
 
-          case 0x54:
-          case 0x55:
+          cpu_case(thumb_op, 0x54):
+          cpu_case(thumb_op, 0x55):
              /* STRB rd, [rb + ro] */
              thumb_access_memory(store, mem_reg, reg[rb] + reg[ro], reg[rd], u8);
              break;
 
-          case 0x56:
-          case 0x57:
+          cpu_case(thumb_op, 0x56):
+          cpu_case(thumb_op, 0x57):
              /* LDSB rd, [rb + ro] */
              thumb_access_memory(load, mem_reg, reg[rb] + reg[ro], reg[rd], s8);
              break;
 
-          case 0x58:
-          case 0x59:
+          cpu_case(thumb_op, 0x58):
+          cpu_case(thumb_op, 0x59):
              /* LDR rd, [rb + ro] */
              thumb_access_memory(load, mem_reg, reg[rb] + reg[ro], reg[rd], u32);
              break;
 
-          case 0x5A:
-          case 0x5B:
+          cpu_case(thumb_op, 0x5A):
+          cpu_case(thumb_op, 0x5B):
              /* LDRH rd, [rb + ro] */
              thumb_access_memory(load, mem_reg, reg[rb] + reg[ro], reg[rd], u16);
              break;
 
-          case 0x5C:
-          case 0x5D:
+          cpu_case(thumb_op, 0x5C):
+          cpu_case(thumb_op, 0x5D):
              /* LDRB rd, [rb + ro] */
              thumb_access_memory(load, mem_reg, reg[rb] + reg[ro], reg[rd], u8);
              break;
 
-          case 0x5E:
-          case 0x5F:
+          cpu_case(thumb_op, 0x5E):
+          cpu_case(thumb_op, 0x5F):
              /* LDSH rd, [rb + ro] */
              thumb_access_memory(load, mem_reg, reg[rb] + reg[ro], reg[rd], s16);
              break;
 
-          case 0x60 ... 0x67:
+          cpu_case_range(thumb_op, 0x60, 0x67):
              /* STR rd, [rb + imm] */
              thumb_access_memory(store, mem_imm, reg[rb] + (imm * 4), reg[rd], u32);
              break;
 
-          case 0x68 ... 0x6F:
+          cpu_case_range(thumb_op, 0x68, 0x6F):
              /* LDR rd, [rb + imm] */
              thumb_access_memory(load, mem_imm, reg[rb] + (imm * 4), reg[rd], u32);
              break;
 
-          case 0x70 ... 0x77:
+          cpu_case_range(thumb_op, 0x70, 0x77):
              /* STRB rd, [rb + imm] */
              thumb_access_memory(store, mem_imm, reg[rb] + imm, reg[rd], u8);
              break;
 
-          case 0x78 ... 0x7F:
+          cpu_case_range(thumb_op, 0x78, 0x7F):
              /* LDRB rd, [rb + imm] */
              thumb_access_memory(load, mem_imm, reg[rb] + imm, reg[rd], u8);
              break;
 
-          case 0x80 ... 0x87:
+          cpu_case_range(thumb_op, 0x80, 0x87):
              /* STRH rd, [rb + imm] */
              thumb_access_memory(store, mem_imm, reg[rb] + (imm * 2), reg[rd], u16);
              break;
 
-          case 0x88 ... 0x8F:
+          cpu_case_range(thumb_op, 0x88, 0x8F):
              /* LDRH rd, [rb + imm] */
              thumb_access_memory(load, mem_imm, reg[rb] + (imm * 2), reg[rd], u16);
              break;
 
-          case 0x90 ... 0x97:
+          cpu_case_range(thumb_op, 0x90, 0x97):
              /* STR r0..7, [sp + imm] */
              thumb_access_memory(store, imm, reg[REG_SP] + (imm * 4), reg[(opcode >> 8) & 7], u32);
              break;
 
-          case 0x98 ... 0x9F:
+          cpu_case_range(thumb_op, 0x98, 0x9F):
              /* LDR r0..7, [sp + imm] */
              thumb_access_memory(load, imm, reg[REG_SP] + (imm * 4), reg[(opcode >> 8) & 7], u32);
              break;
 
-          case 0xA0 ... 0xA7:
+          cpu_case_range(thumb_op, 0xA0, 0xA7):
              /* ADD r0..7, pc, +imm */
              thumb_add_noflags(imm, ((opcode >> 8) & 7), (reg[REG_PC] & ~2) + 4, (imm * 4));
              break;
 
-          case 0xA8 ... 0xAF:
+          cpu_case_range(thumb_op, 0xA8, 0xAF):
              /* ADD r0..7, sp, +imm */
              thumb_add_noflags(imm, ((opcode >> 8) & 7), reg[REG_SP], (imm * 4));
              break;
 
-          case 0xB0:
-          case 0xB1:
-          case 0xB2:
-          case 0xB3:
+          cpu_case(thumb_op, 0xB0):
+          cpu_case(thumb_op, 0xB1):
+          cpu_case(thumb_op, 0xB2):
+          cpu_case(thumb_op, 0xB3):
              if((opcode >> 7) & 0x01)
              {
                 /* ADD sp, -imm */
@@ -3441,80 +3852,80 @@ thumb_loop:
              }
              break;
 
-          case 0xB4:  /* PUSH rlist */
+          cpu_case(thumb_op, 0xB4):  /* PUSH rlist */
              cpu_alert |= exec_thumb_block_mem<AccStore, AddrPreDec>(
                REG_SP, opcode & 0xFF, cycles_remaining);
              break;
 
-          case 0xB5:  /* PUSH rlist, lr */
+          cpu_case(thumb_op, 0xB5):  /* PUSH rlist, lr */
              cpu_alert |= exec_thumb_block_mem<AccStore, AddrPreDec>(
                REG_SP, (opcode & 0xFF) | (1 << REG_LR), cycles_remaining);
              break;
 
-          case 0xBC:  /* POP rlist */
+          cpu_case(thumb_op, 0xBC):  /* POP rlist */
              cpu_alert |= exec_thumb_block_mem<AccLoad, AddrPostInc>(
                REG_SP, opcode & 0xFF, cycles_remaining);
              break;
 
-          case 0xBD:  /* POP rlist, pc */
+          cpu_case(thumb_op, 0xBD):  /* POP rlist, pc */
              cpu_alert |= exec_thumb_block_mem<AccLoad, AddrPostInc>(
                REG_SP, (opcode & 0xFF) | (1 << REG_PC), cycles_remaining);
              break;
 
-          case 0xC0 ... 0xC7:    /* STMIA r0..7!, rlist */
+          cpu_case_range(thumb_op, 0xC0, 0xC7):    /* STMIA r0..7!, rlist */
              cpu_alert |= exec_thumb_block_mem<AccStore, AddrPostInc>(
                (opcode >> 8) & 7, (opcode & 0xFF), cycles_remaining);
              break;
 
-          case 0xC8 ... 0xCF:    /* LDMIA r0..7!, rlist */
+          cpu_case_range(thumb_op, 0xC8, 0xCF):    /* LDMIA r0..7!, rlist */
              cpu_alert |= exec_thumb_block_mem<AccLoad, AddrPostInc>(
                (opcode >> 8) & 7, (opcode & 0xFF), cycles_remaining);
              break;
 
-          case 0xD0:   /* BEQ label */
+          cpu_case(thumb_op, 0xD0):   /* BEQ label */
              thumb_conditional_branch(z_flag == 1);
              break;
-          case 0xD1:   /* BNE label */
+          cpu_case(thumb_op, 0xD1):   /* BNE label */
              thumb_conditional_branch(z_flag == 0);
              break;
-          case 0xD2:   /* BCS label */
+          cpu_case(thumb_op, 0xD2):   /* BCS label */
              thumb_conditional_branch(c_flag == 1);
              break;
-          case 0xD3:   /* BCC label */
+          cpu_case(thumb_op, 0xD3):   /* BCC label */
              thumb_conditional_branch(c_flag == 0);
              break;
-          case 0xD4:   /* BMI label */
+          cpu_case(thumb_op, 0xD4):   /* BMI label */
              thumb_conditional_branch(n_flag == 1);
              break;
-          case 0xD5:   /* BPL label */
+          cpu_case(thumb_op, 0xD5):   /* BPL label */
              thumb_conditional_branch(n_flag == 0);
              break;
-          case 0xD6:   /* BVS label */
+          cpu_case(thumb_op, 0xD6):   /* BVS label */
              thumb_conditional_branch(v_flag == 1);
              break;
-          case 0xD7:   /* BVC label */
+          cpu_case(thumb_op, 0xD7):   /* BVC label */
              thumb_conditional_branch(v_flag == 0);
              break;
-          case 0xD8:   /* BHI label */
+          cpu_case(thumb_op, 0xD8):   /* BHI label */
              thumb_conditional_branch(c_flag & (z_flag ^ 1));
              break;
-          case 0xD9:   /* BLS label */
+          cpu_case(thumb_op, 0xD9):   /* BLS label */
              thumb_conditional_branch((c_flag == 0) | z_flag);
              break;
-          case 0xDA:   /* BGE label */
+          cpu_case(thumb_op, 0xDA):   /* BGE label */
              thumb_conditional_branch(n_flag == v_flag);
              break;
-          case 0xDB:   /* BLT label */
+          cpu_case(thumb_op, 0xDB):   /* BLT label */
              thumb_conditional_branch(n_flag != v_flag);
              break;
-          case 0xDC:   /* BGT label */
+          cpu_case(thumb_op, 0xDC):   /* BGT label */
              thumb_conditional_branch((z_flag == 0) & (n_flag == v_flag));
              break;
-          case 0xDD:   /* BLE label */
+          cpu_case(thumb_op, 0xDD):   /* BLE label */
              thumb_conditional_branch(z_flag | (n_flag != v_flag));
              break;
 
-          case 0xDF:
+          cpu_case(thumb_op, 0xDF):
              collapse_flags();
              REG_MODE(MODE_SUPERVISOR)[6] = reg[REG_PC] + 2;
              REG_SPSR(MODE_SUPERVISOR) = reg[REG_CPSR];
@@ -3526,7 +3937,7 @@ thumb_loop:
              goto arm_loop;
              break;
 
-          case 0xE0 ... 0xE7:
+          cpu_case_range(thumb_op, 0xE0, 0xE7):
              {
                 /* B label */
                 thumb_decode_branch();
@@ -3536,7 +3947,7 @@ thumb_loop:
                 break;
              }
 
-          case 0xF0 ... 0xF7:
+          cpu_case_range(thumb_op, 0xF0, 0xF7):
              {
                 /* (low word) BL label */
                 thumb_decode_branch();
@@ -3545,7 +3956,7 @@ thumb_loop:
                 break;
              }
 
-          case 0xF8 ... 0xFF:
+          cpu_case_range(thumb_op, 0xF8, 0xFF):
              {
                 /* (high word) BL label */
                 thumb_decode_branch();
@@ -3558,6 +3969,10 @@ thumb_loop:
              }
        }
 
+#ifdef CPU_COMPUTED_GOTO
+thumb_instruction_done:
+#endif
+
        /* End of Execute THUMB instruction */
        cycles_remaining -= ws_cyc_seq[(reg[REG_PC] >> 24) & 0xF][0];
 
@@ -3571,8 +3986,10 @@ thumb_loop:
     collapse_flags();
     update_ret = update_gba(cycles_remaining);
     if (completed_frame(update_ret))
-       return;
+       return update_ret;
     cycles_remaining = cycles_to_run(update_ret);
+    if (single_slice)
+       return cycles_remaining;
     continue;
 
     alert:
@@ -3581,6 +3998,16 @@ thumb_loop:
   }
 }
 
+void execute_arm(u32 cycles)
+{
+  execute_arm_loop(cycles, false);
+}
+
+u32 execute_arm_slice(u32 cycles)
+{
+  return execute_arm_loop(cycles, true);
+}
+
 void init_cpu(void)
 {
   // Initialize CPU registers
@@ -3610,6 +4037,9 @@ void init_cpu(void)
   REG_MODE(MODE_IRQ)[5] = 0x03007FA0;
   REG_MODE(MODE_FIQ)[5] = 0x03007FA0;
   REG_MODE(MODE_SUPERVISOR)[5] = 0x03007FE0;
+
+  // A different gamepak (or BIOS) might have been loaded
+  flush_decode_cache();
 }
 
 bool cpu_check_savestate(const u8 *src)
@@ -3628,6 +4058,8 @@ bool cpu_check_savestate(const u8 *src)
 bool cpu_read_savestate(const u8 *src)
 {
   const u8 *cpudoc = bson_find_key(src, "cpu");
+  // RAM is replaced as well
+  flush_decode_cache();
   return bson_read_int32(cpudoc, "bus-value", &reg[REG_BUS_VALUE]) &&
          bson_read_int32_array(cpudoc, "regs", reg, REG_ARCH_COUNT) &&
          bson_read_int32_array(cpudoc, "spsr", spsr, 6) &&
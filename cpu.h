@@ -107,9 +107,10 @@ typedef enum
   REG_MAX           = 64
 } ext_reg_numbers;
 
-extern u32 instruction_count;
+extern instance_local u32 instruction_count;
 
 void execute_arm(u32 cycles);
+u32 execute_arm_slice(u32 cycles);
 u32 check_and_raise_interrupts(void);
 cpu_alert_type check_interrupt(void);
 cpu_alert_type flag_interrupt(irq_type irq_raised);
@@ -134,6 +135,10 @@ bool cpu_read_savestate(const u8 *src);
 u8 function_cc *block_lookup_address_arm(u32 pc);
 u8 function_cc *block_lookup_address_thumb(u32 pc);
 u8 function_cc *block_lookup_address_dual(u32 pc);
+u8 *block_link_address_arm(u32 pc, u8 *branch_source, u8 *link_stub);
+u8 *block_link_address_thumb(u32 pc, u8 *branch_source, u8 *link_stub);
+u8 *block_trace_hot_arm(u32 pc, u8 *block_entry, u8 *block_body);
+u8 *block_trace_hot_thumb(u32 pc, u8 *block_entry, u8 *block_body);
 bool translate_block_arm(u32 pc, bool ram_region);
 bool translate_block_thumb(u32 pc, bool ram_region);
 
@@ -158,15 +163,55 @@ extern u8 *ram_translation_ptr;
 
 #define MAX_TRANSLATION_GATES 16
 
-extern u32 idle_loop_target_pc;
-extern u32 translation_gate_targets;
-extern u32 translation_gate_target_pc[MAX_TRANSLATION_GATES];
+extern instance_local u32 idle_loop_target_pc;
+extern instance_local u32 translation_gate_targets;
+extern instance_local u32 translation_gate_target_pc[MAX_TRANSLATION_GATES];
 
-extern u32 rom_branch_hash[ROM_BRANCH_HASH_SIZE];
+typedef struct
+{
+  u32 pc_value;   // PC of the block (bit 0 set for Thumb)
+  u32 offset;     // Offset of the block in the ROM cache, 0 if unused
+} rom_branch_entry_type;
+
+extern rom_branch_entry_type rom_branch_hash[ROM_BRANCH_HASH_SIZE];
+
+// RAM code pages: EWRAM and IWRAM are split in 256 byte pages (EWRAM ones
+// first), each with a bit that is set while the page holds translated code.
+#define RAM_CODE_PAGE_SHIFT   8
+#define RAM_CODE_PAGE_COUNT   ((0x40000 + 0x8000) >> RAM_CODE_PAGE_SHIFT)
+
+extern u32 ram_code_pages[RAM_CODE_PAGE_COUNT / 32];
 
 void partial_flush_ram_full(u32 address);
 void partial_flush_ram_full_dma(u32 address);
+bool invalidate_ram_code(u32 address, u32 size);
+#ifdef HAVE_DYNAREC
+// Called after writing size bytes of RAM at address: invalidates the blocks
+// that covered them. Returns whether there was any.
+static inline bool ram_code_written(u32 address, u32 size)
+{
+  u32 page;
+  if ((address >> 24) == 0x02)
+    page = (address & 0x3FFFF) >> RAM_CODE_PAGE_SHIFT;
+  else if ((address >> 24) == 0x03)
+    page = (0x40000 + (address & 0x7FFF)) >> RAM_CODE_PAGE_SHIFT;
+  else
+    return false;
+
+  if (!(ram_code_pages[page / 32] & (1U << (page % 32))))
+    return false;
+  return invalidate_ram_code(address, size);
+}
+
+void invalidate_decode_cache_page(u32 page);
+void flush_decode_cache_ram(void);
+#else
+// No RAM is ever tagged as translated code, there's nothing to flush
+#define partial_flush_ram_full_dma(address)
+#define ram_code_written(address, size) false
+#endif
 void flush_translation_cache_rom(void);
+void evict_translation_cache_rom(void);
 void flush_translation_cache_ram(void);
 void dump_translation_cache(void);
 void init_dynarec_caches(void);
@@ -174,8 +219,60 @@ void flush_dynarec_caches(void);
 void init_emitter(bool);
 void init_bios_hooks(void);
 
-extern u32 reg_mode[7][7];
-extern u32 spsr[6];
+extern char rom_translation_cache_filename[512];
+
+void rom_cache_add_reloc(u8 *site);
+bool load_rom_translation_cache(void);
+bool save_rom_translation_cache(void);
+void precompile_rom_translation_cache(u32 time_budget_ms);
+
+#ifdef THREADED_JIT
+extern volatile u32 interpreter_resume_pc;
+
+bool start_translation_thread(void);
+void stop_translation_thread(void);
+bool resume_translation_thread(void);
+void pause_translation_thread(void);
+#endif
+
+#ifdef BLOCK_PROFILE_ANALYZE
+// Per translated block statistics (see cpu_instrument.h). Blocks are keyed
+// by GBA PC, retranslating a block keeps accumulating on the same entry.
+typedef struct
+{
+  u64 executions;
+  u32 pc;
+  u32 thumb;
+  u32 instructions;
+  u32 cycles;
+  u32 host_size;
+  u32 translations;
+} block_profile_type;
+
+typedef enum
+{
+  BLOCK_PROFILE_FLUSH_RAM,
+  BLOCK_PROFILE_FLUSH_ROM,
+  BLOCK_PROFILE_EVICT_ROM,
+  BLOCK_PROFILE_FLUSH_TYPES
+} block_profile_flush_type;
+
+extern u32 block_profile_flushes[BLOCK_PROFILE_FLUSH_TYPES];
+
+block_profile_type *block_profile_add(u32 pc, u32 thumb);
+void print_block_profile(void);
+
+#define STATS_BLOCK_FLUSH(type)                                               \
+  block_profile_flushes[BLOCK_PROFILE_##type]++                               \
+
+#else
+
+#define STATS_BLOCK_FLUSH(type)
+
+#endif
+
+extern instance_local u32 reg_mode[7][7];
+extern instance_local u32 spsr[6];
 
 extern const u32 cpu_modes[16];
 extern const u32 cpsr_masks[4][2];
@@ -136,3 +136,107 @@
   }
 #endif
 
+
+#ifdef BLOCK_PROFILE_ANALYZE
+  // Counts how many times each translated block is entered. The dynarec
+  // emits the counter increment at the start of every block, so branches
+  // within a block are not counted. Cycles are estimated from the number of
+  // instructions and the sequential access time of the block's region.
+
+  #define BLOCK_PROFILE_SIZE    65536
+  #define BLOCK_PROFILE_REPORT  64
+
+  block_profile_type block_profile[BLOCK_PROFILE_SIZE];
+  u32 block_profile_flushes[BLOCK_PROFILE_FLUSH_TYPES];
+  u32 block_profile_dropped = 0;
+
+  block_profile_type *block_profile_add(u32 pc, u32 thumb)
+  {
+    u32 hash = (((pc | thumb) * 2654435761U) >> 16) & (BLOCK_PROFILE_SIZE - 1);
+    u32 i;
+
+    for(i = 0; i < BLOCK_PROFILE_SIZE; i++)
+    {
+      block_profile_type *entry =
+       &block_profile[(hash + i) & (BLOCK_PROFILE_SIZE - 1)];
+
+      if(!entry->translations)
+      {
+        entry->pc = pc;
+        entry->thumb = thumb;
+      }
+
+      if((entry->pc == pc) && (entry->thumb == thumb))
+      {
+        entry->translations++;
+        return entry;
+      }
+    }
+
+    block_profile_dropped++;
+    return NULL;
+  }
+
+  static u64 block_profile_cycles(const block_profile_type *entry)
+  {
+    return entry->executions * entry->cycles;
+  }
+
+  static int sort_block_profile(const void *_a, const void *_b)
+  {
+    u64 a = block_profile_cycles(*(const block_profile_type **)_a);
+    u64 b = block_profile_cycles(*(const block_profile_type **)_b);
+
+    return (a < b) - (a > b);
+  }
+
+  void print_block_profile(void)
+  {
+    block_profile_type **sorted;
+    u64 executions_total = 0;
+    u64 cycles_total = 0;
+    u32 count = 0;
+    u32 i;
+
+    sorted = (block_profile_type **)malloc(
+     BLOCK_PROFILE_SIZE * sizeof(block_profile_type *));
+    if(!sorted)
+      return;
+
+    for(i = 0; i < BLOCK_PROFILE_SIZE; i++)
+    {
+      if(block_profile[i].translations)
+      {
+        sorted[count++] = &block_profile[i];
+        executions_total += block_profile[i].executions;
+        cycles_total += block_profile_cycles(&block_profile[i]);
+      }
+    }
+
+    qsort(sorted, count, sizeof(block_profile_type *), sort_block_profile);
+
+    printf("Block profile: %u blocks (%u not tracked), %llu executions, "
+     "%llu cycles\n", count, block_profile_dropped,
+     (unsigned long long)executions_total, (unsigned long long)cycles_total);
+    printf("Flushes: %u RAM, %u ROM, %u ROM segment evictions\n",
+     block_profile_flushes[BLOCK_PROFILE_FLUSH_RAM],
+     block_profile_flushes[BLOCK_PROFILE_FLUSH_ROM],
+     block_profile_flushes[BLOCK_PROFILE_EVICT_ROM]);
+    printf("      pc  mode    executions  insns  bytes  xlat  cycles\n");
+
+    for(i = 0; i < MIN(count, BLOCK_PROFILE_REPORT); i++)
+    {
+      block_profile_type *entry = sorted[i];
+
+      printf("%08x %5s %13llu %6u %6u %5u %6.2lf%%\n", entry->pc,
+       entry->thumb ? "thumb" : "arm",
+       (unsigned long long)entry->executions, entry->instructions,
+       entry->host_size, entry->translations,
+       cycles_total ? (block_profile_cycles(entry) * 100.0) / cycles_total :
+       0.0);
+    }
+
+    free(sorted);
+  }
+
+#endif  /* BLOCK_PROFILE_ANALYZE */
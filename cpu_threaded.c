@@ -22,6 +22,14 @@
 // - block memory needs psr swapping and user mode reg swapping
 
 #include "common.h"
+#ifdef PSP_STANDALONE
+  #include "psp/psp_wrapper.h"
+#else
+  #include "streams/file_stream.h"
+#endif
+#ifdef THREADED_JIT
+  #include <pthread.h>
+#endif
 #if defined(VITA)
 #include <psp2/kernel/sysmem.h>
 #include <stdio.h>
@@ -64,27 +72,191 @@ u32 rom_cache_watermark = INITIAL_ROM_WATERMARK;
 
 u8 *bios_swi_entrypoint = NULL;
 
-// Contains an offset table to rom_translation cache area
-// It features a chaining linked list for collisions
-// The rom area has a small header section that contains:
-//  - PC value for the entry
-//  - Offset to the next entry (if any)
+// ROM blocks are found through an open addressing hash table (with linear
+// probing) that holds the PC (with the Thumb bit) and the offset of the
+// block in rom_translation cache side by side, so that lookups never have to
+// touch the translated code. Empty entries have a zero offset (the cache
+// starts with the watermark). The table is never allowed to fill up more
+// than 3/4, a segment gets evicted instead.
+rom_branch_entry_type rom_branch_hash[ROM_BRANCH_HASH_SIZE];
+static u32 rom_branch_hash_count = 0;
+
+#define ROM_BRANCH_HASH_MAX_COUNT (ROM_BRANCH_HASH_SIZE / 4 * 3)
+
+#define rom_branch_hash_slot(key)                                             \
+  (((key) * 2654435761U) >> (32 - ROM_BRANCH_HASH_BITS))                      \
+
+// Blocks are added to the hash once complete. With the translation thread
+// the translated code might be looking them up at the same time, so the
+// offset (which marks the entry as used) is written last.
+#ifdef THREADED_JIT
+  #define rom_branch_hash_publish(addr, offset)                               \
+    __atomic_store_n(addr, offset, __ATOMIC_RELEASE)
+  #define rom_branch_hash_read(addr)                                          \
+    __atomic_load_n(addr, __ATOMIC_ACQUIRE)
+#else
+  #define rom_branch_hash_publish(addr, offset)                               \
+    *(addr) = (offset)
+  #define rom_branch_hash_read(addr)                                          \
+    *(addr)
+#endif
+
+// Returns the offset of the block, or 0 if it was not translated yet
+static u32 rom_branch_hash_find(u32 key)
+{
+  u32 i = rom_branch_hash_slot(key);
+  u32 blk_offset;
+
+  while ((blk_offset = rom_branch_hash_read(&rom_branch_hash[i].offset)))
+  {
+    if (rom_branch_hash[i].pc_value == key)
+      return blk_offset;
+    i = (i + 1) & (ROM_BRANCH_HASH_SIZE - 1);
+  }
+  return 0;
+}
+
+static void rom_branch_hash_insert(u32 key, u32 blk_offset)
+{
+  u32 i = rom_branch_hash_slot(key);
+
+  while (rom_branch_hash[i].offset)
+    i = (i + 1) & (ROM_BRANCH_HASH_SIZE - 1);
+
+  rom_branch_hash[i].pc_value = key;
+  rom_branch_hash_publish(&rom_branch_hash[i].offset, blk_offset);
+  rom_branch_hash_count++;
+}
+
+// Empties an entry, moving back the entries probed after it that would no
+// longer be found otherwise (there are no tombstones).
+static void rom_branch_hash_remove(u32 i)
+{
+  u32 j = i;
+
+  while (1)
+  {
+    u32 slot;
+
+    j = (j + 1) & (ROM_BRANCH_HASH_SIZE - 1);
+    if (!rom_branch_hash[j].offset)
+      break;
+
+    // Entries whose slot lies cyclically in (i, j] stay where they are
+    slot = rom_branch_hash_slot(rom_branch_hash[j].pc_value);
+    if ((i <= j) ? ((slot <= i) || (slot > j)) : ((slot <= i) && (slot > j)))
+    {
+      rom_branch_hash[i] = rom_branch_hash[j];
+      i = j;
+    }
+  }
+
+  rom_branch_hash[i].offset = 0;
+  rom_branch_hash_count--;
+}
+
+static void rom_branch_hash_clear(void)
+{
+  memset(rom_branch_hash, 0, sizeof(rom_branch_hash));
+  rom_branch_hash_count = 0;
+}
+
+// Block exits that got linked to a ROM block living in another part of the
+// translation cache (a RAM block or a different ROM cache segment). They
+// must be unlinked (pointed back to their link stub) when the target gets
+// evicted or flushed, since the exit might outlive it.
 typedef struct
 {
-  u32 pc_value;
-  u32 next_entry;
-} hashhdr_type;
+  u8 *branch_source;
+  u8 *link_stub;
+  u8 *target;
+} block_link_type;
+
+#define MAX_BLOCK_LINKS 16384
+
+block_link_type block_links[MAX_BLOCK_LINKS];
+u32 block_link_count = 0;
+
+// ROM cache segments: the one being filled, the end of the translated code
+// in each segment (offsets) and a decaying count of the executions of its
+// blocks (bumped by the block prologues) to pick a victim.
+u32 rom_cache_segment = 0;
+u32 rom_cache_segment_top[ROM_TRANSLATION_CACHE_SEGMENTS];
+u64 rom_cache_segment_execs[ROM_TRANSLATION_CACHE_SEGMENTS];
+
+// Bumped on every cache flush, so that a pending link can tell whether
+// the exit it wants to patch is still there.
+u32 translation_flush_count = 0;
+
+// Offsets (within the ROM cache) of the emitted code that refers to memory
+// outside of the translation cache. Backends that can persist the ROM cache
+// define rom_cache_relocate() to fix these up when the cache is loaded at
+// a different address.
+char rom_translation_cache_filename[512];
+u32 *rom_cache_relocs = NULL;
+u32 rom_cache_reloc_count = 0;
+u32 rom_cache_reloc_capacity = 0;
+
+void rom_cache_add_reloc(u8 *site)
+{
+  u32 offset = (u32)(site - rom_translation_cache);
+  if (!rom_translation_cache_filename[0] ||
+      site < rom_translation_cache ||
+      offset >= ROM_TRANSLATION_CACHE_SIZE)
+    return;
+
+  if (rom_cache_reloc_count == rom_cache_reloc_capacity)
+  {
+    u32 capacity = rom_cache_reloc_capacity ?
+                   rom_cache_reloc_capacity * 2 : 4096;
+    u32 *relocs = realloc(rom_cache_relocs, capacity * sizeof(u32));
+    if (!relocs)
+    {
+      // Out of memory: the cache can no longer be persisted.
+      rom_translation_cache_filename[0] = 0;
+      return;
+    }
+    rom_cache_relocs = relocs;
+    rom_cache_reloc_capacity = capacity;
+  }
+  rom_cache_relocs[rom_cache_reloc_count++] = offset;
+}
+
+// Drops the relocations of code that was discarded, that is everything
+// from offset to the end of the segment being filled (always the most
+// recently recorded ones).
+static void rom_cache_truncate_relocs(u32 offset, u32 end)
+{
+  while (rom_cache_reloc_count &&
+         rom_cache_relocs[rom_cache_reloc_count - 1] >= offset &&
+         rom_cache_relocs[rom_cache_reloc_count - 1] < end)
+    rom_cache_reloc_count--;
+}
 
-u32 rom_branch_hash[ROM_BRANCH_HASH_SIZE];
+// Drops the relocations of an evicted range of the cache
+static void rom_cache_drop_relocs(u32 start, u32 end)
+{
+  u32 i, j;
+  for (i = 0, j = 0; i < rom_cache_reloc_count; i++)
+  {
+    if (rom_cache_relocs[i] < start || rom_cache_relocs[i] >= end)
+      rom_cache_relocs[j++] = rom_cache_relocs[i];
+  }
+  rom_cache_reloc_count = j;
+}
 
 typedef struct
 {
   u8 *block_offset;
+  u32 const_value;  // Value of a load folded into a constant (see below)
   u16 flag_data;
   u8 condition;
   u8 update_cycles;
+  u8 const_reg;     // Destination of the folded load, or NO_CONST_LOAD
 } block_data_type;
 
+#define NO_CONST_LOAD 0xFF
+
 typedef struct
 {
   u32 branch_target;
@@ -224,6 +396,46 @@ extern const u8 bit_count[256];
   #include "x86/x86_emit.h"
 #endif
 
+/* Emitters that can link block exits lazily provide a link stub. For the
+   rest, exits that are not linked at translation time simply go through
+   the regular block lookup. */
+#ifdef generate_branch_link_stub
+  #define lazy_block_linking 1
+#else
+  #define lazy_block_linking 0
+  #define generate_branch_link_stub(type, branch_source, target_pc)           \
+  {                                                                           \
+    u32 pc = target_pc;                                                       \
+    generate_branch_patch_unconditional(branch_source, translation_ptr);      \
+    generate_translation_gate(type);                                          \
+  }
+#endif
+
+/* Evicting a single segment requires unlinking the exits that jump into it,
+   so without link stubs the whole ROM cache is flushed at once. */
+#if lazy_block_linking
+  #define rom_cache_segments ROM_TRANSLATION_CACHE_SEGMENTS
+#else
+  #define rom_cache_segments 1
+#endif
+
+#define rom_cache_segment_size                                                \
+  (ROM_TRANSLATION_CACHE_SIZE / rom_cache_segments)
+
+#define rom_cache_segment_of(offset)                                          \
+  MIN((offset) / rom_cache_segment_size, rom_cache_segments - 1)
+
+static u32 rom_cache_segment_start(u32 segment)
+{
+  return segment ? segment * rom_cache_segment_size : rom_cache_watermark;
+}
+
+static u32 rom_cache_segment_end(u32 segment)
+{
+  return (segment == rom_cache_segments - 1) ?
+    ROM_TRANSLATION_CACHE_SIZE : (segment + 1) * rom_cache_segment_size;
+}
+
 /* Cache invalidation */
 
 #if defined(PSP)
@@ -272,6 +484,210 @@ void translate_icache_sync() {
 
 /* End of Cache invalidation */
 
+/* Linux perf support: every translated block is described to perf so that
+   samples inside the translation caches resolve to the GBA code they come
+   from. Set GPSP_PERF_MAP=map to write /tmp/perf-<pid>.map (read directly
+   by perf report), or GPSP_PERF_MAP=jitdump to write /tmp/jit-<pid>.dump
+   (to be merged with "perf record -k 1" + "perf inject --jit"). The map
+   format has no notion of time, so once a cache gets flushed its entries
+   overlap with those of the blocks translated afterwards: use the jitdump
+   format when caches are flushed often, since perf inject orders the code
+   loads by timestamp and reused addresses resolve correctly. */
+
+#ifdef PERF_JIT_MAP
+
+#include <elf.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define JITDUMP_MAGIC         0x4A695444
+#define JITDUMP_VERSION       1
+#define JITDUMP_CODE_LOAD     0
+
+#if defined(MIPS_ARCH)
+  #define JITDUMP_ELF_MACH    EM_MIPS
+#elif defined(ARM_ARCH)
+  #define JITDUMP_ELF_MACH    EM_ARM
+#elif defined(ARM64_ARCH)
+  #define JITDUMP_ELF_MACH    EM_AARCH64
+#elif defined(__x86_64__)
+  #define JITDUMP_ELF_MACH    EM_X86_64
+#else
+  #define JITDUMP_ELF_MACH    EM_386
+#endif
+
+typedef struct
+{
+  u32 magic;
+  u32 version;
+  u32 total_size;
+  u32 elf_mach;
+  u32 pad1;
+  u32 pid;
+  u64 timestamp;
+  u64 flags;
+} jitdump_header_type;
+
+typedef struct
+{
+  u32 id;
+  u32 total_size;
+  u64 timestamp;
+  u32 pid;
+  u32 tid;
+  u64 vma;
+  u64 code_addr;
+  u64 code_size;
+  u64 code_index;
+} jitdump_code_load_type;
+
+typedef enum
+{
+  PERF_MAP_UNCHECKED,
+  PERF_MAP_DISABLED,
+  PERF_MAP_TEXT,
+  PERF_MAP_JITDUMP
+} perf_map_mode_type;
+
+static perf_map_mode_type perf_map_mode = PERF_MAP_UNCHECKED;
+static FILE *perf_map_file = NULL;
+static u64 perf_map_code_index = 0;
+
+static u64 perf_map_timestamp(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool perf_map_open(void)
+{
+  const char *mode = getenv("GPSP_PERF_MAP");
+  char filename[64];
+
+  perf_map_mode = PERF_MAP_DISABLED;
+  if (!mode || !mode[0])
+    return false;
+
+  if (!strcmp(mode, "jitdump"))
+  {
+    jitdump_header_type hdr;
+
+    snprintf(filename, sizeof(filename), "/tmp/jit-%d.dump", (int)getpid());
+    perf_map_file = fopen(filename, "w+b");
+    if (!perf_map_file)
+      return false;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = JITDUMP_MAGIC;
+    hdr.version = JITDUMP_VERSION;
+    hdr.total_size = sizeof(hdr);
+    hdr.elf_mach = JITDUMP_ELF_MACH;
+    hdr.pid = getpid();
+    hdr.timestamp = perf_map_timestamp();
+    fwrite(&hdr, sizeof(hdr), 1, perf_map_file);
+    fflush(perf_map_file);
+
+    /* perf record finds the dump through this (executable) mapping */
+    if (mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE,
+             fileno(perf_map_file), 0) == MAP_FAILED)
+    {
+      fclose(perf_map_file);
+      perf_map_file = NULL;
+      return false;
+    }
+    perf_map_mode = PERF_MAP_JITDUMP;
+  }
+  else
+  {
+    snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int)getpid());
+    perf_map_file = fopen(filename, "w");
+    if (!perf_map_file)
+      return false;
+    perf_map_mode = PERF_MAP_TEXT;
+  }
+  return true;
+}
+
+static void perf_map_record_block(u8 *start, u8 *end, u32 pc, u32 thumb)
+{
+  char name[32];
+
+  if (perf_map_mode == PERF_MAP_UNCHECKED)
+    perf_map_open();
+  if (!perf_map_file || end <= start)
+    return;
+
+  snprintf(name, sizeof(name), "gba_%s_%08x", thumb ? "thumb" : "arm", pc);
+
+  if (perf_map_mode == PERF_MAP_JITDUMP)
+  {
+    jitdump_code_load_type rec;
+    u32 name_size = strlen(name) + 1;
+
+    rec.id = JITDUMP_CODE_LOAD;
+    rec.total_size = sizeof(rec) + name_size + (end - start);
+    rec.timestamp = perf_map_timestamp();
+    rec.pid = getpid();
+    rec.tid = syscall(SYS_gettid);
+    rec.vma = rec.code_addr = (uintptr_t)start;
+    rec.code_size = end - start;
+    rec.code_index = perf_map_code_index++;
+
+    /* Blocks might be translated by the translation thread too */
+    flockfile(perf_map_file);
+    fwrite(&rec, sizeof(rec), 1, perf_map_file);
+    fwrite(name, name_size, 1, perf_map_file);
+    fwrite(start, end - start, 1, perf_map_file);
+    funlockfile(perf_map_file);
+  }
+  else
+  {
+    fprintf(perf_map_file, "%lx %lx %s\n", (unsigned long)(uintptr_t)start,
+            (unsigned long)(end - start), name);
+  }
+
+  /* The emulator is rarely shut down cleanly when profiling */
+  fflush(perf_map_file);
+}
+
+#else
+
+#define perf_map_record_block(start, end, pc, thumb)
+
+#endif
+
+/* Per block execution counters, reported by print_block_profile */
+#ifdef BLOCK_PROFILE_ANALYZE
+
+#ifndef generate_block_profile_counter
+  #error "Block profiling is not supported by this dynarec backend"
+#endif
+
+#define block_profile_start(thumb)                                            \
+  block_profile_type *block_profile_entry =                                   \
+   block_profile_add(block_start_pc, thumb);                                  \
+  if(block_profile_entry)                                                     \
+    generate_block_profile_counter(&block_profile_entry->executions)          \
+
+#define block_profile_finish(type, start)                                     \
+  if(block_profile_entry)                                                     \
+  {                                                                           \
+    block_profile_entry->instructions = block_data_position;                  \
+    block_profile_entry->cycles = block_profile_entry->instructions *         \
+     def_seq_cycles[block_start_pc >> 24][type##_instruction_width == 4];     \
+    block_profile_entry->host_size = translation_ptr - (start);               \
+  }                                                                           \
+
+#else
+
+#define block_profile_start(thumb)
+#define block_profile_finish(type, start)
+
+#endif
+
 
 #define check_pc_region(pc)                                                   \
   new_pc_region = (pc >> 15);                                                 \
@@ -285,6 +701,7 @@ void translate_icache_sync() {
   }                                                                           \
 
 #define translate_arm_instruction()                                           \
+  flag_status = block_data[block_data_position].flag_data;                    \
   check_pc_region(pc);                                                        \
   opcode = address32(pc_address_block, (pc & 0x7FFF));                        \
   condition = block_data[block_data_position].condition;                      \
@@ -302,6 +719,14 @@ void translate_icache_sync() {
   }                                                                           \
   emit_trace_arm_instruction(pc);                                             \
                                                                               \
+  if(block_data[block_data_position].const_reg != NO_CONST_LOAD)              \
+  {                                                                           \
+    /* Load from a known ROM address, folded into a constant */               \
+    cycle_count += 2;                                                         \
+    arm_load_const(block_data[block_data_position].const_reg,                 \
+     block_data[block_data_position].const_value);                            \
+  }                                                                           \
+  else                                                                        \
   switch((opcode >> 20) & 0xFF)                                               \
   {                                                                           \
     case 0x00:                                                                \
@@ -1743,6 +2168,8 @@ void translate_icache_sync() {
   pc += 4                                                                     \
 
 #define arm_flag_status()                                                     \
+  block_data[block_data_position].flag_data =                                 \
+   arm_flag_data(opcode, condition)                                           \
 
 #define translate_thumb_instruction()                                         \
   flag_status = block_data[block_data_position].flag_data;                    \
@@ -1752,6 +2179,14 @@ void translate_icache_sync() {
   emit_trace_thumb_instruction(pc);                                           \
   u8 hiop = opcode >> 8;                                                      \
                                                                               \
+  if(block_data[block_data_position].const_reg != NO_CONST_LOAD)              \
+  {                                                                           \
+    /* Load from a known ROM address, folded into a constant */               \
+    cycle_count += 2;                                                         \
+    thumb_load_pc_pool_const(block_data[block_data_position].const_reg,       \
+     block_data[block_data_position].const_value);                            \
+  }                                                                           \
+  else                                                                        \
   switch(hiop)                                                                \
   {                                                                           \
     case 0x00 ... 0x07:                                                       \
@@ -1952,17 +2387,12 @@ void translate_icache_sync() {
                                                                               \
     case 0x48 ... 0x4F:                                                       \
       /* LDR r0..7, [pc + imm] */                                             \
+      /* (ROM literal pools are folded into constants, see above) */          \
       {                                                                       \
         thumb_decode_imm();                                                   \
         u32 rdreg = (hiop & 7);                                               \
         u32 aoff = (pc & ~2) + (imm*4) + 4;                                   \
-        /* ROM + same page -> optimize as const load */                       \
-        if (!ram_region && (((aoff + 4) >> 15) == (pc >> 15))) {              \
-          u32 value = address32(pc_address_block, (aoff & 0x7FFF));           \
-          thumb_load_pc_pool_const(rdreg, value);                             \
-        } else {                                                              \
-          thumb_access_memory(load, imm, rdreg, 0, 0, pc_relative, aoff, u32);\
-        }                                                                     \
+        thumb_access_memory(load, imm, rdreg, 0, 0, pc_relative, aoff, u32);  \
       }                                                                       \
       break;                                                                  \
                                                                               \
@@ -2533,6 +2963,185 @@ inline static ramtag_type* get_ram_tag(u16 tagval) {
   return &tbl[tgidx >> 1];  /* Since LSB is always 1 and thus unused */
 }
 
+// RAM code pages
+// IWRAM and EWRAM are split in 256 byte pages (EWRAM pages first, followed by
+// the IWRAM ones). Pages holding (part of) a translated block have their bit
+// set in ram_code_pages and keep a list of the blocks overlapping them, along
+// with the bytes of the page each block covers. A write to a page with its
+// bit set only invalidates the blocks covering the written bytes, which get
+// retranslated on their next lookup, instead of flushing the whole RAM cache.
+// A block spanning several pages has a node in each of them, linked in a
+// ring so that they are all dropped together.
+#define RAM_CODE_MAX_NODES    8192
+
+typedef struct
+{
+  u16 tag;            // Tag of the block (see above)
+  u16 next;           // Next node of the page list (index + 1, 0 ends it)
+  u16 sibling;        // Next node of the same block (index + 1, ring)
+  u16 page;           // Page the node is listed in
+  u8 first;           // First and last byte of the page covered by the block
+  u8 last;
+  u8 thumb;           // Thumb block (the tag is shared with the ARM one)
+  u8 unused;
+} ram_code_node_type;
+
+// The x86 stubs test the bitmap themselves, it is laid out along with the
+// rest of the data they address through the base register (see x86_stub.S)
+#ifndef X86_ARCH
+u32 ram_code_pages[RAM_CODE_PAGE_COUNT / 32];
+#endif
+static u16 ram_code_page_list[RAM_CODE_PAGE_COUNT];
+static ram_code_node_type ram_code_nodes[RAM_CODE_MAX_NODES];
+static u32 ram_code_node_count = 0;
+static u16 ram_code_node_free = 0;
+
+// Offset of the address within the (EWRAM + IWRAM) page space
+static u32 ram_code_offset(u32 address)
+{
+  if (address >= 0x3000000)
+    return 0x40000 + (address & 0x7FFF);
+  return address & 0x3FFFF;
+}
+
+static void ram_code_reset_pages(void)
+{
+  // The interpreter cached RAM instructions are tracked in the pages too
+  flush_decode_cache_ram();
+  memset(ram_code_pages, 0, sizeof(ram_code_pages));
+  memset(ram_code_page_list, 0, sizeof(ram_code_page_list));
+  ram_code_node_count = 0;
+  ram_code_node_free = 0;
+}
+
+// Records a freshly translated RAM block in the pages it overlaps. Returns
+// false if there's no room left, the RAM cache must be flushed then.
+static bool ram_code_register_block(u32 block_start_pc, u32 block_end_pc,
+                                    u8 thumb)
+{
+  u32 region_end = (block_start_pc >= 0x3000000) ? 0x48000 : 0x40000;
+  u32 first = ram_code_offset(block_start_pc);
+  u32 last = MIN(first + (block_end_pc - block_start_pc), region_end) - 1;
+  u16 tag = (block_start_pc >= 0x3000000) ?
+    address16(iwram, block_start_pc & 0x7FFF) :
+    address16(ewram, (block_start_pc & 0x3FFFF) + 0x40000);
+  u16 first_index = 0, prev_index = 0;
+  u32 page;
+
+  for (page = first >> RAM_CODE_PAGE_SHIFT;
+       page <= (last >> RAM_CODE_PAGE_SHIFT); page++)
+  {
+    ram_code_node_type *node;
+    u16 index = ram_code_node_free;
+
+    if (index)
+      ram_code_node_free = ram_code_nodes[index - 1].next;
+    else if (ram_code_node_count < RAM_CODE_MAX_NODES)
+      index = ++ram_code_node_count;
+    else
+      return false;
+
+    if (prev_index)
+      ram_code_nodes[prev_index - 1].sibling = index;
+    else
+      first_index = index;
+    prev_index = index;
+
+    node = &ram_code_nodes[index - 1];
+    node->tag = tag;
+    node->thumb = thumb;
+    node->sibling = first_index;
+    node->page = page;
+    node->first = (page == (first >> RAM_CODE_PAGE_SHIFT)) ? first & 0xFF : 0;
+    node->last = (page == (last >> RAM_CODE_PAGE_SHIFT)) ? last & 0xFF : 0xFF;
+    node->next = ram_code_page_list[page];
+    ram_code_page_list[page] = index;
+    ram_code_pages[page / 32] |= 1U << (page % 32);
+  }
+  return true;
+}
+
+// Removes a node from its page list and frees it
+static void ram_code_unlink_node(u16 index)
+{
+  ram_code_node_type *node = &ram_code_nodes[index - 1];
+  u32 page = node->page;
+  u16 *link = &ram_code_page_list[page];
+
+  while (*link != index)
+    link = &ram_code_nodes[*link - 1].next;
+  *link = node->next;
+
+  if (!ram_code_page_list[page])
+    ram_code_pages[page / 32] &= ~(1U << (page % 32));
+
+  node->next = ram_code_node_free;
+  ram_code_node_free = index;
+}
+
+// Called when size bytes at address are written to: invalidates the blocks
+// that cover them and returns whether there was any. The tags of the word
+// are cleared too, since no valid block covers it anymore (so that further
+// writes to it are not caught by the backends that check the tags).
+bool invalidate_ram_code(u32 address, u32 size)
+{
+  u32 offset = ram_code_offset(address) & ~(size - 1);
+  u32 page = offset >> RAM_CODE_PAGE_SHIFT;
+  u32 first = offset & 0xFF;
+  u32 last = first + size - 1;
+  bool invalidated = false;
+
+  if (ram_code_pages[page / 32] & (1U << (page % 32)))
+  {
+    u16 *link = &ram_code_page_list[page];
+
+    while (*link)
+    {
+      u16 index = *link;
+      ram_code_node_type *node = &ram_code_nodes[index - 1];
+
+      if (node->first <= last && node->last >= first)
+      {
+        ramtag_type *trentry = get_ram_tag(node->tag);
+        u16 sibling;
+
+        if (node->thumb)
+          trentry->offset_thumb = 1;
+        else
+          trentry->offset_arm = 1;
+        invalidated = true;
+
+        // The nodes of the block in the other pages go as well (they are
+        // never listed in this page)
+        for (sibling = node->sibling; sibling != index;)
+        {
+          u16 next_sibling = ram_code_nodes[sibling - 1].sibling;
+          ram_code_unlink_node(sibling);
+          sibling = next_sibling;
+        }
+
+        *link = node->next;
+        node->next = ram_code_node_free;
+        ram_code_node_free = index;
+      }
+      else
+        link = &node->next;
+    }
+
+    if (!ram_code_page_list[page])
+      ram_code_pages[page / 32] &= ~(1U << (page % 32));
+    invalidate_decode_cache_page(page);
+  }
+
+  offset &= ~3U;
+  if (address >= 0x3000000)
+    address32(iwram, offset - 0x40000) = 0;
+  else
+    address32(ewram, offset + 0x40000) = 0;
+
+  return invalidated;
+}
+
 // This function will return a pointer to a translated block of code. If it
 // doesn't exist it will translate it, if it does it will pass it back.
 
@@ -2595,36 +3204,36 @@ u8 function_cc *block_lookup_translate_##type(u32 pc)                         \
     case 0x8 ... 0xD:                                                         \
     {                                                                         \
       u32 key = pc | thumb;                                                   \
-      u32 hash_target = ((key * 2654435761U) >> (32 - ROM_BRANCH_HASH_BITS))  \
-                                              & (ROM_BRANCH_HASH_SIZE - 1);   \
+      u32 blk_offset = rom_branch_hash_find(key);                             \
                                                                               \
-      hashhdr_type *bhdr;                                                     \
-      u32 blk_offset = rom_branch_hash[hash_target];                          \
-      u32 *blk_offset_addr = &rom_branch_hash[hash_target];                   \
-      while(blk_offset)                                                       \
-      {                                                                       \
-        bhdr = (hashhdr_type*)&rom_translation_cache[blk_offset];             \
-        if(bhdr->pc_value == key)                                             \
-          return &rom_translation_cache[                                      \
-                  blk_offset + sizeof(hashhdr_type) + block_prologue_size];   \
+      if(blk_offset)                                                          \
+        return &rom_translation_cache[blk_offset + block_prologue_size];      \
                                                                               \
-        blk_offset = bhdr->next_entry;                                        \
-        blk_offset_addr = &bhdr->next_entry;                                  \
+      if(rom_branch_hash_count >= ROM_BRANCH_HASH_MAX_COUNT)                  \
+      {                                                                       \
+        /* Make room in the hash table, the caller retries */                 \
+        evict_translation_cache_rom();                                        \
+        return NULL;                                                          \
       }                                                                       \
                                                                               \
       { /* Not found, go ahead and translate, and backfill the hash table */  \
         u8 *blkptr;                                                           \
         bool result;                                                          \
-        bhdr = (hashhdr_type*)rom_translation_ptr;                            \
-        bhdr->pc_value = key;                                                 \
-        bhdr->next_entry = 0;                                                 \
-        *blk_offset_addr = (u32)(rom_translation_ptr - rom_translation_cache);\
-        rom_translation_ptr += sizeof(hashhdr_type);                          \
+        blk_offset = (u32)(rom_translation_ptr - rom_translation_cache);      \
+        /* Exits translated right away might lead back to this block */       \
+        if (!lazy_block_linking)                                              \
+          rom_branch_hash_insert(key, blk_offset);                            \
         blkptr = rom_translation_ptr + block_prologue_size;                   \
         result = translate_block_##type(pc, false);                           \
                                                                               \
         if (result)                                                           \
+        {                                                                     \
+          /* Otherwise it is only published once complete, so that it is     \
+             never found half translated (see the translation thread) */      \
+          if (lazy_block_linking)                                             \
+            rom_branch_hash_insert(key, blk_offset);                          \
           return blkptr;                                                      \
+        }                                                                     \
       }                                                                       \
       return NULL;                                                            \
     }                                                                         \
@@ -2654,9 +3263,18 @@ u8 function_cc *block_lookup_address_dual(u32 pc)
   }
 }
 
+#ifdef THREADED_JIT
+static bool translation_thread_enabled = false;
+static u8 *block_lookup_address_async(u32 pc, u32 thumb);
+#endif
+
 u8 function_cc *block_lookup_address_arm(u32 pc)
 {
   unsigned i;
+#ifdef THREADED_JIT
+  if (translation_thread_enabled)
+    return block_lookup_address_async(pc, 0);
+#endif
   for (i = 0; i < 4; i++) {
     u8 *ret = block_lookup_translate_arm(pc);
     if (ret) {
@@ -2673,6 +3291,10 @@ u8 function_cc *block_lookup_address_arm(u32 pc)
 u8 function_cc *block_lookup_address_thumb(u32 pc)
 {
   unsigned i;
+#ifdef THREADED_JIT
+  if (translation_thread_enabled)
+    return block_lookup_address_async(pc, 1);
+#endif
   for (i = 0; i < 4; i++) {
     u8 *ret = block_lookup_translate_thumb(pc);
     if (ret) {
@@ -2686,6 +3308,69 @@ u8 function_cc *block_lookup_address_thumb(u32 pc)
 }
 
 
+static void block_link_exit(u8 *branch_source, u8 *link_stub, u8 *target)
+{
+  u32 target_offset = (u32)(target - rom_translation_cache);
+
+  // Only ROM blocks are linked, RAM blocks can be retranslated at any time
+  if (target < rom_translation_cache ||
+      target >= rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE)
+    return;
+
+  // Anything below the watermark is never evicted
+  if (target_offset >= rom_cache_watermark)
+  {
+    u32 target_segment = rom_cache_segment_of(target_offset);
+    bool record = true;
+
+    if (branch_source >= rom_translation_cache &&
+        branch_source < rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE)
+    {
+      u32 source_offset = (u32)(branch_source - rom_translation_cache);
+
+      // Would outlive its target (below the watermark)
+      if (source_offset < rom_cache_watermark)
+        return;
+
+      // Blocks within the same segment are evicted together
+      record = rom_cache_segment_of(source_offset) != target_segment;
+    }
+
+    if (record)
+    {
+      if (block_link_count == MAX_BLOCK_LINKS)
+        return;
+      block_links[block_link_count].branch_source = branch_source;
+      block_links[block_link_count].link_stub = link_stub;
+      block_links[block_link_count].target = target;
+      block_link_count++;
+    }
+  }
+
+  generate_branch_patch_unconditional(branch_source, target);
+  platform_cache_sync(branch_source, branch_source + 4);
+}
+
+// Called by the link stub of a block exit that was not linked at
+// translation time. Looks the target up (translating it if needed) and
+// patches the exit to jump there directly if possible.
+#define block_link_address_builder(type)                                      \
+u8 *block_link_address_##type(u32 pc, u8 *branch_source, u8 *link_stub)      \
+{                                                                             \
+  u32 flush_count = translation_flush_count;                                  \
+  u8 *target = block_lookup_address_##type(pc);                               \
+                                                                              \
+  /* The lookup might have flushed the cache the exit lives in */             \
+  if (target && flush_count == translation_flush_count)                       \
+    block_link_exit(branch_source, link_stub, target);                        \
+                                                                              \
+  return target;                                                              \
+}                                                                             \
+
+block_link_address_builder(arm);
+block_link_address_builder(thumb);
+
+
 // Potential exit point: If the rd field is pc for instructions is 0x0F,
 // the instruction is b/bl/bx, or the instruction is ldm with PC in the
 // register list.
@@ -2780,11 +3465,22 @@ u8 function_cc *block_lookup_address_thumb(u32 pc)
 #define arm_base_cycles()                                                     \
   cycle_count += def_seq_cycles[pc >> 24][1]                                  \
 
-// For now this just sets a variable that says flags should always be
-// computed.
+// Same liveness analysis as the Thumb one below, arm_flag_data provides the
+// masks (exit points need all the flags, the destination is unknown).
 
 #define arm_dead_flag_eliminate()                                             \
-  flag_status = 0xF                                                           \
+{                                                                             \
+  u32 needed_mask = 0xff;                                                     \
+                                                                              \
+  while(--block_data_position >= 0)                                           \
+  {                                                                           \
+    flag_status = block_data[block_data_position].flag_data;                  \
+    block_data[block_data_position].flag_data =                               \
+     (flag_status & needed_mask);                                             \
+    needed_mask &= ~((flag_status >> 4) & 0x0F);                              \
+    needed_mask |= flag_status >> 8;                                          \
+  }                                                                           \
+}                                                                             \
 
 // The following Thumb instructions can exit:
 // b, bl, bx, swi, pop {... pc}, and mov pc, ..., the latter being a hireg
@@ -2900,6 +3596,23 @@ u8 function_cc *block_lookup_address_thumb(u32 pc)
 
 block_data_type block_data[MAX_BLOCK_SIZE];
 
+#define smc_write_arm_no()                                                    \
+
+#define smc_write_thumb_no()                                                  \
+
+#ifdef SMC_CHECK_CODE_PAGES
+// The backend catches writes to code through the RAM code pages, only the
+// tags at the start of the blocks are needed (to look them up)
+#define smc_write_arm_yes()                                                   \
+
+#define smc_write_thumb_yes()                                                 \
+
+#define arm_ub()                                                              \
+
+#define thumb_ub()                                                            \
+
+#else
+
 #define smc_write_arm_yes() {                                                 \
   intptr_t offset = (pc < 0x03000000) ? 0x40000 : -0x8000;                    \
   if(address32(pc_address_block, (block_end_pc & 0x7FFF) + offset) == 0)      \
@@ -2917,10 +3630,6 @@ block_data_type block_data[MAX_BLOCK_SIZE];
       CODE_TAG_BLOCK16;                                                       \
   }                                                                           \
 }
-#define smc_write_arm_no()                                                    \
-
-#define smc_write_thumb_no()                                                  \
-
 #define arm_ub() {                                          \
   intptr_t offset = (pc < 0x03000000) ? 0x40000 : -0x8000;                    \
   intptr_t mask = 0x7FFF;                 \
@@ -2936,6 +3645,7 @@ block_data_type block_data[MAX_BLOCK_SIZE];
     address16(pc_address_block, ((block_end_pc - 2)  & mask) + offset) =           \
       UB_16;                                                       \
 }
+#endif
 
 /*
  * Inserts Value into a sorted Array of unique values (or doesn't), of
@@ -2997,32 +3707,832 @@ static s32 BinarySearch(u32* Array, u32 Value, u32 Size)
 		return -1;
 }
 
-#define scan_block(type, smc_write_op)                                        \
-{                                                                             \
-  __label__ block_end;                                                        \
-  u8 continue_block = 1;                                                      \
-  u32 branch_targets_sorted[MAX_EXITS];                                       \
-  u32 sorted_branch_count = 0;                                                \
-  /* Find the end of the block */                                             \
-  do                                                                          \
-  {                                                                           \
-    check_pc_region(block_end_pc);                                            \
-    type##_load_opcode();                                                     \
-    smc_write_##type##_##smc_write_op();                                      \
-    type##_flag_status();                                                     \
+// Idle loop detection: a short loop that only reads memory (ie. polls
+// VCOUNT, IF or a variable set by an interrupt handler) and computes on the
+// values it just loaded can only exit once some hardware event happens, so
+// its branch skips straight to the next event (like idle_loop_target_pc).
+// The body can't have stores, branches, conditional instructions or values
+// carried from one iteration to the next.
+
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8
+
+// Registers are bits 0 to 15, flags are bits 16 (V) to 19 (N)
+#define IDLE_LOOP_FLAG_V  (1 << 16)
+#define IDLE_LOOP_FLAG_C  (1 << 17)
+#define IDLE_LOOP_FLAG_Z  (1 << 18)
+#define IDLE_LOOP_FLAG_N  (1 << 19)
+#define IDLE_LOOP_FLAGS   (0xF << 16)
+
+// Flags read by each condition code
+static const u8 condition_read_flags[16] =
+{
+  0x4, 0x4, 0x2, 0x2, 0x8, 0x8, 0x1, 0x1,   // EQ, NE, CS, CC, MI, PL, VS, VC
+  0x6, 0x6, 0x9, 0x9, 0xD, 0xD, 0x0, 0x0    // HI, LS, GE, LT, GT, LE, AL, NV
+};
+
+typedef struct
+{
+  u32 read_first;   // Read before being written in the same iteration
+  u32 written;      // Always written
+  u32 clobbered;    // Possibly written
+} idle_loop_state;
+
+static void idle_loop_access(idle_loop_state *st, u32 reads, u32 writes,
+ u32 clobbers)
+{
+  st->read_first |= reads & ~st->written;
+  st->written |= writes;
+  st->clobbered |= writes | clobbers;
+}
+
+// Data processing with S set: arithmetic ops write all the flags, logical
+// ones might leave C untouched (depends on the shift).
+#define idle_loop_data_proc_flags(op)                                         \
+  ((((op) >= 2 && (op) <= 7) || (op) == 10 || (op) == 11) ?                   \
+    IDLE_LOOP_FLAGS : (IDLE_LOOP_FLAG_N | IDLE_LOOP_FLAG_Z))                  \
+
+static bool arm_idle_loop_opcode(u32 opcode, idle_loop_state *st)
+{
+  u32 rn = (opcode >> 16) & 0x0F;
+  u32 rd = (opcode >> 12) & 0x0F;
+  u32 rm = opcode & 0x0F;
+  u32 reads = 0, writes = 0, clobbers = 0;
+  u32 op = (opcode >> 21) & 0x0F;
+
+  if ((opcode >> 28) != 0x0E)
+    return false;
+
+  switch ((opcode >> 25) & 0x07)
+  {
+    case 0x0:
+      if ((opcode & 0x90) == 0x90)
+      {
+        // Halfword/signed loads, pre-indexed with no writeback
+        if (!(opcode & 0x60) || (opcode & 0x01300000) != 0x01100000 ||
+            rd == 15)
+          return false;
+        reads = (1 << rn) | ((opcode & 0x00400000) ? 0 : (1 << rm));
+        writes = 1 << rd;
+        break;
+      }
+
+      // Register operand, shifted by a register or an immediate (RRX)
+      reads = 1 << rm;
+      if (opcode & 0x10)
+        reads |= 1 << ((opcode >> 8) & 0x0F);
+      else if ((opcode & 0xFE0) == 0x060)
+        reads |= IDLE_LOOP_FLAG_C;
+      /* fallthrough */
+
+    case 0x1:
+      // tst/teq/cmp/cmn without S are PSR transfers or bx
+      if (op >= 8 && op <= 11 && !(opcode & 0x00100000))
+        return false;
+      if (op == 5 || op == 6 || op == 7)
+        reads |= IDLE_LOOP_FLAG_C;
+      if (op != 13 && op != 15)
+        reads |= 1 << rn;
+      if (op < 8 || op > 11)
+      {
+        if (rd == 15)
+          return false;
+        writes |= 1 << rd;
+      }
+      if (opcode & 0x00100000)
+      {
+        writes |= idle_loop_data_proc_flags(op);
+        clobbers |= IDLE_LOOP_FLAG_C;
+      }
+      break;
+
+    case 0x2:
+    case 0x3:
+      // Loads, pre-indexed with no writeback
+      if ((opcode & 0x01300000) != 0x01100000 || rd == 15 ||
+          (opcode & 0x02000010) == 0x02000010)
+        return false;
+      reads = 1 << rn;
+      if (opcode & 0x02000000)
+      {
+        reads |= 1 << rm;
+        if ((opcode & 0xFE0) == 0x060)
+          reads |= IDLE_LOOP_FLAG_C;
+      }
+      writes = 1 << rd;
+      break;
+
+    default:
+      return false;
+  }
+
+  idle_loop_access(st, reads, writes, clobbers);
+  return true;
+}
+
+static bool thumb_idle_loop_opcode(u32 opcode, idle_loop_state *st)
+{
+  u32 rd = opcode & 0x07;
+  u32 rs = (opcode >> 3) & 0x07;
+  u32 rn = (opcode >> 6) & 0x07;
+  u32 rd8 = (opcode >> 8) & 0x07;
+  u32 reads = 0, writes = 0, clobbers = 0;
+
+  switch (opcode >> 11)
+  {
+    case 0x00 ... 0x02:   // lsl/lsr/asr rd, rs, imm
+      reads = 1 << rs;
+      writes = (1 << rd) | IDLE_LOOP_FLAG_N | IDLE_LOOP_FLAG_Z;
+      clobbers = IDLE_LOOP_FLAG_C;
+      break;
+
+    case 0x03:            // add/sub rd, rs, rn/imm
+      reads = (1 << rs) | ((opcode & 0x400) ? 0 : (1 << rn));
+      writes = (1 << rd) | IDLE_LOOP_FLAGS;
+      break;
+
+    case 0x04:            // mov rd, imm
+      writes = (1 << rd8) | IDLE_LOOP_FLAG_N | IDLE_LOOP_FLAG_Z;
+      break;
+
+    case 0x05:            // cmp rd, imm
+      reads = 1 << rd8;
+      writes = IDLE_LOOP_FLAGS;
+      break;
+
+    case 0x06 ... 0x07:   // add/sub rd, imm
+      reads = 1 << rd8;
+      writes = (1 << rd8) | IDLE_LOOP_FLAGS;
+      break;
+
+    case 0x08:
+      if (opcode < 0x4400)
+      {
+        // ALU operations
+        u32 op = (opcode >> 6) & 0x0F;
+        if (op == 0x5 || op == 0x6)   // adc, sbc
+          return false;
+        reads = 1 << rs;
+        if (op != 0x9 && op != 0xF)   // neg, mvn
+          reads |= 1 << rd;
+        if (op != 0x8 && op != 0xA && op != 0xB)   // tst, cmp, cmn
+          writes = 1 << rd;
+        if (op == 0x9 || op == 0xA || op == 0xB)
+          writes |= IDLE_LOOP_FLAGS;
+        else
+        {
+          writes |= IDLE_LOOP_FLAG_N | IDLE_LOOP_FLAG_Z;
+          clobbers = IDLE_LOOP_FLAG_C;
+        }
+      }
+      else
+      {
+        // Hi register operations (no bx nor writes to the PC)
+        u32 hrd = rd | ((opcode >> 4) & 0x08);
+        u32 hrs = (opcode >> 3) & 0x0F;
+        switch ((opcode >> 8) & 0x03)
+        {
+          case 0x0: reads = (1 << hrd) | (1 << hrs); writes = 1 << hrd; break;
+          case 0x1: reads = (1 << hrd) | (1 << hrs); writes = IDLE_LOOP_FLAGS; break;
+          case 0x2: reads = 1 << hrs; writes = 1 << hrd; break;
+          default: return false;
+        }
+        if (writes & (1 << 15))
+          return false;
+      }
+      break;
+
+    case 0x09:            // ldr rd, [pc, imm]
+      reads = 1 << 15;
+      writes = 1 << rd8;
+      break;
+
+    case 0x0A ... 0x0B:   // loads with register offset
+      if ((opcode & 0x0E00) == 0x0000 || (opcode & 0x0E00) == 0x0400 ||
+          (opcode & 0x0E00) == 0x0200)   // str, strb, strh
+        return false;
+      reads = (1 << rs) | (1 << rn);
+      writes = 1 << rd;
+      break;
+
+    case 0x0D:            // ldr rd, [rs, imm]
+    case 0x0F:            // ldrb rd, [rs, imm]
+    case 0x11:            // ldrh rd, [rs, imm]
+      reads = 1 << rs;
+      writes = 1 << rd;
+      break;
+
+    case 0x13:            // ldr rd, [sp, imm]
+      reads = 1 << 13;
+      writes = 1 << rd8;
+      break;
+
+    case 0x14 ... 0x15:   // add rd, pc/sp, imm
+      reads = (opcode & 0x0800) ? (1 << 13) : (1 << 15);
+      writes = 1 << rd8;
+      break;
+
+    default:
+      return false;
+  }
+
+  idle_loop_access(st, reads, writes, clobbers);
+  return true;
+}
+
+// Checks whether the loop from target_pc to the branch at branch_pc (which
+// reads the given flags) is idle. Both must lie within the same 32KB page.
+#define idle_loop_detect_builder(type, width, addressfn)                      \
+static bool type##_idle_loop(u8 *pc_address_block, u32 target_pc,             \
+ u32 branch_pc, u32 branch_flags)                                             \
+{                                                                             \
+  idle_loop_state st = { 0, 0, 0 };                                           \
+  u32 pc;                                                                     \
+                                                                              \
+  if ((target_pc >> 15) != (branch_pc >> 15) ||                               \
+      branch_pc - target_pc > (IDLE_LOOP_MAX_INSTRUCTIONS - 1) * width)       \
+    return false;                                                             \
+                                                                              \
+  for (pc = target_pc; pc != branch_pc; pc += width)                          \
+  {                                                                           \
+    if (!type##_idle_loop_opcode(addressfn(pc_address_block, pc & 0x7FFF),    \
+                                 &st))                                        \
+      return false;                                                           \
+  }                                                                           \
+                                                                              \
+  idle_loop_access(&st, branch_flags << 16, 0, 0);                            \
+  return !(st.read_first & st.clobbered);                                     \
+}                                                                             \
+
+idle_loop_detect_builder(arm, 4, address32);
+idle_loop_detect_builder(thumb, 2, address16);
+
+// Backwards branches within the block (the current trace segment, not bl)
+// are idle loop candidates
+#define arm_idle_loop_candidate()                                             \
+  if (!(opcode & 0x1000000) &&                                                \
+      branch_target >= trace_segments[trace_segment_count - 1].start_pc &&    \
+      branch_target < block_end_pc &&                                         \
+      arm_idle_loop(pc_address_block, branch_target, block_end_pc - 4,        \
+                    condition_read_flags[condition]))                         \
+    idle_loop_pc = block_end_pc - 4                                           \
+
+#define thumb_idle_loop_candidate()                                           \
+  if (opcode < 0xE800 &&                                                      \
+      branch_target >= trace_segments[trace_segment_count - 1].start_pc &&    \
+      branch_target < block_end_pc &&                                         \
+      thumb_idle_loop(pc_address_block, branch_target, block_end_pc - 2,      \
+                      (opcode < 0xE000) ?                                     \
+                        condition_read_flags[(opcode >> 8) & 0x0F] : 0))      \
+    idle_loop_pc = block_end_pc - 2                                           \
+
+// Flag status of an ARM instruction (see thumb_dead_flag_eliminate for the
+// meaning of each set of bits), the opcode comes without its condition.
+static u16 arm_flag_data(u32 opcode, u32 condition)
+{
+  u16 flag_data = 0;
+
+  if((opcode & 0x0C000000) == 0)
+  {
+    if(((opcode & 0x0FD000F0) == 0x00100090) ||
+       ((opcode & 0x0F9000F0) == 0x00900090))
+    {
+      // muls, mlas and the long multiplies set N and Z
+      flag_data = 0xCC;
+    }
+    else
+
+    if((opcode & 0x0FBF0FFF) == 0x010F0000)
+    {
+      // mrs
+      flag_data = 0xF00;
+    }
+    else
+
+    if((opcode & 0x0DB0F000) == 0x0120F000)
+    {
+      // msr (might also switch modes and raise an interrupt)
+      flag_data = 0xF00 | ((opcode & 0x80000) ? 0xFF : 0x00);
+    }
+    else
+
+    if(((opcode & 0x02000090) != 0x00000090) &&
+       ((opcode & 0x01900000) != 0x01000000))
+    {
+      // Data processing
+      u32 op = (opcode >> 21) & 0x0F;
+
+      if((op >= 0x5) && (op <= 0x7))
+        flag_data |= 0x200;                 // adc, sbc, rsc use C
+
+      if(!(opcode & 0x02000010) && ((opcode & 0xFE0) == 0x060))
+        flag_data |= 0x200;                 // rrx uses C
+
+      if(opcode & 0x00100000)
+      {
+        if(((op >= 0x2) && (op <= 0x7)) || (op == 0xA) || (op == 0xB))
+        {
+          flag_data |= 0xFF;
+        }
+        else
+
+        if(opcode & 0x02000000)
+        {
+          // Rotated immediates set C
+          flag_data |= (opcode & 0xF00) ? 0xEE : 0xCC;
+        }
+        else
+
+        if(opcode & 0x10)
+        {
+          // Shifts by a register only set C if the amount is not 0
+          flag_data |= 0xCE;
+        }
+        else
+        {
+          // lsl #0 leaves C alone
+          flag_data |= (opcode & 0xFE0) ? 0xEE : 0xCC;
+        }
+      }
+    }
+  }
+  else
+
+  if(((opcode & 0x0E000000) == 0x06000000) && ((opcode & 0xFF0) == 0x060))
+  {
+    // Memory access with an rrx shifted offset
+    flag_data = 0x200;
+  }
+
+  // Conditional instructions might not modify anything
+  if(condition != 0x0E)
+  {
+    flag_data &= ~0xF0;
+    flag_data |= condition_read_flags[condition] << 8;
+  }
+
+  if(arm_exit_point)
+    flag_data |= 0xF00;
+
+  return flag_data;
+}
+
+// Constant folding: loads from addresses known at translation time that
+// point into the ROM (not counting the GPIO/RTC registers it contains) are
+// replaced with the loaded value. This covers the literal pools (addressed
+// relative to the PC) and the constant tables accessed through a register
+// holding a literal pool value.
+// Registers holding known values are tracked along the block (each segment
+// of a trace on its own), starting from scratch at every internal branch
+// target and after every exit point.
+
+static bool rom_constant_load(u32 address, u32 size, u32 *value)
+{
+  u8 *map;
+
+  if((address < 0x08000000) || (address >= 0x0A000000) ||
+   ((address & 0x1FFFFFF) >= gamepak_size) || (address & (size - 1)))
+    return false;
+
+  if((address + size > 0x080000C4) && (address < 0x080000CA))
+    return false;
+
+  map = memory_map_read[address >> 15];
+  if(!map)
+    return false;
+
+  switch(size)
+  {
+    case 1:
+      *value = address8(map, address & 0x7FFF);
+      break;
+
+    case 2:
+      *value = readaddress16(map, address & 0x7FFF);
+      break;
+
+    default:
+      *value = readaddress32(map, address & 0x7FFF);
+      break;
+  }
+  return true;
+}
+
+// Registers an ARM instruction might write (all of them if unknown)
+static u32 arm_written_regs(u32 opcode)
+{
+  u32 rd = 1 << ((opcode >> 12) & 0x0F);
+  u32 rn = 1 << ((opcode >> 16) & 0x0F);
+  u32 writeback = (!(opcode & 0x01000000) || (opcode & 0x00200000)) ? rn : 0;
+
+  switch((opcode >> 25) & 0x07)
+  {
+    case 0x0:
+      if((opcode & 0xF0) == 0x90)
+      {
+        if(opcode & 0x01000000)
+          return rd;                         // swp
+        if(opcode & 0x00800000)
+          return rd | rn;                    // long multiplies
+        return rn;                           // mul, mla
+      }
+      if((opcode & 0x90) == 0x90)
+        return ((opcode & 0x00100000) ? rd : 0) | writeback;
+      if((opcode & 0x01900000) == 0x01000000)
+        return ((opcode & 0x0FBF0FFF) == 0x010F0000) ? rd : 0xFFFF;
+      return ((opcode & 0x01800000) == 0x01000000) ? 0 : rd;
+
+    case 0x1:
+      if((opcode & 0x01900000) == 0x01000000)
+        return 0xFFFF;                       // msr
+      return ((opcode & 0x01800000) == 0x01000000) ? 0 : rd;
+
+    case 0x2:
+    case 0x3:
+      if((opcode & 0x02000010) == 0x02000010)
+        return 0xFFFF;                       // undefined
+      return ((opcode & 0x00100000) ? rd : 0) | writeback;
+
+    case 0x4:
+      return ((opcode & 0x00100000) ? (opcode & 0xFFFF) : 0) |
+       ((opcode & 0x00200000) ? rn : 0);
+
+    default:
+      return 0xFFFF;
+  }
+}
+
+static void arm_fold_constants(u32 block_start_pc, u32 block_end_pc,
+ s32 block_data_position)
+{
+  u32 known_regs = 0;
+  u32 values[16] = { 0 };
+  u32 pc;
+
+  for(pc = block_start_pc; pc != block_end_pc;
+   pc += 4, block_data_position++)
+  {
+    u8 *map = memory_map_read[pc >> 15];
+    u32 opcode, condition, rd, rn, address = 0, size, value;
+    u32 known_value = 0;
+    bool known = false;
+
+    block_data[block_data_position].const_reg = NO_CONST_LOAD;
+    if(block_data[block_data_position].update_cycles || !map)
+      known_regs = 0;
+    if(!map)
+      continue;
+
+    opcode = address32(map, pc & 0x7FFF);
+    condition = opcode >> 28;
+    opcode &= 0xFFFFFFF;
+    rd = (opcode >> 12) & 0x0F;
+    rn = (opcode >> 16) & 0x0F;
+    values[15] = pc + 8;
+    known_regs |= 1 << 15;
+
+    if((rd != 15) && (known_regs & (1 << rn)))
+    {
+      if((opcode & 0x0F300000) == 0x05100000)
+      {
+        // ldr(b) rd, [rn, +/-imm]
+        address = values[rn] + ((opcode & 0x00800000) ?
+         (opcode & 0xFFF) : -(opcode & 0xFFF));
+        size = (opcode & 0x00400000) ? 1 : 4;
+      }
+      else
+
+      if((opcode & 0x0F7000F0) == 0x015000B0)
+      {
+        // ldrh rd, [rn, +/-imm]
+        u32 offset = ((opcode >> 4) & 0xF0) | (opcode & 0x0F);
+        address = values[rn] + ((opcode & 0x00800000) ? offset : -offset);
+        size = 2;
+      }
+      else
+      {
+        size = 0;
+      }
+
+      if(size && rom_constant_load(address, size, &value))
+      {
+        block_data[block_data_position].const_reg = rd;
+        block_data[block_data_position].const_value = value;
+        known_value = value;
+        known = true;
+      }
+    }
+
+    if((opcode & 0x0E000000) == 0x02000000)
+    {
+      // Data processing with an immediate operand
+      u32 imm;
+      ror(imm, opcode & 0xFF, (opcode >> 7) & 0x1E);
+
+      switch((opcode >> 21) & 0x0F)
+      {
+        case 0x2:
+          // sub rd, rn, imm
+          known_value = values[rn] - imm;
+          known = (known_regs >> rn) & 1;
+          break;
+
+        case 0x4:
+          // add rd, rn, imm
+          known_value = values[rn] + imm;
+          known = (known_regs >> rn) & 1;
+          break;
+
+        case 0xC:
+          // orr rd, rn, imm
+          known_value = values[rn] | imm;
+          known = (known_regs >> rn) & 1;
+          break;
+
+        case 0xD:
+          // mov rd, imm
+          known_value = imm;
+          known = true;
+          break;
+
+        case 0xF:
+          // mvn rd, imm
+          known_value = ~imm;
+          known = true;
+          break;
+      }
+    }
+
+    known_regs &= ~arm_written_regs(opcode);
+    if((condition == 0x0E) && known && (rd != 15))
+    {
+      known_regs |= 1 << rd;
+      values[rd] = known_value;
+    }
+
+    if(arm_exit_point)
+      known_regs = 0;
+  }
+}
+
+// Registers a Thumb instruction might write (all of them if unknown)
+static u32 thumb_written_regs(u32 opcode)
+{
+  u32 rd = 1 << (opcode & 0x07);
+  u32 rd8 = 1 << ((opcode >> 8) & 0x07);
+
+  switch(opcode >> 8)
+  {
+    case 0x00 ... 0x1F:
+    case 0x40 ... 0x43:
+    case 0x50 ... 0x8F:
+      return rd;
+
+    case 0x20 ... 0x3F:
+    case 0x48 ... 0x4F:
+    case 0x90 ... 0xAF:
+      return rd8;
+
+    case 0x44 ... 0x46:
+      return 1 << ((opcode & 0x07) | ((opcode >> 4) & 0x08));
+
+    case 0xB0:
+    case 0xB4 ... 0xB5:
+      return 1 << REG_SP;
+
+    case 0xBC ... 0xBD:
+      return (opcode & 0xFF) | (1 << REG_SP) | ((opcode & 0x100) << 7);
+
+    case 0xC0 ... 0xCF:
+      return (opcode & 0xFF) | rd8;
+
+    default:
+      return 0xFFFF;
+  }
+}
+
+static void thumb_fold_constants(u32 block_start_pc, u32 block_end_pc,
+ s32 block_data_position)
+{
+  u32 known_regs = 0;
+  u32 values[8] = { 0 };
+  u32 pc;
+
+  for(pc = block_start_pc; pc != block_end_pc;
+   pc += 2, block_data_position++)
+  {
+    u8 *map = memory_map_read[pc >> 15];
+    u32 opcode, address = 0, size, value;
+    u32 rd, rs, imm;
+    u32 known_value = 0;
+    bool known = false;
+
+    block_data[block_data_position].const_reg = NO_CONST_LOAD;
+    if(block_data[block_data_position].update_cycles || !map)
+      known_regs = 0;
+    if(!map)
+      continue;
+
+    opcode = address16(map, pc & 0x7FFF);
+    rd = opcode & 0x07;
+    rs = (opcode >> 3) & 0x07;
+    imm = (opcode >> 6) & 0x1F;
+    size = 0;
+
+    switch(opcode >> 8)
+    {
+      case 0x00 ... 0x07:
+        // lsl rd, rs, imm
+        if(known_regs & (1 << rs))
+        {
+          known_value = values[rs] << imm;
+          known = true;
+        }
+        break;
+
+      case 0x20 ... 0x27:
+        // mov rd, imm
+        rd = (opcode >> 8) & 0x07;
+        known_value = opcode & 0xFF;
+        known = true;
+        break;
+
+      case 0x30 ... 0x3F:
+        // add/sub rd, imm
+        rd = (opcode >> 8) & 0x07;
+        if(known_regs & (1 << rd))
+        {
+          known_value = (opcode & 0x0800) ? values[rd] - (opcode & 0xFF) :
+           values[rd] + (opcode & 0xFF);
+          known = true;
+        }
+        break;
+
+      case 0x48 ... 0x4F:
+        // ldr rd, [pc + imm]
+        rd = (opcode >> 8) & 0x07;
+        address = (pc & ~2) + 4 + ((opcode & 0xFF) * 4);
+        size = 4;
+        break;
+
+      case 0x68 ... 0x6F:
+        // ldr rd, [rs + imm]
+        address = values[rs] + (imm * 4);
+        size = (known_regs & (1 << rs)) ? 4 : 0;
+        break;
+
+      case 0x78 ... 0x7F:
+        // ldrb rd, [rs + imm]
+        address = values[rs] + imm;
+        size = (known_regs & (1 << rs)) ? 1 : 0;
+        break;
+
+      case 0x88 ... 0x8F:
+        // ldrh rd, [rs + imm]
+        address = values[rs] + (imm * 2);
+        size = (known_regs & (1 << rs)) ? 2 : 0;
+        break;
+
+      case 0xA0 ... 0xA7:
+        // add rd, pc, imm
+        rd = (opcode >> 8) & 0x07;
+        known_value = (pc & ~2) + 4 + ((opcode & 0xFF) * 4);
+        known = true;
+        break;
+    }
+
+    if(size && rom_constant_load(address, size, &value))
+    {
+      block_data[block_data_position].const_reg = rd;
+      block_data[block_data_position].const_value = value;
+      known_value = value;
+      known = true;
+    }
+
+    known_regs &= ~thumb_written_regs(opcode);
+    if(known)
+    {
+      known_regs |= 1 << rd;
+      values[rd] = known_value;
+    }
+
+    if(thumb_exit_point)
+      known_regs = 0;
+  }
+}
+
+// Traces (superblocks), see block_trace_hot below. The scan of a trace
+// carries on with the target of the unconditional direct branches (b/bl)
+// instead of ending the block there, so that it is made of several
+// segments of consecutive instructions. The branches linking them emit
+// no code other than setting the link register.
+typedef struct
+{
+  u32 start_pc;
+  u32 end_pc;
+  s32 data_position;  // Position of the first instruction in block_data
+} trace_segment_type;
+
+// Position in block_data of the instruction at pc, -1 if it is not part of
+// the block
+static s32 trace_data_position(const trace_segment_type *segments,
+ u32 segment_count, u32 pc, u32 instruction_width)
+{
+  u32 i;
+
+  for(i = 0; i < segment_count; i++)
+  {
+    if((pc >= segments[i].start_pc) && (pc < segments[i].end_pc))
+    {
+      return segments[i].data_position +
+       (pc - segments[i].start_pc) / instruction_width;
+    }
+  }
+  return -1;
+}
+
+// Segments of the last translated block
+static u32 translated_trace_segments = 0;
+
+// Every ROM block entry (linked exits included) counts an execution of the
+// cache segment holding the block, see rom_cache_evict_segment.
+#ifdef generate_segment_counter
+  #define segment_counter_start()                                             \
+    if(!ram_region)                                                           \
+    {                                                                         \
+      generate_segment_counter(                                               \
+       &rom_cache_segment_execs[rom_cache_segment]);                          \
+    }                                                                         \
+
+#else
+  #define segment_counter_start()
+#endif
+
+#ifdef generate_trace_counter
+
+// Execution counters of the ROM blocks, shared by PC hash. They count down
+// from TRACE_HOT_THRESHOLD, the block gets hot when it reaches zero.
+#define TRACE_COUNTER_COUNT (1 << TRACE_COUNTER_BITS)
+
+#define trace_counter_slot(key)                                               \
+  (((key) * 2654435761U) >> (32 - TRACE_COUNTER_BITS))                        \
+
+static u32 trace_counters[TRACE_COUNTER_COUNT];
+static bool translate_trace = false;
+
+#define trace_counter_start(type, thumb)                                      \
+  if(!ram_region && !trace)                                                   \
+  {                                                                           \
+    generate_trace_counter(                                                   \
+     &trace_counters[trace_counter_slot(block_start_pc | thumb)],             \
+     block_start_pc, type);                                                   \
+  }                                                                           \
+
+// Only ROM code can be followed, RAM code could change under the trace
+#define trace_can_follow(target)                                              \
+  (trace && (trace_segment_count < MAX_TRACE_SEGMENTS) &&                     \
+   ((target) >= 0x08000000) && ((target) < 0x0E000000))                       \
+
+#else
+
+#define translate_trace false
+#define trace_counter_start(type, thumb)
+#define trace_can_follow(target) trace
+#define arm_trace_branch(target)
+#define thumb_trace_branch(target)
+
+#endif
+
+#define scan_block(type, smc_write_op)                                        \
+{                                                                             \
+  __label__ block_end;                                                        \
+  u8 continue_block = 1;                                                      \
+  u32 branch_targets_sorted[MAX_EXITS];                                       \
+  u32 sorted_branch_count = 0;                                                \
+  u32 trace_next_pc = ~0U;                                                    \
+  /* Find the end of the block */                                             \
+  do                                                                          \
+  {                                                                           \
+    check_pc_region(block_end_pc);                                            \
+    type##_load_opcode();                                                     \
+    smc_write_##type##_##smc_write_op();                                      \
+    type##_flag_status();                                                     \
                                                                               \
     if(type##_exit_point)                                                     \
     {                                                                         \
+      u8 direct_branch = 0;                                                   \
+                                                                              \
       /* Branch/branch with link */                                           \
       if(type##_opcode_branch)                                                \
       {                                                                       \
         __label__ no_direct_branch;                                           \
         type##_branch_target();                                               \
+        type##_idle_loop_candidate();                                         \
         block_exits[block_exit_position].branch_target = branch_target;       \
 	if(!ram_region)							      \
           sorted_branch_count = InsertUniqueSorted(branch_targets_sorted,     \
           branch_target, sorted_branch_count);                                \
         block_exit_position++;                                                \
+        direct_branch = 1;                                                    \
                                                                               \
         /* Give the branch target macro somewhere to bail if it turns out to  \
            be an indirect branch (ala malformed Thumb bl) */                  \
@@ -3051,7 +4561,13 @@ static s32 BinarySearch(u32* Array, u32 Value, u32 Size)
            using a separate sorted array with unique branch_targets. */       \
         if (ram_region || BinarySearch(branch_targets_sorted, block_end_pc,   \
           sorted_branch_count) == -1)                                         \
-          continue_block = 0;                                                 \
+        {                                                                     \
+          /* Traces go on with the target instead (see below) */              \
+          if (direct_branch && trace_can_follow(branch_target))               \
+            trace_next_pc = branch_target;                                    \
+          else                                                                \
+            continue_block = 0;                                               \
+        }                                                                     \
        if (ram_region)								\
           type##_ub();								\
       }                                                                       \
@@ -3078,9 +4594,34 @@ static s32 BinarySearch(u32* Array, u32 Value, u32 Size)
      (block_end_pc == 0x3007FF0) || (block_end_pc == 0x203FFFF0))             \
     {                                                                         \
       continue_block = 0;                                                     \
+    }                                                                         \
+                                                                              \
+    /* Start a new trace segment at the branch target, unless the block had   \
+       to end anyway or the target is already part of the trace (then the    \
+       branch remains a regular exit) */                                      \
+    if(trace_next_pc != ~0U)                                                  \
+    {                                                                         \
+      trace_segments[trace_segment_count - 1].end_pc = block_end_pc;          \
+      if(continue_block && trace_data_position(trace_segments,                \
+       trace_segment_count, trace_next_pc, type##_instruction_width) < 0)     \
+      {                                                                       \
+        trace_segments[trace_segment_count].start_pc = trace_next_pc;         \
+        trace_segments[trace_segment_count].data_position =                   \
+         block_data_position;                                                 \
+        trace_segment_count++;                                                \
+        block_exit_position--;                                                \
+        block_end_pc = trace_next_pc;                                         \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        continue_block = 0;                                                   \
+      }                                                                       \
+      trace_next_pc = ~0U;                                                    \
     }                                                                         \
   } while(continue_block);                                                    \
                                                                               \
+  trace_segments[trace_segment_count - 1].end_pc = block_end_pc;              \
+                                                                              \
 }                                                                             \
 
 #define arm_fix_pc()                                                          \
@@ -3123,8 +4664,14 @@ bool translate_block_arm(u32 pc, bool ram_region)
   s32 i;
   u32 flag_status;
   block_exit_type block_exits[MAX_EXITS];
+  trace_segment_type trace_segments[MAX_TRACE_SEGMENTS];
+  u32 trace_segment_count = 1;
+  u32 segment;
+  bool trace = translate_trace;
   generate_block_extra_vars_arm();
   arm_fix_pc();
+  trace_segments[0].start_pc = pc;
+  trace_segments[0].data_position = 0;
 
   if(!pc_address_block)
     pc_address_block = load_gamepak_page(pc_region & 0x3FF);
@@ -3136,14 +4683,21 @@ bool translate_block_arm(u32 pc, bool ram_region)
        - (0x10000 - ram_block_tag) / 2 * sizeof(ramtag_type)];
   } else {
     translation_ptr = rom_translation_ptr;
-    translation_cache_limit =
-     rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE -
-     TRANSLATION_CACHE_LIMIT_THRESHOLD;
+    rom_cache_truncate_relocs(
+      (u32)(rom_translation_ptr - rom_translation_cache),
+      rom_cache_segment_end(rom_cache_segment));
+    translation_cache_limit = &rom_translation_cache[
+       rom_cache_segment_end(rom_cache_segment) -
+       TRANSLATION_CACHE_LIMIT_THRESHOLD];
   }
 
   generate_block_prologue();
+  block_profile_start(0);
+  segment_counter_start();
+  trace_counter_start(arm, 0);
 
   u8 translation_gate_required = 0; /* gets updated by scan_block */          \
+  u32 idle_loop_pc = ~0U;           /* gets updated by scan_block */
 
   /* This is a function because it's used a lot more than it might seem (all
      of the data processing functions can access it), and its expansion was
@@ -3160,14 +4714,12 @@ bool translate_block_arm(u32 pc, bool ram_region)
 
   for(i = 0; i < block_exit_position; i++)
   {
-    branch_target = block_exits[i].branch_target;
+    s32 target_position = trace_data_position(trace_segments,
+     trace_segment_count, block_exits[i].branch_target,
+     arm_instruction_width);
 
-    if((branch_target > block_start_pc) &&
-     (branch_target < block_end_pc))
-    {
-      block_data[(branch_target - block_start_pc) /
-       arm_instruction_width].update_cycles = 1;
-    }
+    if(target_position > 0)
+      block_data[target_position].update_cycles = 1;
   }
 
  // if (!ram_region) {                         
@@ -3177,45 +4729,66 @@ bool translate_block_arm(u32 pc, bool ram_region)
   //arm_dead_flag_eliminate();
   //}
   arm_dead_flag_eliminate();
+  for(segment = 0; segment < trace_segment_count; segment++)
+  {
+    arm_fold_constants(trace_segments[segment].start_pc,
+     trace_segments[segment].end_pc, trace_segments[segment].data_position);
+  }
 
   block_exit_position = 0;
   block_data_position = 0;
 
   last_condition = 0x0E;
 
-  while(pc != block_end_pc)
+  for(segment = 0; segment < trace_segment_count; segment++)
   {
-    block_data[block_data_position].block_offset = translation_ptr;
-    arm_base_cycles();
-
-    if (pc == cheat_master_hook)
+    pc = trace_segments[segment].start_pc;
+    while(pc != trace_segments[segment].end_pc)
     {
-      arm_process_cheats();
-    }
-
-    update_pc_limits();
-    translate_arm_instruction();
-    block_data_position++;
-
-    /* If it went too far the cache needs to be flushed and the process
-       restarted. Because we might already be nested several stages in
-       a simple recursive call here won't work, it has to pedal out to
-       the beginning. */
-
-    if(translation_ptr > translation_cache_limit) {
-      if (ram_region)
-        flush_translation_cache_ram();
+      block_data[block_data_position].block_offset = translation_ptr;
+      arm_base_cycles();
+
+      if (pc == cheat_master_hook)
+      {
+        arm_process_cheats();
+      }
+
+      update_pc_limits();
+      if((segment + 1 < trace_segment_count) &&
+       (pc + 4 == trace_segments[segment].end_pc))
+      {
+        /* Branch followed by the trace, which goes on with its target */
+        check_pc_region(pc);
+        opcode = address32(pc_address_block, (pc & 0x7FFF));
+        arm_trace_branch(trace_segments[segment + 1].start_pc);
+        pc += 4;
+      }
       else
-        flush_translation_cache_rom();
-      return false;
-    }
-
-    /* If the next instruction is a block entry point update the
-       cycle counter and update */
-    if (pc != block_end_pc &&
-        block_data[block_data_position].update_cycles)
-    {
-      generate_cycle_update();
+      {
+        translate_arm_instruction();
+      }
+      block_data_position++;
+
+      /* If it went too far the cache needs to be flushed and the process
+         restarted. Because we might already be nested several stages in
+         a simple recursive call here won't work, it has to pedal out to
+         the beginning. */
+
+      if(translation_ptr > translation_cache_limit) {
+        if (ram_region)
+          flush_translation_cache_ram();
+        else
+          evict_translation_cache_rom();
+        return false;
+      }
+
+      /* If the next instruction is a block entry point update the
+         cycle counter and update */
+      if (pc != block_end_pc &&
+          block_data[block_data_position].update_cycles)
+      {
+        generate_cycle_update();
+      }
     }
   }
 
@@ -3231,40 +4804,70 @@ bool translate_block_arm(u32 pc, bool ram_region)
 
   for(i = 0; i < block_exit_position; i++)
   {
+    s32 target_position;
+
     branch_target = block_exits[i].branch_target;
+    target_position = trace_data_position(trace_segments,
+     trace_segment_count, branch_target, arm_instruction_width);
 
-    if((branch_target >= block_start_pc) && (branch_target < block_end_pc))
+    if(target_position >= 0)
     {
       /* Internal branch, patch to recorded address */
-      translation_target =
-       block_data[(branch_target - block_start_pc) /
-        arm_instruction_width].block_offset;
+      translation_target = block_data[target_position].block_offset;
 
       generate_branch_patch_unconditional(block_exits[i].branch_source,
        translation_target);
     }
     else
     {
-      /* This branch exits the basic block. If the branch target is in a      
-       * read-only code area (the BIOS or the Game Pak ROM), we can link the  
-       * block statically below. THIS BEHAVIOUR NEEDS TO BE DUPLICATED IN THE 
-       * EMITTER. Please see your emitter's generate_branch_no_cycle_update   
-       * macro for more information. */                                       
-      if (branch_target < 0x00004000 /* BIOS */                               
-      || (branch_target >= 0x08000000 && branch_target < 0x0E000000))         
-     {                                                                       
-       /* External branch, save for later. Simply compact the external         
-       * exits to the beginning of the same array. */                         
-      if (i != external_block_exit_position)                                  
-      {                                                                       
-        memcpy(&block_exits[external_block_exit_position], &block_exits[i],   
-          sizeof(block_exit_type));                                           
-      }                                                                       
-      external_block_exit_position++;
-     }
+      /* This branch exits the basic block. If the emitter supports link
+       * stubs, the exit goes through one, which looks the target up (and
+       * links it if possible, see block_link_address): this way any link
+       * can be undone when its target is evicted from the cache. Otherwise
+       * exits to read-only code areas (the BIOS or the Game Pak ROM) are
+       * linked statically below, and the rest use the regular lookup. */
+      if (branch_target == 0x00000008 || (!lazy_block_linking
+       && (branch_target < 0x00004000 /* BIOS */
+       || (branch_target >= 0x08000000 && branch_target < 0x0E000000))))
+      {
+        /* External branch, save for later. Simply compact the external
+         * exits to the beginning of the same array. */
+        if (i != external_block_exit_position)
+        {
+          memcpy(&block_exits[external_block_exit_position], &block_exits[i],
+            sizeof(block_exit_type));
+        }
+        external_block_exit_position++;
+      }
+      else
+      {
+        if(translation_ptr > translation_cache_limit) {
+          if (ram_region)
+            flush_translation_cache_ram();
+          else
+            evict_translation_cache_rom();
+          return false;
+        }
+        generate_branch_link_stub(arm, block_exits[i].branch_source,
+         branch_target);
+      }
     }
   }
 
+  translated_trace_segments = trace_segment_count;
+
+  if(ram_region &&
+     !ram_code_register_block(block_start_pc, block_end_pc, 0))
+  {
+    flush_translation_cache_ram();
+    return false;
+  }
+
+  perf_map_record_block(ram_region ? ram_translation_ptr : rom_translation_ptr,
+                        translation_ptr, block_start_pc, 0);
+  block_profile_finish(arm,
+    ram_region ? ram_translation_ptr : rom_translation_ptr);
+
   if (ram_region)
     ram_translation_ptr = translation_ptr;
   else
@@ -3307,8 +4910,14 @@ bool translate_block_thumb(u32 pc, bool ram_region)
   s32 i;
   u32 flag_status;
   block_exit_type block_exits[MAX_EXITS];
+  trace_segment_type trace_segments[MAX_TRACE_SEGMENTS];
+  u32 trace_segment_count = 1;
+  u32 segment;
+  bool trace = translate_trace;
   generate_block_extra_vars_thumb();
   thumb_fix_pc();
+  trace_segments[0].start_pc = pc;
+  trace_segments[0].data_position = 0;
 
   if(!pc_address_block)
     pc_address_block = load_gamepak_page(pc_region & 0x3FF);
@@ -3320,17 +4929,25 @@ bool translate_block_thumb(u32 pc, bool ram_region)
        - (0x10000 - ram_block_tag) / 2 * sizeof(ramtag_type)];
   } else {
     translation_ptr = rom_translation_ptr;
+    rom_cache_truncate_relocs(
+      (u32)(rom_translation_ptr - rom_translation_cache),
+      rom_cache_segment_end(rom_cache_segment));
     translation_cache_limit = &rom_translation_cache[
-       ROM_TRANSLATION_CACHE_SIZE - TRANSLATION_CACHE_LIMIT_THRESHOLD];
+       rom_cache_segment_end(rom_cache_segment) -
+       TRANSLATION_CACHE_LIMIT_THRESHOLD];
   }
 
   generate_block_prologue();
+  block_profile_start(1);
+  segment_counter_start();
+  trace_counter_start(thumb, 1);
 
   /* This is a function because it's used a lot more than it might seem (all
      of the data processing functions can access it), and its expansion was
      massacreing the compiler. */
 
   u8 translation_gate_required = 0; /* gets updated by scan_block */          
+  u32 idle_loop_pc = ~0U;           /* gets updated by scan_block */
 
   if(ram_region)
   {
@@ -3343,14 +4960,12 @@ bool translate_block_thumb(u32 pc, bool ram_region)
 
   for(i = 0; i < block_exit_position; i++)
   {
-    branch_target = block_exits[i].branch_target;
+    s32 target_position = trace_data_position(trace_segments,
+     trace_segment_count, block_exits[i].branch_target,
+     thumb_instruction_width);
 
-    if((branch_target > block_start_pc) &&
-     (branch_target < block_end_pc))
-    {
-      block_data[(branch_target - block_start_pc) /
-       thumb_instruction_width].update_cycles = 1;
-    }
+    if(target_position > 0)
+      block_data[target_position].update_cycles = 1;
   }
 
  // if (!ram_region) {                         
@@ -3360,44 +4975,66 @@ bool translate_block_thumb(u32 pc, bool ram_region)
   //thumb_dead_flag_eliminate();
   //}
   thumb_dead_flag_eliminate();
+  for(segment = 0; segment < trace_segment_count; segment++)
+  {
+    thumb_fold_constants(trace_segments[segment].start_pc,
+     trace_segments[segment].end_pc, trace_segments[segment].data_position);
+  }
 
   block_exit_position = 0;
   block_data_position = 0;
 
-  while(pc != block_end_pc)
+  for(segment = 0; segment < trace_segment_count; segment++)
   {
-    block_data[block_data_position].block_offset = translation_ptr;
-    thumb_base_cycles();
-
-    if (pc == cheat_master_hook)
-    {
-      thumb_process_cheats();
-    }
-
-    update_pc_limits();
-    translate_thumb_instruction();
-    block_data_position++;
-
-    /* If it went too far the cache needs to be flushed and the process
-       restarted. Because we might already be nested several stages in
-       a simple recursive call here won't work, it has to pedal out to
-       the beginning. */
-
-    if(translation_ptr > translation_cache_limit)
+    pc = trace_segments[segment].start_pc;
+    while(pc != trace_segments[segment].end_pc)
     {
-      if (ram_region)
-        flush_translation_cache_ram();
+      block_data[block_data_position].block_offset = translation_ptr;
+      thumb_base_cycles();
+
+      if (pc == cheat_master_hook)
+      {
+        thumb_process_cheats();
+      }
+
+      update_pc_limits();
+      if((segment + 1 < trace_segment_count) &&
+       (pc + 2 == trace_segments[segment].end_pc))
+      {
+        /* Branch followed by the trace, which goes on with its target */
+        check_pc_region(pc);
+        last_opcode = opcode;
+        opcode = address16(pc_address_block, (pc & 0x7FFF));
+        thumb_trace_branch(trace_segments[segment + 1].start_pc);
+        pc += 2;
+      }
       else
-        flush_translation_cache_rom();
-      return false;
-    }
-
-    /* If the next instruction is a block entry point update the
-       cycle counter and update */
-    if (pc != block_end_pc &&
-        block_data[block_data_position].update_cycles)
-    {
-      generate_cycle_update();
+      {
+        translate_thumb_instruction();
+      }
+      block_data_position++;
+
+      /* If it went too far the cache needs to be flushed and the process
+         restarted. Because we might already be nested several stages in
+         a simple recursive call here won't work, it has to pedal out to
+         the beginning. */
+
+      if(translation_ptr > translation_cache_limit)
+      {
+        if (ram_region)
+          flush_translation_cache_ram();
+        else
+          evict_translation_cache_rom();
+        return false;
+      }
+
+      /* If the next instruction is a block entry point update the
+         cycle counter and update */
+      if (pc != block_end_pc &&
+          block_data[block_data_position].update_cycles)
+      {
+        generate_cycle_update();
+      }
     }
   }
 
@@ -3408,40 +5045,70 @@ bool translate_block_thumb(u32 pc, bool ram_region)
 
   for(i = 0; i < block_exit_position; i++)
   {
+    s32 target_position;
+
     branch_target = block_exits[i].branch_target;
+    target_position = trace_data_position(trace_segments,
+     trace_segment_count, branch_target, thumb_instruction_width);
 
-    if((branch_target >= block_start_pc) && (branch_target < block_end_pc))
+    if(target_position >= 0)
     {
       /* Internal branch, patch to recorded address */
-      translation_target =
-       block_data[(branch_target - block_start_pc) /
-        thumb_instruction_width].block_offset;
+      translation_target = block_data[target_position].block_offset;
 
       generate_branch_patch_unconditional(block_exits[i].branch_source,
        translation_target);
     }
     else
     {
-      /* This branch exits the basic block. If the branch target is in a      
-       * read-only code area (the BIOS or the Game Pak ROM), we can link the  
-       * block statically below. THIS BEHAVIOUR NEEDS TO BE DUPLICATED IN THE 
-       * EMITTER. Please see your emitter's generate_branch_no_cycle_update   
-       * macro for more information. */                                       
-      if (branch_target < 0x00004000 /* BIOS */                               
-      || (branch_target >= 0x08000000 && branch_target < 0x0E000000))         
-     {                                                                       
-       /* External branch, save for later. Simply compact the external         
-       * exits to the beginning of the same array. */                         
-      if (i != external_block_exit_position)                                  
-      {                                                                       
-        memcpy(&block_exits[external_block_exit_position], &block_exits[i],   
-          sizeof(block_exit_type));                                           
-      }                                                                       
-      external_block_exit_position++;
-     }
+      /* This branch exits the basic block. If the emitter supports link
+       * stubs, the exit goes through one, which looks the target up (and
+       * links it if possible, see block_link_address): this way any link
+       * can be undone when its target is evicted from the cache. Otherwise
+       * exits to read-only code areas (the BIOS or the Game Pak ROM) are
+       * linked statically below, and the rest use the regular lookup. */
+      if (branch_target == 0x00000008 || (!lazy_block_linking
+       && (branch_target < 0x00004000 /* BIOS */
+       || (branch_target >= 0x08000000 && branch_target < 0x0E000000))))
+      {
+        /* External branch, save for later. Simply compact the external
+         * exits to the beginning of the same array. */
+        if (i != external_block_exit_position)
+        {
+          memcpy(&block_exits[external_block_exit_position], &block_exits[i],
+            sizeof(block_exit_type));
+        }
+        external_block_exit_position++;
+      }
+      else
+      {
+        if(translation_ptr > translation_cache_limit) {
+          if (ram_region)
+            flush_translation_cache_ram();
+          else
+            evict_translation_cache_rom();
+          return false;
+        }
+        generate_branch_link_stub(thumb, block_exits[i].branch_source,
+         branch_target);
+      }
     }
   }
 
+  translated_trace_segments = trace_segment_count;
+
+  if(ram_region &&
+     !ram_code_register_block(block_start_pc, block_end_pc, 1))
+  {
+    flush_translation_cache_ram();
+    return false;
+  }
+
+  perf_map_record_block(ram_region ? ram_translation_ptr : rom_translation_ptr,
+                        translation_ptr, block_start_pc, 1);
+  block_profile_finish(thumb,
+    ram_region ? ram_translation_ptr : rom_translation_ptr);
+
   if (ram_region)
     ram_translation_ptr = translation_ptr;
   else
@@ -3462,20 +5129,74 @@ bool translate_block_thumb(u32 pc, bool ram_region)
   return true;
 }
 
+// Marks everything below top as used, the cache is filled from there on
+static void rom_cache_reset_segments(u32 top)
+{
+  u32 i, current = rom_cache_segment_of(top);
+
+  for (i = 0; i < rom_cache_segments; i++)
+  {
+    rom_cache_segment_top[i] = (i < current) ?
+      rom_cache_segment_end(i) : rom_cache_segment_start(i);
+    rom_cache_segment_execs[i] = 0;
+  }
+  rom_cache_segment_top[current] = top;
+  rom_cache_segment = current;
+
+  last_rom_translation_ptr = &rom_translation_cache[top];
+  rom_translation_ptr      = &rom_translation_cache[top];
+}
+
+// Removes the hash entries of blocks in [start, end) and [start2, end2)
+static void rom_cache_prune_hash(u32 start, u32 end, u32 start2, u32 end2)
+{
+  u32 i;
+  for (i = 0; i < ROM_BRANCH_HASH_SIZE; i++)
+  {
+    // Removing an entry might move another one into this slot
+    while (rom_branch_hash[i].offset)
+    {
+      u32 blk_offset = rom_branch_hash[i].offset;
+      if ((blk_offset >= start && blk_offset < end) ||
+          (blk_offset >= start2 && blk_offset < end2))
+        rom_branch_hash_remove(i);
+      else
+        break;
+    }
+  }
+}
+
 void init_bios_hooks(void)
 {
   // Pre-generate this entry point so that we can safely invoke fast
   // SWI calls from ROM and RAM regardless of cache flushes.
+  rom_cache_segment = 0;
   rom_translation_ptr = &rom_translation_cache[rom_cache_watermark];
   last_rom_translation_ptr = rom_translation_ptr;
+  rom_cache_truncate_relocs(rom_cache_watermark, ROM_TRANSLATION_CACHE_SIZE);
   bios_swi_entrypoint = block_lookup_address_arm(0x8);
   rom_cache_watermark = (u32)(rom_translation_ptr - rom_translation_cache);
+  rom_cache_reset_segments(rom_cache_watermark);
 }
 
 void flush_translation_cache_ram(void)
 {
+  u32 i, j;
+
   /* Flushes RAM caches avoiding doing too much work (ie. wiping unused memory) */
   flush_ram_count++;
+  translation_flush_count++;
+  STATS_BLOCK_FLUSH(FLUSH_RAM);
+
+  /* Forget about the links made by RAM blocks */
+  for (i = 0, j = 0; i < block_link_count; i++)
+  {
+    u8 *branch_source = block_links[i].branch_source;
+    if (branch_source < ram_translation_cache ||
+        branch_source >= ram_translation_cache + RAM_TRANSLATION_CACHE_SIZE)
+      block_links[j++] = block_links[i];
+  }
+  block_link_count = j;
   /*printf("ram flush %d (pc %x), %x to %x, %x to %x\n",
    flush_ram_count, reg[REG_PC], iwram_code_min, iwram_code_max,
    ewram_code_min, ewram_code_max);*/
@@ -3508,26 +5229,727 @@ void flush_translation_cache_ram(void)
   ewram_code_min = ~0U;
   ewram_code_max =  0U;
   ram_block_tag = INITIAL_TOP_TAG;
+  ram_code_reset_pages();
 }
 
 void flush_translation_cache_rom(void)
 {
+  u32 i;
+
+  /* Unlink RAM block exits pointing into the flushed area */
+  for (i = 0; i < block_link_count; i++)
+  {
+    u8 *branch_source = block_links[i].branch_source;
+    if (branch_source >= rom_translation_cache &&
+        branch_source < rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE)
+      continue;
+    generate_branch_patch_unconditional(branch_source,
+                                        block_links[i].link_stub);
+    platform_cache_sync(branch_source, branch_source + 4);
+  }
+  block_link_count = 0;
+  translation_flush_count++;
+  STATS_BLOCK_FLUSH(FLUSH_ROM);
+
   /* We flush the generated code except for everything below the watermark. */
-  last_rom_translation_ptr = &rom_translation_cache[rom_cache_watermark];
-  rom_translation_ptr      = &rom_translation_cache[rom_cache_watermark];
+  rom_cache_reset_segments(rom_cache_watermark);
+  rom_cache_drop_relocs(rom_cache_watermark, ROM_TRANSLATION_CACHE_SIZE);
 
-  memset(rom_branch_hash, 0, sizeof(rom_branch_hash));
+  rom_branch_hash_clear();
+}
+
+#ifdef THREADED_JIT
+static bool in_translation_thread(void);
+static volatile bool rom_cache_full = false;
+#endif
+
+/* Moves on to an unused segment, or evicts the least used one other than
+   the segment being filled (which is cut at the aborted offset). Links into
+   the evicted segment are undone and its blocks are removed from the hash
+   chains. */
+static void rom_cache_evict_segment(u32 aborted)
+{
+  u32 current = rom_cache_segment;
+  u32 current_end = rom_cache_segment_end(current);
+  u32 victim, victim_start, victim_end, i, j;
+
+  if (rom_branch_hash_count >= ROM_BRANCH_HASH_MAX_COUNT)
+  {
+    /* Out of hash entries rather than space, an unused segment won't help.
+       Evict the coldest segment holding blocks, if any. */
+    victim = rom_cache_segments;
+    for (i = 0; i < rom_cache_segments; i++)
+    {
+      if (i != current &&
+          rom_cache_segment_top[i] != rom_cache_segment_start(i) &&
+          (victim == rom_cache_segments ||
+           rom_cache_segment_execs[i] < rom_cache_segment_execs[victim]))
+        victim = i;
+    }
+    if (victim == rom_cache_segments)
+    {
+      flush_translation_cache_rom();
+      return;
+    }
+  }
+  else
+  {
+    for (victim = 0; victim < rom_cache_segments; victim++)
+    {
+      if (victim != current &&
+          rom_cache_segment_top[victim] == rom_cache_segment_start(victim))
+        break;
+    }
+  }
+
+  if (victim == rom_cache_segments)
+  {
+    victim = (current + 1) % rom_cache_segments;
+    for (i = 0; i < rom_cache_segments; i++)
+    {
+      if (i != current &&
+          rom_cache_segment_execs[i] < rom_cache_segment_execs[victim])
+        victim = i;
+    }
+  }
+
+  victim_start = rom_cache_segment_start(victim);
+  victim_end = rom_cache_segment_end(victim);
+  translation_flush_count++;
+  STATS_BLOCK_FLUSH(EVICT_ROM);
+
+  rom_cache_prune_hash(victim_start, victim_end, aborted, current_end);
+
+  for (i = 0, j = 0; i < block_link_count; i++)
+  {
+    u8 *branch_source = block_links[i].branch_source;
+    u32 target_offset = (u32)(block_links[i].target - rom_translation_cache);
+    bool source_evicted = false;
+    bool target_evicted = (target_offset >= victim_start &&
+                           target_offset < victim_end);
+
+    if (branch_source >= rom_translation_cache &&
+        branch_source < rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE)
+    {
+      u32 source_offset = (u32)(branch_source - rom_translation_cache);
+      source_evicted = (source_offset >= victim_start &&
+                        source_offset < victim_end);
+    }
+
+    if (target_evicted && !source_evicted)
+    {
+      generate_branch_patch_unconditional(branch_source,
+                                          block_links[i].link_stub);
+      platform_cache_sync(branch_source, branch_source + 4);
+    }
+    else if (!target_evicted && !source_evicted)
+      block_links[j++] = block_links[i];
+  }
+  block_link_count = j;
+
+  rom_cache_truncate_relocs(aborted, current_end);
+  rom_cache_drop_relocs(victim_start, victim_end);
+
+  /* Age the execution counters so that old executions matter less */
+  for (i = 0; i < rom_cache_segments; i++)
+    rom_cache_segment_execs[i] >>= 1;
+  rom_cache_segment_execs[victim] = 0;
+
+  rom_cache_segment_top[current] = aborted;
+  rom_cache_segment_top[victim] = victim_start;
+  rom_cache_segment = victim;
+
+  last_rom_translation_ptr = &rom_translation_cache[victim_start];
+  rom_translation_ptr      = &rom_translation_cache[victim_start];
+}
+
+/* Called when the segment being filled runs out of space, in the middle of
+   a translation (which gets discarded). Instead of flushing everything only
+   one segment is evicted. */
+void evict_translation_cache_rom(void)
+{
+  u32 current = rom_cache_segment;
+  u32 aborted = (u32)(rom_translation_ptr - rom_translation_cache);
+
+  if (rom_cache_segments == 1)
+  {
+    flush_translation_cache_rom();
+    return;
+  }
+
+#ifdef THREADED_JIT
+  /* The translated code keeps running while the translation thread works,
+     so the eviction is left to the main thread (the block was not published
+     yet and is simply dropped). */
+  if (in_translation_thread())
+  {
+    rom_cache_truncate_relocs(aborted, rom_cache_segment_end(current));
+    rom_translation_ptr = &rom_translation_cache[aborted];
+    rom_cache_full = true;
+    return;
+  }
+#endif
+
+  rom_cache_evict_segment(aborted);
+}
+
+/* Load time precompilation: the ROM (and BIOS) code reachable from the
+   entry points is discovered by a linear disassembly that follows calls and
+   unconditional jumps, and translated ahead of time. The scan is just a
+   heuristic, mistaking data for code (or missing code) only wastes cache
+   space (or time later on). */
+
+#define PRECOMPILE_QUEUE_SIZE 1024
+// Instructions scanned per entry point looking for calls and jumps
+#define PRECOMPILE_SCAN_LENGTH 1024
+
+// Pending entry points (PC | thumb), processed depth first
+static u32 precompile_queue[PRECOMPILE_QUEUE_SIZE];
+static u32 precompile_count = 0;
+static u32 precompile_deadline = 0;
+
+static u32 precompile_time_ms(void)
+{
+#ifdef THREADED_JIT
+  // Might run in the translation thread, wall time is needed
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u32)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+  return (u32)((u64)clock() * 1000 / CLOCKS_PER_SEC);
+#endif
+}
+
+static bool precompile_code_address(u32 pc)
+{
+  if (pc < 0x4000)
+    return true;
+  return (pc >> 24) >= 0x08 && (pc >> 24) <= 0x0D &&
+         (pc & 0x1FFFFFF) < gamepak_size;
+}
+
+static void precompile_push(u32 key)
+{
+  if (precompile_code_address(key & ~1U) &&
+      precompile_count < PRECOMPILE_QUEUE_SIZE &&
+      !rom_branch_hash_find(key))
+    precompile_queue[precompile_count++] = key;
+}
+
+static u8 *precompile_code_page(u32 pc)
+{
+  u8 *page = memory_map_read[pc >> 15];
+  if (!page)
+    page = load_gamepak_page((pc >> 15) & 0x3FF);
+  return page;
+}
+
+// Scans until an unconditional exit that no previous (forward) branch skips
+static void precompile_scan_arm(u32 pc)
+{
+  u32 furthest_target = pc;
+  u32 i;
+
+  for (i = 0; i < PRECOMPILE_SCAN_LENGTH && precompile_code_address(pc);
+       i++, pc += 4)
+  {
+    u32 opcode = address32(precompile_code_page(pc), pc & 0x7FFF);
+    u32 condition = opcode >> 28;
+    bool exit = false;
+
+    if (condition == 0xF)
+      break;
+
+    if ((opcode & 0x0E000000) == 0x0A000000)
+    {
+      u32 target = pc + 8 + ((s32)(opcode << 8) >> 6);
+
+      if (opcode & 0x01000000)
+        precompile_push(target);
+      else if (condition == 0xE)
+      {
+        precompile_push(target);
+        exit = true;
+      }
+      else if (target > furthest_target)
+        furthest_target = target;
+    }
+    else if (condition == 0xE)
+    {
+      // bx, ALU ops (not MSR and friends), ldr and ldm writing the PC
+      exit = ((opcode & 0x0FFFFFF0) == 0x012FFF10) ||
+             (((opcode & 0x0C00F000) == 0x0000F000) &&
+              ((opcode & 0x01900000) != 0x01000000)) ||
+             ((opcode & 0x0C10F000) == 0x0410F000) ||
+             ((opcode & 0x0E108000) == 0x08108000);
+    }
+
+    if (exit && pc >= furthest_target)
+      break;
+  }
+}
+
+static void precompile_scan_thumb(u32 pc)
+{
+  u32 furthest_target = pc;
+  u32 i;
+
+  for (i = 0; i < PRECOMPILE_SCAN_LENGTH && precompile_code_address(pc);
+       i++, pc += 2)
+  {
+    u32 opcode = address16(precompile_code_page(pc), pc & 0x7FFF);
+    bool exit = false;
+
+    if ((opcode & 0xF800) == 0xF000)
+    {
+      u32 opcode_low = address16(precompile_code_page(pc + 2),
+                                 (pc + 2) & 0x7FFF);
+      if ((opcode_low & 0xF800) != 0xF800)
+        break;
+      precompile_push((pc + 4 + ((s32)(opcode << 21) >> 9) +
+                       ((opcode_low & 0x7FF) << 1)) | 1);
+      pc += 2;
+    }
+    else if ((opcode & 0xF800) == 0xE000)
+    {
+      precompile_push((pc + 4 + ((s32)(opcode << 21) >> 20)) | 1);
+      exit = true;
+    }
+    else if ((opcode & 0xF800) == 0xE800 || (opcode & 0xFF00) == 0xDE00)
+      break;
+    else if ((opcode & 0xF000) == 0xD000 && (opcode & 0x0F00) != 0x0F00)
+    {
+      u32 target = pc + 4 + ((s32)(opcode << 24) >> 23);
+      if (target > furthest_target)
+        furthest_target = target;
+    }
+    else
+    {
+      // bx, pop {pc}, mov/add pc
+      exit = ((opcode & 0xFF87) == 0x4700) ||
+             ((opcode & 0xFF00) == 0xBD00) ||
+             ((opcode & 0xFF87) == 0x4687) ||
+             ((opcode & 0xFF87) == 0x4487);
+    }
+
+    if (exit && pc >= furthest_target)
+      break;
+  }
+}
+
+// Translates the next pending entry point, returns false once done (the
+// queue is empty, the time budget is spent or the cache is half full).
+static bool precompile_rom_block(void)
+{
+  u32 key;
+  u8 *blkptr;
+
+  if (!precompile_count ||
+      (s32)(precompile_time_ms() - precompile_deadline) >= 0 ||
+      (u32)(rom_translation_ptr - rom_translation_cache) >=
+        ROM_TRANSLATION_CACHE_SIZE / 2 ||
+      rom_branch_hash_count >= ROM_BRANCH_HASH_MAX_COUNT / 2)
+  {
+    precompile_count = 0;
+    return false;
+  }
+
+  key = precompile_queue[--precompile_count];
+  if (rom_branch_hash_find(key))
+    return true;
+
+  if (key & 1)
+    blkptr = block_lookup_translate_thumb(key);
+  else
+    blkptr = block_lookup_translate_arm(key);
+
+  if (blkptr)
+  {
+    if (key & 1)
+      precompile_scan_thumb(key & ~1U);
+    else
+      precompile_scan_arm(key);
+  }
+  return true;
+}
+
+#ifdef THREADED_JIT
+
+#ifndef translation_exit_address
+  #error "The translation thread is not supported by this backend"
+#endif
+
+/* Translation thread: ROM and BIOS blocks missing from the cache are queued
+   and translated in the background, while the translated code exits to the
+   interpreter (see execute_arm_translate) until the block it is waiting for
+   is ready. RAM blocks are still translated synchronously. Translations are
+   serialized by translation_mutex, and the thread only runs during
+   execute_arm_translate, so the caches can be modified in between frames. */
+
+#define TRANSLATION_QUEUE_SIZE 64
+
+static pthread_t translation_thread;
+static pthread_mutex_t translation_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t translation_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t translation_queue_cond = PTHREAD_COND_INITIALIZER;
+
+// Pending blocks (PC | thumb), the most recent request goes first
+static u32 translation_queue[TRANSLATION_QUEUE_SIZE];
+static u32 translation_queue_count = 0;
+static u32 translation_awaited_key = ~0U;
+static bool translation_thread_started = false;
+static bool translation_thread_quit = false;
+static bool translation_thread_busy = false;
+
+static bool in_translation_thread(void)
+{
+  return translation_thread_started &&
+         pthread_equal(pthread_self(), translation_thread);
+}
+
+static void *translation_thread_main(void *arg)
+{
+  pthread_mutex_lock(&translation_queue_mutex);
+  while (!translation_thread_quit)
+  {
+    u32 key = ~0U;
+    u8 *blkptr = NULL;
+
+    if (!translation_thread_enabled || rom_cache_full ||
+        (!translation_queue_count && !precompile_count))
+    {
+      pthread_cond_wait(&translation_queue_cond, &translation_queue_mutex);
+      continue;
+    }
+
+    // Requested blocks go first, precompilation uses the idle time
+    if (translation_queue_count)
+      key = translation_queue[--translation_queue_count];
+    translation_thread_busy = true;
+    pthread_mutex_unlock(&translation_queue_mutex);
+
+    pthread_mutex_lock(&translation_mutex);
+    if (key == ~0U)
+      precompile_rom_block();
+    else if (key & 1)
+      blkptr = block_lookup_translate_thumb(key);
+    else
+      blkptr = block_lookup_translate_arm(key);
+    translate_icache_sync();
+    pthread_mutex_unlock(&translation_mutex);
+
+    pthread_mutex_lock(&translation_queue_mutex);
+    translation_thread_busy = false;
+    if (blkptr && key == translation_awaited_key)
+    {
+      translation_awaited_key = ~0U;
+      interpreter_resume_pc = key & ~1U;
+    }
+    pthread_cond_broadcast(&translation_queue_cond);
+  }
+  pthread_mutex_unlock(&translation_queue_mutex);
+  return NULL;
+}
+
+// Performs the eviction the translation thread ran into, if any
+static void translation_thread_evict(void)
+{
+  pthread_mutex_lock(&translation_mutex);
+  if (rom_cache_full)
+  {
+    rom_cache_evict_segment((u32)(rom_translation_ptr - rom_translation_cache));
+    rom_cache_full = false;
+  }
+  pthread_mutex_unlock(&translation_mutex);
+}
+
+// Block lookup while the translation thread is running: missing ROM blocks
+// are requested and the lookup returns the exit to the interpreter.
+static u8 *block_lookup_address_async(u32 pc, u32 thumb)
+{
+  u32 region = pc >> 24;
+  u8 *ret = NULL;
+  u32 i;
+
+  pc &= thumb ? ~1U : ~3U;
+
+  if (rom_cache_full)
+  {
+    translation_thread_evict();
+    pthread_mutex_lock(&translation_queue_mutex);
+    pthread_cond_broadcast(&translation_queue_cond);
+    pthread_mutex_unlock(&translation_queue_mutex);
+  }
+
+  if (region == 0x0 || (region >= 0x8 && region <= 0xD))
+  {
+    u32 key = pc | thumb;
+    u32 blk_offset = rom_branch_hash_find(key);
+
+    if (blk_offset)
+      return &rom_translation_cache[blk_offset + block_prologue_size];
+
+    pthread_mutex_lock(&translation_queue_mutex);
+    for (i = 0; i < translation_queue_count; i++)
+    {
+      if (translation_queue[i] == key)
+        break;
+    }
+    if (i == translation_queue_count &&
+        translation_queue_count == TRANSLATION_QUEUE_SIZE)
+      i = 0;   // Drop the oldest request
+    else if (i == translation_queue_count)
+      translation_queue_count++;
+    memmove(&translation_queue[i], &translation_queue[i + 1],
+            (translation_queue_count - i - 1) * sizeof(u32));
+    translation_queue[translation_queue_count - 1] = key;
+
+    translation_awaited_key = key;
+    interpreter_resume_pc = ~0U;
+    pthread_cond_broadcast(&translation_queue_cond);
+    pthread_mutex_unlock(&translation_queue_mutex);
+
+    reg[REG_PC] = pc;
+    return translation_exit_address;
+  }
+
+  pthread_mutex_lock(&translation_mutex);
+  for (i = 0; i < 4 && !ret; i++)
+  {
+    if (thumb)
+      ret = block_lookup_translate_thumb(pc);
+    else
+      ret = block_lookup_translate_arm(pc);
+  }
+  pthread_mutex_unlock(&translation_mutex);
+
+  if (ret)
+  {
+    translate_icache_sync();
+    return ret;
+  }
+
+  printf("bad jump %x (%x)\n", pc, reg[REG_PC]);
+  fflush(stdout);
+  return NULL;
+}
+
+bool start_translation_thread(void)
+{
+  if (translation_thread_started)
+    return true;
+
+  // Loading ROM pages on demand is not thread safe
+  if (gamepak_must_swap())
+    return false;
+
+  translation_thread_quit = false;
+  translation_queue_count = 0;
+  if (pthread_create(&translation_thread, NULL, translation_thread_main, NULL))
+    return false;
+
+  translation_thread_started = true;
+  return true;
+}
+
+void stop_translation_thread(void)
+{
+  if (!translation_thread_started)
+    return;
+
+  pthread_mutex_lock(&translation_queue_mutex);
+  translation_thread_quit = true;
+  pthread_cond_broadcast(&translation_queue_cond);
+  pthread_mutex_unlock(&translation_queue_mutex);
+  pthread_join(translation_thread, NULL);
+
+  translation_thread_started = false;
+  translation_queue_count = 0;
+  translation_thread_evict();
+}
+
+// Called when entering and leaving execute_arm_translate
+bool resume_translation_thread(void)
+{
+  if (!translation_thread_started)
+    return false;
+
+  pthread_mutex_lock(&translation_queue_mutex);
+  translation_thread_enabled = true;
+  translation_awaited_key = ~0U;
+  interpreter_resume_pc = ~0U;
+  pthread_cond_broadcast(&translation_queue_cond);
+  pthread_mutex_unlock(&translation_queue_mutex);
+  return true;
 }
 
+void pause_translation_thread(void)
+{
+  pthread_mutex_lock(&translation_queue_mutex);
+  translation_thread_enabled = false;
+  while (translation_thread_busy)
+    pthread_cond_wait(&translation_queue_cond, &translation_queue_mutex);
+  interpreter_resume_pc = ~0U;
+  pthread_mutex_unlock(&translation_queue_mutex);
+
+  translation_thread_evict();
+}
+
+#endif
+
+// Precompiles the code reachable from the ROM entry point and the BIOS
+// vectors, spending up to time_budget_ms on it. With the translation thread
+// running it is left to the thread, which works on it whenever idle.
+void precompile_rom_translation_cache(u32 time_budget_ms)
+{
+  // Scanning would keep swapping the ROM pages in and out
+  if (gamepak_must_swap())
+    return;
+
+  precompile_count = 0;
+  precompile_deadline = precompile_time_ms() + time_budget_ms;
+  precompile_push(0x08000000);
+  precompile_push(0x00000018);     // IRQ vector
+  precompile_push(0x00000008);     // SWI vector
+  precompile_push(0x00000000);
+
+#ifdef THREADED_JIT
+  if (translation_thread_started)
+    return;
+#endif
+
+  while (precompile_rom_block());
+  translate_icache_sync();
+}
+
+#ifdef generate_trace_counter
+
+// Points the hash entry of a block to a different translation of it
+static void rom_branch_hash_replace(u32 key, u32 blk_offset)
+{
+  u32 i = rom_branch_hash_slot(key);
+
+  while (rom_branch_hash[i].offset)
+  {
+    if (rom_branch_hash[i].pc_value == key)
+    {
+      rom_branch_hash_publish(&rom_branch_hash[i].offset, blk_offset);
+      return;
+    }
+    i = (i + 1) & (ROM_BRANCH_HASH_SIZE - 1);
+  }
+
+  if (rom_branch_hash_count < ROM_BRANCH_HASH_MAX_COUNT)
+    rom_branch_hash_insert(key, blk_offset);
+}
+
+// With the translation thread running, the caches can only be modified by
+// whoever holds translation_mutex. The trace is left for later if busy.
+static bool trace_translation_begin(void)
+{
+#ifdef THREADED_JIT
+  if (translation_thread_enabled &&
+      (rom_cache_full || pthread_mutex_trylock(&translation_mutex)))
+    return false;
+#endif
+  translate_trace = true;
+  return true;
+}
+
+static void trace_translation_end(void)
+{
+  translate_trace = false;
+#ifdef THREADED_JIT
+  if (translation_thread_enabled)
+    pthread_mutex_unlock(&translation_mutex);
+#endif
+}
+
+static void trace_reset_counters(void)
+{
+  u32 i;
+  for (i = 0; i < TRACE_COUNTER_COUNT; i++)
+    trace_counters[i] = TRACE_HOT_THRESHOLD;
+}
+
+// Called on entry of a ROM block whose execution counter ran out. The block
+// is retranslated as a trace (see scan_block) at the end of the ROM cache,
+// which replaces it in the hash, and its counter sequence is turned into a
+// jump to the trace (linked like a block exit, so that it falls back to the
+// block body if the trace gets evicted). Blocks that do not end with a
+// branch that can be followed simply stop counting. Returns the code to
+// resume execution at.
+#define block_trace_hot_builder(type, thumb)                                  \
+u8 *block_trace_hot_##type(u32 pc, u8 *block_entry, u8 *block_body)           \
+{                                                                             \
+  u32 key = pc | thumb;                                                       \
+  u32 flush_count = translation_flush_count;                                  \
+  u32 trace_offset;                                                           \
+  u8 *trace_ptr;                                                              \
+  u8 *branch_source;                                                          \
+  bool result;                                                                \
+                                                                              \
+  /* The counter might be shared with other blocks, rearm it for them */      \
+  trace_counters[trace_counter_slot(key)] = TRACE_HOT_THRESHOLD;              \
+                                                                              \
+  if (!trace_translation_begin())                                             \
+    return block_body;                                                        \
+                                                                              \
+  branch_source = trace_counter_to_jump(block_entry, block_body);             \
+  platform_cache_sync(block_entry, block_body);                               \
+                                                                              \
+  trace_offset = (u32)(rom_translation_ptr - rom_translation_cache);          \
+  trace_ptr = rom_translation_ptr + block_prologue_size;                      \
+  result = translate_block_##type(pc, false);                                 \
+                                                                              \
+  if (!result || flush_count != translation_flush_count)                      \
+  {                                                                           \
+    /* The block itself might be gone */                                      \
+    trace_translation_end();                                                  \
+    return block_lookup_address_##type(pc);                                   \
+  }                                                                           \
+                                                                              \
+  if (translated_trace_segments == 1)                                         \
+  {                                                                           \
+    /* Nothing to gain, drop it */                                            \
+    rom_translation_ptr = &rom_translation_cache[trace_offset];               \
+    rom_cache_truncate_relocs(trace_offset,                                   \
+     rom_cache_segment_end(rom_cache_segment));                               \
+    trace_translation_end();                                                  \
+    return block_body;                                                        \
+  }                                                                           \
+                                                                              \
+  translate_icache_sync();                                                    \
+  rom_branch_hash_replace(key, trace_offset);                                 \
+  block_link_exit(branch_source, block_body, trace_ptr);                      \
+  trace_translation_end();                                                    \
+  return trace_ptr;                                                           \
+}                                                                             \
+
+block_trace_hot_builder(arm, 0);
+block_trace_hot_builder(thumb, 1);
+
+#else
+
+#define trace_reset_counters()
+
+#endif
+
 void init_dynarec_caches(void)
 {
   /* Initialize caches so that we can start initalizing the emitter. */
   rom_translation_ptr = last_rom_translation_ptr = &rom_translation_cache[0];
-  memset(rom_branch_hash, 0, sizeof(rom_branch_hash));
+  rom_branch_hash_clear();
+  block_link_count = 0;
+  rom_cache_reloc_count = 0;
+  rom_cache_segment = 0;
 
   ram_translation_ptr = last_ram_translation_ptr = &ram_translation_cache[0];
   memset(iwram, 0, 0x8000);
   memset(&ewram[0x40000], 0, 0x40000);
+  ram_code_reset_pages();
+  trace_reset_counters();
+  precompile_count = 0;
 
   ewram_code_min = 0;
   ewram_code_max = 0x40000;
@@ -3546,103 +5968,526 @@ void flush_dynarec_caches(void)
   flush_translation_cache_ram();
 }
 
-void partial_flush_ram_full_dma(u32 address)
+// Persistent ROM translation cache. The ROM cache contents only depend on
+// the ROM and BIOS images, the few settings that alter code generation and
+// the emulator build itself, so they can be saved on exit and reused on the
+// next run. Any key mismatch results in the file being ignored.
+
+#define ROM_CACHE_FILE_MAGIC "gpSPjit4"
+
+typedef struct
 {
-  u8 *smc_data;
-  u8 *ewram_smc_data = &ewram[0x40000];
-  u8 *iwram_smc_data = iwram;
+  char magic[8];
+  u32 build_hash;
+  u32 rom_crc;
+  u32 rom_size;
+  u32 bios_crc;
+  u32 idle_loop_target_pc;
+  u32 cheat_master_hook;
+  u32 cache_size;
+  u32 branch_hash_size;
+  u32 watermark;
+  u32 segment_count;
+  u32 current_segment;
+  u32 segment_top[ROM_TRANSLATION_CACHE_SEGMENTS];
+  u32 bios_swi_offset;
+  u32 branch_count;
+  u32 reloc_count;
+  u32 link_count;
+  u64 cache_base;
+  u64 text_base;
+} rom_cache_header_type;
+
+// A recorded block link, as offsets within the ROM cache
+typedef struct
+{
+  u32 branch_source;
+  u32 link_stub;
+  u32 target;
+} rom_cache_link_type;
 
-  // printf("SMC Data Address: %x \n", address);
+#ifdef rom_cache_relocate
 
-  switch (address >> 24)
+static u32 rom_cache_build_hash(void)
+{
+  // FNV-1a over anything that identifies the code generator
+  static const char build_id[] =
+    GPSP_VERSION " " __DATE__ " " __TIME__ " " rom_cache_backend;
+  u32 hash = 0x811C9DC5;
+  u32 i;
+
+  for (i = 0; i < sizeof(build_id); i++)
+    hash = (hash ^ (u8)build_id[i]) * 0x01000193;
+  hash = (hash ^ (u32)sizeof(void *)) * 0x01000193;
+  return hash;
+}
+
+static void rom_cache_fill_key(rom_cache_header_type *hdr)
+{
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, ROM_CACHE_FILE_MAGIC, sizeof(hdr->magic));
+  hdr->build_hash = rom_cache_build_hash();
+  hdr->rom_crc = gamepak_crc32();
+  hdr->rom_size = gamepak_size;
+  hdr->bios_crc = crc32_update(0, bios_rom, sizeof(bios_rom));
+  hdr->idle_loop_target_pc = idle_loop_target_pc;
+  hdr->cheat_master_hook = cheat_master_hook;
+  hdr->cache_size = ROM_TRANSLATION_CACHE_SIZE;
+  hdr->branch_hash_size = ROM_BRANCH_HASH_SIZE;
+  hdr->text_base = (uintptr_t)update_gba;
+  hdr->cache_base = (uintptr_t)rom_translation_cache;
+}
+
+#ifdef PERF_JIT_MAP
+
+static int perf_map_offset_compare(const void *a, const void *b)
+{
+  u32 offset_a = ((const rom_branch_entry_type *)a)->offset;
+  u32 offset_b = ((const rom_branch_entry_type *)b)->offset;
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// Blocks loaded from disk were never translated in this process, describe
+// them to perf as well. Each one ends where the next one (or its segment)
+// begins.
+static void perf_map_record_rom_cache(void)
+{
+  rom_branch_entry_type *blocks;
+  u32 count = 0, i;
+
+  blocks = malloc(MAX(rom_branch_hash_count, 1) *
+                  sizeof(rom_branch_entry_type));
+  if (!blocks)
+    return;
+
+  for (i = 0; i < ROM_BRANCH_HASH_SIZE; i++)
   {
-    case 0x02: /* EWRAM */
-      smc_data = ewram_smc_data + (address & 0x3FFFE);
+    if (rom_branch_hash[i].offset)
+      blocks[count++] = rom_branch_hash[i];
+  }
+  qsort(blocks, count, sizeof(rom_branch_entry_type),
+        perf_map_offset_compare);
+
+  for (i = 0; i < count; i++)
+  {
+    u32 offset = blocks[i].offset;
+    u32 end;
+
+    // Blocks below the watermark are translated on every start anyway
+    if (offset < rom_cache_watermark)
+      continue;
+
+    end = rom_cache_segment_top[rom_cache_segment_of(offset)];
+    if (i + 1 < count)
+      end = MIN(end, blocks[i + 1].offset);
+    perf_map_record_block(&rom_translation_cache[offset],
+                          &rom_translation_cache[end],
+                          blocks[i].pc_value & ~1U, blocks[i].pc_value & 1);
+  }
+  free(blocks);
+}
+
+#else
+
+#define perf_map_record_rom_cache()
+
+#endif
+
+// The file holds the code of each segment, from its start up to its top.
+// The first one also holds the code below the watermark.
+static u32 rom_cache_saved_start(u32 segment)
+{
+  return segment ? rom_cache_segment_start(segment) : 0;
+}
+
+static u32 rom_cache_saved_size(const rom_cache_header_type *hdr)
+{
+  u32 size = 0, i;
+  for (i = 0; i < rom_cache_segments; i++)
+    size += hdr->segment_top[i] - rom_cache_saved_start(i);
+  return size;
+}
+
+// Whether [offset, offset + size) lies within the saved code
+static bool rom_cache_saved_range(const rom_cache_header_type *hdr,
+                                  u32 offset, u32 size)
+{
+  return offset < ROM_TRANSLATION_CACHE_SIZE &&
+         offset + size <= hdr->segment_top[rom_cache_segment_of(offset)];
+}
+
+bool load_rom_translation_cache(void)
+{
+  rom_cache_header_type key, *hdr;
+  const rom_branch_entry_type *branches;
+  const u8 *code, *relocs, *links;
+  u8 *data;
+  int64_t file_size;
+  u32 code_size;
+  s32 delta;
+  u32 i;
+  RFILE *fd;
+
+#ifdef BLOCK_PROFILE_ANALYZE
+  // Cached blocks would count into entries that were never registered
+  return false;
+#endif
+
+  if (!rom_translation_cache_filename[0])
+    return false;
+
+  fd = filestream_open(rom_translation_cache_filename,
+                       RETRO_VFS_FILE_ACCESS_READ,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  if (!fd)
+    return false;
+
+  file_size = filestream_get_size(fd);
+  if (file_size < (int64_t)sizeof(rom_cache_header_type) ||
+      file_size > (int64_t)(sizeof(rom_cache_header_type) +
+                            sizeof(rom_branch_hash) +
+                            ROM_TRANSLATION_CACHE_SIZE * 2))
+  {
+    filestream_close(fd);
+    return false;
+  }
+
+  data = malloc(file_size);
+  if (!data)
+  {
+    filestream_close(fd);
+    return false;
+  }
+
+  if (filestream_read(fd, data, file_size) != file_size)
+  {
+    filestream_close(fd);
+    free(data);
+    return false;
+  }
+  filestream_close(fd);
+
+  hdr = (rom_cache_header_type *)data;
+  rom_cache_fill_key(&key);
+
+  if (memcmp(hdr->magic, key.magic, sizeof(key.magic)) ||
+      hdr->build_hash != key.build_hash ||
+      hdr->rom_crc != key.rom_crc ||
+      hdr->rom_size != key.rom_size ||
+      hdr->bios_crc != key.bios_crc ||
+      hdr->idle_loop_target_pc != key.idle_loop_target_pc ||
+      hdr->cheat_master_hook != key.cheat_master_hook ||
+      hdr->cache_size != key.cache_size ||
+      hdr->branch_hash_size != key.branch_hash_size ||
+      hdr->watermark != rom_cache_watermark ||
+      hdr->segment_count != rom_cache_segments ||
+      hdr->current_segment >= rom_cache_segments ||
+      hdr->bios_swi_offset >= hdr->watermark ||
+      hdr->branch_count > ROM_BRANCH_HASH_MAX_COUNT ||
+      hdr->link_count > MAX_BLOCK_LINKS)
+  {
+    free(data);
+    return false;
+  }
+
+  for (i = 0; i < rom_cache_segments; i++)
+  {
+    if (hdr->segment_top[i] < rom_cache_segment_start(i) ||
+        hdr->segment_top[i] > rom_cache_segment_end(i))
       break;
-    case 0x03: /* IWRAM */
-      smc_data = iwram_smc_data + (address & 0x7FFE);
-//      printf("SMC Data Address: %x \n", smc_data);
+  }
+
+  code_size = (i == rom_cache_segments) ? rom_cache_saved_size(hdr) : 0;
+  if (i != rom_cache_segments ||
+      file_size != (int64_t)(sizeof(rom_cache_header_type) +
+                             hdr->branch_count * sizeof(rom_branch_entry_type) +
+                             code_size + hdr->reloc_count * sizeof(u32) +
+                             hdr->link_count * sizeof(rom_cache_link_type)))
+  {
+    free(data);
+    return false;
+  }
+
+  branches = (const rom_branch_entry_type *)
+    (data + sizeof(rom_cache_header_type));
+  for (i = 0; i < hdr->branch_count; i++)
+  {
+    if (!rom_cache_saved_range(hdr, branches[i].offset, 1))
       break;
-    default:   /* no smc_data */
-      return;
   }
 
-  u8 *smc_data_area, *smc_data_area_end, *smc_data_right ;
-  smc_data_right = smc_data; // Save this pointer to go to the right later
+  if (i != hdr->branch_count)
+  {
+    free(data);
+    return false;
+  }
 
-  switch (address >> 24)
+  code = (const u8 *)&branches[hdr->branch_count];
+  relocs = code + code_size;
+  for (i = 0; i < hdr->reloc_count; i++)
   {
-    case 0x02: /* EWRAM */
-      smc_data_area = ewram_smc_data;
-      smc_data_area_end = ewram_smc_data + 0x40000;
+    u32 offset, prev_offset = 0;
+    memcpy(&offset, &relocs[i * sizeof(u32)], sizeof(u32));
+    if (i)
+      memcpy(&prev_offset, &relocs[(i - 1) * sizeof(u32)], sizeof(u32));
+    if (!rom_cache_saved_range(hdr, offset, sizeof(u32)) ||
+        (i && offset <= prev_offset))
       break;
-    case 0x03: /* IWRAM */
-      smc_data_area = iwram_smc_data;
-      smc_data_area_end = iwram_smc_data + 0x8000;
+  }
+
+  if (i != hdr->reloc_count)
+  {
+    free(data);
+    return false;
+  }
+
+  links = relocs + hdr->reloc_count * sizeof(u32);
+  for (i = 0; i < hdr->link_count; i++)
+  {
+    rom_cache_link_type link;
+    memcpy(&link, &links[i * sizeof(link)], sizeof(link));
+    if (!rom_cache_saved_range(hdr, link.branch_source, 1) ||
+        !rom_cache_saved_range(hdr, link.link_stub, 1) ||
+        !rom_cache_saved_range(hdr, link.target, 1))
       break;
   }
-  
-  *((u16*) smc_data) = 0;
 
-  while (1)
+  if (i != hdr->link_count)
   {
-    smc_data = smc_data - 2;
-    if (smc_data < smc_data_area)
-      smc_data = smc_data_area_end - 2; // Wrap to the end
-    if (*((u16*) smc_data) == 0 || *((u16*) smc_data) == UB_16)
-       break; 
-     *((u16*) smc_data) = 0;
+    free(data);
+    return false;
   }
 
-  smc_data = smc_data_right;
+  if (hdr->reloc_count > rom_cache_reloc_capacity)
+  {
+    u32 *new_relocs = realloc(rom_cache_relocs,
+                              hdr->reloc_count * sizeof(u32));
+    if (!new_relocs)
+    {
+      free(data);
+      return false;
+    }
+    rom_cache_relocs = new_relocs;
+    rom_cache_reloc_capacity = hdr->reloc_count;
+  }
 
-  while (1)
+  memcpy(rom_cache_relocs, relocs, hdr->reloc_count * sizeof(u32));
+  rom_cache_reloc_count = hdr->reloc_count;
+
+  rom_branch_hash_clear();
+  for (i = 0; i < hdr->branch_count; i++)
+    rom_branch_hash_insert(branches[i].pc_value, branches[i].offset);
+
+  // Every segment is filled on from where it was left
+  for (i = 0; i < rom_cache_segments; i++)
   {
-    smc_data = smc_data + 2;
-    if (smc_data == smc_data_area_end)
-      smc_data = smc_data_area; // Wrap to the beginning
-    if (*((u16*) smc_data) == 0)
-      break;
-      *((u16*) smc_data) = 0;
+    u32 start = rom_cache_saved_start(i);
+    u32 size = hdr->segment_top[i] - start;
+
+    memcpy(&rom_translation_cache[start], code, size);
+    code += size;
+    rom_cache_segment_top[i] = hdr->segment_top[i];
+    rom_cache_segment_execs[i] = 0;
+  }
+  rom_cache_segment = hdr->current_segment;
+
+  // The saved code has its exits linked already, eviction must be able to
+  // unlink them again.
+  for (i = 0; i < hdr->link_count; i++)
+  {
+    rom_cache_link_type link;
+    memcpy(&link, &links[i * sizeof(link)], sizeof(link));
+    block_links[i].branch_source = &rom_translation_cache[link.branch_source];
+    block_links[i].link_stub = &rom_translation_cache[link.link_stub];
+    block_links[i].target = &rom_translation_cache[link.target];
   }
+  block_link_count = hdr->link_count;
 
+  last_rom_translation_ptr =
+    &rom_translation_cache[rom_cache_segment_top[rom_cache_segment]];
+  rom_translation_ptr = last_rom_translation_ptr;
+
+  // Calls out of the cache are relative, rebase them if the emulator or
+  // the cache got mapped somewhere else this time.
+  delta = (s32)((key.text_base - hdr->text_base) -
+                (key.cache_base - hdr->cache_base));
+  if (delta)
+  {
+    for (i = 0; i < rom_cache_reloc_count; i++)
+      rom_cache_relocate(&rom_translation_cache[rom_cache_relocs[i]], delta);
+  }
+
+  bios_swi_entrypoint = &rom_translation_cache[hdr->bios_swi_offset];
+  for (i = 0; i < rom_cache_segments; i++)
+    platform_cache_sync(&rom_translation_cache[rom_cache_saved_start(i)],
+                        &rom_translation_cache[rom_cache_segment_top[i]]);
+  perf_map_record_rom_cache();
+
+  free(data);
+  return true;
 }
 
-void partial_flush_ram_full(u32 address)
+static int rom_cache_reloc_compare(const void *a, const void *b)
 {
-  u8 *smc_data;
-  u8 *ewram_smc_data = &ewram[0x40000];
-  u8 *iwram_smc_data = iwram;
+  u32 offset_a = *(const u32 *)a;
+  u32 offset_b = *(const u32 *)b;
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
 
-  switch (address >> 24)
+bool save_rom_translation_cache(void)
+{
+  rom_cache_header_type hdr;
+  rom_branch_entry_type *branches;
+  rom_cache_link_type *links;
+  u32 *relocs;
+  char tmpname[sizeof(rom_translation_cache_filename) + 4];
+  bool ok;
+  u32 i;
+  RFILE *fd;
+
+  if (!rom_translation_cache_filename[0])
+    return false;
+
+  rom_cache_fill_key(&hdr);
+  hdr.watermark = rom_cache_watermark;
+  hdr.bios_swi_offset = (u32)(bios_swi_entrypoint - rom_translation_cache);
+
+  // Relocations past the current pointer belong to an aborted translation
+  rom_cache_segment_top[rom_cache_segment] =
+    (u32)(rom_translation_ptr - rom_translation_cache);
+  rom_cache_truncate_relocs(rom_cache_segment_top[rom_cache_segment],
+                            rom_cache_segment_end(rom_cache_segment));
+
+  // Once segments got evicted the cache is no longer filled linearly, save
+  // the code of each segment (and the relocations in order).
+  hdr.segment_count = rom_cache_segments;
+  hdr.current_segment = rom_cache_segment;
+  for (i = 0; i < rom_cache_segments; i++)
+    hdr.segment_top[i] = rom_cache_segment_top[i];
+  hdr.reloc_count = rom_cache_reloc_count;
+  relocs = malloc(MAX(hdr.reloc_count, 1) * sizeof(u32));
+  if (!relocs)
+    return false;
+  memcpy(relocs, rom_cache_relocs, hdr.reloc_count * sizeof(u32));
+  qsort(relocs, hdr.reloc_count, sizeof(u32), rom_cache_reloc_compare);
+
+  // Only the used hash entries are saved, they get reinserted on load
+  branches = malloc(MAX(rom_branch_hash_count, 1) *
+                    sizeof(rom_branch_entry_type));
+  if (!branches)
   {
-    case 0x02: /* EWRAM */
-      smc_data = ewram_smc_data + (address & 0x3FFFE);
-      break;
-    case 0x03: /* IWRAM */
-      smc_data = iwram_smc_data + (address & 0x7FFE);
-//      printf("SMC Data Address: %x \n", smc_data);
-      break;
-    default:   /* no smc_data */
-      return;
+    free(relocs);
+    return false;
+  }
+  hdr.branch_count = 0;
+  for (i = 0; i < ROM_BRANCH_HASH_SIZE; i++)
+  {
+    if (rom_branch_hash[i].offset)
+      branches[hdr.branch_count++] = rom_branch_hash[i];
+  }
+
+  // Links made by RAM blocks are gone along with the RAM cache
+  links = malloc(MAX(block_link_count, 1) * sizeof(rom_cache_link_type));
+  if (!links)
+  {
+    free(relocs);
+    free(branches);
+    return false;
+  }
+  hdr.link_count = 0;
+  for (i = 0; i < block_link_count; i++)
+  {
+    u8 *branch_source = block_links[i].branch_source;
+    if (branch_source < rom_translation_cache ||
+        branch_source >= rom_translation_cache + ROM_TRANSLATION_CACHE_SIZE)
+      continue;
+    links[hdr.link_count].branch_source =
+      (u32)(branch_source - rom_translation_cache);
+    links[hdr.link_count].link_stub =
+      (u32)(block_links[i].link_stub - rom_translation_cache);
+    links[hdr.link_count].target =
+      (u32)(block_links[i].target - rom_translation_cache);
+    hdr.link_count++;
   }
 
-  u8 *smc_data_area, *smc_data_area_end, *smc_data_right ;
-  smc_data_right = smc_data; // Save this pointer to go to the right later
+  // Written under a temporary name and renamed when complete, a crash or
+  // a full disk must not leave a truncated cache behind to be loaded.
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", rom_translation_cache_filename);
+  fd = filestream_open(tmpname, RETRO_VFS_FILE_ACCESS_WRITE,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  if (!fd)
+  {
+    free(relocs);
+    free(branches);
+    free(links);
+    return false;
+  }
 
+  ok = filestream_write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+       filestream_write(fd, branches,
+         hdr.branch_count * sizeof(rom_branch_entry_type)) ==
+         hdr.branch_count * sizeof(rom_branch_entry_type);
+  for (i = 0; ok && i < rom_cache_segments; i++)
+  {
+    u32 start = rom_cache_saved_start(i);
+    u32 size = hdr.segment_top[i] - start;
+    ok = filestream_write(fd, &rom_translation_cache[start], size) == size;
+  }
+  ok = ok &&
+       filestream_write(fd, relocs,
+         hdr.reloc_count * sizeof(u32)) == hdr.reloc_count * sizeof(u32) &&
+       filestream_write(fd, links,
+         hdr.link_count * sizeof(rom_cache_link_type)) ==
+         hdr.link_count * sizeof(rom_cache_link_type);
+  if (filestream_close(fd))
+    ok = false;
+  free(relocs);
+  free(branches);
+  free(links);
+
+  if (ok && filestream_rename(tmpname, rom_translation_cache_filename))
+  {
+    // Some platforms cannot rename over an existing file, the old cache
+    // can go first (it is rebuilt anyway if this fails too)
+    filestream_delete(rom_translation_cache_filename);
+    ok = !filestream_rename(tmpname, rom_translation_cache_filename);
+  }
+  if (!ok)
+    filestream_delete(tmpname);
+  return ok;
+}
+
+#else
+
+// This backend does not track the code that needs relocation.
+bool load_rom_translation_cache(void)
+{
+  return false;
+}
+
+bool save_rom_translation_cache(void)
+{
+  return false;
+}
+
+#endif
+
+void partial_flush_ram_full_dma(u32 address)
+{
+  invalidate_ram_code(address, 4);
+}
+
+void partial_flush_ram_full(u32 address)
+{
   switch (address >> 24)
   {
     case 0x02: /* EWRAM */
-      smc_data_area = ewram_smc_data;
-      smc_data_area_end = ewram_smc_data + 0x40000;
-      break;
     case 0x03: /* IWRAM */
-      smc_data_area = iwram_smc_data;
-      smc_data_area_end = iwram_smc_data + 0x8000;
+      invalidate_ram_code(address, 4);
       break;
+    default:   /* no smc_data */
+      return;
   }
-  
-  *((u16*) smc_data) = 0;
 
   // ******* TRANSLATION GATES ********
 
@@ -3683,26 +6528,4 @@ void partial_flush_ram_full(u32 address)
   //  trentry_flush->offset_thumb = 1;
     //printf("Flush Block Start: %x , SMC Data value %x \n", trentry_flush->block_start, *((u16*) smc_data));
   //}
-
-  while (1)
-  {
-    smc_data = smc_data - 2;
-    if (smc_data < smc_data_area)
-      smc_data = smc_data_area_end - 2; // Wrap to the end
-    if (*((u16*) smc_data) == 0 || *((u16*) smc_data) == UB_16)
-       break; 
-     *((u16*) smc_data) = 0;
-  }
-
-  smc_data = smc_data_right;
-
-  while (1)
-  {
-    smc_data = smc_data + 2;
-    if (smc_data == smc_data_area_end)
-      smc_data = smc_data_area; // Wrap to the beginning
-    if (*((u16*) smc_data) == 0)
-      break;
-      *((u16*) smc_data) = 0;
-  }
 }
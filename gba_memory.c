@@ -18,11 +18,21 @@
  */
 
 #include "common.h"
+#include "memmap.h"
 #ifdef PSP_STANDALONE
   #include "psp/psp_wrapper.h"
 #else
   #include "streams/file_stream.h"
 #endif
+#include "gbz.h"
+#if defined(GAMEPAK_PREFETCH) || defined(ASYNC_BACKUP)
+  #include <pthread.h>
+#endif
+#include <fcntl.h>
+#include <assert.h>
+#if defined(_WIN32) && !defined(_XBOX)
+  #include <io.h>
+#endif
 
 /* Sound */
 #define gbc_sound_tone_control_low(channel, regn)                             \
@@ -166,6 +176,7 @@ static void gbc_trigger_sound(u32 value)
 #define trigger_sound()                                                       \
 {                                                                             \
   render_gbc_sound();                                                         \
+  assert(timers_synced());                                                    \
   timer[0].direct_sound_channels =                                            \
       ((((value >> 10) & 0x01) == 0) | ((((value >> 14) & 0x01) == 0) << 1)); \
   timer[1].direct_sound_channels =                                            \
@@ -181,6 +192,7 @@ static void gbc_trigger_sound(u32 value)
   if((value >> 15) & 0x01)                                                    \
     sound_reset_fifo(1);                                                      \
   write_ioreg(REG_SOUNDCNT_H, value & 0x770F);                                \
+  reschedule_timers();                                                        \
 }                                                                             \
 
 static void sound_control_x(u32 value)
@@ -208,10 +220,11 @@ static void sound_control_x(u32 value)
    float_to_fp8_24((GBC_BASE_RATE / sound_frequency) / (timer_reload))        \
 
 /* Main */
-extern timer_type timer[4];
+extern instance_local timer_type timer[4];
 static const u32 prescale_table[] = { 0, 6, 8, 10 };
 
 #define count_timer(timer_number)                                             \
+  assert(timers_synced());                                                    \
   timer[timer_number].reload = 0x10000 - value;                               \
   if(timer_number < 2)                                                        \
   {                                                                           \
@@ -219,6 +232,7 @@ static const u32 prescale_table[] = { 0, 6, 8, 10 };
      timer[timer_number].reload << timer[timer_number].prescale;              \
     sound_update_frequency_step(timer_number);                                \
   }                                                                           \
+  reschedule_timers();                                                        \
 
 #define adjust_sound_buffer(timer_number, channel)                            \
   if(timer[timer_number].direct_sound_channels & (0x01 << channel))           \
@@ -236,6 +250,7 @@ static void trigger_timer(u32 timer_number, u32 value)
          u32 prescale = prescale_table[value & 0x03];
          u32 timer_reload = timer[timer_number].reload;
 
+         assert(timers_synced());
          if((value >> 2) & 0x01)
             timer[timer_number].status = TIMER_CASCADE;
          else
@@ -248,6 +263,8 @@ static void trigger_timer(u32 timer_number, u32 value)
 
          timer_reload <<= prescale;
          timer[timer_number].count = timer_reload;
+         timer[timer_number].overflow_cycle = cpu_ticks + timer_reload;
+         reschedule_timers();
 
          if(timer_reload < execute_cycles)
             execute_cycles = timer_reload;
@@ -268,7 +285,9 @@ static void trigger_timer(u32 timer_number, u32 value)
    {
       if(timer[timer_number].status != TIMER_INACTIVE)
       {
+         assert(timers_synced());
          timer[timer_number].status = TIMER_INACTIVE;
+         reschedule_timers();
       }
    }
    write_ioreg(REG_TMXCNT(timer_number), value);
@@ -281,7 +300,7 @@ const u8 ws1_seq[] = {4, 1};
 const u8 ws2_seq[] = {8, 1};
 
 /* Divided by region and bus width (16/32) */
-u8 ws_cyc_seq[16][2] =
+instance_local u8 ws_cyc_seq[16][2] =
 {
   { 1, 1 }, // BIOS
   { 1, 1 }, // Invalid
@@ -300,7 +319,7 @@ u8 ws_cyc_seq[16][2] =
   { 1, 1 }, // Invalid
   { 1, 1 }, // Invalid
 };
-u8 ws_cyc_nseq[16][2] =
+instance_local u8 ws_cyc_nseq[16][2] =
 {
   { 1, 1 }, // BIOS
   { 1, 1 }, // Invalid
@@ -339,35 +358,38 @@ const u32 def_seq_cycles[16][2] =
 };
 
 
-u8 bios_rom[1024 * 16];
+instance_local u8 bios_rom[1024 * 16];
 
 // Up to 128kb, store SRAM, flash ROM, or EEPROM here.
-u8 gamepak_backup[1024 * 128];
+instance_local u8 gamepak_backup[1024 * 128];
 
-dma_transfer_type dma[4];
+instance_local dma_transfer_type dma[4];
 
 // ROM memory is allocated in blocks of 1MB to better map the native block
 // mapping system. We will try to allocate 32 of them to allow loading
 // ROMs up to 32MB, but we might fail on memory constrained systems.
 
-u8 *gamepak_buffers[32];    /* Pointers to malloc'ed blocks */
-u32 gamepak_buffer_count;   /* Value between 1 and 32 */
-u32 gamepak_size;           /* Size of the ROM in bytes */
+instance_local u8 *gamepak_buffers[32];    /* Pointers to malloc'ed blocks */
+instance_local u32 gamepak_buffer_count;   /* Value between 1 and 32 */
+instance_local u32 gamepak_size;           /* Size of the ROM in bytes */
+static instance_local u32 gamepak_file_size;  /* Actual file size (not rounded) */
+static instance_local u32 gamepak_file_crc;   /* CRC32 of the loaded ROM contents */
 // We allocate in 1MB chunks.
 const unsigned gamepak_buffer_blocksize = 1024*1024;
 
 // LRU queue with the loaded blocks and what they map to
-struct {
+instance_local struct {
   u16 next_lru;             /* Index in the struct to the next LRU entry */
   s16 phy_rom;              /* ROM page number (-1 means not mapped) */
+  u8 *data;                 /* 32KB buffer backing the entry */
 } gamepak_blk_queue[1024];
 
-u16 gamepak_lru_head;
-u16 gamepak_lru_tail;
+instance_local u16 gamepak_lru_head;
+instance_local u16 gamepak_lru_tail;
 
 // Stick page bit: prevents page eviction for a frame. This is used to prevent
 // unmapping code pages while being used (ie. in the interpreter).
-u32 gamepak_sticky_bit[1024/32];
+instance_local u32 gamepak_sticky_bit[1024/32];
 
 #define gamepak_sb_test(idx) \
  (gamepak_sticky_bit[((unsigned)(idx)) >> 5] & (1 << (((unsigned)(idx)) & 31)))
@@ -375,25 +397,101 @@ u32 gamepak_sticky_bit[1024/32];
 // This is global so that it can be kept open for large ROMs to swap
 // pages from, so there's no slowdown with opening and closing the file
 // a lot.
-RFILE *gamepak_file_large = NULL;
+instance_local RFILE *gamepak_file_large = NULL;
+
+// Page index of compressed ROM files (see gbz.h), pages are decompressed
+// as they are loaded.
+static instance_local gbz_index_type gamepak_gbz;
+static instance_local u8 *gamepak_gbz_scratch = NULL;
+
+#ifdef MMAP_ROM
+// Whole ROM file mapped in memory (instead of using the buffers above)
+#define GAMEPAK_MAPPING_SIZE (32 * 1024 * 1024)
+instance_local bool gamepak_mmap_enable = false;
+static instance_local u8 *gamepak_mapping = NULL;
+#endif
+
+#ifdef GAMEPAK_PREFETCH
+/* ROMs that do not fit in the buffers swap pages in on demand. A thread
+   reads the pages that are likely to be needed soon into staging buffers:
+   the page that followed the last fault on the faulting page, the next one
+   and the pages a DMA is about to read. A fault on a staged page swaps the
+   staging buffer with the evicted entry buffer. */
+#define GAMEPAK_PREFETCH_SLOTS 8
+
+typedef struct
+{
+  u8 *data;                 /* 32KB staging buffer */
+  s16 phy_rom;              /* ROM page it holds (-1 means free) */
+  bool ready;               /* Set by the thread once it is read */
+} gamepak_prefetch_slot_type;
+
+typedef struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t request;   /* New pages queued (or exit requested) */
+  pthread_cond_t loaded;    /* A staging buffer is ready */
+  RFILE *file;              /* The thread reads using its own handle */
+  gbz_index_type gbz;       /* Shares the index of compressed ROMs */
+  u8 *gbz_scratch;
+  bool exit;
+
+  u8 *staging;              /* Memory backing the slots initially */
+  gamepak_prefetch_slot_type slots[GAMEPAK_PREFETCH_SLOTS];
+  u8 slot_queue[GAMEPAK_PREFETCH_SLOTS];  /* Slots waiting to be read */
+  u32 queue_head;
+  u32 queue_count;
+  u32 next_slot;
+
+  // Owned by the emulation thread: page (plus one) that was faulted in
+  // after each page, zero if unknown.
+  u16 fault_next[1024];
+  u32 last_fault;
+} gamepak_prefetch_type;
+
+static instance_local gamepak_prefetch_type *gamepak_prefetch = NULL;
+
+static void gamepak_prefetch_request(u32 physical_index);
+#endif
 
 // Writes to these respective locations should trigger an update
 // so the related subsystem may react to it.
 
 // If the GBC audio waveform is modified:
-u32 gbc_sound_wave_update = 0;
+instance_local u32 gbc_sound_wave_update = 0;
 
 // Keep it 32KB until the upper 64KB is accessed, then make it 64KB.
 
-u32 backup_type = BACKUP_NONE;
-u32 sram_bankcount = SRAM_SIZE_32KB;
+instance_local u32 backup_type = BACKUP_NONE;
+instance_local u32 sram_bankcount = SRAM_SIZE_32KB;
 
-u32 flash_mode = FLASH_BASE_MODE;
-u32 flash_command_position = 0;
-u32 flash_bank_num;  // 0 or 1
-u32 flash_bank_cnt;
+instance_local u32 flash_mode = FLASH_BASE_MODE;
+instance_local u32 flash_command_position = 0;
+instance_local u32 flash_bank_num;  // 0 or 1
+instance_local u32 flash_bank_cnt;
 
-u32 flash_device_id = FLASH_DEVICE_MACRONIX_64KB;
+instance_local u32 flash_device_id = FLASH_DEVICE_MACRONIX_64KB;
+
+// Range of the backup memory modified since it was last saved (empty when
+// start >= end), and the size of the last saved file.
+static instance_local u32 backup_dirty_start = 0;
+static instance_local u32 backup_dirty_end = 0;
+static instance_local u32 backup_saved_size = 0;
+
+static inline void backup_mark_dirty(u32 offset, u32 size)
+{
+  if (backup_dirty_start >= backup_dirty_end)
+  {
+    backup_dirty_start = offset;
+    backup_dirty_end = offset + size;
+  }
+  else
+  {
+    backup_dirty_start = MIN(backup_dirty_start, offset);
+    backup_dirty_end = MAX(backup_dirty_end, offset + size);
+  }
+}
 
 void reload_timing_info()
 {
@@ -501,10 +599,10 @@ u8 read_backup(u32 address)
 // EEPROM is 512 bytes by default; it is autodetecte as 8KB if
 // 14bit address DMAs are made (this is done in the DMA handler).
 
-u32 eeprom_size = EEPROM_512_BYTE;
-u32 eeprom_mode = EEPROM_BASE_MODE;
-u32 eeprom_address = 0;
-u32 eeprom_counter = 0;
+instance_local u32 eeprom_size = EEPROM_512_BYTE;
+instance_local u32 eeprom_mode = EEPROM_BASE_MODE;
+instance_local u32 eeprom_address = 0;
+instance_local u32 eeprom_counter = 0;
 
 void function_cc write_eeprom(u32 unused_address, u32 value)
 {
@@ -551,6 +649,7 @@ void function_cc write_eeprom(u32 unused_address, u32 value)
         {
           eeprom_mode = EEPROM_WRITE_MODE;
           memset(gamepak_backup + eeprom_address, 0, 8);
+          backup_mark_dirty(eeprom_address, 8);
         }
       }
       break;
@@ -558,6 +657,7 @@ void function_cc write_eeprom(u32 unused_address, u32 value)
     case EEPROM_WRITE_MODE:
       gamepak_backup[eeprom_address + (eeprom_counter / 8)] |=
        (value & 0x01) << (7 - (eeprom_counter % 8));
+      backup_mark_dirty(eeprom_address + (eeprom_counter / 8), 1);
       eeprom_counter++;
       if(eeprom_counter == 64)
       {
@@ -1105,6 +1205,7 @@ void function_cc write_backup(u32 address, u32 value)
           if(flash_mode == FLASH_ERASE_MODE)
           {
             memset(gamepak_backup, 0xFF, 1024 * 64 * flash_bank_cnt);
+            backup_mark_dirty(0, 1024 * 64 * flash_bank_cnt);
             flash_mode = FLASH_BASE_MODE;
           }
           break;
@@ -1115,7 +1216,10 @@ void function_cc write_backup(u32 address, u32 value)
       flash_command_position = 0;
     }
     if(backup_type == BACKUP_SRAM)
+    {
       gamepak_backup[0x5555] = value;
+      backup_mark_dirty(0x5555, 1);
+    }
   }
   else
 
@@ -1130,6 +1234,7 @@ void function_cc write_backup(u32 address, u32 value)
       // Erase sector
       u32 fulladdr = (address & 0xF000) + 64*1024*flash_bank_num;
       memset(&gamepak_backup[fulladdr], 0xFF, 1024 * 4);
+      backup_mark_dirty(fulladdr, 1024 * 4);
       flash_mode = FLASH_BASE_MODE;
       flash_command_position = 0;
     }
@@ -1149,6 +1254,7 @@ void function_cc write_backup(u32 address, u32 value)
       // Write value to flash ROM
       u32 fulladdr = address + 64*1024*flash_bank_num;
       gamepak_backup[fulladdr] = value;
+      backup_mark_dirty(fulladdr, 1);
       flash_mode = FLASH_BASE_MODE;
     }
     else
@@ -1160,6 +1266,7 @@ void function_cc write_backup(u32 address, u32 value)
       if(address >= 0x8000)
         sram_bankcount = SRAM_SIZE_64KB;
       gamepak_backup[address] = value;
+      backup_mark_dirty(address, 1);
     }
   }
 }
@@ -1203,19 +1310,19 @@ typedef enum
 #define RTC_WRITE_TIME_FULL           1
 #define RTC_WRITE_STATUS              2
 
-u32 rtc_state = RTC_DISABLED;
-u32 rtc_write_mode;
-u8 rtc_registers[3];
-u32 rtc_command;
-u32 rtc_data[12];
-u32 rtc_status = 0x40;
-u32 rtc_data_bytes;
-s32 rtc_bit_count;
+instance_local u32 rtc_state = RTC_DISABLED;
+instance_local u32 rtc_write_mode;
+instance_local u8 rtc_registers[3];
+instance_local u32 rtc_command;
+instance_local u32 rtc_data[12];
+instance_local u32 rtc_status = 0x40;
+instance_local u32 rtc_data_bytes;
+instance_local s32 rtc_bit_count;
 
 // Fake RTC system for SF2000 and devices without hardware clock
-fake_rtc_state_type fake_rtc_state = {0};
-bool fake_rtc_enabled = false;
-int fake_rtc_prev_time_bump = 0;
+instance_local fake_rtc_state_type fake_rtc_state = {0};
+instance_local bool fake_rtc_enabled = false;
+instance_local int fake_rtc_prev_time_bump = 0;
 
 static u32 encode_bcd(u8 value)
 {
@@ -1276,7 +1383,7 @@ void fake_rtc_update(void)
   }
   
   // Save periodically (every 5 minutes of real time)
-  static u32 last_save_time = 0;
+  static instance_local u32 last_save_time = 0;
   if (fake_rtc_state.needs_save && (current_real_time_u32 - last_save_time) >= 300) {
     fake_rtc_save();
     last_save_time = current_real_time_u32;
@@ -1816,12 +1923,251 @@ cpu_alert_type function_cc write_memory32(u32 address, u32 value)
   return CPU_ALERT_NONE;
 }
 
-char backup_filename[512];
+instance_local char backup_filename[512];
+
+// Size of the save file for the current backup type.
+static u32 backup_file_size(void)
+{
+  switch(backup_type)
+  {
+    case BACKUP_SRAM:
+      return 0x8000 * sram_bankcount;
+
+    case BACKUP_FLASH:
+      return 0x10000 * flash_bank_cnt;
+
+    case BACKUP_EEPROM:
+      return 0x200 * eeprom_size;
+
+    default:
+      return 0;
+  }
+}
+
+// Makes sure a written file is on the disk, not only in the OS cache, so
+// that it can safely replace the previous save.
+static bool sync_backup_file(const char *name)
+{
+#if defined(_WIN32) && !defined(_XBOX)
+  int fd = _open(name, _O_RDWR | _O_BINARY);
+  bool ok = fd >= 0 && !_commit(fd);
+  if (fd >= 0)
+    _close(fd);
+  return ok;
+#elif defined(__unix__) || defined(__APPLE__)
+  int fd = open(name, O_WRONLY);
+  bool ok = fd >= 0 && !fsync(fd);
+  if (fd >= 0)
+    close(fd);
+  return ok;
+#else
+  return true;
+#endif
+}
+
+// Writes the file to a temporary name first and renames it over the old
+// one, so that a crash mid write does not destroy the previous save.
+static bool write_backup_file(const char *name, const u8 *data, u32 size)
+{
+  char tmpname[512 + 4];
+  RFILE *fd;
+  bool ok;
+
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+  fd = filestream_open(tmpname, RETRO_VFS_FILE_ACCESS_WRITE,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  if (!fd)
+    return false;
+
+  ok = filestream_write(fd, data, size) == size;
+  if (filestream_close(fd))
+    ok = false;
+  // The rename must not hit the disk before the data does
+  if (ok && !sync_backup_file(tmpname))
+    ok = false;
+
+  if (ok && filestream_rename(tmpname, name))
+  {
+#if defined(_WIN32) || defined(PSP)
+    // These cannot rename over an existing file, the old save has to go
+    // first. Should the rename still fail, the new save is left in the
+    // temporary file rather than losing both.
+    filestream_delete(name);
+    return !filestream_rename(tmpname, name);
+#else
+    // A real error, the old save is still there
+    ok = false;
+#endif
+  }
+
+  if (!ok)
+    filestream_delete(tmpname);
+  return ok;
+}
+
+#ifdef ASYNC_BACKUP
+/* Saves are written by a thread so that the emulation does not stall on
+   file I/O. The emulation thread copies the modified bytes into the pending
+   image, the thread takes a copy of it (under the lock) and writes that. */
+typedef struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t request;   /* A save is pending (or exit requested) */
+  pthread_cond_t idle;      /* Nothing pending nor being written */
+  bool exit;
+  bool pending;
+  bool busy;
+
+  char name[512];
+  u32 size;
+  u8 image[1024 * 128];     /* Pending save, only updated where modified */
+  u8 write_buf[1024 * 128]; /* Copy being written by the thread */
+} backup_writer_type;
+
+static instance_local backup_writer_type *backup_writer = NULL;
+
+static void *backup_writer_thread(void *arg)
+{
+  backup_writer_type *bw = (backup_writer_type*)arg;
+  char name[512];
+
+  pthread_mutex_lock(&bw->lock);
+  while (true)
+  {
+    u32 size;
+
+    // Pending saves are written before exiting
+    while (!bw->pending && !bw->exit)
+      pthread_cond_wait(&bw->request, &bw->lock);
+    if (!bw->pending)
+      break;
+
+    size = bw->size;
+    memcpy(bw->write_buf, bw->image, size);
+    strcpy(name, bw->name);
+    bw->pending = false;
+    bw->busy = true;
+    pthread_mutex_unlock(&bw->lock);
+
+    write_backup_file(name, bw->write_buf, size);
+
+    pthread_mutex_lock(&bw->lock);
+    bw->busy = false;
+    if (!bw->pending)
+      pthread_cond_broadcast(&bw->idle);
+  }
+  pthread_mutex_unlock(&bw->lock);
+
+  return NULL;
+}
+
+static bool backup_writer_start(void)
+{
+  backup_writer_type *bw =
+    (backup_writer_type*)calloc(1, sizeof(backup_writer_type));
+  if (!bw)
+    return false;
+
+  pthread_mutex_init(&bw->lock, NULL);
+  pthread_cond_init(&bw->request, NULL);
+  pthread_cond_init(&bw->idle, NULL);
+  if (pthread_create(&bw->thread, NULL, backup_writer_thread, bw))
+  {
+    pthread_cond_destroy(&bw->idle);
+    pthread_cond_destroy(&bw->request);
+    pthread_mutex_destroy(&bw->lock);
+    free(bw);
+    return false;
+  }
+
+  backup_writer = bw;
+  return true;
+}
+
+// Writes whatever is pending and stops the thread.
+static void backup_writer_stop(void)
+{
+  backup_writer_type *bw = backup_writer;
+  if (!bw)
+    return;
+
+  pthread_mutex_lock(&bw->lock);
+  bw->exit = true;
+  pthread_cond_signal(&bw->request);
+  pthread_mutex_unlock(&bw->lock);
+  pthread_join(bw->thread, NULL);
+
+  pthread_cond_destroy(&bw->idle);
+  pthread_cond_destroy(&bw->request);
+  pthread_mutex_destroy(&bw->lock);
+  free(bw);
+  backup_writer = NULL;
+}
+
+// Queues the modified part of the backup memory (all of it if the file
+// name or size changed).
+static bool backup_writer_queue(const char *name, u32 size)
+{
+  backup_writer_type *bw = backup_writer;
+  u32 start = 0, end = size;
+
+  if (!bw && !backup_writer_start())
+    return false;
+  bw = backup_writer;
+
+  pthread_mutex_lock(&bw->lock);
+  if (size == bw->size && !strcmp(name, bw->name))
+  {
+    start = MIN(backup_dirty_start, size);
+    end = MIN(backup_dirty_end, size);
+  }
+  if (start < end)
+    memcpy(&bw->image[start], &gamepak_backup[start], end - start);
+
+  strncpy(bw->name, name, sizeof(bw->name));
+  bw->name[sizeof(bw->name) - 1] = 0;
+  bw->size = size;
+  bw->pending = true;
+  pthread_cond_signal(&bw->request);
+  pthread_mutex_unlock(&bw->lock);
+
+  return true;
+}
+#endif
+
+// Waits until the queued saves are written to disk.
+void flush_backup(void)
+{
+#ifdef ASYNC_BACKUP
+  backup_writer_type *bw = backup_writer;
+  if (!bw)
+    return;
+
+  pthread_mutex_lock(&bw->lock);
+  while (bw->pending || bw->busy)
+    pthread_cond_wait(&bw->idle, &bw->lock);
+  pthread_mutex_unlock(&bw->lock);
+#endif
+}
 
 u32 load_backup(char *name)
 {
-  RFILE *fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
-                              RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  RFILE *fd;
+
+  // A save of this very file might still be on its way
+  flush_backup();
+#ifdef ASYNC_BACKUP
+  // The next save must copy everything again
+  if (backup_writer)
+    backup_writer->size = 0;
+#endif
+
+  backup_dirty_start = backup_dirty_end = 0;
+  backup_saved_size = 0;
+
+  fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
 
   if(fd)
   {
@@ -1859,6 +2205,7 @@ u32 load_backup(char *name)
         flash_bank_cnt = FLASH_SIZE_128KB;
         break;
     }
+    backup_saved_size = backup_file_size();
     return 1;
   }
   else
@@ -1872,40 +2219,25 @@ u32 load_backup(char *name)
 
 u32 save_backup(char *name)
 {
-  if(backup_type != BACKUP_NONE)
-  {
-    RFILE *fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_WRITE,
-                                RETRO_VFS_FILE_ACCESS_HINT_NONE);
-
-    if(fd)
-    {
-      u32 backup_size = 0;
+  u32 backup_size = backup_file_size();
 
-      switch(backup_type)
-      {
-        case BACKUP_SRAM:
-          backup_size = 0x8000 * sram_bankcount;
-          break;
-
-        case BACKUP_FLASH:
-          backup_size = 0x10000 * flash_bank_cnt;
-          break;
-
-        case BACKUP_EEPROM:
-          backup_size = 0x200 * eeprom_size;
-          break;
+  if(!backup_size)
+    return 0;
 
-        default:
-          break;
-      }
+  // Nothing to do if the file is up to date
+  if(backup_dirty_start >= backup_dirty_end &&
+     backup_size == backup_saved_size)
+    return 1;
 
-      filestream_write(fd, gamepak_backup, backup_size);
-      filestream_close(fd);
-      return 1;
-    }
-  }
+#ifdef ASYNC_BACKUP
+  if(!backup_writer_queue(name, backup_size))
+#endif
+  if(!write_backup_file(name, gamepak_backup, backup_size))
+    return 0;
 
-  return 0;
+  backup_dirty_start = backup_dirty_end = 0;
+  backup_saved_size = backup_size;
+  return 1;
 }
 
 void update_backup(void)
@@ -2143,19 +2475,15 @@ const dma_region_type dma_region_map[17] =
 #define dma_write_iwram(type, tfsize)                                         \
   if(address##tfsize(iwram + 0x8000, type##_ptr & 0x7FFF) != eswap##tfsize(read_value)) {          \
     address##tfsize(iwram + 0x8000, type##_ptr & 0x7FFF) = eswap##tfsize(read_value);               \
-    if(address##tfsize(iwram, type##_ptr & 0x7FFF) != 0)   {                         \
-        partial_flush_ram_full_dma(type##_ptr);                                            \
-        alerts |= CPU_ALERT_SMC;                                                \
-    }															\
+    if(ram_code_written(type##_ptr, tfsize / 8))                              \
+      alerts |= CPU_ALERT_SMC;                                                \
   }															\
 
 #define dma_write_ewram(type, tfsize)                                         \
   if(address##tfsize(ewram, type##_ptr & 0x3FFFF) != eswap##tfsize(read_value)) {       \
     address##tfsize(ewram, type##_ptr & 0x3FFFF) = eswap##tfsize(read_value);   \
-    if(address##tfsize(ewram, (type##_ptr & 0x3FFFF) + 0x40000) != 0)	{	        \
-         partial_flush_ram_full_dma(type##_ptr);                                            \
-         alerts |= CPU_ALERT_SMC;                                                \
-    }															\
+    if(ram_code_written(type##_ptr, tfsize / 8))                              \
+      alerts |= CPU_ALERT_SMC;                                                \
   }	
 
 #define print_line()                                                          \
@@ -2398,6 +2726,150 @@ dma_tf_loop_builder(32);
 
 static const int dma_stride[4] = {1, -1, 0, 1};
 
+// Returns the host memory backing a DMA address and how many bytes are
+// contiguous from there (up to the end of the region or its mirror), or
+// NULL if the region has side effects or is not plain memory.
+static u8 *dma_host_span(u32 ptr, bool write, u32 *span)
+{
+  switch(dma_region_map[MIN(ptr >> 24, 16)])
+  {
+    case DMA_REGION_IWRAM:
+      *span = 0x8000 - (ptr & 0x7FFF);
+      return &iwram[0x8000 + (ptr & 0x7FFF)];
+
+    case DMA_REGION_EWRAM:
+      *span = 0x40000 - (ptr & 0x3FFFF);
+      return &ewram[ptr & 0x3FFFF];
+
+    case DMA_REGION_VRAM:
+    {
+      u32 offset = ptr & 0x1FFFF;
+      if (offset >= 0x18000)
+      {
+        *span = 0x20000 - offset;
+        return &vram[offset - 0x8000];
+      }
+      *span = 0x18000 - offset;
+      return &vram[offset];
+    }
+
+    case DMA_REGION_OAM_RAM:
+      *span = 0x400 - (ptr & 0x3FF);
+      return (u8*)oam_ram + (ptr & 0x3FF);
+
+    case DMA_REGION_PALETTE_RAM:
+      *span = 0x400 - (ptr & 0x3FF);
+      return (u8*)palette_ram + (ptr & 0x3FF);
+
+    case DMA_REGION_GAMEPAK:
+    {
+      u8 *page = memory_map_read[ptr >> 15];
+      if (write)
+        return NULL;
+      if (!page)
+      {
+        if ((ptr & 0x1FFFFFF) >= gamepak_size)
+          return NULL;
+        page = load_gamepak_page((ptr >> 15) & 0x3FF);
+      }
+      *span = 0x8000 - (ptr & 0x7FFF);
+      return &page[ptr & 0x7FFF];
+    }
+
+    default:
+      return NULL;
+  }
+}
+
+// Whether a RAM range contains translated code. Tests the same page bitmap
+// the RAM code invalidation uses, since the halfword tags only mark where
+// the blocks start.
+static bool dma_ram_has_code(u32 address, u32 bytes)
+{
+#ifdef HAVE_DYNAREC
+  u32 page, last_page;
+
+  if ((address >> 24) == 0x02)
+    page = address & 0x3FFFF;
+  else if ((address >> 24) == 0x03)
+    page = 0x40000 + (address & 0x7FFF);
+  else
+    return false;
+
+  last_page = (page + bytes - 1) >> RAM_CODE_PAGE_SHIFT;
+  for (page >>= RAM_CODE_PAGE_SHIFT; page <= last_page; page++)
+  {
+    if (ram_code_pages[page / 32] & (1U << (page % 32)))
+      return true;
+  }
+#endif
+  return false;
+}
+
+// Moves elements in bulk while both the source and destination are plain
+// memory: incrementing copies and fixed source fills to RAM, VRAM, OAM and
+// palette. RAM holding translated code is left to the regular loop (which
+// handles the invalidation). Returns how many elements were moved.
+static u32 dma_bulk_copy(u32 src_ptr, u32 dest_ptr, bool src_inc,
+                         u32 length, u32 tfsize)
+{
+  u32 done = 0;
+
+  while (done < length)
+  {
+    u32 src_span, dest_span, count, bytes, i;
+    u8 *src = dma_host_span(src_ptr, false, &src_span);
+    u8 *dest = dma_host_span(dest_ptr, true, &dest_span);
+
+    if (!src || !dest)
+      break;
+
+    count = MIN(length - done, dest_span / tfsize);
+    if (src_inc)
+      count = MIN(count, src_span / tfsize);
+    bytes = count * tfsize;
+
+    // The element by element copy replicates data when the destination
+    // overlaps the source ahead of it.
+    if (!count || (src_inc && dest > src && dest < src + bytes))
+      break;
+    if (dma_ram_has_code(dest_ptr, bytes))
+      break;
+
+    if (src_inc)
+      memmove(dest, src, bytes);
+    else if (tfsize == 2)
+    {
+      u16 value = address16(src, 0);
+      for (i = 0; i < bytes; i += 2)
+        address16(dest, i) = value;
+    }
+    else
+    {
+      u32 value = address32(src, 0);
+      for (i = 0; i < bytes; i += 4)
+        address32(dest, i) = value;
+    }
+
+    if (dest >= (u8*)palette_ram && dest < (u8*)palette_ram + sizeof(palette_ram))
+    {
+      u32 offset = dest - (u8*)palette_ram;
+      for (i = 0; i < bytes; i += 2)
+        address16(palette_ram_converted, offset + i) =
+          convert_palette(readaddress16(palette_ram, offset + i));
+    }
+    else if (dest >= (u8*)oam_ram && dest < (u8*)oam_ram + sizeof(oam_ram))
+      reg[OAM_UPDATED] = 1;
+
+    if (src_inc)
+      src_ptr += bytes;
+    dest_ptr += bytes;
+    done += count;
+  }
+
+  return done;
+}
+
 static cpu_alert_type dma_transfer_copy(
   dma_transfer_type *dmach, u32 src_ptr, u32 dest_ptr, u32 length)
 {
@@ -2406,6 +2878,24 @@ static cpu_alert_type dma_transfer_copy(
     int dst_stride = dma_stride[dmach->dest_direction];
     int src_stride = dma_stride[dmach->source_direction];
     bool dst_wb = dmach->dest_direction < 3;
+    u32 tfsize = dmach->length_type == DMA_16BIT ? 2 : 4;
+
+    if (dst_stride > 0 && src_stride >= 0)
+    {
+      u32 done = dma_bulk_copy(src_ptr, dest_ptr, src_stride > 0,
+                               length, tfsize);
+      src_ptr += done * src_stride * tfsize;
+      dest_ptr += done * tfsize;
+      length -= done;
+
+      if (!length)
+      {
+        dmach->source_address = src_ptr;
+        if (dst_wb)
+          dmach->dest_address = dest_ptr;
+        return CPU_ALERT_NONE;
+      }
+    }
 
     if(dmach->length_type == DMA_16BIT)
        return dma_tf_loop16(src_ptr, dest_ptr, 2 * src_stride, 2 * dst_stride, dst_wb, length, dmach);
@@ -2437,6 +2927,19 @@ cpu_alert_type dma_transfer(unsigned dma_chan, int *usedcycles)
   dma_region_type dst_reg0 = dma_region_map[dst_ptr >> 24];
   dma_region_type dst_reg1 = dma_region_map[dst_end >> 24];
 
+#ifdef GAMEPAK_PREFETCH
+  // Get the ROM pages read ahead of the copy (and the one after them)
+  if (gamepak_prefetch && src_reg0 == DMA_REGION_GAMEPAK &&
+      src_reg1 == DMA_REGION_GAMEPAK && dma_stride[dmach->source_direction] > 0)
+  {
+    u32 page = (src_ptr & 0x1FFFFFF) >> 15;
+    u32 last = MIN(((src_end & 0x1FFFFFF) >> 15) + 1,
+                   page + GAMEPAK_PREFETCH_SLOTS - 1);
+    for (; page <= last; page++)
+      gamepak_prefetch_request(page);
+  }
+#endif
+
   if (src_reg0 == src_reg1 && dst_reg0 == dst_reg1)
     ret = dma_transfer_copy(dmach, src_ptr, dst_ptr, byte_length >> tfsizes);
   else if (src_reg0 == src_reg1) {
@@ -2548,21 +3051,251 @@ static u32 evict_gamepak_page(void)
   return ret;
 }
 
+// Reads a ROM page from the file, decompressing it if the file is compressed
+static void read_gamepak_file_page(RFILE *fd, const gbz_index_type *gbz,
+                                   u32 physical_index, u8 *dst, u8 *scratch)
+{
+  if (gbz->page_offset)
+    gbz_read_page(fd, gbz, physical_index, dst, scratch);
+  else
+  {
+    filestream_seek(fd, physical_index * (32 * 1024), SEEK_SET);
+    filestream_read(fd, dst, 32 * 1024);
+  }
+}
+
+#ifdef GAMEPAK_PREFETCH
+static void *gamepak_prefetch_thread(void *arg)
+{
+  gamepak_prefetch_type *pf = (gamepak_prefetch_type*)arg;
+
+  pthread_mutex_lock(&pf->lock);
+  while (!pf->exit)
+  {
+    gamepak_prefetch_slot_type *slot;
+
+    if (!pf->queue_count)
+    {
+      pthread_cond_wait(&pf->request, &pf->lock);
+      continue;
+    }
+
+    slot = &pf->slots[pf->slot_queue[pf->queue_head]];
+    pf->queue_head = (pf->queue_head + 1) % GAMEPAK_PREFETCH_SLOTS;
+    pf->queue_count--;
+
+    // Queued slots are not touched by the emulation thread until ready
+    pthread_mutex_unlock(&pf->lock);
+    read_gamepak_file_page(pf->file, &pf->gbz, slot->phy_rom, slot->data,
+                           pf->gbz_scratch);
+    pthread_mutex_lock(&pf->lock);
+
+    slot->ready = true;
+    pthread_cond_broadcast(&pf->loaded);
+  }
+  pthread_mutex_unlock(&pf->lock);
+
+  return NULL;
+}
+
+static void gamepak_prefetch_request(u32 physical_index)
+{
+  gamepak_prefetch_type *pf = gamepak_prefetch;
+  gamepak_prefetch_slot_type *slot = NULL;
+  unsigned i;
+
+  // Nothing to do for pages that are already present
+  if (physical_index >= (gamepak_size >> 15) ||
+      memory_map_read[(0x8000000 / (32 * 1024)) + physical_index])
+    return;
+
+  pthread_mutex_lock(&pf->lock);
+  for (i = 0; i < GAMEPAK_PREFETCH_SLOTS; i++)
+  {
+    if (pf->slots[i].phy_rom == (s16)physical_index)
+    {
+      pthread_mutex_unlock(&pf->lock);
+      return;
+    }
+  }
+
+  // Recycle free or ready slots, the oldest first
+  for (i = 0; i < GAMEPAK_PREFETCH_SLOTS && !slot; i++)
+  {
+    u32 idx = (pf->next_slot + i) % GAMEPAK_PREFETCH_SLOTS;
+    if (pf->slots[idx].phy_rom < 0 || pf->slots[idx].ready)
+    {
+      slot = &pf->slots[idx];
+      pf->next_slot = idx + 1;
+      pf->slot_queue[(pf->queue_head + pf->queue_count++) %
+                     GAMEPAK_PREFETCH_SLOTS] = idx;
+    }
+  }
+
+  if (slot)
+  {
+    slot->phy_rom = physical_index;
+    slot->ready = false;
+    pthread_cond_signal(&pf->request);
+  }
+  pthread_mutex_unlock(&pf->lock);
+}
+
+// Moves a prefetched page into a queue entry (waits for it if it is still
+// being read). Returns false if the page was not requested.
+static bool gamepak_prefetch_take(u32 entry, u32 physical_index)
+{
+  gamepak_prefetch_type *pf = gamepak_prefetch;
+  bool found = false;
+  unsigned i;
+
+  pthread_mutex_lock(&pf->lock);
+  for (i = 0; i < GAMEPAK_PREFETCH_SLOTS; i++)
+  {
+    gamepak_prefetch_slot_type *slot = &pf->slots[i];
+    if (slot->phy_rom == (s16)physical_index)
+    {
+      u8 *data = slot->data;
+      while (!slot->ready)
+        pthread_cond_wait(&pf->loaded, &pf->lock);
+
+      slot->data = gamepak_blk_queue[entry].data;
+      slot->phy_rom = -1;
+      slot->ready = false;
+      gamepak_blk_queue[entry].data = data;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pf->lock);
+
+  return found;
+}
+
+// Queue entries that took a staging buffer get back one of the buffers
+// they left in the slots (and are unmapped), the staging memory can go then.
+static void gamepak_prefetch_stop(void)
+{
+  gamepak_prefetch_type *pf = gamepak_prefetch;
+  u8 *staging_end;
+  unsigned i, slot = 0;
+
+  if (!pf)
+    return;
+
+  pthread_mutex_lock(&pf->lock);
+  pf->exit = true;
+  pthread_cond_signal(&pf->request);
+  pthread_mutex_unlock(&pf->lock);
+  pthread_join(pf->thread, NULL);
+
+  staging_end = pf->staging + GAMEPAK_PREFETCH_SLOTS * 32 * 1024;
+  for (i = 0; i < 1024; i++)
+  {
+    u8 *data = gamepak_blk_queue[i].data;
+    if (data < pf->staging || data >= staging_end)
+      continue;
+
+    // Only as many entries as slots can hold a staging buffer
+    while (pf->slots[slot].data >= pf->staging &&
+           pf->slots[slot].data < staging_end)
+      slot++;
+    gamepak_blk_queue[i].data = pf->slots[slot].data;
+    pf->slots[slot].data = data;
+
+    if (gamepak_blk_queue[i].phy_rom >= 0)
+    {
+      map_rom_entry(read, gamepak_blk_queue[i].phy_rom, NULL,
+                    gamepak_size >> 15);
+      gamepak_blk_queue[i].phy_rom = -1;
+    }
+  }
+
+  pthread_cond_destroy(&pf->loaded);
+  pthread_cond_destroy(&pf->request);
+  pthread_mutex_destroy(&pf->lock);
+  filestream_close(pf->file);
+  free(pf->gbz_scratch);
+  free(pf->staging);
+  free(pf);
+  gamepak_prefetch = NULL;
+}
+
+static void gamepak_prefetch_start(const char *name)
+{
+  gamepak_prefetch_type *pf;
+  unsigned i;
+
+  pf = (gamepak_prefetch_type*)calloc(1, sizeof(gamepak_prefetch_type));
+  if (!pf)
+    return;
+
+  pf->staging = (u8*)malloc(GAMEPAK_PREFETCH_SLOTS * 32 * 1024);
+  pf->file = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
+                             RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  if (!pf->staging || !pf->file)
+    goto fail;
+
+  pf->gbz = gamepak_gbz;
+  if (pf->gbz.page_offset)
+  {
+    pf->gbz_scratch = (u8*)malloc(GBZ_PAGE_SIZE);
+    if (!pf->gbz_scratch)
+      goto fail;
+  }
+
+  for (i = 0; i < GAMEPAK_PREFETCH_SLOTS; i++)
+  {
+    pf->slots[i].data = &pf->staging[i * 32 * 1024];
+    pf->slots[i].phy_rom = -1;
+  }
+
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->request, NULL);
+  pthread_cond_init(&pf->loaded, NULL);
+  if (pthread_create(&pf->thread, NULL, gamepak_prefetch_thread, pf))
+  {
+    pthread_cond_destroy(&pf->loaded);
+    pthread_cond_destroy(&pf->request);
+    pthread_mutex_destroy(&pf->lock);
+    goto fail;
+  }
+
+  gamepak_prefetch = pf;
+  return;
+
+fail:
+  if (pf->file)
+    filestream_close(pf->file);
+  free(pf->gbz_scratch);
+  free(pf->staging);
+  free(pf);
+}
+#endif
+
 u8 *load_gamepak_page(u32 physical_index)
 {
+#ifdef MMAP_ROM
+  // Every page of a mapped ROM is always present
+  if(gamepak_mapping)
+    return &gamepak_mapping[(physical_index & 0x3FF) * 32 * 1024];
+#endif
+
   if(physical_index >= (gamepak_size >> 15))
     return &gamepak_buffers[0][0];
 
   u32 entry = evict_gamepak_page();
-  u32 block_idx = entry / 32;
-  u32 block_off = entry % 32;
-  u8 *swap_location = &gamepak_buffers[block_idx][32 * 1024 * block_off];
+  u8 *swap_location;
 
   // Fill in the entry
   gamepak_blk_queue[entry].phy_rom = physical_index;
 
-  filestream_seek(gamepak_file_large, physical_index * (32 * 1024), SEEK_SET);
-  filestream_read(gamepak_file_large, swap_location, (32 * 1024));
+#ifdef GAMEPAK_PREFETCH
+  if(!gamepak_prefetch || !gamepak_prefetch_take(entry, physical_index))
+#endif
+    read_gamepak_file_page(gamepak_file_large, &gamepak_gbz, physical_index,
+                           gamepak_blk_queue[entry].data, gamepak_gbz_scratch);
+  swap_location = gamepak_blk_queue[entry].data;
 
   // Map it to the read handlers now
   map_rom_entry(read, physical_index, swap_location, gamepak_size >> 15);
@@ -2574,12 +3307,42 @@ u8 *load_gamepak_page(u32 physical_index)
     address16(swap_location, 0xC8) = eswap16(rtc_registers[2]);
   }
 
+#ifdef GAMEPAK_PREFETCH
+  if(gamepak_prefetch)
+  {
+    // Guess what comes next: the page that followed this one last time
+    // (if any) and the next page.
+    gamepak_prefetch_type *pf = gamepak_prefetch;
+    u32 predicted = pf->fault_next[physical_index];
+
+    pf->fault_next[pf->last_fault] = physical_index + 1;
+    pf->last_fault = physical_index;
+    if(predicted)
+      gamepak_prefetch_request(predicted - 1);
+    gamepak_prefetch_request(physical_index + 1);
+  }
+#endif
+
   return swap_location;
 }
 
-void init_gamepak_buffer(void)
+static void reset_gamepak_queue(void)
 {
   unsigned i;
+  for (i = 0; i < 1024; i++)
+  {
+    gamepak_blk_queue[i].next_lru = (u16)(i + 1);
+    gamepak_blk_queue[i].phy_rom = -1;
+    gamepak_blk_queue[i].data = i < 32 * gamepak_buffer_count ?
+      &gamepak_buffers[i / 32][32 * 1024 * (i % 32)] : NULL;
+  }
+
+  gamepak_lru_head = 0;
+  gamepak_lru_tail = 32 * gamepak_buffer_count - 1;
+}
+
+void init_gamepak_buffer(void)
+{
   // Try to allocate up to 32 blocks of 1MB each
   gamepak_buffer_count = 0;
   while (gamepak_buffer_count < ROM_BUFFER_SIZE)
@@ -2591,20 +3354,17 @@ void init_gamepak_buffer(void)
   }
 
   // Initialize the memory map structure
-  for (i = 0; i < 1024; i++)
-  {
-    gamepak_blk_queue[i].next_lru = (u16)(i + 1);
-    gamepak_blk_queue[i].phy_rom = -1;
-  }
-
-  gamepak_lru_head = 0;
-  gamepak_lru_tail = 32 * gamepak_buffer_count - 1;
+  reset_gamepak_queue();
 }
 
 bool gamepak_must_swap(void)
 {
   // Returns whether the current gamepak buffer is not big enough to hold
   // the full gamepak ROM. In these cases the device must swap.
+#ifdef MMAP_ROM
+  if(gamepak_mapping)
+    return false;
+#endif
   return gamepak_buffer_count * gamepak_buffer_blocksize < gamepak_size;
 }
 
@@ -2680,12 +3440,31 @@ void memory_term(void)
   // Save fake RTC state before termination - DISABLED
   // fake_rtc_save();
   
+#ifdef GAMEPAK_PREFETCH
+  gamepak_prefetch_stop();
+#endif
+#ifdef ASYNC_BACKUP
+  backup_writer_stop();
+#endif
+
   if (gamepak_file_large)
   {
     filestream_close(gamepak_file_large);
     gamepak_file_large = NULL;
   }
 
+  gbz_close(&gamepak_gbz);
+  free(gamepak_gbz_scratch);
+  gamepak_gbz_scratch = NULL;
+
+#ifdef MMAP_ROM
+  if (gamepak_mapping)
+  {
+    unmap_rom_file(gamepak_mapping, GAMEPAK_MAPPING_SIZE);
+    gamepak_mapping = NULL;
+  }
+#endif
+
   while (gamepak_buffer_count)
   {
     free(gamepak_buffers[--gamepak_buffer_count]);
@@ -2868,16 +3647,102 @@ unsigned memory_write_savestate(u8 *dst)
   return (unsigned int)(dst - startp);
 }
 
+u32 crc32_update(u32 crc, const u8 *data, u32 size)
+{
+  // Nibble based, good enough for the odd checksum
+  static const u32 crc32_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  while (size--)
+  {
+    crc = (crc >> 4) ^ crc32_table[(crc ^ *data) & 0xF];
+    crc = (crc >> 4) ^ crc32_table[(crc ^ (*data >> 4)) & 0xF];
+    data++;
+  }
+  return ~crc;
+}
+
+#ifdef MMAP_ROM
+// Maps the ROM file in memory: every page is mapped from the start (no
+// copies and no swapping) and the page cache is shared among all the
+// instances running the same ROM.
+static bool map_gamepak_file(const char *name)
+{
+  unsigned file_size, i;
+  u32 rom_blocks;
+
+  if (gamepak_mapping)
+  {
+    unmap_rom_file(gamepak_mapping, GAMEPAK_MAPPING_SIZE);
+    gamepak_mapping = NULL;
+  }
+
+  if (!gamepak_mmap_enable)
+    return false;
+
+  gamepak_mapping = (u8*)map_rom_file(name, GAMEPAK_MAPPING_SIZE, &file_size);
+  if (!gamepak_mapping)
+    return false;
+
+  // Compressed ROMs are loaded into the buffers instead
+  if (!memcmp(gamepak_mapping, GBZ_MAGIC, 4))
+  {
+    unmap_rom_file(gamepak_mapping, GAMEPAK_MAPPING_SIZE);
+    gamepak_mapping = NULL;
+    return false;
+  }
+
+  gamepak_file_size = file_size;
+  gamepak_size = (gamepak_file_size + 0x7FFF) & ~0x7FFF;
+  rom_blocks = gamepak_size >> 15;
+
+  map_null(read, 0x8000000, 0xD000000);
+  for (i = 0; i < rom_blocks; i++)
+    map_rom_entry(read, i, &gamepak_mapping[i * 32 * 1024], rom_blocks);
+
+  gamepak_file_crc = crc32_update(0, gamepak_mapping, gamepak_file_size);
+  return true;
+}
+#endif
+
 static s32 load_gamepak_raw(const char *name)
 {
   unsigned i, j;
+
+#ifdef GAMEPAK_PREFETCH
+  gamepak_prefetch_stop();
+#endif
+  reset_gamepak_queue();
+  gbz_close(&gamepak_gbz);
+
+#ifdef MMAP_ROM
+  if (map_gamepak_file(name))
+    return 0;
+#endif
+
   gamepak_file_large = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
                                        RETRO_VFS_FILE_ACCESS_HINT_NONE);
   if(gamepak_file_large)
   {
+    // Compressed ROMs are decompressed page by page
+    if (gbz_open(gamepak_file_large, &gamepak_gbz))
+    {
+      if (!gamepak_gbz_scratch)
+        gamepak_gbz_scratch = (u8*)malloc(GBZ_PAGE_SIZE);
+      if (!gamepak_gbz_scratch)
+        return -1;
+      gamepak_file_size = gamepak_gbz.rom_size;
+    }
+    else
+      gamepak_file_size = (u32)filestream_get_size(gamepak_file_large);
+
     // Round size to 32KB pages
-    gamepak_size = (u32)filestream_get_size(gamepak_file_large);
-    gamepak_size = (gamepak_size + 0x7FFF) & ~0x7FFF;
+    gamepak_size = (gamepak_file_size + 0x7FFF) & ~0x7FFF;
 
     // Load stuff in 1MB chunks
     u32 buf_blocks = (gamepak_size + gamepak_buffer_blocksize-1) / (gamepak_buffer_blocksize);
@@ -2892,29 +3757,74 @@ static s32 load_gamepak_raw(const char *name)
     for (i = 0; i < ldblks; i++)
     {
       // Load 1MB chunk and map it
-      filestream_read(gamepak_file_large, gamepak_buffers[i], gamepak_buffer_blocksize);
+      if (!gamepak_gbz.page_offset)
+        filestream_read(gamepak_file_large, gamepak_buffers[i], gamepak_buffer_blocksize);
       for (j = 0; j < 32 && i*32 + j < rom_blocks; j++)
       {
         u32 phyn = i*32 + j;
         u8* blkptr = &gamepak_buffers[i][32 * 1024 * j];
         u32 entry = evict_gamepak_page();
+        if (gamepak_gbz.page_offset &&
+            !gbz_read_page(gamepak_file_large, &gamepak_gbz, phyn, blkptr,
+                           gamepak_gbz_scratch))
+          return -1;
         gamepak_blk_queue[entry].phy_rom = phyn;
         // Map it to the read handlers now
         map_rom_entry(read, phyn, blkptr, rom_blocks);
       }
     } 
 
+    // The whole ROM is hashed (like a mapped one), the pages that did not
+    // fit in the buffers are read just for it.
+    gamepak_file_crc = 0;
+    for (i = 0; i < ldblks; i++)
+    {
+      u32 blksize = MIN(gamepak_file_size - i * gamepak_buffer_blocksize,
+                        gamepak_buffer_blocksize);
+      gamepak_file_crc = crc32_update(gamepak_file_crc, gamepak_buffers[i],
+                                      blksize);
+    }
+    if (ldblks * 32 < rom_blocks)
+    {
+      u8 *page = (u8*)malloc(32 * 1024);
+      if (!page)
+        return -1;
+      for (i = ldblks * 32; i < rom_blocks; i++)
+      {
+        read_gamepak_file_page(gamepak_file_large, &gamepak_gbz, i, page,
+                               gamepak_gbz_scratch);
+        gamepak_file_crc = crc32_update(gamepak_file_crc, page,
+                                        MIN(gamepak_file_size - i * 32 * 1024,
+                                            32 * 1024));
+      }
+      free(page);
+    }
+
+#ifdef GAMEPAK_PREFETCH
+    if (gamepak_must_swap())
+      gamepak_prefetch_start(name);
+#endif
+
     return 0;
   }
 
   return -1;
 }
 
+// CRC32 of the ROM file, computed when the ROM is loaded (pages might get
+// swapped later on). ROMs that do not fit in the buffers are only
+// checksummed up to what was loaded.
+u32 gamepak_crc32(void)
+{
+  return gamepak_file_crc;
+}
+
 u32 load_gamepak(const struct retro_game_info* info, const char *name)
 {
    char *p;
    char gamepak_filename[512];
    gamepak_info_t gpinfo;
+   u8 *header;
 
    if (load_gamepak_raw(name))
       return -1;
@@ -2937,10 +3847,15 @@ u32 load_gamepak(const struct retro_game_info* info, const char *name)
      load_backup(backup_filename);
 
    // Buffer 0 always has the first 1MB chunk of the ROM
+   header = gamepak_buffers[0];
+#ifdef MMAP_ROM
+   if (gamepak_mapping)
+      header = gamepak_mapping;
+#endif
    memset(&gpinfo, 0, sizeof(gpinfo));
-   memcpy(gpinfo.gamepak_title, &gamepak_buffers[0][0xA0], 12);
-   memcpy(gpinfo.gamepak_code,  &gamepak_buffers[0][0xAC],  4);
-   memcpy(gpinfo.gamepak_maker, &gamepak_buffers[0][0xB0],  2);
+   memcpy(gpinfo.gamepak_title, &header[0xA0], 12);
+   memcpy(gpinfo.gamepak_code,  &header[0xAC],  4);
+   memcpy(gpinfo.gamepak_maker, &header[0xB0],  2);
 
    idle_loop_target_pc = 0xFFFFFFFF;
    translation_gate_targets = 0;
@@ -25,7 +25,7 @@
   #define use_libretro_save_method 0
 #else
   #include "libretro.h"
-  extern int use_libretro_save_method;
+  extern instance_local int use_libretro_save_method;
 #endif
 
 #define DMA_CHAN_CNT   4
@@ -232,45 +232,53 @@ void function_cc write_rtc(u32 address, u32 value);
 /* EDIT: Shouldn't this be extern ?! */
 extern const u32 def_seq_cycles[16][2];
 /* Cycles can change depending on WAITCNT */
-extern u8 ws_cyc_seq[16][2];
-extern u8 ws_cyc_nseq[16][2];
+extern instance_local u8 ws_cyc_seq[16][2];
+extern instance_local u8 ws_cyc_nseq[16][2];
 
-extern u32 gamepak_size;
+extern instance_local u32 gamepak_size;
 extern char gamepak_title[13];
 extern char gamepak_code[5];
 extern char gamepak_maker[3];
 extern char gamepak_filename[512];
 
+u32 crc32_update(u32 crc, const u8 *data, u32 size);
+u32 gamepak_crc32(void);
+
 cpu_alert_type dma_transfer(unsigned dma_chan, int *cycles);
 u8 *memory_region(u32 address, u32 *memory_limit);
 u32 load_gamepak(const struct retro_game_info* info, const char *name);
 u32 load_backup(char *name);
+u32 save_backup(char *name);
 s32 load_bios(char *name);
 void update_backup(void);
+void flush_backup(void);
 void init_memory(void);
 void init_gamepak_buffer(void);
 bool gamepak_must_swap(void);
+#ifdef MMAP_ROM
+extern instance_local bool gamepak_mmap_enable;
+#endif
 void memory_term(void);
 u8 *load_gamepak_page(u32 physical_index);
 
 extern u32 oam_update;
-extern u32 gbc_sound_wave_update;
-extern dma_transfer_type dma[DMA_CHAN_CNT];
+extern instance_local u32 gbc_sound_wave_update;
+extern instance_local dma_transfer_type dma[DMA_CHAN_CNT];
 
 extern u8 open_gba_bios_rom[1024*16];
-extern u16 palette_ram[512];
-extern u16 oam_ram[512];
-extern u16 palette_ram_converted[512];
-extern u16 io_registers[512];
-extern u8 vram[1024 * 96];
-extern u8 bios_rom[1024 * 16];
+extern instance_local u16 palette_ram[512];
+extern instance_local u16 oam_ram[512];
+extern instance_local u16 palette_ram_converted[512];
+extern instance_local u16 io_registers[512];
+extern instance_local u8 vram[1024 * 96];
+extern instance_local u8 bios_rom[1024 * 16];
 // Double buffer used for SMC detection
-extern u8 ewram[1024 * 256 * 2];
-extern u8 iwram[1024 * 32 * 2];
+extern instance_local u8 ewram[1024 * 256 * 2];
+extern instance_local u8 iwram[1024 * 32 * 2];
 
-extern u8 *memory_map_read[8 * 1024];
+extern instance_local u8 *memory_map_read[8 * 1024];
 
-extern u32 reg[64];
+extern instance_local u32 reg[64];
 
 #define BACKUP_SRAM       0
 #define BACKUP_FLASH      1
@@ -301,12 +309,12 @@ extern u32 reg[64];
 #define FLASH_WRITE_MODE              3
 #define FLASH_BANKSWITCH_MODE         4
 
-extern u32 backup_type;
-extern u32 sram_bankcount;
-extern u32 flash_bank_cnt;
-extern u32 eeprom_size;
+extern instance_local u32 backup_type;
+extern instance_local u32 sram_bankcount;
+extern instance_local u32 flash_bank_cnt;
+extern instance_local u32 eeprom_size;
 
-extern u8 gamepak_backup[1024 * 128];
+extern instance_local u8 gamepak_backup[1024 * 128];
 
 // Fake RTC system disabled - using stubs
 typedef struct {
@@ -316,9 +324,9 @@ typedef struct {
   bool needs_save;             // Flag to save data periodically
 } fake_rtc_state_type;
 
-extern fake_rtc_state_type fake_rtc_state;
-extern bool fake_rtc_enabled;
-extern int fake_rtc_prev_time_bump;
+extern instance_local fake_rtc_state_type fake_rtc_state;
+extern instance_local bool fake_rtc_enabled;
+extern instance_local int fake_rtc_prev_time_bump;
 
 void fake_rtc_init(void);
 void fake_rtc_update(void);
@@ -329,7 +337,7 @@ void fake_rtc_get_time(struct tm* time_out);
 void fake_rtc_reset_one_off_bump(void);
 
 // Page sticky bit routines
-extern u32 gamepak_sticky_bit[1024/32];
+extern instance_local u32 gamepak_sticky_bit[1024/32];
 static inline void touch_gamepak_page(u32 physical_index)
 {
   u32 idx = (physical_index >> 5) & 31;
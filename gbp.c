@@ -38,8 +38,8 @@ static const u32 gbp_seq[16] = {
   0x30000003, // Responds with rumble amount
 };
 
-static u32 gbp_seq_n = 0;
-static bool gbp_rumble = false;
+static instance_local u32 gbp_seq_n = 0;
+static instance_local bool gbp_rumble = false;
 
 // GB Player sequencing
 u32 gbp_transfer(u32 value) {
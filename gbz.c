@@ -0,0 +1,186 @@
+/* gameplaySP
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common.h"
+#ifdef PSP_STANDALONE
+  #include "psp/psp_wrapper.h"
+#else
+  #include "streams/file_stream.h"
+#endif
+#include "gbz.h"
+
+static u32 read_le32(const u8 *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+// Decompresses an LZ4 block. Returns the decompressed size or -1 if the
+// block is malformed (or does not fit in dst).
+s32 lz4_decompress(const u8 *src, u32 src_size, u8 *dst, u32 dst_size)
+{
+  const u8 *ip = src;
+  const u8 *iend = src + src_size;
+  u8 *op = dst;
+  u8 *oend = dst + dst_size;
+
+  while (ip < iend)
+  {
+    u32 token = *ip++;
+    u32 length = token >> 4;
+    u32 offset;
+
+    // Literals
+    if (length == 15)
+    {
+      u32 b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    if (length > (u32)(iend - ip) || length > (u32)(oend - op))
+      return -1;
+    memcpy(op, ip, length);
+    op += length;
+    ip += length;
+
+    // The last sequence has no match
+    if (ip == iend)
+      break;
+
+    // Match
+    if (iend - ip < 2)
+      return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (!offset || offset > (u32)(op - dst))
+      return -1;
+
+    length = token & 15;
+    if (length == 15)
+    {
+      u32 b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    length += 4;
+    if (length > (u32)(oend - op))
+      return -1;
+
+    if (offset >= length)
+      memcpy(op, op - offset, length);
+    else
+    {
+      // Overlapping copy (repeats the last offset bytes)
+      const u8 *match = op - offset;
+      u32 i;
+      for (i = 0; i < length; i++)
+        op[i] = match[i];
+    }
+    op += length;
+  }
+
+  return (s32)(op - dst);
+}
+
+// Reads the container index. Returns false (and leaves the file at the
+// start) if the file is not a valid container.
+bool gbz_open(RFILE *fd, gbz_index_type *gbz)
+{
+  u8 header[GBZ_HEADER_SIZE];
+  u8 *offsets;
+  s64 file_size = filestream_get_size(fd);
+  u32 i;
+
+  gbz->page_offset = NULL;
+
+  filestream_seek(fd, 0, SEEK_SET);
+  if (filestream_read(fd, header, sizeof(header)) != sizeof(header) ||
+      memcmp(header, GBZ_MAGIC, 4))
+    goto not_gbz;
+
+  gbz->rom_size = read_le32(&header[4]);
+  gbz->page_count = read_le32(&header[8]);
+  if (!gbz->rom_size || gbz->page_count > GBZ_MAX_PAGES ||
+      gbz->page_count != (gbz->rom_size + GBZ_PAGE_SIZE - 1) / GBZ_PAGE_SIZE)
+    goto not_gbz;
+
+  offsets = (u8*)malloc(4 * (gbz->page_count + 1));
+  gbz->page_offset = (u32*)malloc(4 * (gbz->page_count + 1));
+  if (!offsets || !gbz->page_offset ||
+      filestream_read(fd, offsets, 4 * (gbz->page_count + 1)) !=
+        4 * (gbz->page_count + 1))
+  {
+    free(offsets);
+    goto not_gbz;
+  }
+
+  for (i = 0; i <= gbz->page_count; i++)
+    gbz->page_offset[i] = read_le32(&offsets[i * 4]);
+  free(offsets);
+
+  // Pages must be in order and none can be bigger than uncompressed
+  for (i = 0; i < gbz->page_count; i++)
+  {
+    if (gbz->page_offset[i + 1] < gbz->page_offset[i] ||
+        gbz->page_offset[i + 1] - gbz->page_offset[i] > GBZ_PAGE_SIZE)
+      goto not_gbz;
+  }
+  if (gbz->page_offset[gbz->page_count] > file_size)
+    goto not_gbz;
+
+  return true;
+
+not_gbz:
+  gbz_close(gbz);
+  filestream_seek(fd, 0, SEEK_SET);
+  return false;
+}
+
+void gbz_close(gbz_index_type *gbz)
+{
+  free(gbz->page_offset);
+  gbz->page_offset = NULL;
+}
+
+// Reads (and decompresses) a page. The scratch buffer must hold a page.
+bool gbz_read_page(RFILE *fd, const gbz_index_type *gbz, u32 page,
+                   u8 *dst, u8 *scratch)
+{
+  u32 size, stored;
+
+  if (page >= gbz->page_count)
+    return false;
+
+  size = MIN(gbz->rom_size - page * GBZ_PAGE_SIZE, GBZ_PAGE_SIZE);
+  stored = gbz->page_offset[page + 1] - gbz->page_offset[page];
+
+  filestream_seek(fd, gbz->page_offset[page], SEEK_SET);
+  if (stored == size)
+    return filestream_read(fd, dst, size) == size;
+
+  if (filestream_read(fd, scratch, stored) != stored)
+    return false;
+
+  return lz4_decompress(scratch, stored, dst, size) == (s32)size;
+}
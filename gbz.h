@@ -0,0 +1,52 @@
+/* gameplaySP
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef GBZ_H
+#define GBZ_H
+
+/* Compressed ROM container. The ROM is split in 32KB pages, compressed
+   one by one (LZ4 block format) so that any page can be read on its own.
+   All fields are little endian:
+
+     0x00  "GBZ1"                 magic
+     0x04  u32 rom_size           uncompressed ROM size in bytes
+     0x08  u32 page_count         number of 32KB pages
+     0x0C  u32 offset[count + 1]  file offset of every page (and the end)
+
+   A page as big as its uncompressed size is stored as is. Containers are
+   built using tools/gbz_pack. */
+
+#define GBZ_MAGIC              "GBZ1"
+#define GBZ_HEADER_SIZE        12
+#define GBZ_PAGE_SIZE          (32 * 1024)
+#define GBZ_MAX_PAGES          1024
+
+typedef struct
+{
+  u32 rom_size;
+  u32 page_count;
+  u32 *page_offset;         /* NULL when the ROM is not compressed */
+} gbz_index_type;
+
+bool gbz_open(RFILE *fd, gbz_index_type *gbz);
+void gbz_close(gbz_index_type *gbz);
+bool gbz_read_page(RFILE *fd, const gbz_index_type *gbz, u32 page,
+                   u8 *dst, u8 *scratch);
+
+s32 lz4_decompress(const u8 *src, u32 src_size, u8 *dst, u32 dst_size);
+
+#endif
@@ -28,10 +28,47 @@
    instruction can take. STM/LDM are tipically the biggest ones */
 #define TRANSLATION_CACHE_LIMIT_THRESHOLD (1024 * 2)
 
-/* Hash table size for ROM trans cache lookups */
-#define ROM_BRANCH_HASH_BITS                           16
+/* The ROM translation cache is split in segments that are evicted one at
+   a time (the coldest one) when the cache fills up. Only emitters that can
+   unlink block exits use more than one segment. */
+#define ROM_TRANSLATION_CACHE_SEGMENTS 8
+
+/* Hash table size for ROM trans cache lookups (in blocks, it can be filled
+   up to 3/4, which needs to fit the blocks the ROM cache can hold) */
+#if defined(SMALL_TRANSLATION_CACHE)
+  #define ROM_BRANCH_HASH_BITS                         15
+#else
+  #define ROM_BRANCH_HASH_BITS                         17
+#endif
 #define ROM_BRANCH_HASH_SIZE   (1 << ROM_BRANCH_HASH_BITS)
 
+/* ROM blocks that run this many times are retranslated as a trace that
+   follows their unconditional branches (up to a number of segments). The
+   execution counters are shared by PC hash. */
+#define TRACE_HOT_THRESHOLD    2048
+#define TRACE_COUNTER_BITS       12
+#define MAX_TRACE_SEGMENTS        4
+
+/* The x86 dynarec keeps the hot guest registers in host registers when
+   running on x86-64 (SysV ABI only, Win64 has less scratch registers) */
+#if defined(X86_ARCH) && (defined(__x86_64__) || defined(__amd64__)) && \
+    !defined(_WIN64)
+  #define X86_64_REG_CACHE
+#endif
+
+/* MULTI_INSTANCE builds keep the whole emulator state per thread: every
+   thread driving the libretro API runs its own GBA. The dynarec shares one
+   translation cache and emits the addresses of the state it accesses, so
+   these builds are interpreter only. */
+#ifdef MULTI_INSTANCE
+  #ifdef HAVE_DYNAREC
+    #error "MULTI_INSTANCE builds do not support the dynarec"
+  #endif
+  #define instance_local __thread
+#else
+  #define instance_local
+#endif
+
 /* RFU Multiplayer config, do not mess around too much with it */
 #define MAX_RFU_NETPLAYERS       32
 
@@ -19,27 +19,27 @@
 
 #include "common.h"
 
-bool libretro_supports_bitmasks    = false;
-bool libretro_supports_ff_override = false;
-bool libretro_ff_enabled           = false;
-bool libretro_ff_enabled_prev      = false;
+instance_local bool libretro_supports_bitmasks    = false;
+instance_local bool libretro_supports_ff_override = false;
+instance_local bool libretro_ff_enabled           = false;
+instance_local bool libretro_ff_enabled_prev      = false;
 #ifdef SF2000
-bool mappingYXtoLR                 = false;
+instance_local bool mappingYXtoLR                 = false;
 
 // SPEED CONTROL: Select+R and Select+L speed toggles
-static u8 speed_mode_fast = 0;    // 0=normal, 1=fast, 2=fast+frameskip
-static u8 speed_mode_slow = 0;    // 0=normal, 1=0.7x, 2=0.5x
-static bool select_r_pressed_prev = false;
-static bool select_l_pressed_prev = false;
+static instance_local u8 speed_mode_fast = 0;    // 0=normal, 1=fast, 2=fast+frameskip
+static instance_local u8 speed_mode_slow = 0;    // 0=normal, 1=0.7x, 2=0.5x
+static instance_local bool select_r_pressed_prev = false;
+static instance_local bool select_l_pressed_prev = false;
 #endif
 
-unsigned turbo_period      = TURBO_PERIOD_MIN;
-unsigned turbo_pulse_width = TURBO_PULSE_WIDTH_MIN;
-unsigned turbo_a_counter   = 0;
-unsigned turbo_b_counter   = 0;
+instance_local unsigned turbo_period      = TURBO_PERIOD_MIN;
+instance_local unsigned turbo_pulse_width = TURBO_PULSE_WIDTH_MIN;
+instance_local unsigned turbo_a_counter   = 0;
+instance_local unsigned turbo_b_counter   = 0;
 
-static u32 old_key = 0;
-static retro_input_state_t input_state_cb;
+static instance_local u32 old_key = 0;
+static instance_local retro_input_state_t input_state_cb;
 
 void retro_set_input_state(retro_input_state_t cb) { input_state_cb = cb; }
 
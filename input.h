@@ -60,10 +60,10 @@ static const map btn_map[] = {
    { RETRO_DEVICE_ID_JOYPAD_A,      BUTTON_A }
 };
 
-extern bool libretro_supports_bitmasks;
-extern bool libretro_supports_ff_override;
-extern bool libretro_ff_enabled;
-extern bool libretro_ff_enabled_prev;
+extern instance_local bool libretro_supports_bitmasks;
+extern instance_local bool libretro_supports_ff_override;
+extern instance_local bool libretro_ff_enabled;
+extern instance_local bool libretro_ff_enabled_prev;
 
 /* Minimum (and default) turbo pulse train
  * is 2 frames ON, 2 frames OFF */
@@ -73,7 +73,7 @@ extern bool libretro_ff_enabled_prev;
 #define TURBO_PULSE_WIDTH_MAX 15
 
 #ifdef SF2000
-extern bool mappingYXtoLR;
+extern instance_local bool mappingYXtoLR;
 
 // SPEED CONTROL: Function declarations
 float get_speed_multiplier(void);
@@ -81,10 +81,10 @@ bool get_speed_frameskip_enabled(void);
 void get_speed_mode_info(char *buffer, size_t size);
 #endif
 
-extern unsigned turbo_period;
-extern unsigned turbo_pulse_width;
-extern unsigned turbo_a_counter;
-extern unsigned turbo_b_counter;
+extern instance_local unsigned turbo_period;
+extern instance_local unsigned turbo_pulse_width;
+extern instance_local unsigned turbo_a_counter;
+extern instance_local unsigned turbo_b_counter;
 
 void init_input(void);
 u32 update_input(void);
@@ -54,9 +54,9 @@ static int translation_caches_inited = 0;
 // Usually 59.72750057 Hz, unless GBC_RATE is overclocked (for 60FPS)
 #define GBA_FPS ((float) GBC_BASE_RATE) / (308 * 228 * 4)
 
-static s16 *audio_sample_buffer        = NULL;
-static float audio_samples_per_frame   = 0.0f;
-static float audio_samples_accumulator = 0.0f;
+static instance_local s16 *audio_sample_buffer        = NULL;
+static instance_local float audio_samples_per_frame   = 0.0f;
+static instance_local float audio_samples_accumulator = 0.0f;
 
 /* Workaround for a RetroArch audio driver
  * limitation: a maximum of 1024 frames
@@ -67,45 +67,52 @@ static float audio_samples_accumulator = 0.0f;
  * can be skipped */
 #define FRAMESKIP_MAX 30
 
-u32 skip_next_frame                          = 0;
-static frameskip_type current_frameskip_type = no_frameskip;
-static u32 frameskip_threshold               = 0;
-static u32 frameskip_interval                = 0;
-static u32 frameskip_counter                 = 0;
-static bool audio_buff_active                = false;
-static unsigned audio_buff_occupancy         = 0;
-static bool audio_buff_underrun              = false;
-static unsigned audio_latency                = 0;
-static bool update_audio_latency             = false;
-static bios_type selected_bios               = auto_detect;
-
-static retro_log_printf_t log_cb;
-static retro_video_refresh_t video_cb;
-static retro_audio_sample_batch_t audio_batch_cb;
-static retro_input_poll_t input_poll_cb;
-static retro_environment_t environ_cb;
-
-struct retro_perf_callback perf_cb;
-
-int dynarec_enable;
-int use_libretro_save_method = 0;
-boot_mode selected_boot_mode = boot_game;
-int sprite_limit = 1;
+instance_local u32 skip_next_frame                          = 0;
+static instance_local frameskip_type current_frameskip_type = no_frameskip;
+static instance_local u32 frameskip_threshold               = 0;
+static instance_local u32 frameskip_interval                = 0;
+static instance_local u32 frameskip_counter                 = 0;
+static instance_local bool audio_buff_active                = false;
+static instance_local unsigned audio_buff_occupancy         = 0;
+static instance_local bool audio_buff_underrun              = false;
+static instance_local unsigned audio_latency                = 0;
+static instance_local bool update_audio_latency             = false;
+static instance_local bios_type selected_bios               = auto_detect;
+
+static instance_local retro_log_printf_t log_cb;
+static instance_local retro_video_refresh_t video_cb;
+static instance_local retro_audio_sample_batch_t audio_batch_cb;
+static instance_local retro_input_poll_t input_poll_cb;
+static instance_local retro_environment_t environ_cb;
+
+instance_local struct retro_perf_callback perf_cb;
+
+instance_local int dynarec_enable;
+#ifdef HAVE_DYNAREC
+static bool dynarec_cache_enable = false;
+static u32 dynarec_precompile_ms = 0;
+#ifdef THREADED_JIT
+static bool dynarec_thread_enable = false;
+#endif
+#endif
+instance_local int use_libretro_save_method = 0;
+instance_local boot_mode selected_boot_mode = boot_game;
+instance_local int sprite_limit = 1;
 
 #ifdef SF2000
-static bool fast_forward_audio_enabled = false;
+static instance_local bool fast_forward_audio_enabled = false;
 #endif
 
-u32 idle_loop_target_pc = 0xFFFFFFFF;
-u32 translation_gate_target_pc[MAX_TRANSLATION_GATES];
-u32 translation_gate_targets = 0;
+instance_local u32 idle_loop_target_pc = 0xFFFFFFFF;
+instance_local u32 translation_gate_target_pc[MAX_TRANSLATION_GATES];
+instance_local u32 translation_gate_targets = 0;
 
-static u16 *gba_screen_pixels_prev = NULL;
-static u16 *gba_processed_pixels   = NULL;
+static instance_local u16 *gba_screen_pixels_prev = NULL;
+static instance_local u16 *gba_processed_pixels   = NULL;
 
-static void (*video_post_process)(void) = NULL;
-static bool post_process_cc  = false;
-static bool post_process_mix = false;
+static instance_local void (*video_post_process)(void) = NULL;
+static instance_local bool post_process_cc  = false;
+static instance_local bool post_process_mix = false;
 
 static void error_msg(const char* text)
 {
@@ -436,7 +443,7 @@ static void video_run(void)
 
 #ifdef PERF_TEST
 
-extern struct retro_perf_callback perf_cb;
+extern instance_local struct retro_perf_callback perf_cb;
 
 #define RETRO_PERFORMANCE_INIT(X) \
    static struct retro_perf_counter X = {#X}; \
@@ -785,6 +792,28 @@ static void check_variables(int started_from_load)
    }
    else
       dynarec_enable = 1;
+
+   if (started_from_load) {
+     var.key                = "gpsp_drc_cache";
+     var.value              = NULL;
+     dynarec_cache_enable   = false;
+     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+        dynarec_cache_enable = !strcmp(var.value, "enabled");
+
+     var.key                = "gpsp_drc_precompile";
+     var.value              = NULL;
+     dynarec_precompile_ms  = 0;
+     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+        dynarec_precompile_ms = strtoul(var.value, NULL, 10);
+
+#ifdef THREADED_JIT
+     var.key                = "gpsp_drc_thread";
+     var.value              = NULL;
+     dynarec_thread_enable  = false;
+     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+        dynarec_thread_enable = !strcmp(var.value, "enabled");
+#endif
+   }
 #else
    dynarec_enable = 0;
 #endif
@@ -811,6 +840,14 @@ static void check_variables(int started_from_load)
         else if (!strcmp(var.value, "bios"))
            selected_boot_mode = boot_bios;
      }
+
+#ifdef MMAP_ROM
+     var.key                = "gpsp_rom_mmap";
+     var.value              = NULL;
+     gamepak_mmap_enable    = false;
+     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+        gamepak_mmap_enable = !strcmp(var.value, "enabled");
+#endif
    }
 
    var.key                = "gpsp_sprlim";
@@ -1063,8 +1100,28 @@ bool retro_load_game(const struct retro_game_info* info)
       return false;
    }
 
+#ifdef HAVE_DYNAREC
+   /* The cache file is keyed by the ROM contents, not its file name */
+   if (dynarec_cache_enable)
+      snprintf(rom_translation_cache_filename,
+               sizeof(rom_translation_cache_filename), "%s%cgpsp-%08x.jit",
+               save_path, PATH_SEPARATOR_CHAR, gamepak_crc32());
+   else
+      rom_translation_cache_filename[0] = 0;
+#endif
+
    reset_gba();
 
+#ifdef THREADED_JIT
+   if (dynarec_thread_enable && !start_translation_thread())
+      info_msg("Background recompilation is not available for this game.");
+#endif
+
+#ifdef HAVE_DYNAREC
+   if (dynarec_enable && dynarec_precompile_ms)
+      precompile_rom_translation_cache(dynarec_precompile_ms);
+#endif
+
    set_memory_descriptors();
 
    return true;
@@ -1079,6 +1136,17 @@ bool retro_load_game_special(unsigned game_type,
 void retro_unload_game(void)
 {
    update_backup();
+   flush_backup();
+#ifdef THREADED_JIT
+   stop_translation_thread();
+#endif
+#ifdef BLOCK_PROFILE_ANALYZE
+   print_block_profile();
+#endif
+#ifdef HAVE_DYNAREC
+   if (dynarec_enable)
+      save_rom_translation_cache();
+#endif
 
    if (libretro_ff_enabled)
       set_fastforward_override(false);
@@ -1245,7 +1313,7 @@ void retro_run(void)
    
    // Apply frameskip for fast mode with frameskip enabled
    if (get_speed_frameskip_enabled()) {
-     static u32 frameskip_counter = 0;
+     static instance_local u32 frameskip_counter = 0;
      frameskip_counter++;
      if (frameskip_counter % 3 == 0) {
        skip_next_frame = 1;
@@ -1270,7 +1338,7 @@ void retro_run(void)
 #ifdef SF2000
    // For slow modes, skip iterations by using static counter
    if (speed_mult < 1.0f) {
-     static u32 slow_counter = 0;
+     static instance_local u32 slow_counter = 0;
      slow_counter++;
      if (speed_mult == 0.7f && slow_counter % 10 < 7) {
        break; // Skip 3 out of 10 iterations for 0.7x speed
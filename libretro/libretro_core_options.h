@@ -88,6 +88,57 @@ struct retro_core_option_definition option_defs_us[] = {
       },
       "enabled"
    },
+   {
+      "gpsp_drc_cache",
+      "Persistent Recompiler Cache",
+      "Saves the code generated for the game ROM when the content is closed and reuses it the next time the same game is loaded, avoiding most of the recompilation stutter at startup. Files are written to the save directory.",
+      {
+         { "disabled", NULL },
+         { "enabled",  NULL },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+   {
+      "gpsp_drc_precompile",
+      "Recompile Game Code at Load",
+      "Recompiles the code reachable from the game entry point when the content is loaded, for up to the selected time, instead of as it runs. Reduces the stutter at the beginning of the game. With 'Background Recompilation' enabled the work is done by the recompilation thread instead.",
+      {
+         { "disabled", NULL },
+         { "100",      "100 ms" },
+         { "250",      "250 ms" },
+         { "500",      "500 ms" },
+         { "1000",     "1 s" },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+#ifdef THREADED_JIT
+   {
+      "gpsp_drc_thread",
+      "Background Recompilation",
+      "Recompiles the game code in a separate thread, running it with the interpreter in the meantime. Reduces the stutter caused by recompilation on multi-core devices, but timing is slightly less consistent. Not used for games too large to be kept fully in memory.",
+      {
+         { "disabled", NULL },
+         { "enabled",  NULL },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+#endif
+#endif
+#ifdef MMAP_ROM
+   {
+      "gpsp_rom_mmap",
+      "Map Game ROM File",
+      "Maps the game file in memory instead of loading it. Large games no longer need to be swapped in while running and the memory is shared with other instances running the same game. Requires the content to be a plain file on disk. Changes take effect on next content load.",
+      {
+         { "disabled", NULL },
+         { "enabled",  NULL },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
 #endif
    {
       "gpsp_sprlim",
@@ -0,0 +1,363 @@
+/* Lockstep differential tester: runs a ROM through the dynarec and through
+ * the interpreter, frame by frame, starting every frame from the same state
+ * and comparing the resulting savestates (registers, RAM, I/O and the rest
+ * of the emulated hardware). Differences are reported along with the PCs
+ * where each core stopped.
+ *
+ * The translated code can only be stopped once the frame is complete and,
+ * unlike the interpreter, it does so at the end of a block. The interpreter
+ * is thus run a bit further, until it reaches the same PC, before comparing.
+ *
+ * Build with "make lockstep_test" (requires the x86 dynarec).
+ * Usage: lockstep_test rom.gba [frames] [-k] [-a]
+ *   -k keeps going after a difference (continuing from the interpreter).
+ *   -a compares the whole state. By default only the CPU registers and the
+ *      RAM areas are compared: both cores check for events and interrupts
+ *      at different points, which shows up in the timing related state.
+ *      For the same reason, values read from the timers or VCOUNT (and the
+ *      interrupt stack contents) can legitimately differ in RAM too.
+ */
+
+#include "common.h"
+#include "libretro.h"
+
+#if !defined(HAVE_DYNAREC) || !defined(THREADED_JIT)
+  #error "The lockstep tester requires a dynarec build with THREADED_JIT"
+#endif
+
+#define MAX_REPORTED_DIFFS 16
+
+typedef struct
+{
+  const char *key;
+  u32 address;
+} memory_key_type;
+
+static const memory_key_type memory_keys[] =
+{
+  { "ewram",  0x02000000 },
+  { "iwram",  0x03000000 },
+  { "ioregs", 0x04000000 },
+  { "palram", 0x05000000 },
+  { "vram",   0x06000000 },
+  { "oamram", 0x07000000 },
+};
+
+static const char *compared_keys[] =
+{
+  "cpu.regs", "memory.ewram", "memory.iwram", "memory.vram",
+  "memory.oamram", "memory.palram",
+};
+
+static bool compare_all = false;
+static bool print_diffs = false;
+static u32 diff_count = 0;
+
+static void video_refresh(const void *data, unsigned width, unsigned height,
+                          size_t pitch) {}
+static void audio_sample(int16_t left, int16_t right) {}
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+  return frames;
+}
+static void input_poll(void) {}
+static int16_t input_state(unsigned port, unsigned device, unsigned index,
+                           unsigned id)
+{
+  return 0;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+  if (cmd == RETRO_ENVIRONMENT_GET_VARIABLE)
+  {
+    struct retro_variable *var = (struct retro_variable *)data;
+
+    if (!strcmp(var->key, "gpsp_drc"))
+      var->value = "enabled";
+    else if (!strcmp(var->key, "gpsp_bios"))
+      var->value = "builtin";
+    else
+      return false;
+    return true;
+  }
+  return false;
+}
+
+static void print_opcode(const char *who, u32 pc, u32 cpsr)
+{
+  if (cpsr & 0x20)
+    printf("  %-11s stopped at %08x (thumb %04x)\n", who, pc,
+           read_memory16(pc));
+  else
+    printf("  %-11s stopped at %08x (arm %08x)\n", who, pc,
+           read_memory32(pc));
+}
+
+static void report_diff(const char *path, const char *key, u32 offset,
+                        u32 dynarec_value, u32 interp_value, u32 size)
+{
+  u32 i;
+
+  if (!print_diffs || ++diff_count > MAX_REPORTED_DIFFS)
+    return;
+
+  for (i = 0; i < sizeof(memory_keys) / sizeof(memory_keys[0]); i++)
+  {
+    if (!strcmp(key, memory_keys[i].key))
+    {
+      printf("  %s%s @ %08x: dynarec %0*x, interpreter %0*x\n", path, key,
+             memory_keys[i].address + offset, size * 2, dynarec_value,
+             size * 2, interp_value);
+      return;
+    }
+  }
+
+  if (size == 4)
+    printf("  %s%s: dynarec %08x, interpreter %08x\n", path, key,
+           dynarec_value, interp_value);
+  else
+    printf("  %s%s + %x: dynarec %02x, interpreter %02x\n", path, key,
+           offset, dynarec_value, interp_value);
+}
+
+static bool is_compared(const char *path, const char *key)
+{
+  char name[128];
+  u32 i;
+
+  if (compare_all)
+    return true;
+
+  snprintf(name, sizeof(name), "%s%s", path, key);
+  for (i = 0; i < sizeof(compared_keys) / sizeof(compared_keys[0]); i++)
+  {
+    const char *compared = compared_keys[i];
+    u32 compared_len = strlen(compared);
+    u32 len = strlen(name);
+
+    /* The key itself, a field within it or a document leading to it */
+    if (!strncmp(name, compared, compared_len) &&
+        (!name[compared_len] || name[compared_len] == '.'))
+      return true;
+    if (!strncmp(compared, name, len) && compared[len] == '.')
+      return true;
+  }
+  return false;
+}
+
+/* Walks both savestate documents (they have the same layout) and counts
+   (and optionally prints) the compared values that differ. */
+static u32 compare_document(const u8 *dyn, const u8 *itp, const char *path)
+{
+  u32 diffs = 0;
+  const u8 *dyn_end = dyn + bson_read_u32(dyn) - 1;
+
+  dyn += 4;
+  itp += 4;
+
+  while (dyn < dyn_end && *dyn)
+  {
+    u8 type = *dyn++;
+    const char *key = (const char *)dyn;
+    u32 keylen = strlen(key) + 1;
+    u32 size, i;
+
+    bool compared = is_compared(path, key);
+
+    dyn += keylen;
+    itp += keylen + 1;
+
+    switch (type)
+    {
+      case BSON_TYPE_INT32:
+        if (compared && bson_read_u32(dyn) != bson_read_u32(itp))
+        {
+          report_diff(path, key, 0, bson_read_u32(dyn), bson_read_u32(itp), 4);
+          diffs++;
+        }
+        size = 4;
+        break;
+
+      case BSON_TYPE_DOC:
+      case BSON_TYPE_ARR:
+        if (compared)
+        {
+          char subpath[128];
+          snprintf(subpath, sizeof(subpath), "%s%s.", path, key);
+          diffs += compare_document(dyn, itp, subpath);
+        }
+        size = bson_read_u32(dyn);
+        break;
+
+      case BSON_TYPE_BIN:
+        size = bson_read_u32(dyn);
+        for (i = 0; compared && i < size; i++)
+        {
+          u8 dyn_byte = dyn[5 + i];
+          u8 itp_byte = itp[5 + i];
+          if (dyn_byte != itp_byte)
+          {
+            report_diff(path, key, i, dyn_byte, itp_byte, 1);
+            diffs++;
+          }
+        }
+        size += 5;
+        break;
+
+      case BSON_TYPE_STR:
+        size = bson_read_u32(dyn) + 4;
+        if (compared && memcmp(dyn, itp, size))
+        {
+          report_diff(path, key, 0, 0, 1, 4);
+          diffs++;
+        }
+        break;
+
+      default:
+        printf("  unknown savestate field type %02x (%s%s)\n", type, path,
+               key);
+        return diffs;
+    }
+
+    dyn += size;
+    itp += size;
+  }
+  return diffs;
+}
+
+static bool load_rom(const char *filename, struct retro_game_info *info)
+{
+  FILE *fd = fopen(filename, "rb");
+  void *data;
+  long size;
+
+  if (!fd)
+    return false;
+
+  fseek(fd, 0, SEEK_END);
+  size = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  data = malloc(size);
+  if (!data || fread(data, 1, size, fd) != (size_t)size)
+  {
+    fclose(fd);
+    free(data);
+    return false;
+  }
+  fclose(fd);
+
+  info->path = filename;
+  info->data = data;
+  info->size = size;
+  info->meta = NULL;
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  struct retro_game_info game_info;
+  u8 *start_state, *dynarec_state, *interp_state;
+  u32 frames = 3600;
+  bool keep_going = false;
+  u32 mismatches = 0;
+  u32 frame;
+  int i;
+
+  if (argc < 2)
+  {
+    printf("Usage: %s rom.gba [frames] [-k] [-a]\n", argv[0]);
+    return 2;
+  }
+
+  for (i = 2; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-k"))
+      keep_going = true;
+    else if (!strcmp(argv[i], "-a"))
+      compare_all = true;
+    else
+      frames = atoi(argv[i]);
+  }
+
+  retro_set_video_refresh(video_refresh);
+  retro_set_audio_sample(audio_sample);
+  retro_set_audio_sample_batch(audio_sample_batch);
+  retro_set_input_poll(input_poll);
+  retro_set_input_state(input_state);
+  retro_set_environment(environment);
+  retro_init();
+
+  if (!load_rom(argv[1], &game_info) || !retro_load_game(&game_info))
+  {
+    printf("Failed to load %s\n", argv[1]);
+    return 2;
+  }
+
+  /* Frames shown by the splash screen do not run the emulated hardware */
+  skip_splash_screen();
+
+  start_state = malloc(GBA_STATE_MEM_SIZE);
+  dynarec_state = malloc(GBA_STATE_MEM_SIZE);
+  interp_state = malloc(GBA_STATE_MEM_SIZE);
+
+  for (frame = 0; frame < frames; frame++)
+  {
+    u32 start_pc = reg[REG_PC];
+    u32 dynarec_pc, dynarec_cpsr;
+
+    memset(start_state, 0, GBA_STATE_MEM_SIZE);
+    gba_save_state(start_state);
+
+    execute_arm_translate(execute_cycles);
+    dynarec_pc = reg[REG_PC];
+    dynarec_cpsr = reg[REG_CPSR];
+    memset(dynarec_state, 0, GBA_STATE_MEM_SIZE);
+    gba_save_state(dynarec_state);
+
+    /* Restoring the state also flushes the translation caches */
+    gba_load_state(start_state);
+    clear_gamepak_stickybits();
+    execute_arm(execute_cycles);
+
+    /* Catch up with the end of the last translated block */
+    if (reg[REG_PC] != dynarec_pc)
+    {
+      s32 remaining;
+
+      interpreter_resume_pc = dynarec_pc;
+      remaining = execute_arm_slice(execute_cycles);
+      interpreter_resume_pc = ~0U;
+      if (reg[REG_PC] == dynarec_pc)
+        update_gba(remaining);
+    }
+
+    memset(interp_state, 0, GBA_STATE_MEM_SIZE);
+    gba_save_state(interp_state);
+
+    if (compare_document(dynarec_state, interp_state, ""))
+    {
+      mismatches++;
+      printf("Frame %u diverges (frame started at %08x):\n", frame,
+             start_pc);
+      print_opcode("dynarec", dynarec_pc, dynarec_cpsr);
+      print_opcode("interpreter", reg[REG_PC], reg[REG_CPSR]);
+
+      print_diffs = true;
+      diff_count = 0;
+      compare_document(dynarec_state, interp_state, "");
+      print_diffs = false;
+      if (diff_count > MAX_REPORTED_DIFFS)
+        printf("  (%u more differences)\n", diff_count - MAX_REPORTED_DIFFS);
+
+      if (!keep_going)
+        break;
+    }
+  }
+
+  printf("%u frames run, %u diverged\n", frame < frames ? frame + 1 : frames,
+         mismatches);
+
+  retro_deinit();
+  return mismatches ? 1 : 0;
+}
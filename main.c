@@ -21,27 +21,32 @@
 #include <ctype.h>
 #include <time.h>
 
-timer_type timer[4];
+instance_local timer_type timer[4];
 
-u32 frame_counter = 0;
-u32 cpu_ticks = 0;
-u32 execute_cycles = 0;
-s32 video_count = 0;
+instance_local u32 frame_counter = 0;
+instance_local u32 cpu_ticks = 0;
+instance_local u32 execute_cycles = 0;
 
-u32 last_frame = 0;
-u32 flush_ram_count = 0;
-u32 gbc_update_count = 0;
-u32 oam_update_count = 0;
+instance_local u32 last_frame = 0;
+instance_local u32 flush_ram_count = 0;
+instance_local u32 gbc_update_count = 0;
+instance_local u32 oam_update_count = 0;
 
-char main_path[512];
-char save_path[512];
+instance_local char main_path[512];
+instance_local char save_path[512];
 
 // Custom splash screen variables
-static bool splash_shown = false;
-static u32 splash_timer = 0;
-static bool first_rom_execution = false;
+static instance_local bool splash_shown = false;
+static instance_local u32 splash_timer = 0;
+static instance_local bool first_rom_execution = false;
 
-static u32 random_state = 0;
+// Skips the splash screen (which is not part of the emulated state)
+void skip_splash_screen(void)
+{
+  splash_shown = true;
+}
+
+static instance_local u32 random_state = 0;
 
 // Generate 16 random bits.
 u16 rand_gen() {
@@ -193,7 +198,7 @@ static void draw_splash_text(u16 *screen_buffer, const char *text, int x, int y,
 
 // Display custom splash screen
 static void show_custom_splash() {
-  extern u16* gba_screen_pixels;
+  extern instance_local u16* gba_screen_pixels;
   u16 bg_color = 0xF5BB;    // #FBB7DF background (RGB565: R31,G45,B27)
   u16 text_color = 0xFFFF;  // White text
   u16 accent_color = 0xFFFF; // White accent
@@ -291,46 +296,292 @@ static void show_custom_splash() {
   // Clean design without diagonal lines
 }
 
-static unsigned update_timers(irq_type *irq_raised, unsigned completed_cycles)
+/* Event scheduler. Events are due at an absolute cycle (in cpu_ticks time,
+   wrapping around) and the pending ones are kept in a binary min-heap, so
+   that the next event is always at the top. Events scheduled in the past
+   are flagged as overdue: they run on the next update but do not cut the
+   CPU execution short. */
+static instance_local u32 event_cycle[EVENT_COUNT];
+static instance_local u8 event_heap[EVENT_COUNT];
+static instance_local s8 event_heap_pos[EVENT_COUNT];   // -1 if not queued
+static instance_local u32 event_heap_size = 0;
+static instance_local u32 events_overdue = 0;
+
+#define event_before(a, b) ((s32)(event_cycle[a] - event_cycle[b]) < 0)
+
+static void event_heap_set(u32 pos, u32 event)
+{
+  event_heap[pos] = event;
+  event_heap_pos[event] = pos;
+}
+
+static void event_heap_fix(u32 pos)
+{
+  u32 event = event_heap[pos];
+
+  // Move it up
+  while (pos > 0 && event_before(event, event_heap[(pos - 1) / 2]))
+  {
+    event_heap_set(pos, event_heap[(pos - 1) / 2]);
+    pos = (pos - 1) / 2;
+  }
+
+  // Or down
+  while (true)
+  {
+    u32 child = pos * 2 + 1;
+    if (child >= event_heap_size)
+      break;
+    if (child + 1 < event_heap_size &&
+        event_before(event_heap[child + 1], event_heap[child]))
+      child++;
+    if (!event_before(event_heap[child], event))
+      break;
+    event_heap_set(pos, event_heap[child]);
+    pos = child;
+  }
+
+  event_heap_set(pos, event);
+}
+
+static void clear_events(void)
+{
+  u32 i;
+  for (i = 0; i < EVENT_COUNT; i++)
+    event_heap_pos[i] = -1;
+  event_heap_size = 0;
+  events_overdue = 0;
+}
+
+static inline s32 cycles_until(u32 event)
+{
+  return (s32)(event_cycle[event] - cpu_ticks);
+}
+
+static void dequeue_event(u32 event)
+{
+  s32 pos = event_heap_pos[event];
+
+  events_overdue &= ~(1 << event);
+  if (pos < 0)
+    return;
+
+  event_heap_pos[event] = -1;
+  if ((u32)pos != --event_heap_size)
+  {
+    event_heap_set(pos, event_heap[event_heap_size]);
+    event_heap_fix(pos);
+  }
+}
+
+static void queue_event(u32 event, s32 cycles)
+{
+  s32 pos = event_heap_pos[event];
+
+  event_cycle[event] = cpu_ticks + cycles;
+  if (cycles < 0)
+  {
+    dequeue_event(event);
+    events_overdue |= (1 << event);
+    return;
+  }
+
+  events_overdue &= ~(1 << event);
+  if (pos < 0)
+  {
+    pos = event_heap_size++;
+    event_heap_set(pos, event);
+  }
+  event_heap_fix(pos);
+}
+
+// Schedules an event N cycles after the last update (replacing any
+// previous one of the same kind).
+void schedule_event(event_type event, s32 cycles)
+{
+  queue_event(event, cycles);
+}
+
+// Removes the event from the queue (it is not pending anymore).
+void cancel_event(event_type event)
+{
+  dequeue_event(event);
+}
+
+bool event_pending(event_type event)
+{
+  return event_heap_pos[event] >= 0 || (events_overdue & (1 << event));
+}
+
+// Cycles left (since the last update) for the event, negative if late.
+s32 event_cycles_left(event_type event)
+{
+  return cycles_until(event);
+}
+
+// Returns the events that are due now (as a bitmask). They stay queued,
+// whoever handles them must reschedule or cancel them.
+static u32 due_events(void)
+{
+  u32 due = events_overdue;
+  events_overdue = 0;
+
+  if (event_heap_size && cycles_until(event_heap[0]) <= 0)
+  {
+    u32 i;
+    for (i = 0; i < event_heap_size; i++)
+    {
+      if (cycles_until(event_heap[i]) <= 0)
+        due |= (1 << event_heap[i]);
+    }
+  }
+
+  return due;
+}
+
+// Cycles until the closest event.
+static u32 next_event_cycles(void)
+{
+  return MAX(cycles_until(event_heap[0]), 0);
+}
+
+// Timer events are never scheduled further than this, the timers get
+// synchronised and the event is scheduled again.
+#define TIMER_EVENT_MAX_CYCLES  0x40000000
+#define TIMER_NEVER             (~(u64)0)
+#define TIMER_EVENTS_MASK       (0xF << EVENT_TIMER0)
+
+// Counts the overflows of a timer counting down "left" with the given
+// period, leaving "left" positive (the counter value after the reload).
+static inline u32 timer_overflows(s32 *left, u32 period)
+{
+  u32 overflows;
+  if(*left > 0)
+    return 0;
+
+  overflows = 1 + (u32)(-*left) / period;
+  *left += overflows * period;
+  return overflows;
+}
+
+// Timers are not counted down continuously, prescaled timers keep the cycle
+// of their next overflow and cascade timers count the overflows of the
+// previous timer. This brings them (and their TMxD registers) up to the
+// current cycle, raising the IRQs and ticking the direct sound channels for
+// every overflow since the last call. Returns the DMA cycles consumed.
+static inline unsigned update_timers(irq_type *irq_raised)
 {
    unsigned i, ret = 0;
+   u32 prev_overflows = 0;
+
    for (i = 0; i < 4; i++)
    {
-      if(timer[i].status == TIMER_INACTIVE)
-         continue;
+      u32 overflows = 0;
 
-      if(timer[i].status != TIMER_CASCADE)
+      if(timer[i].status == TIMER_PRESCALE)
       {
-         timer[i].count -= completed_cycles;
+         s32 left = (s32)(timer[i].overflow_cycle - cpu_ticks);
+         if(left <= 0)
+         {
+            u32 period = timer[i].reload << timer[i].prescale;
+            overflows = timer_overflows(&left, period);
+            timer[i].overflow_cycle += overflows * period;
+         }
          /* io_registers accessors range: REG_TM0D, REG_TM1D, REG_TM2D, REG_TM3D */
-         write_ioreg(REG_TMXD(i), -(timer[i].count >> timer[i].prescale));
+         write_ioreg(REG_TMXD(i), -(left >> timer[i].prescale));
+      }
+      else if(timer[i].status == TIMER_CASCADE && prev_overflows)
+      {
+         timer[i].count -= prev_overflows;
+         overflows = timer_overflows(&timer[i].count,
+                                     timer[i].reload << timer[i].prescale);
+         write_ioreg(REG_TMXD(i), -timer[i].count);
       }
 
-      if(timer[i].count > 0)
+      prev_overflows = overflows;
+      if(!overflows)
          continue;
 
       /* irq_raised value range: IRQ_TIMER0, IRQ_TIMER1, IRQ_TIMER2, IRQ_TIMER3 */
       if(timer[i].irq)
          *irq_raised |= (IRQ_TIMER0 << i);
 
-      if((i != 3) && (timer[i + 1].status == TIMER_CASCADE))
+      if(i < 2 && timer[i].direct_sound_channels)
       {
-         timer[i + 1].count--;
-         write_ioreg(REG_TMXD(i + 1), -timer[i+1].count);
+         u32 j;
+         for(j = 0; j < overflows; j++)
+         {
+            if(timer[i].direct_sound_channels & 0x01)
+               ret += sound_timer(timer[i].frequency_step, 0);
+
+            if(timer[i].direct_sound_channels & 0x02)
+               ret += sound_timer(timer[i].frequency_step, 1);
+         }
       }
+   }
+   return ret;
+}
 
-      if(i < 2)
-      {
-         if(timer[i].direct_sound_channels & 0x01)
-            ret += sound_timer(timer[i].frequency_step, 0);
+// Cycles until the given overflow (1 being the next one) of a timer,
+// following the cascade chain down to the prescaled timer driving it.
+static u64 timer_overflow_cycles(unsigned i, u64 overflow)
+{
+  u64 period = timer[i].reload << timer[i].prescale;
 
-         if(timer[i].direct_sound_channels & 0x02)
-            ret += sound_timer(timer[i].frequency_step, 1);
-      }
+  // Too far away to matter, the event is scheduled again later
+  if(overflow > TIMER_EVENT_MAX_CYCLES)
+    return TIMER_EVENT_MAX_CYCLES;
 
-      timer[i].count += (timer[i].reload << timer[i].prescale);
-   }
-   return ret;
+  if(timer[i].status == TIMER_PRESCALE)
+    return MAX((s32)(timer[i].overflow_cycle - cpu_ticks), 0) +
+           (overflow - 1) * period;
+
+  if(timer[i].status == TIMER_CASCADE && i > 0)
+    return timer_overflow_cycles(i - 1,
+                                 MAX(timer[i].count, 1) + (overflow - 1) * period);
+
+  return TIMER_NEVER;
+}
+
+// Timer settings only change in the memory handlers, which run between two
+// update_gba calls: the last one brought every timer up to cpu_ticks, so no
+// overflow is pending that should still be counted with the old settings.
+bool timers_synced(void)
+{
+  unsigned i;
+  for (i = 0; i < 4; i++)
+  {
+    if(timer[i].status == TIMER_PRESCALE &&
+       (s32)(timer[i].overflow_cycle - cpu_ticks) <= 0)
+      return false;
+    if(timer[i].status == TIMER_CASCADE && timer[i].count <= 0)
+      return false;
+  }
+  return true;
+}
+
+// Schedules the next overflow of a timer if it raises an IRQ or feeds a
+// direct sound channel, the others are only updated lazily.
+static inline void reschedule_timer(unsigned i)
+{
+  u64 cycles = TIMER_NEVER;
+
+  if(timer[i].irq || (i < 2 && timer[i].direct_sound_channels))
+    cycles = timer_overflow_cycles(i, 1);
+
+  if(cycles == TIMER_NEVER)
+    dequeue_event(EVENT_TIMER0 + i);
+  else
+    queue_event(EVENT_TIMER0 + i, MIN(cycles, TIMER_EVENT_MAX_CYCLES));
+}
+
+// Schedules all the timers again, must be called after changing any of
+// their settings (they can affect the cascaded timers).
+void reschedule_timers(void)
+{
+  unsigned i;
+  for (i = 0; i < 4; i++)
+    reschedule_timer(i);
 }
 
 void init_main(void)
@@ -352,7 +603,9 @@ void init_main(void)
   frame_counter = 0;
   cpu_ticks = 0;
   execute_cycles = 960;
-  video_count = 960;
+
+  clear_events();
+  schedule_event(EVENT_VIDEO, 960);
   
   // Initialize splash screen state
   splash_shown = false;
@@ -362,6 +615,7 @@ void init_main(void)
 #ifdef HAVE_DYNAREC
   init_dynarec_caches();
   init_emitter(gamepak_must_swap());
+  load_rom_translation_cache();
 #endif
 }
 
@@ -395,14 +649,14 @@ u32 function_cc update_gba(int remaining_cycles)
     } else if (!splash_shown) {
       splash_shown = true;
       // Clear the screen after splash
-      extern u16* gba_screen_pixels;
+      extern instance_local u16* gba_screen_pixels;
       memset(gba_screen_pixels, 0, GBA_SCREEN_BUFFER_SIZE);
     }
   }
 
   do
   {
-    unsigned i;
+    u32 due;
     // Number of cycles we ask to run - cycles that we did not execute
     // (remaining_cycles can be negative and should be close to zero)
     unsigned completed_cycles = execute_cycles - remaining_cycles;
@@ -410,21 +664,36 @@ u32 function_cc update_gba(int remaining_cycles)
 
 
     remaining_cycles = 0;
+    due = due_events();
 
     // Timers can trigger DMA (usually sound) and consume cycles
-    dma_cycles = update_timers(&irq_raised, completed_cycles);
+    dma_cycles = update_timers(&irq_raised);
+    // Only the timers that overflowed have a new overflow cycle
+    if (due & TIMER_EVENTS_MASK)
+    {
+      unsigned i;
+      for (i = 0; i < 4; i++)
+      {
+        if (due & (1 << (EVENT_TIMER0 + i)))
+          reschedule_timer(i);
+      }
+    }
     // Check for serial port IRQs as well.
     if (update_serial(completed_cycles))
       irq_raised |= IRQ_SERIAL;
+    if (due & (1 << EVENT_SERIAL))
+    {
+      dequeue_event(EVENT_SERIAL);
+      if (serial_transfer_done())
+        irq_raised |= IRQ_SERIAL;
+    }
 
-    // Video count tracks the video cycles remaining until the next event
-    video_count -= completed_cycles;
-
-    // Ran out of cycles, move to the next video area
-    if(video_count <= 0)
+    // Move to the next video area
+    if (due & (1 << EVENT_VIDEO))
     {
       u32 vcount = read_ioreg(REG_VCOUNT);
       u32 dispstat = read_ioreg(REG_DISPSTAT);
+      s32 video_count = cycles_until(EVENT_VIDEO);
 
       // Check if we are in hrefresh (0) or hblank (1)
       if ((dispstat & 0x02) == 0)
@@ -525,6 +794,7 @@ u32 function_cc update_gba(int remaining_cycles)
         write_ioreg(REG_VCOUNT, vcount);
       }
       write_ioreg(REG_DISPSTAT, dispstat);
+      queue_event(EVENT_VIDEO, video_count);
     }
 
     // Flag any V/H blank interrupts, DMA IRQs, Vcount, etc.
@@ -535,45 +805,46 @@ u32 function_cc update_gba(int remaining_cycles)
     if (check_and_raise_interrupts())
       changed_pc = 0x40000000;
 
-    // Figure out when we need to stop CPU execution. The next event is
-    // a video event or a timer event, whatever happens first.
-    execute_cycles = MAX(video_count, 0);
-    
-#if defined(SF2000) || defined(MIPS_SOFT_FPU) || defined(__mips__)
-    // SF2000/MIPS optimization: batch more cycles together to reduce dynarec overhead
-    // Extended to all soft FPU MIPS devices for better performance
-    // Only do this when we have a reasonable chunk and no critical events pending
-    if (execute_cycles > 300 && execute_cycles < 3000) {
-      execute_cycles = MIN(execute_cycles * 2, 6000);  // Double the execution chunk, increased range
-    }
-#endif
-    {
-      u32 cc = serial_next_event();
-      execute_cycles = MIN(execute_cycles, cc);
-    }
-
-    // If we are paused due to a DMA, cap the number of cyles to that amount.
+    // If we are paused due to a DMA, sleep until it completes.
     if (reg[CPU_HALT_STATE] == CPU_DMA) {
       u32 dma_cyc = reg[REG_SLEEP_CYCLES];
-      // The first iteration is marked by bit 31 set, just do nothing now.
-      if (dma_cyc & 0x80000000)
-        dma_cyc &= 0x7FFFFFFF;  // Start counting DMA cycles from now on.
+      // The first iteration is marked by bit 31 set, start counting DMA
+      // cycles from now on.
+      if (dma_cyc & 0x80000000) {
+        dma_cyc &= 0x7FFFFFFF;
+        if (dma_cyc)
+          queue_event(EVENT_DMA, dma_cyc);
+      }
+      else if (due & (1 << EVENT_DMA))
+      {
+        dequeue_event(EVENT_DMA);
+        dma_cyc = 0;
+      }
       else
-        dma_cyc -= MIN(dma_cyc, completed_cycles);  // Account DMA cycles.
+        dma_cyc = cycles_until(EVENT_DMA);
 
       reg[REG_SLEEP_CYCLES] = dma_cyc;
       if (!dma_cyc)
         reg[CPU_HALT_STATE] = CPU_ACTIVE;   // DMA finished, resume execution.
-      else
-        execute_cycles = MIN(execute_cycles, dma_cyc);  // Continue sleeping.
     }
 
-    for (i = 0; i < 4; i++)
-    {
-       if (timer[i].status == TIMER_PRESCALE &&
-           timer[i].count < execute_cycles)
-          execute_cycles = timer[i].count;
+    // Run the CPU until the next event is due.
+    execute_cycles = next_event_cycles();
+
+#if defined(SF2000) || defined(MIPS_SOFT_FPU) || defined(__mips__)
+    // SF2000/MIPS optimization: batch more cycles together to reduce dynarec overhead
+    // Extended to all soft FPU MIPS devices for better performance
+    // Only do this when we have a reasonable chunk and no critical events pending
+    if (event_heap[0] == EVENT_VIDEO &&
+        execute_cycles > 300 && execute_cycles < 3000) {
+      execute_cycles = MIN(execute_cycles * 2, 6000);  // Double the execution chunk, increased range
+      // Still stop for any other event
+      if (event_heap_size > 1)
+        execute_cycles = MIN(execute_cycles, (u32)cycles_until(event_heap[1]));
+      if (event_heap_size > 2)
+        execute_cycles = MIN(execute_cycles, (u32)cycles_until(event_heap[2]));
     }
+#endif
   } while(reg[CPU_HALT_STATE] != CPU_ACTIVE && !frame_complete);
 
   // We voluntarily limit this. It is not accurate but it would be much harder.
@@ -642,6 +913,10 @@ bool main_check_savestate(const u8 *src)
 bool main_read_savestate(const u8 *src)
 {
   int i;
+  s32 video_count;
+  // Serial transfers are not part of the state, they just carry on.
+  bool serial_busy = event_pending(EVENT_SERIAL);
+  s32 serial_cycles = event_cycles_left(EVENT_SERIAL);
   const u8 *p1 = bson_find_key(src, "emu");
   const u8 *p2 = bson_find_key(src, "timers");
   if (!p1 || !p2)
@@ -672,6 +947,21 @@ bool main_read_savestate(const u8 *src)
       return false;
   }
 
+  // Rebuild the event queue using the loaded counters
+  clear_events();
+  schedule_event(EVENT_VIDEO, video_count);
+  for (i = 0; i < 4; i++)
+  {
+    if (timer[i].status == TIMER_PRESCALE)
+      timer[i].overflow_cycle = cpu_ticks + timer[i].count;
+  }
+  reschedule_timers();
+  if (serial_busy)
+    schedule_event(EVENT_SERIAL, MAX(serial_cycles, 0));
+  // A pending DMA sleep (not the first iteration, see update_gba)
+  if (reg[REG_SLEEP_CYCLES] && !(reg[REG_SLEEP_CYCLES] & 0x80000000))
+    schedule_event(EVENT_DMA, reg[REG_SLEEP_CYCLES]);
+
   return true;
 }
 
@@ -683,7 +973,7 @@ unsigned main_write_savestate(u8* dst)
   bson_write_int32(dst, "frame-count", frame_counter);
   bson_write_int32(dst, "cpu-ticks", cpu_ticks);
   bson_write_int32(dst, "exec-cycles", execute_cycles);
-  bson_write_int32(dst, "video-count", video_count);
+  bson_write_int32(dst, "video-count", event_cycles_left(EVENT_VIDEO));
   bson_write_int32(dst, "sleep-cycles", reg[REG_SLEEP_CYCLES]);
   bson_finish_document(dst, wbptr);
 
@@ -692,7 +982,9 @@ unsigned main_write_savestate(u8* dst)
   {
     char tname[2] = {'0' + i, 0};
     bson_start_document(dst, tname, wbptr2);
-    bson_write_int32(dst, "count", timer[i].count);
+    // Prescaled timers store the cycles left, like cascade timers do ticks
+    bson_write_int32(dst, "count", timer[i].status == TIMER_PRESCALE ?
+      timer[i].overflow_cycle - cpu_ticks : (u32)timer[i].count);
     bson_write_int32(dst, "reload", timer[i].reload);
     bson_write_int32(dst, "prescale", timer[i].prescale);
     bson_write_int32(dst, "freq-step", timer[i].frequency_step);
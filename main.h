@@ -36,7 +36,8 @@
 
 typedef struct
 {
-  s32 count;
+  s32 count;            /* Ticks left until the overflow (cascade timers) */
+  u32 overflow_cycle;   /* Cycle of the next overflow (prescaled timers) */
   u32 reload;
   u32 prescale;
   fixed8_24 frequency_step;
@@ -45,6 +46,20 @@ typedef struct
   u32 status;
 } timer_type;
 
+/* Hardware events, the scheduler keeps the cycle at which each one is due
+   and the CPU runs until the closest one. */
+typedef enum
+{
+  EVENT_VIDEO = 0,    /* H-blank start or end of the scan line */
+  EVENT_TIMER0,       /* Overflow of a timer raising an IRQ or feeding sound */
+  EVENT_TIMER1,
+  EVENT_TIMER2,
+  EVENT_TIMER3,
+  EVENT_SERIAL,       /* Serial transfer completion */
+  EVENT_DMA,          /* End of the CPU sleep caused by a DMA */
+  EVENT_COUNT
+} event_type;
+
 typedef enum
 {
   no_frameskip = 0,
@@ -66,17 +81,17 @@ typedef enum
   boot_bios
 } boot_mode;
 
-extern u32 gbc_update_count;
+extern instance_local u32 gbc_update_count;
 
-extern u32 frame_counter;
-extern u32 cpu_ticks;
-extern u32 execute_cycles;
-extern u32 skip_next_frame;
+extern instance_local u32 frame_counter;
+extern instance_local u32 cpu_ticks;
+extern instance_local u32 execute_cycles;
+extern instance_local u32 skip_next_frame;
 
-extern u32 flush_ram_count;
+extern instance_local u32 flush_ram_count;
 
-extern char main_path[512];
-extern char save_path[512];
+extern instance_local char main_path[512];
+extern instance_local char save_path[512];
 
 u16 rand_gen();
 void rand_seed(u32 data);
@@ -85,9 +100,18 @@ void rand_seed(u32 data);
 #define completed_frame(c) ((c) & 0x80000000)
 u32 function_cc update_gba(int remaining_cycles);
 void reset_gba(void);
+void skip_splash_screen(void);
 
 void init_main(void);
 
+void schedule_event(event_type event, s32 cycles);
+void cancel_event(event_type event);
+bool event_pending(event_type event);
+s32 event_cycles_left(event_type event);
+
+bool timers_synced(void);
+void reschedule_timers(void);
+
 void game_name_ext(char *src, char *buffer, char *extension);
 
 bool main_check_savestate(const u8 *src);
@@ -95,9 +119,9 @@ unsigned main_write_savestate(u8* ptr);
 bool main_read_savestate(const u8 *src);
 
 extern u32 num_skipped_frames;
-extern int dynarec_enable;
-extern boot_mode selected_boot_mode;
-extern int sprite_limit;
+extern instance_local int dynarec_enable;
+extern instance_local boot_mode selected_boot_mode;
+extern instance_local int sprite_limit;
 
 #ifdef TRACE_REGISTERS
 void print_regs(void);
@@ -130,3 +130,49 @@ bool validate_addr_section_mips(void *ptr, unsigned size, unsigned max_offset_mb
 
 #endif /* MMAP_JIT_CACHE */
 
+#ifdef MMAP_ROM
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Maps a ROM file in memory, so that it can be read directly from the page
+// cache (which is also shared with other processes using the same file).
+// The mapping is private (copy on write) since the emulator patches a few
+// bytes (ie. RTC registers) and it spans map_size bytes: anything past the
+// end of the file reads as zero.
+void *map_rom_file(const char *name, unsigned map_size, unsigned *file_size) {
+	struct stat st;
+	void *p, *f;
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !st.st_size || st.st_size > map_size) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	f = mmap(p, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0);
+	close(fd);
+	if (f == MAP_FAILED) {
+		munmap(p, map_size);
+		return NULL;
+	}
+
+	*file_size = st.st_size;
+	return p;
+}
+
+void unmap_rom_file(void *ptr, unsigned map_size) {
+	munmap(ptr, map_size);
+}
+
+#endif /* MMAP_ROM */
@@ -4,4 +4,7 @@
 void *map_jit_block(unsigned size);
 void unmap_jit_block(void *bufptr, unsigned size);
 
+void *map_rom_file(const char *name, unsigned map_size, unsigned *file_size);
+void unmap_rom_file(void *ptr, unsigned map_size);
+
 #endif
@@ -232,7 +232,7 @@ u32 arm_to_mips_reg[] =
    ((mips_absolute_offset(offset)) & 0x3FFFFFF)                               \
 
 #define generate_branch_no_cycle_update(type,writeback_location, new_pc)      \
-  if(pc == idle_loop_target_pc)                                               \
+  if(pc == idle_loop_target_pc || pc == idle_loop_pc)                         \
   {                                                                           \
     generate_load_pc(reg_a0, new_pc);                                         \
     mips_emit_lui(reg_cycles, 0);                                             \
@@ -1240,6 +1240,9 @@ u32 execute_store_cpsr_body(u32 _cpsr, u32 address)
 #define thumb_load_pc_pool_const(rd, value)                                   \
   generate_load_imm(arm_to_mips_reg[rd], (value));                            \
 
+#define arm_load_const(rd, value)                                             \
+  generate_load_imm(arm_to_mips_reg[rd], (value));                            \
+
 #define arm_access_memory_load(mem_type)                                      \
   cycle_count += 2;                                                           \
   mips_emit_jal(mips_absolute_offset(execute_load_##mem_type));               \
@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
+
+// Number of frames every session runs
+#define TEST_FRAMES 1000
 
 // Minimal libretro callbacks
 void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch) {}
@@ -11,22 +15,71 @@ void input_poll() {}
 int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) { return 0; }
 bool environment(unsigned cmd, void *data) { return false; }
 
-int main(int argc, char *argv[]) {
-    printf("Starting GPSP performance test...\n");
-    
-    // Initialize libretro core
+typedef struct {
+    struct retro_game_info game_info;
+    int index;
+    int verbose;
+    double seconds;
+} session_t;
+
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs a whole emulator session. Builds with MULTI_INSTANCE keep the core
+// state per thread, so every thread running this gets its own GBA.
+static void *run_session(void *arg) {
+    session_t *session = (session_t *)arg;
+    struct retro_game_info game_info = session->game_info;
+
     retro_set_video_refresh(video_refresh);
     retro_set_audio_sample(audio_sample);
     retro_set_audio_sample_batch(audio_sample_batch);
     retro_set_input_poll(input_poll);
     retro_set_input_state(input_state);
     retro_set_environment(environment);
-    
+
     retro_init();
-    
+
+    if (!retro_load_game(&game_info)) {
+        printf("Session %d: failed to load game, running without ROM\n",
+               session->index);
+    }
+
+    if (session->verbose)
+        printf("Running %d frames for profiling...\n", TEST_FRAMES);
+    double start = wall_time();
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        retro_run();
+        if (session->verbose && i % 100 == 0) printf("Frame %d\n", i);
+    }
+
+    session->seconds = wall_time() - start;
+
+    retro_deinit();
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
     struct retro_game_info game_info = {0};
+    int instances = argc > 2 ? atoi(argv[2]) : 1;
+
+    printf("Starting GPSP performance test...\n");
+
+#ifndef MULTI_INSTANCE
+    if (instances > 1) {
+        printf("Running several instances requires a MULTI_INSTANCE build\n");
+        return 1;
+    }
+#endif
+    if (instances < 1)
+        instances = 1;
+
     if (argc > 1) {
-        // Try to load ROM if provided
+        // Try to load ROM if provided, all the sessions share this copy
         FILE *f = fopen(argv[1], "rb");
         if (f) {
             fseek(f, 0, SEEK_END);
@@ -35,32 +88,50 @@ int main(int argc, char *argv[]) {
             void *data = malloc(size);
             fread(data, 1, size, f);
             fclose(f);
-            
+
             game_info.path = argv[1];
             game_info.data = data;
             game_info.size = size;
             printf("Loading ROM: %s (%zu bytes)\n", argv[1], size);
         }
     }
-    
-    if (!retro_load_game(&game_info)) {
-        printf("Failed to load game, running without ROM\n");
+
+    session_t *sessions = calloc(instances, sizeof(session_t));
+    pthread_t *threads = calloc(instances, sizeof(pthread_t));
+    double start = wall_time();
+
+    if (instances == 1) {
+        sessions[0].game_info = game_info;
+        sessions[0].verbose = 1;
+        run_session(&sessions[0]);
+    } else {
+        printf("Running %d frames on %d instances...\n", TEST_FRAMES, instances);
+        for (int i = 0; i < instances; i++) {
+            sessions[i].game_info = game_info;
+            sessions[i].index = i;
+            if (pthread_create(&threads[i], NULL, run_session, &sessions[i])) {
+                printf("Could not start session %d\n", i);
+                return 1;
+            }
+        }
+        for (int i = 0; i < instances; i++)
+            pthread_join(threads[i], NULL);
     }
-    
-    printf("Running 1000 frames for profiling...\n");
-    clock_t start = clock();
-    
-    // Run 1000 frames
-    for (int i = 0; i < 1000; i++) {
-        retro_run();
-        if (i % 100 == 0) printf("Frame %d\n", i);
+
+    double total = wall_time() - start;
+
+    for (int i = 0; i < instances; i++) {
+        printf("Completed %d frames in %.2f seconds (%.1f FPS)\n",
+               TEST_FRAMES, sessions[i].seconds,
+               TEST_FRAMES / sessions[i].seconds);
     }
-    
-    clock_t end = clock();
-    double time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    printf("Completed 1000 frames in %.2f seconds (%.1f FPS)\n", 
-           time_taken, 1000.0 / time_taken);
-    
-    retro_deinit();
+    if (instances > 1) {
+        printf("%d instances in %.2f seconds (%.1f FPS overall)\n", instances,
+               total, TEST_FRAMES * instances / total);
+    }
+
+    free(threads);
+    free(sessions);
+    free((void *)game_info.data);
     return 0;
-}
\ No newline at end of file
+}
@@ -397,6 +397,26 @@ u32 flash_bank_cnt;
 
 u32 flash_device_id = FLASH_DEVICE_MACRONIX_64KB;
 
+// Range of the backup memory modified since it was last saved (empty when
+// start >= end), and the size of the last saved file.
+static u32 backup_dirty_start = 0;
+static u32 backup_dirty_end = 0;
+static u32 backup_saved_size = 0;
+
+static inline void backup_mark_dirty(u32 offset, u32 size)
+{
+  if (backup_dirty_start >= backup_dirty_end)
+  {
+    backup_dirty_start = offset;
+    backup_dirty_end = offset + size;
+  }
+  else
+  {
+    backup_dirty_start = MIN(backup_dirty_start, offset);
+    backup_dirty_end = MAX(backup_dirty_end, offset + size);
+  }
+}
+
 void reload_timing_info()
 {
   int i;
@@ -553,6 +573,7 @@ void function_cc write_eeprom(u32 unused_address, u32 value)
         {
           eeprom_mode = EEPROM_WRITE_MODE;
           memset(gamepak_backup + eeprom_address, 0, 8);
+          backup_mark_dirty(eeprom_address, 8);
         }
       }
       break;
@@ -560,6 +581,7 @@ void function_cc write_eeprom(u32 unused_address, u32 value)
     case EEPROM_WRITE_MODE:
       gamepak_backup[eeprom_address + (eeprom_counter / 8)] |=
        (value & 0x01) << (7 - (eeprom_counter % 8));
+      backup_mark_dirty(eeprom_address + (eeprom_counter / 8), 1);
       eeprom_counter++;
       if(eeprom_counter == 64)
       {
@@ -1107,6 +1129,7 @@ void function_cc write_backup(u32 address, u32 value)
           if(flash_mode == FLASH_ERASE_MODE)
           {
             memset(gamepak_backup, 0xFF, 1024 * 64 * flash_bank_cnt);
+            backup_mark_dirty(0, 1024 * 64 * flash_bank_cnt);
             flash_mode = FLASH_BASE_MODE;
           }
           break;
@@ -1117,7 +1140,10 @@ void function_cc write_backup(u32 address, u32 value)
       flash_command_position = 0;
     }
     if(backup_type == BACKUP_SRAM)
+    {
       gamepak_backup[0x5555] = value;
+      backup_mark_dirty(0x5555, 1);
+    }
   }
   else
 
@@ -1132,6 +1158,7 @@ void function_cc write_backup(u32 address, u32 value)
       // Erase sector
       u32 fulladdr = (address & 0xF000) + 64*1024*flash_bank_num;
       memset(&gamepak_backup[fulladdr], 0xFF, 1024 * 4);
+      backup_mark_dirty(fulladdr, 1024 * 4);
       flash_mode = FLASH_BASE_MODE;
       flash_command_position = 0;
     }
@@ -1151,6 +1178,7 @@ void function_cc write_backup(u32 address, u32 value)
       // Write value to flash ROM
       u32 fulladdr = address + 64*1024*flash_bank_num;
       gamepak_backup[fulladdr] = value;
+      backup_mark_dirty(fulladdr, 1);
       flash_mode = FLASH_BASE_MODE;
     }
     else
@@ -1162,6 +1190,7 @@ void function_cc write_backup(u32 address, u32 value)
       if(address >= 0x8000)
         sram_bankcount = SRAM_SIZE_64KB;
       gamepak_backup[address] = value;
+      backup_mark_dirty(address, 1);
     }
   }
 }
@@ -1820,10 +1849,65 @@ cpu_alert_type function_cc write_memory32(u32 address, u32 value)
 
 char backup_filename[512];
 
+// Size of the save file for the current backup type.
+static u32 backup_file_size(void)
+{
+  switch(backup_type)
+  {
+    case BACKUP_SRAM:
+      return 0x8000 * sram_bankcount;
+
+    case BACKUP_FLASH:
+      return 0x10000 * flash_bank_cnt;
+
+    case BACKUP_EEPROM:
+      return 0x200 * eeprom_size;
+
+    default:
+      return 0;
+  }
+}
+
+// Writes the file to a temporary name first and renames it over the old
+// one, so that a crash mid write does not destroy the previous save.
+static bool write_backup_file(const char *name, const u8 *data, u32 size)
+{
+  char tmpname[512 + 4];
+  RFILE *fd;
+  bool ok;
+
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+  fd = filestream_open(tmpname, RETRO_VFS_FILE_ACCESS_WRITE,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  if (!fd)
+    return false;
+
+  ok = filestream_write(fd, data, size) == size;
+  filestream_close(fd);
+
+  if (ok && filestream_rename(tmpname, name))
+  {
+    // The PSP cannot rename over an existing file, the old save has to go
+    // first. Should the rename still fail, the new save is left in the
+    // temporary file rather than losing both.
+    filestream_delete(name);
+    return !filestream_rename(tmpname, name);
+  }
+
+  if (!ok)
+    filestream_delete(tmpname);
+  return ok;
+}
+
 u32 load_backup(char *name)
 {
-  RFILE *fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
-                              RETRO_VFS_FILE_ACCESS_HINT_NONE);
+  RFILE *fd;
+
+  backup_dirty_start = backup_dirty_end = 0;
+  backup_saved_size = 0;
+
+  fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_READ,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE);
 
   if(fd)
   {
@@ -1861,6 +1945,7 @@ u32 load_backup(char *name)
         flash_bank_cnt = FLASH_SIZE_128KB;
         break;
     }
+    backup_saved_size = backup_file_size();
     return 1;
   }
   else
@@ -1874,40 +1959,22 @@ u32 load_backup(char *name)
 
 u32 save_backup(char *name)
 {
-  if(backup_type != BACKUP_NONE)
-  {
-    RFILE *fd = filestream_open(name, RETRO_VFS_FILE_ACCESS_WRITE,
-                                RETRO_VFS_FILE_ACCESS_HINT_NONE);
-
-    if(fd)
-    {
-      u32 backup_size = 0;
-
-      switch(backup_type)
-      {
-        case BACKUP_SRAM:
-          backup_size = 0x8000 * sram_bankcount;
-          break;
-
-        case BACKUP_FLASH:
-          backup_size = 0x10000 * flash_bank_cnt;
-          break;
+  u32 backup_size = backup_file_size();
 
-        case BACKUP_EEPROM:
-          backup_size = 0x200 * eeprom_size;
-          break;
+  if(!backup_size)
+    return 0;
 
-        default:
-          break;
-      }
+  // Nothing to do if the file is up to date
+  if(backup_dirty_start >= backup_dirty_end &&
+     backup_size == backup_saved_size)
+    return 1;
 
-      filestream_write(fd, gamepak_backup, backup_size);
-      filestream_close(fd);
-      return 1;
-    }
-  }
+  if(!write_backup_file(name, gamepak_backup, backup_size))
+    return 0;
 
-  return 0;
+  backup_dirty_start = backup_dirty_end = 0;
+  backup_saved_size = backup_size;
+  return 1;
 }
 
 void update_backup(void)
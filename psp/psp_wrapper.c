@@ -112,6 +112,16 @@ int64_t filestream_get_size(void *stream)
     return file->size;
 }
 
+int filestream_delete(const char *path)
+{
+    return remove(path);
+}
+
+int filestream_rename(const char *old_path, const char *new_path)
+{
+    return rename(old_path, new_path);
+}
+
 // Wrapper for load_gamepak that doesn't need retro_game_info
 s32 load_gamepak_raw(const char *name);
 
@@ -148,11 +158,7 @@ int load_gamepak_psp(const char *filename)
     snprintf(save_filename, sizeof(save_filename), "ms0:/PSP/GAME/gpsp-temp/SAVES/%s", rom_name);
     
     // Try to load save data
-    FILE *save_file = fopen(save_filename, "rb");
-    if(save_file) {
-        fread(gamepak_backup, 1, sizeof(gamepak_backup), save_file);
-        fclose(save_file);
-    }
+    load_backup(save_filename);
     
     return 0;
 }
@@ -160,15 +166,6 @@ int load_gamepak_psp(const char *filename)
 // Update backup (save) file
 void update_backup_psp(const char *filename)
 {
-    extern u32 backup_type;
-    extern u32 sram_bankcount;
-    extern u32 flash_bank_cnt;
-    extern u32 eeprom_size;
-    
-    // Don't save if no backup detected
-    if(backup_type == BACKUP_NONE)
-        return;
-    
     char save_filename[512];
     char rom_name[256];
     
@@ -193,31 +190,7 @@ void update_backup_psp(const char *filename)
     // Build full path in SAVES directory
     snprintf(save_filename, sizeof(save_filename), "ms0:/PSP/GAME/gpsp-temp/SAVES/%s", rom_name);
     
-    // Calculate actual backup size based on type
-    u32 backup_size = 0;
-    
-    switch(backup_type)
-    {
-        case BACKUP_SRAM:
-            backup_size = 0x8000 * sram_bankcount;
-            break;
-        
-        case BACKUP_FLASH:
-            backup_size = 0x10000 * flash_bank_cnt;
-            break;
-        
-        case BACKUP_EEPROM:
-            backup_size = 0x200 * eeprom_size;
-            break;
-        
-        default:
-            return;
-    }
-    
-    FILE *save_file = fopen(save_filename, "wb");
-    if(save_file) {
-        fwrite(gamepak_backup, 1, backup_size, save_file);
-        fclose(save_file);
-    }
+    // Only written when modified since the last save
+    save_backup(save_filename);
 }
 
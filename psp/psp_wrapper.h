@@ -27,6 +27,8 @@ int64_t filestream_write(void *stream, const void *data, int64_t len);
 int64_t filestream_seek(void *stream, int64_t offset, int whence);
 int64_t filestream_tell(void *stream);
 int64_t filestream_get_size(void *stream);
+int filestream_delete(const char *path);
+int filestream_rename(const char *old_path, const char *new_path);
 
 // PSP-specific game loading
 int load_gamepak_psp(const char *filename);
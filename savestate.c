@@ -19,8 +19,8 @@
 
 #include "common.h"
 
-const u8 *state_mem_read_ptr;
-u8 *state_mem_write_ptr;
+instance_local const u8 *state_mem_read_ptr;
+instance_local u8 *state_mem_write_ptr;
 
 bool bson_contains_key(const u8 *srcp, const char *key, u8 keytype)
 {
@@ -19,9 +19,17 @@
 
 #include "common.h"
 
-int serial_mode = SERIAL_MODE_AUTO;
-
-static u32 serial_irq_cycles = 0;
+instance_local int serial_mode = SERIAL_MODE_AUTO;
+
+#ifdef PSP_STANDALONE
+// The PSP frontend counts the cycles left for the transfer to complete.
+static instance_local u32 serial_irq_cycles = 0;
+#define serial_busy()               (serial_irq_cycles != 0)
+#define serial_schedule(cycles)     serial_irq_cycles = (cycles)
+#else
+#define serial_busy()               event_pending(EVENT_SERIAL)
+#define serial_schedule(cycles)     schedule_event(EVENT_SERIAL, (cycles))
+#endif
 
 // Timings are very aproximate, hopefully they are good enough.
 #define CLOCK_CYC_256KHZ_8BIT        524    // CLOCK / 256KHz * 8
@@ -81,7 +89,7 @@ cpu_alert_type write_siocnt(u16 value) {
     if (serial_mode == SERIAL_MODE_RFU) {
       // If Start bit is set, we are in master mode (internal clock), and
       // there's no ongoing transmission, we start a transmission.
-      if ((newval & 0x0080) && (newval & 0x1) && !serial_irq_cycles) {
+      if ((newval & 0x0080) && (newval & 0x1) && !serial_busy()) {
         // We simulate the data is immediately sent to the RFU module
         // and some data is received back (we simulate some delay too).
         u32 rval = rfu_transfer(read_ioreg32(REG_SIODATA32_L));
@@ -90,10 +98,11 @@ cpu_alert_type write_siocnt(u16 value) {
 
         // We schedule a future event to clear the "working" bit
         // and potentially generate an IRQ.
-        serial_irq_cycles = (newval & 0x2) ? CLOCK_CYC_2MHZ_8BIT :
-                                             CLOCK_CYC_256KHZ_8BIT;
+        u32 xfer_cycles = (newval & 0x2) ? CLOCK_CYC_2MHZ_8BIT :
+                                           CLOCK_CYC_256KHZ_8BIT;
         if (newval & 0x1000)
-          serial_irq_cycles <<= 2;   // 4 times longer to send 32 bits.
+          xfer_cycles <<= 2;   // 4 times longer to send 32 bits.
+        serial_schedule(xfer_cycles);
       }
 
       // RFU SI/SO ack logic emulation.
@@ -112,7 +121,7 @@ cpu_alert_type write_siocnt(u16 value) {
     }
     else if (serial_mode == SERIAL_MODE_GBP) {
       // Serial configured in slave mode, waiting for incoming word.
-      if ((newval & 0x0080) && !(newval & 0x1) && !serial_irq_cycles) {
+      if ((newval & 0x0080) && !(newval & 0x1) && !serial_busy()) {
         // Send a new GBP sequence
         u32 rval = gbp_transfer(read_ioreg32(REG_SIODATA32_L));
         write_ioreg(REG_SIODATA32_L, rval & 0xFFFF);
@@ -120,7 +129,7 @@ cpu_alert_type write_siocnt(u16 value) {
 
         // Schedule the interrupt/reception. We simulate a 64KHz clock, which
         // translates to ~32 exchanges per frame (~2 rumble updates per frame).
-        serial_irq_cycles = CLOCK_CYC_64KHZ_32BIT;
+        serial_schedule(CLOCK_CYC_64KHZ_32BIT);
       }
     }
     break;
@@ -132,12 +141,23 @@ cpu_alert_type write_siocnt(u16 value) {
   return CPU_ALERT_NONE;
 }
 
+// The ongoing transfer completed, returns if a serial IRQ should be raised.
+bool serial_transfer_done(void) {
+  // Clear the send bit, signal data is ready.
+  // Set the device busy bit, to perform the weird SO/SI handshake.
+  write_ioreg(REG_SIOCNT, (read_ioreg(REG_SIOCNT) & ~0x80) | 0x04);
+  // Return if IRQs are enabled.
+  return read_ioreg(REG_SIOCNT) & 0x4000;
+}
+
+#ifdef PSP_STANDALONE
 // How many cycles until the next serial event happens. Return MAX otherwise.
 u32 serial_next_event() {
   if (serial_irq_cycles)
     return serial_irq_cycles;
   return ~0U;
 }
+#endif
 
 // Account for consumed cycles and return if a serial IRQ should be raised.
 bool update_serial(unsigned cycles) {
@@ -149,20 +169,17 @@ bool update_serial(unsigned cycles) {
     break;
   };
 
+#ifdef PSP_STANDALONE
   if (serial_irq_cycles) {
     if (serial_irq_cycles > cycles)
       serial_irq_cycles -= cycles;
     else {
       // Event happening now!
       serial_irq_cycles = 0;
-      // Clear the send bit, signal data is ready.
-      // Set the device busy bit, to perform the weird SO/SI handshake.
-      write_ioreg(REG_SIOCNT, (read_ioreg(REG_SIOCNT) & ~0x80) | 0x04);
-      // Return if IRQs are enabled.
-      return read_ioreg(REG_SIOCNT) & 0x4000;
+      return serial_transfer_done();
     }
   }
+#endif
 
   return false;
 }
-
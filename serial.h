@@ -22,15 +22,18 @@
 #define SERIAL_MODE_GBP           2  // Connected to the GB Player
 #define SERIAL_MODE_AUTO          3  // Choose best fit automatically
 
-extern int serial_mode;
+extern instance_local int serial_mode;
 
 // Register writes
 cpu_alert_type write_siocnt(u16 value);
 cpu_alert_type write_rcnt(u16 value);
 
 // Serial IRQ interface
+#ifdef PSP_STANDALONE
 u32 serial_next_event();
+#endif
 bool update_serial(unsigned cycles);
+bool serial_transfer_done(void);
 
 // RFU interface
 void rfu_reset(void);
@@ -21,16 +21,16 @@
 #include "common.h"
 #include "frequency_luts.h"
 
-direct_sound_struct direct_sound_channel[2];
-gbc_sound_struct gbc_sound_channel[4];
+instance_local direct_sound_struct direct_sound_channel[2];
+instance_local gbc_sound_struct gbc_sound_channel[4];
 
 const u32 sound_frequency = GBA_SOUND_FREQUENCY;
 
-u32 sound_on;
-static s16 sound_buffer[BUFFER_SIZE];
-static u32 sound_buffer_base;
+instance_local u32 sound_on;
+static instance_local s16 sound_buffer[BUFFER_SIZE];
+static instance_local u32 sound_buffer_base;
 
-static fixed16_16 gbc_sound_tick_step;
+static instance_local fixed16_16 gbc_sound_tick_step;
 
 /* Queue 4 samples to the top of the DS FIFO, wrap around circularly */
 
@@ -170,10 +170,10 @@ const s8 square_pattern_duty[4][8] =
   {  7,  7,  7,  7, -8, -8,  7,  7 },
 };
 
-s8 wave_samples[64];
+instance_local s8 wave_samples[64];
 
-u32 noise_table15[1024];
-u32 noise_table7[4];
+instance_local u32 noise_table15[1024];
+instance_local u32 noise_table7[4];
 
 const u32 gbc_sound_master_volume_table[4] = { 1, 2, 4, 0 };
 
@@ -209,13 +209,13 @@ const u32 gbc_sound_envelope_volume_table[16] =
   fixed_div(15, 15, 14)
 };
 
-u32 gbc_sound_buffer_index = 0;
-u32 gbc_sound_last_cpu_ticks = 0;
-u32 gbc_sound_partial_ticks = 0;
+instance_local u32 gbc_sound_buffer_index = 0;
+instance_local u32 gbc_sound_last_cpu_ticks = 0;
+instance_local u32 gbc_sound_partial_ticks = 0;
 
-u32 gbc_sound_master_volume_left;
-u32 gbc_sound_master_volume_right;
-u32 gbc_sound_master_volume;
+instance_local u32 gbc_sound_master_volume_left;
+instance_local u32 gbc_sound_master_volume_right;
+instance_local u32 gbc_sound_master_volume;
 
 #define update_volume_channel_envelope(channel)                               \
   volume_##channel = gbc_sound_envelope_volume_table[envelope_volume] *       \
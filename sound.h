@@ -92,16 +92,16 @@ typedef struct
 } gbc_sound_struct;
 
 const extern s8 square_pattern_duty[4][8];
-extern direct_sound_struct direct_sound_channel[2];
-extern gbc_sound_struct gbc_sound_channel[4];
-extern u32 gbc_sound_master_volume_left;
-extern u32 gbc_sound_master_volume_right;
-extern u32 gbc_sound_master_volume;
-extern u32 gbc_sound_buffer_index;
-extern u32 gbc_sound_last_cpu_ticks;
+extern instance_local direct_sound_struct direct_sound_channel[2];
+extern instance_local gbc_sound_struct gbc_sound_channel[4];
+extern instance_local u32 gbc_sound_master_volume_left;
+extern instance_local u32 gbc_sound_master_volume_right;
+extern instance_local u32 gbc_sound_master_volume;
+extern instance_local u32 gbc_sound_buffer_index;
+extern instance_local u32 gbc_sound_last_cpu_ticks;
 
 extern const u32 sound_frequency;
-extern u32 sound_on;
+extern instance_local u32 sound_on;
 
 // Pre-calculated frequency lookup tables for SF2000 optimization
 extern const u32 tone_frequency_lut[2048];
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Builds a compressed ROM container (see gbz.h) out of a ROM file:
+ * every 32KB page is compressed on its own (LZ4 block format)
+ * so that gpsp can decompress the pages as it loads them.
+ *
+ * Usage: gbz_pack rom.gba rom.gbz */
+
+#define PAGE_SIZE    (32 * 1024)
+#define MAX_PAGES    1024
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5   /* The block must end with literals */
+#define MATCH_LIMIT    12   /* No match can start this close to the end */
+#define HASH_BITS      14
+
+static uint32_t read32(const uint8_t *p)
+{
+   uint32_t v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+static void write_le32(uint8_t *p, uint32_t v)
+{
+   p[0] = v;
+   p[1] = v >> 8;
+   p[2] = v >> 16;
+   p[3] = v >> 24;
+}
+
+static size_t emit_length(uint8_t *dst, size_t op, size_t len)
+{
+   for (; len >= 255; len -= 255)
+      dst[op++] = 255;
+   dst[op++] = len;
+   return op;
+}
+
+/* Emits a sequence (literals and an optional match), returns the
+ * new output position or 0 if it does not fit. */
+static size_t emit_sequence(uint8_t *dst, size_t op, size_t capacity,
+                            const uint8_t *lit, size_t lit_len,
+                            size_t offset, size_t match_len)
+{
+   size_t token = op++;
+   size_t mlen = match_len ? match_len - MIN_MATCH : 0;
+
+   /* Worst case size of the sequence */
+   if (op + lit_len + lit_len / 255 + match_len / 255 + 8 > capacity)
+      return 0;
+
+   dst[token] = (lit_len < 15 ? lit_len : 15) << 4;
+   if (lit_len >= 15)
+      op = emit_length(dst, op, lit_len - 15);
+   memcpy(&dst[op], lit, lit_len);
+   op += lit_len;
+
+   if (!match_len)
+      return op;
+
+   dst[op++] = offset;
+   dst[op++] = offset >> 8;
+   dst[token] |= mlen < 15 ? mlen : 15;
+   if (mlen >= 15)
+      op = emit_length(dst, op, mlen - 15);
+
+   return op;
+}
+
+/* Greedy LZ4 block compressor. Returns the compressed size, or 0 if
+ * it would not be smaller than capacity. */
+static size_t lz4_compress(const uint8_t *src, size_t size,
+                           uint8_t *dst, size_t capacity)
+{
+   static int32_t table[1 << HASH_BITS];
+   size_t ip = 0, anchor = 0, op = 0;
+
+   memset(table, 0xFF, sizeof(table));
+
+   if (size > MATCH_LIMIT)
+   {
+      size_t match_end_limit = size - LAST_LITERALS;
+
+      while (ip < size - MATCH_LIMIT)
+      {
+         uint32_t seq = read32(&src[ip]);
+         uint32_t h = (seq * 2654435761U) >> (32 - HASH_BITS);
+         int32_t ref = table[h];
+         size_t len = MIN_MATCH;
+
+         table[h] = ip;
+         if (ref < 0 || read32(&src[ref]) != seq)
+         {
+            ip++;
+            continue;
+         }
+
+         while (ip + len < match_end_limit && src[ref + len] == src[ip + len])
+            len++;
+
+         op = emit_sequence(dst, op, capacity, &src[anchor], ip - anchor,
+                            ip - ref, len);
+         if (!op)
+            return 0;
+
+         ip += len;
+         anchor = ip;
+      }
+   }
+
+   op = emit_sequence(dst, op, capacity, &src[anchor], size - anchor, 0, 0);
+   return op;
+}
+
+int main(int argc, char *argv[])
+{
+   FILE *fin, *fout;
+   uint8_t *rom, *index;
+   static uint8_t page_buf[PAGE_SIZE];
+   uint32_t rom_size, pages, offset, i;
+   long fsize;
+
+   if (argc != 3)
+   {
+      fprintf(stderr, "Usage: %s rom.gba rom.gbz\n", argv[0]);
+      return 1;
+   }
+
+   fin = fopen(argv[1], "rb");
+   if (!fin)
+   {
+      fprintf(stderr, "Could not open %s\n", argv[1]);
+      return 1;
+   }
+   fseek(fin, 0, SEEK_END);
+   fsize = ftell(fin);
+   fseek(fin, 0, SEEK_SET);
+
+   if (fsize <= 0 || fsize > PAGE_SIZE * MAX_PAGES)
+   {
+      fprintf(stderr, "Invalid ROM size (%ld bytes)\n", fsize);
+      return 1;
+   }
+
+   rom_size = fsize;
+   pages = (rom_size + PAGE_SIZE - 1) / PAGE_SIZE;
+   rom = malloc(rom_size);
+   index = malloc(12 + 4 * (pages + 1));
+   if (fread(rom, 1, rom_size, fin) != rom_size)
+   {
+      fprintf(stderr, "Could not read %s\n", argv[1]);
+      return 1;
+   }
+   fclose(fin);
+
+   fout = fopen(argv[2], "wb");
+   if (!fout)
+   {
+      fprintf(stderr, "Could not create %s\n", argv[2]);
+      return 1;
+   }
+
+   /* The index is written once all the page sizes are known */
+   memcpy(index, "GBZ1", 4);
+   write_le32(&index[4], rom_size);
+   write_le32(&index[8], pages);
+   offset = 12 + 4 * (pages + 1);
+   fseek(fout, offset, SEEK_SET);
+
+   for (i = 0; i < pages; i++)
+   {
+      const uint8_t *page = &rom[i * PAGE_SIZE];
+      uint32_t size = rom_size - i * PAGE_SIZE;
+      size_t csize;
+
+      if (size > PAGE_SIZE)
+         size = PAGE_SIZE;
+
+      /* Pages that do not compress are stored as they are */
+      csize = lz4_compress(page, size, page_buf, size - 1);
+      write_le32(&index[12 + 4 * i], offset);
+      if (csize)
+         fwrite(page_buf, 1, csize, fout);
+      else
+      {
+         fwrite(page, 1, size, fout);
+         csize = size;
+      }
+      offset += csize;
+   }
+   write_le32(&index[12 + 4 * pages], offset);
+
+   fseek(fout, 0, SEEK_SET);
+   fwrite(index, 1, 12 + 4 * (pages + 1), fout);
+   fclose(fout);
+
+   printf("%s: %u bytes, %u pages, %u bytes compressed\n",
+          argv[2], rom_size, pages, offset);
+
+   free(index);
+   free(rom);
+   return 0;
+}
@@ -22,12 +22,12 @@ extern "C" {
   #include "common.h"
 }
 
-u16* gba_screen_pixels = NULL;
+instance_local u16* gba_screen_pixels = NULL;
 
 #ifdef SF2000_DISABLED_VCOUNT_CACHE
 // DISABLED: VCOUNT cache causes visual glitches
-static u32 g_cached_vcount = 0;
-static u32 g_vcount_frame_id = 0xFFFFFFFF;
+static instance_local u32 g_cached_vcount = 0;
+static instance_local u32 g_vcount_frame_id = 0xFFFFFFFF;
 
 static inline u32 get_cached_vcount() {
   return g_cached_vcount;
@@ -147,8 +147,8 @@ typedef enum
   PIXCOPY     // Special mode used for sprites, to allow for obj-window drawing
 } rendtype;
 
-s32 affine_reference_x[2];
-s32 affine_reference_y[2];
+instance_local s32 affine_reference_x[2];
+instance_local s32 affine_reference_y[2];
 
 static inline s32 signext28(u32 value)
 {
@@ -1171,9 +1171,9 @@ static const u8 obj_dim_table[3][4][2] = {
   { {8, 16}, {8, 32}, {16, 32}, {32, 64} }
 };
 
-static u8 obj_priority_list[5][160][128];
-static u8 obj_priority_count[5][160];
-static u8 obj_alpha_count[160];
+static instance_local u8 obj_priority_list[5][160][128];
+static instance_local u8 obj_priority_count[5][160];
+static instance_local u8 obj_alpha_count[160];
 
 typedef struct {
   s32 obj_x, obj_y;
@@ -1844,8 +1844,8 @@ static void order_obj(u32 video_mode)
   }
 }
 
-u32 layer_order[16];
-u32 layer_count;
+instance_local u32 layer_order[16];
+instance_local u32 layer_count;
 
 // Sorts active BG/OBJ layers and generates an ordered list of layers.
 // Things are drawn back to front, so lowest priority goes first.
@@ -1960,8 +1960,8 @@ static void merge_blend(u32 start, u32 end, u16 *dst, u32 *src) {
 
 // SF2000: Disable blend palette cache - hurts performance
 #ifdef SF2000_DISABLED_BLEND_PALETTE_CACHE
-static u16 last_blend_palette_idx = 0xFFFF;
-static u16 last_blend_palette_val = 0;
+static instance_local u16 last_blend_palette_idx = 0xFFFF;
+static instance_local u16 last_blend_palette_val = 0;
 // DISABLED: Blend palette cache hurts performance
 #define PALETTE_LOOKUP(idx) (((idx) == last_blend_palette_idx) ? last_blend_palette_val : \
   (last_blend_palette_idx = (idx), last_blend_palette_val = palette_ram_converted[(idx)]))
@@ -2064,9 +2064,9 @@ static void merge_brightness(u32 start, u32 end, u16 *srcdst) {
 
 // SF2000: Disable brightness palette cache - hurts performance
 #ifdef SF2000_DISABLED_BRIGHTNESS_PALETTE_CACHE
-static u16 last_brightness_palette_idx = 0xFFFF;
-static u16 last_brightness_palette_val = 0;
-static u32 palette_frame_counter = 0;
+static instance_local u16 last_brightness_palette_idx = 0xFFFF;
+static instance_local u16 last_brightness_palette_val = 0;
+static instance_local u32 palette_frame_counter = 0;
 // DISABLED: Brightness palette cache hurts performance
 #define PALETTE_LOOKUP(idx) ((palette_frame_counter++ & 0x3FF) == 0 ? \
   (last_brightness_palette_idx = 0xFFFF, palette_ram_converted[idx]) : \
@@ -2444,8 +2444,8 @@ static void render_scanline_conditional(
 {
 #ifdef SF2000_DISABLED_DISPCNT_CACHE
   // DISABLED: DISPCNT cache overhead on soft FPU MIPS
-  static u16 cached_dispcnt = 0xFFFF;
-  static u32 cached_scanline = 0xFFFFFFFF;
+  static instance_local u16 cached_dispcnt = 0xFFFF;
+  static instance_local u32 cached_scanline = 0xFFFFFFFF;
   u32 current_vcount = get_cached_vcount();
   
   if (cached_scanline != current_vcount) {
@@ -2534,9 +2534,9 @@ static void render_window_n_pass(u16 *scanline, u32 start, u32 end)
 #endif
 #ifdef SF2000
   // Performance optimization: Cache window register reads - expensive on MIPS
-  static u32 cached_winxv[2] = {0xFFFFFFFF, 0xFFFFFFFF};
-  static u32 cached_winxh[2] = {0xFFFFFFFF, 0xFFFFFFFF};
-  static u32 cache_vcount = 0xFFFFFFFF;
+  static instance_local u32 cached_winxv[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+  static instance_local u32 cached_winxh[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+  static instance_local u32 cache_vcount = 0xFFFFFFFF;
   
   // Cache window registers per scanline instead of per function call
   if (cache_vcount != vcount) {
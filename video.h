@@ -29,9 +29,9 @@ void set_partial_flush_enabled(u8 enabled);
 void mark_vram_dirty(u32 address, u32 size);
 #endif
 
-extern s32 affine_reference_x[2];
-extern s32 affine_reference_y[2];
+extern instance_local s32 affine_reference_x[2];
+extern instance_local s32 affine_reference_y[2];
 
-extern u16* gba_screen_pixels;
+extern instance_local u16* gba_screen_pixels;
 
 #endif
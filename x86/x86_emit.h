@@ -27,6 +27,17 @@ u32 x86_update_gba(u32 pc);
 void x86_indirect_branch_arm(u32 address);
 void x86_indirect_branch_thumb(u32 address);
 void x86_indirect_branch_dual(u32 address);
+void x86_link_branch_arm(u32 address);
+void x86_link_branch_thumb(u32 address);
+void x86_trace_hot_arm(u32 address);
+void x86_trace_hot_thumb(u32 address);
+#ifdef THREADED_JIT
+void x86_exit_to_interpreter(void);
+
+// Returned by the block lookup to leave the translated code (the PC to
+// resume from is stored in reg[REG_PC]).
+#define translation_exit_address ((u8*)x86_exit_to_interpreter)
+#endif
 
 void function_cc execute_store_cpsr(u32 new_cpsr, u32 store_mask);
 
@@ -99,16 +110,25 @@ typedef enum
     x86_emit_dword(offset);                                                   \
   }                                                                           \
 
+// Always encoded with a 32 bit displacement (for large constant offsets)
+#define x86_emit_mem_sib_op_disp32(dest, base, ridx, scale, offset)           \
+  x86_emit_mod_rm(x86_mod_mem_disp32, 0x4, dest);                             \
+  x86_emit_sib(scale, ridx, base);                                            \
+  x86_emit_dword(offset)                                                      \
+
 #define x86_emit_reg_op(dest, source)                                         \
   x86_emit_mod_rm(x86_mod_reg, source, dest)                                  \
 
 
 typedef enum
 {
+  x86_opcode_rex_b                      = 0x41,
+  x86_opcode_mov_rm8_reg                = 0x88,
   x86_opcode_mov_rm_reg                 = 0x89,
   x86_opcode_mov_reg_rm                 = 0x8B,
   x86_opcode_mov_reg_imm                = 0xB8,
   x86_opcode_mov_rm_imm                 = 0x00C7,
+  x86_opcode_rol_reg_imm                = 0x00C1,
   x86_opcode_ror_reg_imm                = 0x01C1,
   x86_opcode_shl_reg_imm                = 0x04C1,
   x86_opcode_shr_reg_imm                = 0x05C1,
@@ -128,6 +148,7 @@ typedef enum
   x86_opcode_imul_eax_rm                = 0x05F7,
   x86_opcode_idiv_eax_rm                = 0x07F7,
   x86_opcode_add_rm_imm                 = 0x0081,
+  x86_opcode_adc_rm_imm                 = 0x0281,
   x86_opcode_and_rm_imm                 = 0x0481,
   x86_opcode_sub_rm_imm                 = 0x0581,
   x86_opcode_xor_rm_imm                 = 0x0681,
@@ -140,12 +161,17 @@ typedef enum
   x86_opcode_xor_reg_rm                 = 0x33,
   x86_opcode_cmp_reg_rm                 = 0x39,
   x86_opcode_cmp_rm_imm                 = 0x0781,
+  x86_opcode_cmp_rm_imm8                = 0x0783,
+  x86_opcode_cmp_rm8_imm8               = 0x0780,
   x86_opcode_lea_reg_rm                 = 0x8D,
   x86_opcode_j                          = 0x80,
+  x86_opcode_j_short                    = 0x70,
+  x86_opcode_jmp_short                  = 0xEB,
   x86_opcode_cdq                        = 0x99,
   x86_opcode_jmp                        = 0xE9,
   x86_opcode_jmp_reg                    = 0x04FF,
-  x86_opcode_ext                        = 0x0F
+  x86_opcode_ext                        = 0x0F,
+  x86_opcode_prefix_16                  = 0x66
 } x86_opcodes;
 
 typedef enum
@@ -157,6 +183,11 @@ typedef enum
   x86_opcode_setnz                      = 0x95,
   x86_opcode_sets                       = 0x98,
   x86_opcode_setns                      = 0x99,
+  x86_opcode_movzx_rm8                  = 0xB6,
+  x86_opcode_movzx_rm16                 = 0xB7,
+  x86_opcode_movsx_rm8                  = 0xBE,
+  x86_opcode_movsx_rm16                 = 0xBF,
+  x86_opcode_bt_rm_reg                  = 0xA3,
 } x86_ext_opcodes;
 
 typedef enum
@@ -204,6 +235,14 @@ typedef enum
                       x86_reg_number_##ridx, scale, offset);                  \
 }                                                                             \
 
+#define x86_emit_opcode_1b_mem_sib_disp32(opcode, dest, base, ridx, scale,    \
+ offset)                                                                      \
+{                                                                             \
+  x86_emit_byte(x86_opcode_##opcode);                                         \
+  x86_emit_mem_sib_op_disp32(x86_reg_number_##dest, x86_reg_number_##base,    \
+                             x86_reg_number_##ridx, scale, offset);           \
+}                                                                             \
+
 #define x86_emit_opcode_1b(opcode, reg)                                       \
   x86_emit_byte(x86_opcode_##opcode | x86_reg_number_##reg)                   \
 
@@ -215,6 +254,55 @@ typedef enum
   x86_emit_byte(x86_opcode_##opcode & 0xFF);                                  \
   x86_emit_mem_op(x86_opcode_##opcode >> 8, x86_reg_number_##base, offset)    \
 
+// Always encoded with a 32 bit displacement (for code of a fixed size)
+#define x86_emit_opcode_1b_ext_mem_disp32(opcode, base, offset)               \
+  x86_emit_byte(x86_opcode_##opcode & 0xFF);                                  \
+  x86_emit_mod_rm(x86_mod_mem_disp32, x86_reg_number_##base,                  \
+   x86_opcode_##opcode >> 8);                                                 \
+  x86_emit_dword(offset)                                                      \
+
+#define x86_emit_opcode_1b_ext_mem_sib(opcode, base, ridx, scale, offset)     \
+  x86_emit_byte(x86_opcode_##opcode & 0xFF);                                  \
+  x86_emit_mem_sib_op(x86_opcode_##opcode >> 8, x86_reg_number_##base,        \
+                      x86_reg_number_##ridx, scale, offset)                   \
+
+#define x86_emit_opcode_1b_ext_mem_sib_disp32(opcode, base, ridx, scale,       \
+ offset)                                                                      \
+  x86_emit_byte(x86_opcode_##opcode & 0xFF);                                  \
+  x86_emit_mem_sib_op_disp32(x86_opcode_##opcode >> 8, x86_reg_number_##base, \
+                             x86_reg_number_##ridx, scale, offset)            \
+
+#ifdef X86_64_REG_CACHE
+// Register to register ops where one operand is a cached guest register
+// (a raw host register number, r8d-r15d need a REX prefix)
+#define x86_emit_opcode_1b_reg_cached(opcode, dest, cached)                   \
+{                                                                             \
+  if((cached) & 8)                                                            \
+  {                                                                           \
+    x86_emit_byte(x86_opcode_rex_b);                                          \
+  }                                                                           \
+  x86_emit_byte(x86_opcode_##opcode);                                         \
+  x86_emit_reg_op(x86_reg_number_##dest, ((cached) & 7));                     \
+}                                                                             \
+
+#define x86_emit_mov_reg_cached(dest, cached)                                 \
+  x86_emit_opcode_1b_reg_cached(mov_reg_rm, dest, cached)                     \
+
+#define x86_emit_mov_cached_reg(source, cached)                               \
+  x86_emit_opcode_1b_reg_cached(mov_rm_reg, source, cached)                   \
+
+#define x86_emit_mov_cached_imm(cached, imm)                                  \
+{                                                                             \
+  if((cached) & 8)                                                            \
+  {                                                                           \
+    x86_emit_byte(x86_opcode_rex_b);                                          \
+  }                                                                           \
+  x86_emit_byte(x86_opcode_mov_reg_imm | ((cached) & 7));                     \
+  x86_emit_dword(imm);                                                        \
+}                                                                             \
+
+#endif
+
 #define x86_emit_mov_reg_mem(dest, base, offset)                              \
   x86_emit_opcode_1b_mem(mov_reg_rm, dest, base, offset)                      \
 
@@ -264,6 +352,26 @@ typedef enum
   x86_emit_opcode_1b_ext_mem(and_rm_imm, base, offset);                       \
   x86_emit_dword(imm)                                                         \
 
+#define x86_emit_add_mem_imm(imm, base, offset)                               \
+  x86_emit_opcode_1b_ext_mem(add_rm_imm, base, offset);                       \
+  x86_emit_dword(imm)                                                         \
+
+#define x86_emit_adc_mem_imm(imm, base, offset)                               \
+  x86_emit_opcode_1b_ext_mem(adc_rm_imm, base, offset);                       \
+  x86_emit_dword(imm)                                                         \
+
+#define x86_emit_sub_mem_disp32_imm(imm, base, offset)                        \
+  x86_emit_opcode_1b_ext_mem_disp32(sub_rm_imm, base, offset);                \
+  x86_emit_dword(imm)                                                         \
+
+#define x86_emit_add_mem_disp32_imm(imm, base, offset)                        \
+  x86_emit_opcode_1b_ext_mem_disp32(add_rm_imm, base, offset);                \
+  x86_emit_dword(imm)                                                         \
+
+#define x86_emit_adc_mem_disp32_imm(imm, base, offset)                        \
+  x86_emit_opcode_1b_ext_mem_disp32(adc_rm_imm, base, offset);                \
+  x86_emit_dword(imm)                                                         \
+
 #define x86_emit_shl_reg_imm(dest, imm)                                       \
   x86_emit_opcode_1b_ext_reg(shl_reg_imm, dest);                              \
   x86_emit_byte(imm)                                                          \
@@ -280,6 +388,10 @@ typedef enum
   x86_emit_opcode_1b_ext_reg(ror_reg_imm, dest);                              \
   x86_emit_byte(imm)                                                          \
 
+#define x86_emit_rol_reg_imm(dest, imm)                                       \
+  x86_emit_opcode_1b_ext_reg(rol_reg_imm, dest);                              \
+  x86_emit_byte(imm)                                                          \
+
 #define x86_emit_add_reg_reg(dest, source)                                    \
   x86_emit_opcode_1b_reg(add_reg_rm, dest, source)                            \
 
@@ -337,6 +449,10 @@ typedef enum
   x86_emit_opcode_1b_ext_reg(cmp_rm_imm, dest);                               \
   x86_emit_dword(imm)                                                         \
 
+#define x86_emit_cmp_reg_imm8(dest, imm)                                      \
+  x86_emit_opcode_1b_ext_reg(cmp_rm_imm8, dest);                              \
+  x86_emit_byte(imm)                                                          \
+
 #define x86_emit_rot_reg_reg(type, dest)                                      \
   x86_emit_opcode_1b_ext_reg(type##_reg_rm, dest)                             \
 
@@ -369,6 +485,7 @@ typedef enum
 
 #define x86_emit_call_offset(relative_offset)                                 \
   x86_emit_byte(x86_opcode_call_offset);                                      \
+  rom_cache_add_reloc(translation_ptr);                                       \
   x86_emit_dword(relative_offset)                                             \
 
 #define x86_emit_ret()                                                        \
@@ -393,6 +510,17 @@ typedef enum
   (writeback_location) = translation_ptr;                                     \
   translation_ptr += 4                                                        \
 
+// Short (8 bit displacement) jumps, for branches within an instruction
+#define x86_emit_j_short_filler(condition_code, writeback_location)           \
+  x86_emit_byte(x86_opcode_j_short | condition_code);                         \
+  (writeback_location) = translation_ptr;                                     \
+  translation_ptr++                                                           \
+
+#define x86_emit_jmp_short_filler(writeback_location)                         \
+  x86_emit_byte(x86_opcode_jmp_short);                                        \
+  (writeback_location) = translation_ptr;                                     \
+  translation_ptr++                                                           \
+
 #define x86_emit_jmp_offset(offset)                                           \
   x86_emit_byte(x86_opcode_jmp);                                              \
   x86_emit_dword(offset)                                                      \
@@ -420,6 +548,8 @@ typedef enum
 #endif
 
 /* Offsets from reg_base, see stub.S */
+#define IWRAM_BASE_OFF  0x0D00
+#define EWRAM_BASE_OFF  0x28D00
 #define SPSR_BASE_OFF   0xA9100
 
 #define generate_test_imm(ireg, imm)                                          \
@@ -446,14 +576,84 @@ typedef enum
 #define generate_store_spsr(ireg, idxr)                                       \
   x86_emit_mov_mem_idx_reg(reg_##ireg, reg_base, 2, reg_##idxr, SPSR_BASE_OFF);
 
+#ifdef X86_64_REG_CACHE
+
+/* Guest r0-r7 live in r8d-r15d and sp in edi while translated code runs.
+   reg[] is only up to date around calls into C, see store_registers and
+   load_registers in x86_stub.S (which must use the same mapping). */
+#define x86_cached_reg(reg_index)                                             \
+  (((u32)(reg_index) < 8) ? (s32)(reg_index) + 8 :                            \
+   (((reg_index) == REG_SP) ? (s32)x86_reg_number_edi : -1))                  \
+
 #define generate_load_reg(ireg, reg_index)                                    \
-  x86_emit_mov_reg_mem(reg_##ireg, reg_base, reg_index * 4);                  \
+{                                                                             \
+  s32 cached_reg = x86_cached_reg(reg_index);                                 \
+  if(cached_reg >= 0)                                                         \
+  {                                                                           \
+    x86_emit_mov_reg_cached(reg_##ireg, cached_reg);                          \
+  }                                                                           \
+  else                                                                        \
+  {                                                                           \
+    x86_emit_mov_reg_mem(reg_##ireg, reg_base, (reg_index) * 4);              \
+  }                                                                           \
+}                                                                             \
 
-#define generate_load_pc(ireg, new_pc)                                        \
-  x86_emit_mov_reg_imm(reg_##ireg, (new_pc))                                  \
+#define generate_store_reg(ireg, reg_index)                                   \
+{                                                                             \
+  s32 cached_reg = x86_cached_reg(reg_index);                                 \
+  if(cached_reg >= 0)                                                         \
+  {                                                                           \
+    x86_emit_mov_cached_reg(reg_##ireg, cached_reg);                          \
+  }                                                                           \
+  else                                                                        \
+  {                                                                           \
+    x86_emit_mov_mem_reg(reg_##ireg, reg_base, (reg_index) * 4);              \
+  }                                                                           \
+}                                                                             \
 
-#define generate_load_imm(ireg, imm)                                          \
-  x86_emit_mov_reg_imm(reg_##ireg, imm)                                       \
+#define generate_store_reg_i32(imm32, reg_index)                              \
+{                                                                             \
+  s32 cached_reg = x86_cached_reg(reg_index);                                 \
+  if(cached_reg >= 0)                                                         \
+  {                                                                           \
+    x86_emit_mov_cached_imm(cached_reg, (imm32));                             \
+  }                                                                           \
+  else                                                                        \
+  {                                                                           \
+    x86_emit_mov_mem_imm((imm32), reg_base, (reg_index) * 4);                 \
+  }                                                                           \
+}                                                                             \
+
+// Flush/reload the cached registers around direct calls to C functions.
+// Reloading does not touch eax (return value).
+#define emit_save_regs()                                                      \
+{                                                                             \
+  u32 i;                                                                      \
+  for(i = 0; i < 8; i++)                                                      \
+  {                                                                           \
+    x86_emit_byte(0x44);  /* REX.R */                                         \
+    x86_emit_byte(x86_opcode_mov_rm_reg);                                     \
+    x86_emit_mem_op(i, x86_reg_number_ebx, i * 4);                            \
+  }                                                                           \
+  x86_emit_mov_mem_reg(edi, ebx, REG_SP * 4);                                 \
+}                                                                             \
+
+#define emit_restore_regs()                                                   \
+{                                                                             \
+  u32 i;                                                                      \
+  for(i = 0; i < 8; i++)                                                      \
+  {                                                                           \
+    x86_emit_byte(0x44);  /* REX.R */                                         \
+    x86_emit_byte(x86_opcode_mov_reg_rm);                                     \
+    x86_emit_mem_op(i, x86_reg_number_ebx, i * 4);                            \
+  }                                                                           \
+  x86_emit_mov_reg_mem(edi, ebx, REG_SP * 4);                                 \
+}                                                                             \
+
+#else
+
+#define generate_load_reg(ireg, reg_index)                                    \
+  x86_emit_mov_reg_mem(reg_##ireg, reg_base, reg_index * 4);                  \
 
 #define generate_store_reg(ireg, reg_index)                                   \
   x86_emit_mov_mem_reg(reg_##ireg, reg_base, (reg_index) * 4)                 \
@@ -461,6 +661,17 @@ typedef enum
 #define generate_store_reg_i32(imm32, reg_index)                              \
   x86_emit_mov_mem_imm((imm32), reg_base, (reg_index) * 4)                    \
 
+#define emit_save_regs()
+#define emit_restore_regs()
+
+#endif
+
+#define generate_load_pc(ireg, new_pc)                                        \
+  x86_emit_mov_reg_imm(reg_##ireg, (new_pc))                                  \
+
+#define generate_load_imm(ireg, imm)                                          \
+  x86_emit_mov_reg_imm(reg_##ireg, imm)                                       \
+
 #define generate_shift_left(ireg, imm)                                        \
   x86_emit_shl_reg_imm(reg_##ireg, imm)                                       \
 
@@ -565,6 +776,12 @@ typedef enum
   x86_emit_adc_reg_reg(reg_a1, reg_##ireg_hi)                                 \
 
 
+// All calls leave the translation cache (to the stubs or C code), they are
+// recorded so that a persisted ROM cache can be relocated when loaded.
+#define rom_cache_backend "x86"
+#define rom_cache_relocate(site, delta)                                       \
+  *((u32 *)(site)) += (u32)(delta)                                            \
+
 #define generate_function_call(function_location)                             \
   x86_emit_call_offset(x86_relative_offset(translation_ptr,                   \
    function_location, 4));                                                    \
@@ -582,8 +799,11 @@ typedef enum
 #define generate_branch_patch_unconditional(dest, offset)                     \
   *((u32 *)(dest)) = x86_relative_offset(dest, offset, 4)                     \
 
+#define generate_branch_patch_short(dest, offset)                             \
+  *(dest) = (u8)x86_relative_offset(dest, offset, 1)                          \
+
 #define generate_branch_no_cycle_update(writeback_location, new_pc)           \
-  if(pc == idle_loop_target_pc)                                               \
+  if(pc == idle_loop_target_pc || pc == idle_loop_pc)                         \
   {                                                                           \
     generate_load_imm(cycles, 0);                                             \
     x86_emit_mov_reg_imm(eax, new_pc);                                        \
@@ -603,6 +823,16 @@ typedef enum
   generate_cycle_update();                                                    \
   generate_branch_no_cycle_update(writeback_location, new_pc)                 \
 
+// Branches followed by a trace fall through to their target, but they still
+// charge the cycles and check for events like any other block exit (loops
+// might not have any other exit that does).
+#define generate_trace_branch_cycle_update(new_pc)                            \
+  generate_cycle_update();                                                    \
+  x86_emit_test_reg_reg(reg_cycles, reg_cycles);                              \
+  x86_emit_j_offset(x86_condition_code_ns, 10);                               \
+  x86_emit_mov_reg_imm(eax, new_pc);                                          \
+  generate_function_call(x86_update_gba)                                      \
+
 // a0 holds the destination
 
 #define generate_indirect_branch_cycle_update(type)                           \
@@ -614,8 +844,100 @@ typedef enum
   x86_emit_call_offset(x86_relative_offset(translation_ptr,                   \
    x86_indirect_branch_##type, 4))                                            \
 
+// Block exits that are not linked at translation time jump to a stub that
+// calls x86_link_branch_* with the target PC. The stub call is followed by
+// the distance back to the exit's jump offset, so that the exit can be
+// patched to jump to the target block directly.
+#define x86_link_stub_call_size 10
+
+#define generate_branch_link_stub(type, branch_source, target_pc)            \
+{                                                                             \
+  generate_branch_patch_unconditional(branch_source, translation_ptr);       \
+  generate_load_pc(a0, target_pc);                                            \
+  generate_function_call(x86_link_branch_##type);                             \
+  x86_emit_dword((u32)(translation_ptr - (branch_source)));                   \
+}                                                                             \
+
+// link_data points to the dword that follows the stub call
+u8 function_cc *x86_link_branch_arm_body(u32 pc, u8 *link_data)
+{
+  return block_link_address_arm(pc, link_data - *(u32 *)link_data,
+                                link_data - x86_link_stub_call_size);
+}
+
+u8 function_cc *x86_link_branch_thumb_body(u32 pc, u8 *link_data)
+{
+  return block_link_address_thumb(pc, link_data - *(u32 *)link_data,
+                                  link_data - x86_link_stub_call_size);
+}
+
+// ROM blocks first count an execution of their cache segment (a 64 bit
+// counter, addressed relative to reg[]), which decides what gets evicted
+// once the ROM cache is full.
+#define generate_segment_counter(counter)                                     \
+{                                                                             \
+  u32 counter_offset = (u32)((u8 *)(counter) - (u8 *)reg);                    \
+  x86_emit_add_mem_disp32_imm(1, reg_base, counter_offset);                   \
+  x86_emit_adc_mem_disp32_imm(0, reg_base, counter_offset + 4);               \
+}                                                                             \
+
+// ROM blocks then decrement their execution counter (addressed
+// relative to reg[], like the profile counters below), and call
+// x86_trace_hot_* with the block PC once it reaches zero. The sequence
+// always takes x86_trace_counter_size bytes, so that the block can be found
+// from the return address of the call.
+#define x86_trace_counter_size 22
+
+#define generate_trace_counter(counter, block_pc, type)                       \
+{                                                                             \
+  u8 *jmp_not_hot;                                                            \
+  x86_emit_sub_mem_disp32_imm(1, reg_base,                                    \
+   (u32)((u8 *)(counter) - (u8 *)reg));                                       \
+  x86_emit_j_short_filler(x86_condition_code_nz, jmp_not_hot);                \
+  generate_load_pc(a0, block_pc);                                             \
+  generate_function_call(x86_trace_hot_##type);                               \
+  generate_branch_patch_short(jmp_not_hot, translation_ptr);                  \
+}                                                                             \
+
+// Replaces the counter sequence with a jump to the block body, returns the
+// location of its offset (so that it can be linked to the trace instead)
+static u8 *x86_trace_counter_to_jump(u8 *block_entry, u8 *block_body)
+{
+  block_entry[0] = x86_opcode_jmp;
+  generate_branch_patch_unconditional(block_entry + 1, block_body);
+  return block_entry + 1;
+}
+
+#define trace_counter_to_jump(block_entry, block_body)                        \
+  x86_trace_counter_to_jump(block_entry, block_body)                          \
+
+// return_address points right after the counter sequence
+u8 function_cc *x86_trace_hot_arm_body(u32 pc, u8 *return_address)
+{
+  return block_trace_hot_arm(pc, return_address - x86_trace_counter_size,
+                             return_address);
+}
+
+u8 function_cc *x86_trace_hot_thumb_body(u32 pc, u8 *return_address)
+{
+  return block_trace_hot_thumb(pc, return_address - x86_trace_counter_size,
+                               return_address);
+}
+
 #define block_prologue_size 0
 #define generate_block_prologue()
+
+#ifdef BLOCK_PROFILE_ANALYZE
+// Increments a 64 bit block execution counter. It is addressed relative to
+// reg[] since it lives in the same data segment. The host flags are not
+// live on block entry.
+#define generate_block_profile_counter(counter)                               \
+{                                                                             \
+  s32 counter_offset = (s32)((u8 *)(counter) - (u8 *)reg);                    \
+  x86_emit_add_mem_imm(1, reg_base, counter_offset);                          \
+  x86_emit_adc_mem_imm(0, reg_base, counter_offset + 4);                      \
+}
+#endif
 #define generate_block_extra_vars_arm()
 #define generate_block_extra_vars_thumb()
 
@@ -666,9 +988,11 @@ typedef enum
   }
 
   #define emit_trace_instruction(pc, mode)         \
+    emit_save_regs();                              \
     x86_emit_mov_reg_imm(reg_arg0, pc);            \
     x86_emit_mov_reg_imm(reg_arg1, mode);          \
-    generate_function_call(trace_instruction);
+    generate_function_call(trace_instruction);     \
+    emit_restore_regs();
   #define emit_trace_arm_instruction(pc)           \
     emit_trace_instruction(pc, 1)
   #define emit_trace_thumb_instruction(pc)         \
@@ -1069,8 +1393,10 @@ u32 function_cc execute_spsr_restore(u32 address)
   generate_store_reg(ireg, reg_index);                                        \
   if(reg_index == 15)                                                         \
   {                                                                           \
+    emit_save_regs();                                                         \
     generate_mov(arg0, ireg);                                                 \
     generate_function_call(execute_spsr_restore);                             \
+    emit_restore_regs();                                                      \
     generate_indirect_branch_dual();                                          \
   }                                                                           \
 
@@ -1406,17 +1732,160 @@ u32 execute_store_cpsr_body()
   arm_psr_##transfer_type(op_type, psr_reg);                                  \
 }                                                                             \
 
+// Guest memory accesses: a0 holds the address, a1 the value to store and
+// loaded values are returned in rv. IWRAM and EWRAM are accessed inline,
+// anything else (as well as misaligned loads, which rotate the value) goes
+// through the stubs in x86_stub.S, which dispatch on the memory region.
+// Stores to RAM holding translated code (non-zero SMC tag) are also left to
+// the stubs, which take care of flushing the RAM translation cache (so the
+// address in a0 must be preserved until then).
+
+#define x86_load_align_bits_u8    0
+#define x86_load_align_bits_s8    0
+#define x86_load_align_bits_u16   1
+#define x86_load_align_bits_s16   1
+#define x86_load_align_bits_u32   2
+
+#define x86_store_address_mask_u8   (~0)
+#define x86_store_address_mask_u16  (~1)
+#define x86_store_address_mask_u32  (~3)
+
+#define x86_emit_load_mem_u8(dest, base, index, offset)                       \
+  x86_emit_byte(x86_opcode_ext);                                              \
+  x86_emit_opcode_1b_mem_sib_disp32(movzx_rm8, dest, base, index, 0, offset)  \
+
+#define x86_emit_load_mem_s8(dest, base, index, offset)                       \
+  x86_emit_byte(x86_opcode_ext);                                              \
+  x86_emit_opcode_1b_mem_sib_disp32(movsx_rm8, dest, base, index, 0, offset)  \
+
+#define x86_emit_load_mem_u16(dest, base, index, offset)                      \
+  x86_emit_byte(x86_opcode_ext);                                              \
+  x86_emit_opcode_1b_mem_sib_disp32(movzx_rm16, dest, base, index, 0, offset) \
+
+#define x86_emit_load_mem_s16(dest, base, index, offset)                      \
+  x86_emit_byte(x86_opcode_ext);                                              \
+  x86_emit_opcode_1b_mem_sib_disp32(movsx_rm16, dest, base, index, 0, offset) \
+
+#define x86_emit_load_mem_u32(dest, base, index, offset)                      \
+  x86_emit_opcode_1b_mem_sib_disp32(mov_reg_rm, dest, base, index, 0, offset) \
+
+#define x86_emit_store_mem_u8(source, base, index, offset)                    \
+  x86_emit_opcode_1b_mem_sib_disp32(mov_rm8_reg, source, base, index, 0,      \
+   offset)                                                                    \
+
+#define x86_emit_store_mem_u16(source, base, index, offset)                   \
+  x86_emit_byte(x86_opcode_prefix_16);                                        \
+  x86_emit_opcode_1b_mem_sib_disp32(mov_rm_reg, source, base, index, 0,       \
+   offset)                                                                    \
+
+#define x86_emit_store_mem_u32(source, base, index, offset)                   \
+  x86_emit_opcode_1b_mem_sib_disp32(mov_rm_reg, source, base, index, 0,       \
+   offset)                                                                    \
+
+// Stores test the RAM code page bitmap rather than the SMC tags
+#define SMC_CHECK_CODE_PAGES
+
+// Copies the bit at index bit (of the word in base) to the carry
+#define x86_emit_bt_reg_reg(bit, base)                                        \
+  x86_emit_byte(x86_opcode_ext);                                              \
+  x86_emit_opcode_1b_reg(bt_rm_reg, bit, base)                                \
+
+#define x86_emit_load_mem_word_u32(dest, base, index, offset)                 \
+  x86_emit_opcode_1b_mem_sib_disp32(mov_reg_rm, dest, base, index, 2, offset) \
+
+// Tests the bit of the RAM code page (see cpu_threaded.c) the address in a0
+// falls in, region_mask wraps it and first_page is the first region page
+#define x86_smc_check_yes(region_mask, first_page, writeback_location)        \
+  generate_mov(a2, a0);                                                       \
+  generate_shift_right(a2, RAM_CODE_PAGE_SHIFT);                              \
+  generate_and_imm(a2, (region_mask) >> RAM_CODE_PAGE_SHIFT);                 \
+  generate_mov(t0, a2);                                                       \
+  generate_shift_right(t0, 5);                                                \
+  x86_emit_load_mem_word_u32(reg_t0, reg_base, reg_t0,                        \
+   ((u32)((u8 *)ram_code_pages - (u8 *)reg) + (first_page) / 8));             \
+  x86_emit_bt_reg_reg(reg_a2, reg_t0);                                        \
+  x86_emit_j_short_filler(x86_condition_code_c, writeback_location)           \
+
+// Aligned word stores (block transfers) do not signal SMC, like the stubs
+#define x86_smc_check_no(region_mask, first_page, writeback_location)         \
+
+#define generate_load_memory(mem_type, pc_value)                              \
+{                                                                             \
+  u8 *jmp_not_iwram, *jmp_not_ewram, *jmp_iwram_done, *jmp_ewram_done;       \
+  generate_mov(a2, a0);                                                       \
+  x86_emit_rol_reg_imm(reg_a2, 8);                                            \
+  generate_and_imm(a2, (1 << (8 + x86_load_align_bits_##mem_type)) - 1);      \
+  x86_emit_cmp_reg_imm8(reg_a2, 0x03);                                        \
+  x86_emit_j_short_filler(x86_condition_code_nz, jmp_not_iwram);              \
+  generate_and_imm(a0, 0x7FFF);                                               \
+  x86_emit_load_mem_##mem_type(reg_rv, reg_base, reg_a0,                      \
+   IWRAM_BASE_OFF + 0x8000);                                                  \
+  x86_emit_jmp_short_filler(jmp_iwram_done);                                  \
+  generate_branch_patch_short(jmp_not_iwram, translation_ptr);                \
+  x86_emit_cmp_reg_imm8(reg_a2, 0x02);                                        \
+  x86_emit_j_short_filler(x86_condition_code_nz, jmp_not_ewram);              \
+  generate_and_imm(a0, 0x3FFFF);                                              \
+  x86_emit_load_mem_##mem_type(reg_rv, reg_base, reg_a0, EWRAM_BASE_OFF);     \
+  x86_emit_jmp_short_filler(jmp_ewram_done);                                  \
+  generate_branch_patch_short(jmp_not_ewram, translation_ptr);                \
+  generate_load_pc(a1, pc_value);                                             \
+  generate_function_call(execute_load_##mem_type);                            \
+  generate_branch_patch_short(jmp_iwram_done, translation_ptr);               \
+  generate_branch_patch_short(jmp_ewram_done, translation_ptr);               \
+}                                                                             \
+
+#define x86_generate_store_memory(store_type, mem_type, smc_check,            \
+ slow_path_setup)                                                             \
+{                                                                             \
+  u8 *jmp_not_iwram, *jmp_not_ewram, *jmp_iwram_done, *jmp_ewram_done;       \
+  u8 *jmp_smc_iwram = NULL, *jmp_smc_ewram = NULL;                            \
+  generate_mov(a2, a0);                                                       \
+  generate_shift_right(a2, 24);                                               \
+  x86_emit_cmp_reg_imm8(reg_a2, 0x03);                                        \
+  x86_emit_j_short_filler(x86_condition_code_nz, jmp_not_iwram);              \
+  x86_smc_check_##smc_check(0x7FFF, 0x400, jmp_smc_iwram);                    \
+  generate_mov(a2, a0);                                                       \
+  generate_and_imm(a2, 0x7FFF & x86_store_address_mask_##mem_type);           \
+  x86_emit_store_mem_##mem_type(reg_a1, reg_base, reg_a2,                     \
+   IWRAM_BASE_OFF + 0x8000);                                                  \
+  x86_emit_jmp_short_filler(jmp_iwram_done);                                  \
+  generate_branch_patch_short(jmp_not_iwram, translation_ptr);                \
+  x86_emit_cmp_reg_imm8(reg_a2, 0x02);                                        \
+  x86_emit_j_short_filler(x86_condition_code_nz, jmp_not_ewram);              \
+  x86_smc_check_##smc_check(0x3FFFF, 0, jmp_smc_ewram);                       \
+  generate_mov(a2, a0);                                                       \
+  generate_and_imm(a2, 0x3FFFF & x86_store_address_mask_##mem_type);          \
+  x86_emit_store_mem_##mem_type(reg_a1, reg_base, reg_a2, EWRAM_BASE_OFF);    \
+  x86_emit_jmp_short_filler(jmp_ewram_done);                                  \
+  generate_branch_patch_short(jmp_not_ewram, translation_ptr);                \
+  if(jmp_smc_iwram)                                                           \
+  {                                                                           \
+    generate_branch_patch_short(jmp_smc_iwram, translation_ptr);              \
+    generate_branch_patch_short(jmp_smc_ewram, translation_ptr);              \
+  }                                                                           \
+  slow_path_setup;                                                            \
+  generate_function_call(execute_##store_type##_##mem_type);                  \
+  generate_branch_patch_short(jmp_iwram_done, translation_ptr);               \
+  generate_branch_patch_short(jmp_ewram_done, translation_ptr);               \
+}                                                                             \
+
+// The PC is only needed by the stubs (SMC and I/O side effects)
+#define generate_store_memory(mem_type, pc_value)                             \
+  x86_generate_store_memory(store, mem_type, yes,                             \
+   generate_store_reg_i32(pc_value, REG_PC))                                  \
+
+#define generate_store_memory_aligned()                                       \
+  x86_generate_store_memory(store_aligned, u32, no, )                         \
+
 #define arm_access_memory_load(mem_type)                                      \
   cycle_count += 2;                                                           \
-  generate_load_pc(a1, pc);                                                   \
-  generate_function_call(execute_load_##mem_type);                            \
+  generate_load_memory(mem_type, pc);                                         \
   generate_store_reg_pc_no_flags(rv, rd)                                      \
 
 #define arm_access_memory_store(mem_type)                                     \
   cycle_count++;                                                              \
   generate_load_reg_pc(a1, rd, 12);                                           \
-  generate_store_reg_i32(pc + 4, REG_PC);                                     \
-  generate_function_call(execute_store_##mem_type)                            \
+  generate_store_memory(mem_type, pc + 4)                                     \
 
 #define no_op                                                                 \
 
@@ -1496,13 +1965,12 @@ u32 execute_store_cpsr_body()
 
 
 #define arm_block_memory_load()                                               \
-  generate_load_pc(a1, pc);                                                   \
-  generate_function_call(execute_load_u32);                                   \
+  generate_load_memory(u32, pc);                                              \
   generate_store_reg(rv, i)                                                   \
 
 #define arm_block_memory_store()                                              \
   generate_load_reg_pc(a1, i, 8);                                             \
-  generate_function_call(execute_store_aligned_u32)                           \
+  generate_store_memory_aligned()                                             \
 
 #define arm_block_memory_final_load(writeback_type)                           \
   arm_block_memory_load()                                                     \
@@ -1510,8 +1978,7 @@ u32 execute_store_cpsr_body()
 #define arm_block_memory_final_store(writeback_type)                          \
   generate_load_reg_pc(a1, i, 12);                                            \
   arm_block_memory_writeback_post_store(writeback_type);                      \
-  generate_store_reg_i32(pc + 4, REG_PC);                                     \
-  generate_function_call(execute_store_u32)                                   \
+  generate_store_memory(u32, pc + 4)                                          \
 
 #define arm_block_memory_adjust_pc_store()                                    \
 
@@ -1784,17 +2251,18 @@ u32 execute_store_cpsr_body()
 #define thumb_load_pc_pool_const(reg_rd, value)                               \
   generate_store_reg_i32(value, reg_rd)                                       \
 
+#define arm_load_const(reg_rd, value)                                         \
+  generate_store_reg_i32(value, reg_rd)                                       \
+
 #define thumb_access_memory_load(mem_type, reg_rd)                            \
   cycle_count += 2;                                                           \
-  generate_load_pc(a1, pc);                                                   \
-  generate_function_call(execute_load_##mem_type);                            \
+  generate_load_memory(mem_type, pc);                                         \
   generate_store_reg(rv, reg_rd)                                              \
 
 #define thumb_access_memory_store(mem_type, reg_rd)                           \
   cycle_count++;                                                              \
   generate_load_reg(a1, reg_rd);                                              \
-  generate_store_reg_i32(pc + 2, REG_PC);                                     \
-  generate_function_call(execute_store_##mem_type)                            \
+  generate_store_memory(mem_type, pc + 2)                                     \
 
 #define thumb_access_memory_generate_address_pc_relative(offset, _rb, _ro)    \
   generate_load_pc(a0, (offset))                                              \
@@ -1858,8 +2326,7 @@ u32 execute_store_cpsr_body()
 #define thumb_block_memory_extra_pop_pc()                                     \
   generate_load_reg(a0, REG_SAVE3);                                           \
   generate_add_imm(a0, (bit_count[reg_list] * 4));                            \
-  generate_load_pc(a1, pc);                                                   \
-  generate_function_call(execute_load_u32);                                   \
+  generate_load_memory(u32, pc);                                              \
   generate_store_reg(rv, REG_PC);                                             \
   generate_indirect_branch_cycle_update(thumb)                                \
 
@@ -1867,24 +2334,22 @@ u32 execute_store_cpsr_body()
   generate_load_reg(a0, REG_SAVE3);                                           \
   generate_add_imm(a0, (bit_count[reg_list] * 4));                            \
   generate_load_reg(a1, REG_LR);                                              \
-  generate_function_call(execute_store_aligned_u32)                           \
+  generate_store_memory_aligned()                                             \
 
 #define thumb_block_memory_load()                                             \
-  generate_load_pc(a1, pc);                                                   \
-  generate_function_call(execute_load_u32);                                   \
+  generate_load_memory(u32, pc);                                              \
   generate_store_reg(rv, i)                                                   \
 
 #define thumb_block_memory_store()                                            \
   generate_load_reg(a1, i);                                                   \
-  generate_function_call(execute_store_aligned_u32)                           \
+  generate_store_memory_aligned()                                             \
 
 #define thumb_block_memory_final_load()                                       \
   thumb_block_memory_load()                                                   \
 
 #define thumb_block_memory_final_store()                                      \
   generate_load_reg(a1, i);                                                   \
-  generate_store_reg_i32(pc + 2, REG_PC);                                     \
-  generate_function_call(execute_store_u32)                                   \
+  generate_store_memory(u32, pc + 2)                                          \
 
 #define thumb_block_memory_final_no(access_type)                              \
   thumb_block_memory_final_##access_type()                                    \
@@ -2167,8 +2632,10 @@ static void function_cc execute_swi(u32 pc)
 
 #define arm_swi()                                                             \
   collapse_flags(a0, a1);                                                     \
+  emit_save_regs();                                                           \
   generate_load_pc(arg0, (pc + 4));                                           \
   generate_function_call(execute_swi);                                        \
+  emit_restore_regs();                                                        \
   generate_branch()                                                           \
 
 #define thumb_b()                                                             \
@@ -2185,6 +2652,24 @@ static void function_cc execute_swi(u32 pc)
    block_exits[block_exit_position].branch_target);                           \
   block_exit_position++                                                       \
 
+// Unconditional branches followed by a trace (see block_trace_hot) only
+// have to set the link register, the code of the target comes next.
+#define arm_trace_branch(target)                                              \
+  if(opcode & 0x01000000)                                                     \
+  {                                                                           \
+    generate_load_pc(a0, (pc + 4));                                           \
+    generate_store_reg(a0, REG_LR);                                           \
+  }                                                                           \
+  generate_trace_branch_cycle_update(target)                                  \
+
+#define thumb_trace_branch(target)                                            \
+  if(opcode >= 0xF800)                                                        \
+  {                                                                           \
+    generate_load_pc(a0, ((pc + 2) | 0x01));                                  \
+    generate_store_reg(a0, REG_LR);                                           \
+  }                                                                           \
+  generate_trace_branch_cycle_update(target)                                  \
+
 #define thumb_blh()                                                           \
 {                                                                             \
   thumb_decode_branch();                                                      \
@@ -2204,15 +2689,21 @@ static void function_cc execute_swi(u32 pc)
 }                                                                             \
 
 #define thumb_process_cheats()                                                \
-  generate_function_call(process_cheats);
+  emit_save_regs();                                                           \
+  generate_function_call(process_cheats);                                     \
+  emit_restore_regs();
 
 #define arm_process_cheats()                                                  \
-  generate_function_call(process_cheats);
+  emit_save_regs();                                                           \
+  generate_function_call(process_cheats);                                     \
+  emit_restore_regs();
 
 #define thumb_swi()                                                           \
   collapse_flags(a0, a1);                                                     \
+  emit_save_regs();                                                           \
   generate_load_pc(arg0, (pc + 2));                                           \
   generate_function_call(execute_swi);                                        \
+  emit_restore_regs();                                                        \
   generate_branch_cycle_update(                                               \
    block_exits[block_exit_position].branch_source,                            \
    block_exits[block_exit_position].branch_target);                           \
@@ -2273,7 +2764,29 @@ void init_emitter(bool must_swap) {
 u32 function_cc execute_arm_translate_internal(u32 cycles, void *regptr);
 
 u32 execute_arm_translate(u32 cycles) {
+#ifdef THREADED_JIT
+  u32 ret;
+  if (!resume_translation_thread())
+    return execute_arm_translate_internal(cycles, &reg[0]);
+
+  // The translated code exits whenever it reaches a block that is still
+  // being translated, the interpreter runs it meanwhile (until the block
+  // is ready or the next event is due).
+  while (1) {
+    ret = execute_arm_translate_internal(cycles, &reg[0]);
+    if (completed_frame(ret))
+      break;
+    ret = execute_arm_slice(reg[REG_SAVE]);
+    if (completed_frame(ret))
+      break;
+    cycles = ret;
+  }
+
+  pause_translation_thread();
+  return ret;
+#else
   return execute_arm_translate_internal(cycles, &reg[0]);
+#endif
 }
 
 #endif